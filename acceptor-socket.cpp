@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -104,9 +105,19 @@ void* AcceptConnectionsAcceptor(void* _A) {
         }
 
         int incoming_port = ntohs(return_port_no((struct sockaddr *)&their_addr));
-        // incoming connection must be from a commander.
         A->AddToCommanderFDSet(new_fd);
-        A->SendBackOwnFD(new_fd);
+        if (A->S->IsAcceptorPort(incoming_port) != -1) {
+            // the previous acceptor of chains in the chain mode of phase 2,
+            // or a vote relay, which needs this side's fd for its P2As
+            string msg = to_string(new_fd) + kMessageDelim;
+            if (!SendReady(new_fd) || send(new_fd, msg.c_str(), msg.size(), 0) == -1)
+                D(cout << "SA" << A->S->get_pid() << ": ERROR: Cannot send fd to acceptor" << endl;)
+        } else {
+            // otherwise the incoming connection must be from a commander.
+            A->SendBackOwnFD(new_fd);
+        }
+        // the acceptor loop listens to the commander from its next turn
+        A->S->get_wakeup(kAcceptorRole)->Notify();
     }
     pthread_exit(NULL);
 }
@@ -118,6 +129,60 @@ void* AcceptConnectionsAcceptor(void* _A) {
  */
 bool Acceptor::ConnectToScout(const int server_id) {
     // if (get_scout_fd(server_id) != -1) return true;
+    int sockfd = ConnectFromAcceptorPort(S->get_scout_listen_port(server_id));
+    if (sockfd == -1)
+        return false;
+    set_scout_fd(server_id, sockfd);
+    return true;
+}
+
+/**
+ * Connects to a replica port, for the replica to learn accepted pvalues
+ * @param server_id id of server whose replica to connect to
+ * @return  true if connection was successfull
+ */
+bool Acceptor::ConnectToReplica(const int server_id) {
+    int sockfd = ConnectFromAcceptorPort(S->get_replica_listen_port(server_id));
+    if (sockfd == -1)
+        return false;
+    // LEARNs are small and the replica sends nothing back to ack them
+    // with, so without this each one waits for the last one's ack
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+    set_replica_fd(server_id, sockfd);
+    return true;
+}
+
+/**
+ * Connects to the acceptor port of the next acceptor in a chain of phase 2,
+ * or of another acceptor in the group of a vote relay, and gets the fd of
+ * the connection on its side
+ * @param server_id id of server whose acceptor to connect to
+ * @return  true if connection was successfull
+ */
+bool Acceptor::ConnectToPeerAcceptor(const int server_id) {
+    int sockfd = ConnectFromAcceptorPort(S->get_acceptor_listen_port(server_id));
+    if (sockfd == -1)
+        return false;
+    string remote_fd;
+    if (!ReceiveHandshake(sockfd, kReadyTimeout, remote_fd)) {
+        close(sockfd);
+        return false;
+    }
+    set_peer_remote_fd(server_id, stoi(remote_fd));
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+    set_peer_fd(server_id, sockfd);
+    return true;
+}
+
+/**
+ * Connects from the acceptor port of this server, which peers use to
+ * tell acceptor connections apart, and waits for the peer's READY
+ * @param port listen port to connect to
+ * @return  fd of the connection, -1 if it failed
+ */
+int Acceptor::ConnectFromAcceptorPort(const int port) {
 
     int sockfd;  // listen on sock_fd, new connection on new_fd
     struct addrinfo hints, *clientinfo, *l;
@@ -183,10 +248,10 @@ bool Acceptor::ConnectToScout(const int server_id) {
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE; // use my IP
-    if ((rv = getaddrinfo(NULL, std::to_string(S->get_scout_listen_port(server_id)).c_str(),
+    if ((rv = getaddrinfo(NULL, std::to_string(port).c_str(),
                           &hints, &servinfo)) != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return false;
+        return -1;
     }
     // loop through all the results and connect to the first we can
     for (l = servinfo; l != NULL; l = l->ai_next)
@@ -201,10 +266,14 @@ bool Acceptor::ConnectToScout(const int server_id) {
         break;
     }
     if (l == NULL) {
-        return false;
+        return -1;
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
-    set_scout_fd(server_id, sockfd);
-    return true;
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "server.h"
 #include "constants.h"
 #include "utilities.h"
+#include "dispatch.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -35,6 +36,20 @@ Acceptor::Acceptor(Server* _S) {
     set_best_ballot_num(Ballot(INT_MIN, INT_MIN));
 
     scout_fd_.resize(S->get_num_servers(), -1);
+    replica_fd_.resize(S->get_num_servers(), -1);
+    peer_fd_.resize(S->get_num_servers(), -1);
+    peer_remote_fd_.resize(S->get_num_servers(), -1);
+    p2b_awaited_.resize(S->get_num_servers());
+    next_tally_ = 0;
+    phase1_tally_ = -1;
+    last_standby_attempt_ = {0, 0};
+    last_learner_attempt_ = {0, 0};
+    lease_expiry_ = {0, 0};
+    fast_ballot_ = Ballot(INT_MIN, INT_MIN);
+    next_fast_slot_ = 0;
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
 }
 
 
@@ -42,6 +57,18 @@ int Acceptor::get_scout_fd(const int server_id) {
     return scout_fd_[server_id];
 }
 
+int Acceptor::get_replica_fd(const int server_id) {
+    return replica_fd_[server_id];
+}
+
+int Acceptor::get_peer_fd(const int server_id) {
+    return peer_fd_[server_id];
+}
+
+int Acceptor::get_peer_remote_fd(const int server_id) {
+    return peer_remote_fd_[server_id];
+}
+
 set<int> Acceptor::get_commander_fd_set() {
     return commander_fd_set_;
 }
@@ -54,6 +81,18 @@ void Acceptor::set_scout_fd(const int server_id, const int fd) {
     scout_fd_[server_id] = fd;
 }
 
+void Acceptor::set_replica_fd(const int server_id, const int fd) {
+    replica_fd_[server_id] = fd;
+}
+
+void Acceptor::set_peer_fd(const int server_id, const int fd) {
+    peer_fd_[server_id] = fd;
+}
+
+void Acceptor::set_peer_remote_fd(const int server_id, const int fd) {
+    peer_remote_fd_[server_id] = fd;
+}
+
 void Acceptor::set_best_ballot_num(const Ballot &b) {
     best_ballot_num_.id = b.id;
     best_ballot_num_.seq_num = b.seq_num;
@@ -137,33 +176,535 @@ void Acceptor::Unicast(const string &type, const string& msg,
     {
         return;
     }
-    if (send(serv_fd, msg.c_str(), msg.size(), 0) == -1) {
-        D(cout << "SA" << S->get_pid() << ": ERROR in sending " << type << endl;)
-        if (serv_fd == get_scout_fd(primary_id)) {
-            close(serv_fd);
-            set_scout_fd(primary_id, -1);
+    outbox_.Enqueue(serv_fd, msg);
+    D(cout << "SA" << S->get_pid() << ": " << type << " message queued: " << msg << endl;)
+}
+
+/**
+ * sends as much of the messages queued during this turn of the acceptor loop
+ * as the sockets take, and closes the scout/commander connections on which
+ * sending failed. A dropped P1B/P2B cannot be resent later, so connections
+ * which dropped messages on queue overflow are closed too
+ */
+void Acceptor::FlushOutbox(const int primary_id)
+{
+    vector<int> failed_fds, resync_fds;
+    outbox_.Flush(failed_fds);
+    outbox_.TakeResyncFds(resync_fds);
+    failed_fds.insert(failed_fds.end(), resync_fds.begin(), resync_fds.end());
+    for (auto fd : failed_fds) {
+        D(cout << "SA" << S->get_pid() << ": ERROR in sending to fd " << fd << endl;)
+        int peer_id = GetPeerIdFromFd(fd);
+        if (peer_id != -1) {
+            ClosePeer(peer_id, primary_id);
+            continue;
+        }
+        close(fd);
+        inbox_.Reset(fd);
+        int scout_id = GetScoutIdFromFd(fd);
+        if (scout_id != -1) {
+            set_scout_fd(scout_id, -1);
         } else {
-            close(serv_fd);
-            RemoveFromCommanderFDSet(serv_fd);
+            RemoveFromCommanderFDSet(fd);
+        }
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            if (get_replica_fd(i) == fd)
+                set_replica_fd(i, -1);
         }
     }
-    else {
-        D(cout << "SA" << S->get_pid() << ": " << type << " message sent: " << msg << endl;)
+}
+
+/**
+ * @param  fd fd of a connection to a scout
+ * @return    id of server whose scout is on the other end, -1 if none
+ */
+int Acceptor::GetScoutIdFromFd(const int fd)
+{
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_scout_fd(i) == fd)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * keeps a connection to the scout of the hot standby, and tells it the
+ * current best ballot on connecting. At most one attempt per heartbeat
+ * interval, and none while the standby is suspected
+ * @param primary_id id of primary server
+ */
+void Acceptor::ConnectToStandby(const int primary_id)
+{
+    int standby_id = S->get_standby_id();
+    if (standby_id == -1 || standby_id == primary_id || get_scout_fd(standby_id) != -1)
+        return;
+    if (S->get_failure_detector()->IsSuspected(standby_id))
+        return;
+    if (ElapsedSince(last_standby_attempt_) < S->get_failure_detector()->get_heartbeat_interval())
+        return;
+
+    gettimeofday(&last_standby_attempt_, NULL);
+    if (ConnectToScout(standby_id)) {
+        D(cout << "SA" << S->get_pid() << ": Connected to scout of standby S" << standby_id << endl;)
+        SendPromised();
+    }
+}
+
+/**
+ * keeps a connection to the replica of every server in the distributed
+ * learning mode, and sends a replica all pvalues accepted so far on
+ * connecting, so that it can settle COMMIT notices for slots it missed.
+ * At most one round of attempts per heartbeat interval, and none to
+ * suspected servers
+ */
+void Acceptor::ConnectToLearners()
+{
+    if (!S->get_options().distributed_learning)
+        return;
+
+    char buf;
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        int fd = get_replica_fd(i);
+        if (fd != -1 && recv(fd, &buf, 1, MSG_DONTWAIT | MSG_PEEK) == 0) {
+            close(fd);
+            outbox_.Discard(fd);
+            set_replica_fd(i, -1);
+        }
+    }
+    if (ElapsedSince(last_learner_attempt_) < S->get_failure_detector()->get_heartbeat_interval())
+        return;
+
+    gettimeofday(&last_learner_attempt_, NULL);
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_replica_fd(i) != -1
+                || (i != S->get_pid() && S->get_failure_detector()->IsSuspected(i)))
+            continue;
+        if (!ConnectToReplica(i))
+            continue;
+        D(cout << "SA" << S->get_pid() << ": Connected to replica S" << i << " as learner" << endl;)
+        for (const auto &t : accepted_) {
+            string msg = kLearn + kInternalDelim + to_string(S->get_pid())
+                         + kInternalDelim + tripleToString(t) + kMessageDelim;
+            outbox_.Enqueue(get_replica_fd(i), msg);
+        }
+    }
+}
+
+/**
+ * tells every connected replica of an accepted P2A with
+ * LEARN-<acceptor>-<triple>[-<skip to>-<stride>]$
+ * @param t       accepted triple
+ * @param skip_to for a skip, see AcceptP2a(), -1 otherwise
+ * @param stride  stride of the skip
+ */
+void Acceptor::SendLearn(const Triple &t, const int skip_to, const int stride)
+{
+    string msg = kLearn + kInternalDelim + to_string(S->get_pid())
+                 + kInternalDelim + tripleToString(t);
+    if (skip_to != -1)
+        msg += kInternalDelim + to_string(skip_to) + kInternalDelim + to_string(stride);
+    msg += kMessageDelim;
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_replica_fd(i) == -1)
+            continue;
+        outbox_.Enqueue(get_replica_fd(i), msg);
+        D(cout << "SA" << S->get_pid() << ": LEARN message queued for replica S" << i << ": " << msg << endl;)
+    }
+}
+
+/**
+ * accepts a pvalue of phase 2, unless a higher ballot was promised
+ * @param  t         pvalue of the P2A
+ * @param  skip_to   for a skip, NOOP in every stride-th slot from t.s
+ *                   below skip_to, -1 otherwise
+ * @param  stride    stride of the skip
+ * @return           true if accepted
+ */
+bool Acceptor::AcceptP2a(const Triple &t, const int skip_to, const int stride,
+                         const int primary_id)
+{
+    if (t.b < get_best_ballot_num())
+        return false;
+
+    if (t.b > get_best_ballot_num()) {
+        set_best_ballot_num(t.b);
+        SendPromised();
+    }
+    accepted_.insert(t);
+    if (skip_to != -1) {
+        for (int s = t.s + stride; s < skip_to; s += stride)
+            accepted_.insert(Triple(t.b, s, t.p));
+    } else if (t.p.msg != kNoop) {
+        S->NoteAcceptedSlot(t.s);
+        if (S->get_options().speculative && S->get_pid() == primary_id)
+            S->AddAcceptedValue(t);
+    }
+    return true;
+}
+
+/**
+ * takes CHAIN-<triple>-<chain>[-<skip to>-<stride>]$ in the chain mode of
+ * phase 2, where chain lists <acceptor>.<fd> for this acceptor and the ones
+ * after it, fd being the acceptor side of that acceptor's connection to the
+ * commander. The pvalue is accepted and passed on to the next acceptor, and
+ * the last one tells the commander with P2B-<pid>-<ballot>-CHAIN$ that the
+ * whole chain accepted. An acceptor with a higher ballot answers the
+ * commander with a plain P2B instead, which preempts it
+ * @param token tokens of CHAIN
+ */
+void Acceptor::ReceiveChain(const std::vector<string> &token, const int primary_id)
+{
+    Triple t = stringToTriple(token[1]);
+    int skip_to = (token.size() == 5) ? stoi(token[3]) : -1;
+    int stride = (token.size() == 5) ? stoi(token[4]) : 0;
+    std::vector<string> chain = split(token[2], kInternalSetDelim[0]);
+    if (chain.empty())
+        return;
+    int return_fd = stoi(split(chain[0], kInternalStructDelim[0])[1]);
+
+    if (!AcceptP2a(t, skip_to, stride, primary_id)) {
+        SendP2b(get_best_ballot_num(), return_fd, primary_id);
+        return;
+    }
+
+    if (chain.size() == 1) {
+        string msg = kP2b + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                     + ballotToString(get_best_ballot_num()) + kInternalDelim + kChain
+                     + kMessageDelim;
+        Unicast(kP2b, msg, primary_id, return_fd);
+    } else {
+        int next_id = stoi(split(chain[1], kInternalStructDelim[0])[0]);
+        string msg = kChain + kInternalDelim + token[1] + kInternalDelim
+                     + token[2].substr(chain[0].size() + 1);
+        if (skip_to != -1)
+            msg += kInternalDelim + token[3] + kInternalDelim + token[4];
+        msg += kMessageDelim;
+        // if it cannot be passed on, the commander falls back on P2A
+        // to every acceptor once thrifty_timeout_ms passed
+        if (GetPeerConnection(next_id) != -1)
+            Unicast(kChain, msg, primary_id, get_peer_fd(next_id));
+    }
+
+    if (S->get_options().distributed_learning)
+        SendLearn(t, skip_to, stride);
+}
+
+/**
+ * @param  server_id id of another acceptor
+ * @return           fd of the connection to it, connecting first if there is
+ *                   none, -1 if connecting failed. The acceptor loop closes
+ *                   connections closed by the other side
+ */
+int Acceptor::GetPeerConnection(const int server_id)
+{
+    if (get_peer_fd(server_id) == -1 && ConnectToPeerAcceptor(server_id))
+        D(cout << "SA" << S->get_pid() << ": Connected to acceptor S" << server_id << endl;)
+    return get_peer_fd(server_id);
+}
+
+/**
+ * closes the connection to another acceptor, and stops waiting for the
+ * votes it was asked for as a member of this relay's group
+ * @param server_id id of the other acceptor
+ */
+void Acceptor::ClosePeer(const int server_id, const int primary_id)
+{
+    int fd = get_peer_fd(server_id);
+    if (fd == -1)
+        return;
+    close(fd);
+    outbox_.Discard(fd);
+    inbox_.Reset(fd);
+    set_peer_fd(server_id, -1);
+
+    std::deque<int> awaited;
+    awaited.swap(p2b_awaited_[server_id]);
+    for (auto tally_id : awaited)
+        SettleTally(tally_id, server_id, primary_id);
+    if (phase1_tally_ != -1)
+        SettleTally(phase1_tally_, server_id, primary_id);
+}
+
+/**
+ * @param  fd fd of a connection opened by this acceptor to another one
+ * @return    id of the other acceptor, -1 if none
+ */
+int Acceptor::GetPeerIdFromFd(const int fd)
+{
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_peer_fd(i) == fd)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * starts a tally of the votes of this relay's group, with this acceptor's
+ * own vote for b
+ * @param  return_fd fd of the scout or commander to answer
+ * @param  phase1    true for a P1A, false for a P2A
+ * @return           id of the new tally
+ */
+int Acceptor::AddTally(const int return_fd, const bool phase1, const Ballot &b)
+{
+    time_t timeout = S->get_options().relay_timeout;
+    RelayTally tally;
+    tally.return_fd = return_fd;
+    tally.phase1 = phase1;
+    tally.b = b;
+    tally.voters.insert(S->get_pid());
+    struct timeval now, length = {timeout / 1000000, timeout % 1000000};
+    gettimeofday(&now, NULL);
+    timeradd(&now, &length, &tally.deadline);
+    tallies_[next_tally_] = tally;
+    return next_tally_++;
+}
+
+/**
+ * takes RELAY-<return fd>-<triple>-<group>[-<skip to>-<stride>]$ from a
+ * commander as the vote relay of group, the ids of the other acceptors in
+ * its group. The pvalue is accepted and passed on to the group as P2A, and
+ * the commander gets VOTES-<pid>-<ballot>-<voters>$ for the whole group
+ * once each one answered, or relay_timeout_ms passed. A higher ballot,
+ * of this acceptor or of one in its group, is sent back right away with
+ * that acceptor as the only voter, and preempts the commander
+ * @param token tokens of RELAY
+ */
+void Acceptor::ReceiveRelay(const std::vector<string> &token, const int primary_id)
+{
+    int return_fd = stoi(token[1]);
+    Triple t = stringToTriple(token[2]);
+    int skip_to = (token.size() == 6) ? stoi(token[4]) : -1;
+    int stride = (token.size() == 6) ? stoi(token[5]) : 0;
+
+    bool accepted = AcceptP2a(t, skip_to, stride, primary_id);
+    int tally_id = AddTally(return_fd, false, get_best_ballot_num());
+    if (accepted) {
+        string rest = kInternalDelim + token[2];
+        if (skip_to != -1)
+            rest += kInternalDelim + token[4] + kInternalDelim + token[5];
+        rest += kMessageDelim;
+        for (const auto &member : split(token[3], kInternalSetDelim[0])) {
+            int id = stoi(member);
+            if (GetPeerConnection(id) == -1)
+                continue;
+            string msg = kP2a + kInternalDelim + to_string(get_peer_remote_fd(id)) + rest;
+            Unicast(kP2a, msg, primary_id, get_peer_fd(id));
+            tallies_[tally_id].awaited.insert(id);
+            p2b_awaited_[id].push_back(tally_id);
+        }
+        if (S->get_options().distributed_learning)
+            SendLearn(t, skip_to, stride);
+    }
+    if (tallies_[tally_id].awaited.empty())
+        SendVotes(tally_id, primary_id);
+}
+
+/**
+ * takes P1A-<scout>-<ballot>-<group>$ from a scout as the vote relay of
+ * group. Promises the ballot as for a P1A, and passes P1A-<scout>-<ballot>$
+ * on to the group. The scout gets
+ * VOTES-<pid>-<ballot>-<voters>-<pvalues>[-<fast votes>]$ once each one
+ * answered, or relay_timeout_ms passed, with the pvalues accepted by the
+ * voters, and how many of them accepted each triple in a fast slot
+ * @param token     tokens of P1A
+ * @param return_fd fd of the scout
+ */
+void Acceptor::RelayP1a(const std::vector<string> &token, const int primary_id,
+                        const int return_fd)
+{
+    Ballot b = stringToBallot(token[2]);
+    if (b > get_best_ballot_num()) {
+        set_best_ballot_num(b);
+        SendPromised();
+    }
+    // the scout of the last P1A relayed was preempted meanwhile
+    if (phase1_tally_ != -1)
+        SendVotes(phase1_tally_, primary_id);
+
+    int tally_id = AddTally(return_fd, true, get_best_ballot_num());
+    tallies_[tally_id].pvalues = accepted_;
+    for (const auto &t : fast_accepted_)
+        tallies_[tally_id].fast_votes[t]++;
+    if (b == get_best_ballot_num()) {
+        string msg = kP1a + kInternalDelim + token[1] + kInternalDelim + token[2]
+                     + kMessageDelim;
+        for (const auto &member : split(token[3], kInternalSetDelim[0])) {
+            int id = stoi(member);
+            if (GetPeerConnection(id) == -1)
+                continue;
+            Unicast(kP1a, msg, primary_id, get_peer_fd(id));
+            tallies_[tally_id].awaited.insert(id);
+        }
+    }
+    if (tallies_[tally_id].awaited.empty())
+        SendVotes(tally_id, primary_id);
+    else
+        phase1_tally_ = tally_id;
+}
+
+/**
+ * counts P2B-<member>-<ballot>$ from an acceptor of this relay's group,
+ * which answers the P2As passed on to it in the order they were sent
+ * @param member_id id of the acceptor
+ * @param b         ballot of the P2B
+ */
+void Acceptor::ReceiveMemberP2b(const int member_id, const Ballot &b, const int primary_id)
+{
+    if (p2b_awaited_[member_id].empty())
+        return;
+    int tally_id = p2b_awaited_[member_id].front();
+    p2b_awaited_[member_id].pop_front();
+    auto it = tallies_.find(tally_id);
+    if (it == tallies_.end())
+        return;     // the commander got the votes after relay_timeout_ms
+
+    if (b > it->second.b) {
+        it->second.b = b;
+        it->second.voters.clear();
+        it->second.voters.insert(member_id);
+        SendVotes(tally_id, primary_id);
+        return;
+    }
+    if (b == it->second.b)
+        it->second.voters.insert(member_id);
+    SettleTally(tally_id, member_id, primary_id);
+}
+
+/**
+ * counts P1B-<member>-<ballot>-<pvalues>[-<fast slot pvalues>]$ from an
+ * acceptor of this relay's group, for the last P1A relayed
+ * @param member_id id of the acceptor
+ * @param token     tokens of P1B
+ */
+void Acceptor::ReceiveMemberP1b(const int member_id, const std::vector<string> &token,
+                                const int primary_id)
+{
+    auto it = tallies_.find(phase1_tally_);
+    if (it == tallies_.end() || it->second.awaited.count(member_id) == 0)
+        return;
+
+    RelayTally &tally = it->second;
+    Ballot b = stringToBallot(token[2]);
+    if (b < tally.b)
+        return;     // answers an earlier P1A
+    if (b > tally.b) {
+        tally.b = b;
+        tally.voters.clear();
+        tally.voters.insert(member_id);
+        tally.pvalues.clear();
+        tally.fast_votes.clear();
+        SendVotes(phase1_tally_, primary_id);
+        return;
+    }
+    tally.voters.insert(member_id);
+    if (token.size() >= 4) {
+        unordered_set<Triple> r = stringToTripleSet(token[3]);
+        union_set(tally.pvalues, r);
+    }
+    if (token.size() == 5) {
+        for (const auto &t : stringToTripleSet(token[4]))
+            tally.fast_votes[t]++;
     }
+    SettleTally(phase1_tally_, member_id, primary_id);
+}
+
+/**
+ * stops waiting for the vote of member_id in a tally, and answers the
+ * scout or commander once no more votes are awaited
+ */
+void Acceptor::SettleTally(const int tally_id, const int member_id, const int primary_id)
+{
+    auto it = tallies_.find(tally_id);
+    if (it == tallies_.end() || it->second.awaited.erase(member_id) == 0)
+        return;
+    if (it->second.awaited.empty())
+        SendVotes(tally_id, primary_id);
+}
+
+/**
+ * answers the scout or commander of a tally with VOTES, see ReceiveRelay()
+ * and RelayP1a(), and drops the tally
+ */
+void Acceptor::SendVotes(const int tally_id, const int primary_id)
+{
+    auto it = tallies_.find(tally_id);
+    if (it == tallies_.end())
+        return;
+
+    const RelayTally &tally = it->second;
+    string voters;
+    for (auto id : tally.voters) {
+        if (!voters.empty())
+            voters += kInternalSetDelim;
+        voters += to_string(id);
+    }
+    string msg = kVotes + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                 + ballotToString(tally.b) + kInternalDelim + voters;
+    if (tally.phase1) {
+        msg += kInternalDelim + tripleSetToString(tally.pvalues);
+        if (!tally.fast_votes.empty())
+            msg += kInternalDelim + fastVotesToString(tally.fast_votes);
+    }
+    msg += kMessageDelim;
+    Unicast(kVotes, msg, primary_id, tally.return_fd);
+
+    if (phase1_tally_ == tally_id)
+        phase1_tally_ = -1;
+    tallies_.erase(it);
+}
+
+/**
+ * answers the scouts and commanders of tallies whose groups did not answer
+ * within relay_timeout_ms with the votes collected so far. They send P1A
+ * or P2A straight to the acceptors left out, if they still need them
+ */
+void Acceptor::SendExpiredVotes(const int primary_id)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    vector<int> expired;
+    for (const auto &tally : tallies_) {
+        if (timercmp(&tally.second.deadline, &now, <))
+            expired.push_back(tally.first);
+    }
+    for (auto tally_id : expired)
+        SendVotes(tally_id, primary_id);
+}
+
+/**
+ * tells the scout of the hot standby the current best ballot, so that its
+ * leader can reserve a higher one before taking over
+ */
+void Acceptor::SendPromised()
+{
+    int standby_id = S->get_standby_id();
+    if (standby_id == -1 || get_scout_fd(standby_id) == -1 || get_best_ballot_num().id == INT_MIN)
+        return;
+
+    string msg = kPromised + kInternalDelim + to_string(S->get_pid());
+    msg += kInternalDelim + ballotToString(get_best_ballot_num()) + kMessageDelim;
+    Unicast(kPromised, msg, standby_id, get_scout_fd(standby_id));
 }
 
 /**
  * sends phase 1B message to scout
- * @param b  current best ballot num of acceptor
- * @param st accepted set of acceptor
+ * @param b         current best ballot num of acceptor
+ * @param st        accepted set of acceptor
+ * @param return_fd fd of the scout which sent P1A. A hot standby taking
+ *                  over sends P1A before this acceptor sees it as primary
  */
 void Acceptor::SendP1b(const Ballot& b, const unordered_set<Triple> &st,
-                       const int primary_id)
+                       const int primary_id, int return_fd)
 {
     string msg = kP1b + kInternalDelim + to_string(S->get_pid());
     msg += kInternalDelim + ballotToString(b) + kInternalDelim;
-    msg += tripleSetToString(st) + kMessageDelim;
-    Unicast(kP1b, msg, primary_id);
+    msg += tripleSetToString(st);
+    // the triples accepted in fast slots once more, for counting votes
+    if (!fast_accepted_.empty())
+        msg += kInternalDelim + tripleSetToString(fast_accepted_);
+    msg += kMessageDelim;
+    Unicast(kP1b, msg, primary_id, return_fd);
 }
 
 /**
@@ -178,6 +719,150 @@ void Acceptor::SendP2b(const Ballot& b, int return_fd, const int primary_id)
     Unicast(kP2b, msg, primary_id, return_fd);
 }
 
+/**
+ * promises a higher ballot and answers with P1B
+ * @param b         ballot of the P1A
+ * @param return_fd fd of the scout which sent P1A
+ */
+void Acceptor::ReceiveP1a(const Ballot &b, const int primary_id, const int return_fd)
+{
+    if (b > get_best_ballot_num()) {
+        set_best_ballot_num(b);
+        SendPromised();
+    }
+    SendP1b(get_best_ballot_num(), accepted_, primary_id, return_fd);
+}
+
+/**
+ * LEASE-<ballot>-<round>$ asks for a lease on behalf of the leader of ballot.
+ * a lease is granted only to the ballot this acceptor promised last, and is
+ * not renewed while another leader waits for it to expire. A grant is
+ * LEASEACK-<pid>-<ballot>-<round>$
+ * @param token     tokens of LEASE message
+ * @param return_fd fd of the scout of the leader asking for the lease
+ */
+void Acceptor::ReceiveLease(const std::vector<string> &token, const int primary_id,
+                            const int return_fd)
+{
+    Ballot b = stringToBallot(token[1]);
+    if (!(b == get_best_ballot_num()) || !deferred_p1a_.empty())
+        return;
+
+    time_t lease = S->get_options().lease_duration;
+    if (lease > 0) {
+        struct timeval now, length = {lease / 1000000, lease % 1000000};
+        gettimeofday(&now, NULL);
+        timeradd(&now, &length, &lease_expiry_);
+        lease_ballot_ = b;
+    }
+    string msg = kLeaseAck + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                 + ballotToString(b) + kInternalDelim + token[2] + kMessageDelim;
+    Unicast(kLeaseAck, msg, primary_id, return_fd);
+}
+
+/**
+ * @return true if a lease granted by this acceptor has not expired yet
+ */
+bool Acceptor::LeaseActive()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return timercmp(&now, &lease_expiry_, <);
+}
+
+/**
+ * gives up the lease before it expires. Only done when the master picks a
+ * new primary, which it does once the old primary crashed or handed over
+ */
+void Acceptor::ReleaseLease()
+{
+    lease_expiry_ = {0, 0};
+}
+
+/**
+ * answers the P1As which came while the lease was active,
+ * once it expired. Scouts which went away meanwhile are skipped
+ */
+void Acceptor::ProcessDeferredP1a(const int primary_id)
+{
+    if (deferred_p1a_.empty() || LeaseActive())
+        return;
+
+    for (const auto &p1a : deferred_p1a_) {
+        if (GetScoutIdFromFd(p1a.first) != -1)
+            ReceiveP1a(p1a.second, primary_id, p1a.first);
+    }
+    deferred_p1a_.clear();
+}
+
+/**
+ * @return true if the leader of the ballot promised last granted fast slots
+ *         with ANY. A higher ballot ends the grant till its leader sends ANY
+ */
+bool Acceptor::FastGranted()
+{
+    return fast_ballot_.id != INT_MIN && fast_ballot_ == get_best_ballot_num();
+}
+
+/**
+ * ANY-<ballot>-<first slot>$ lets clients propose from first slot on with
+ * ballot, once its leader decided every slot below. Fast slots are taken
+ * from first slot on again, so that acceptors which took different slots
+ * for the same chat before line up. Chats which waited for it are accepted,
+ * but for those the leader recovered with ballot
+ * @param token tokens of ANY message
+ */
+void Acceptor::ReceiveAny(const std::vector<string> &token, const int primary_id)
+{
+    Ballot b = stringToBallot(token[1]);
+    if (b < get_best_ballot_num())
+        return;
+    if (b > get_best_ballot_num()) {
+        // its leader got a phase 1 quorum without this acceptor
+        set_best_ballot_num(b);
+        SendPromised();
+    }
+
+    fast_ballot_ = b;
+    next_fast_slot_ = stoi(token[2]);
+    D(cout << "SA" << S->get_pid() << ": Fast slots from " << next_fast_slot_
+      << " granted with ballot " << ballotToString(b) << endl;)
+    vector<Proposal> waiting;
+    waiting.swap(fast_waiting_);
+    for (const auto &p : waiting) {
+        bool recovered = false;
+        for (const auto &t : accepted_) {
+            if (t.b == b && t.p == p) {
+                recovered = true;
+                break;
+            }
+        }
+        if (!recovered)
+            ReceiveFast(p, primary_id);
+    }
+}
+
+/**
+ * accepts a chat sent by a client with FAST-<proposal>$ in the next fast
+ * slot, and tells the primary's leader with FASTP2B-<acceptor>-<triple>$.
+ * Without a fast ballot granted, the chat waits for the next ANY
+ * @param p chat proposal sent by the client
+ */
+void Acceptor::ReceiveFast(const Proposal &p, const int primary_id)
+{
+    if (!FastGranted()) {
+        fast_waiting_.push_back(p);
+        return;
+    }
+
+    Triple t(fast_ballot_, next_fast_slot_++, p);
+    accepted_.insert(t);
+    fast_accepted_.insert(t);
+    string msg = kFastP2b + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                 + tripleToString(t) + kMessageDelim;
+    Unicast(kFastP2b, msg, primary_id);
+}
+
 /**
  * function for performing acceptor related job
  */
@@ -186,6 +871,96 @@ void Acceptor::AcceptorMode(const int primary_id)
     int num_bytes;
     vector<int> fds;
     fd_set recv_from;
+    std::vector<StringView> message;     // reused, so parsing allocates nothing
+
+    // P2A and P2B are parsed in place, the others from strings. peer_id is
+    // the acceptor the message being handled came from, -1 for none
+    int peer_id = -1;
+    Dispatcher dispatcher("acceptor");
+    dispatcher.Register(MSG_P2B, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        if (peer_id == -1 || view.size() != 3)
+            return false;
+        ReceiveMemberP2b(peer_id, viewToBallot(view[2]), primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_P2A, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        D(cout << "SA" << S->get_pid() << ": Received P2A message: " << msg << endl;)
+
+        int return_fd = viewToInt(view[1]);
+        Triple recvd_triple = viewToTriple(view[2]);
+        int skip_to = (view.size() == 5) ? viewToInt(view[3]) : -1;
+        int stride = (view.size() == 5) ? viewToInt(view[4]) : 0;
+        bool accepted = AcceptP2a(recvd_triple, skip_to, stride, primary_id);
+        SendP2b(get_best_ballot_num(), return_fd, primary_id);
+        if (accepted && S->get_options().distributed_learning)
+            SendLearn(recvd_triple, skip_to, stride);
+        return true;
+    });
+    dispatcher.Register(MSG_P1B, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        if (peer_id == -1 || view.size() < 3)
+            return false;
+        ReceiveMemberP1b(peer_id, ViewsToStrings(view), primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_P1A, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        D(cout << "SA" << S->get_pid() << ": Received P1A message" << msg <<  endl;)
+        Ballot recvd_ballot = viewToBallot(view[2]);
+        if (recvd_ballot > get_best_ballot_num() && LeaseActive()
+                && recvd_ballot.id != lease_ballot_.id) {
+            D(cout << "SA" << S->get_pid() << ": Deferring P1A of ballot "
+              << ballotToString(recvd_ballot) << " till lease of ballot "
+              << ballotToString(lease_ballot_) << " expires" << endl;)
+            deferred_p1a_.push_back(make_pair(fd, recvd_ballot));
+        } else if (view.size() == 4) {
+            RelayP1a(ViewsToStrings(view), primary_id, fd);
+        } else {
+            ReceiveP1a(recvd_ballot, primary_id, fd);
+        }
+        return true;
+    });
+    dispatcher.Register(MSG_CHAIN, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        if (view.size() != 3 && view.size() != 5)
+            return false;
+        D(cout << "SA" << S->get_pid() << ": Received CHAIN message: " << msg << endl;)
+        ReceiveChain(ViewsToStrings(view), primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_RELAY, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        if (view.size() != 4 && view.size() != 6)
+            return false;
+        D(cout << "SA" << S->get_pid() << ": Received RELAY message: " << msg << endl;)
+        ReceiveRelay(ViewsToStrings(view), primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_LEASE, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        if (view.size() != 3)
+            return false;
+        ReceiveLease(ViewsToStrings(view), primary_id, fd);
+        return true;
+    });
+    dispatcher.Register(MSG_ANY, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        if (view.size() != 3)
+            return false;
+        D(cout << "SA" << S->get_pid() << ": Received ANY message: " << msg << endl;)
+        ReceiveAny(ViewsToStrings(view), primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_FAST, [&](const StringView &msg, const vector<StringView> &view,
+                                      const int fd) {
+        if (view.size() != 2)
+            return false;
+        D(cout << "SA" << S->get_pid() << ": Received FAST message: " << msg << endl;)
+        ReceiveFast(viewToProposal(view[1]), primary_id);
+        return true;
+    });
 
     while (S->get_mode() == RECOVER)
     {
@@ -193,35 +968,87 @@ void Acceptor::AcceptorMode(const int primary_id)
     }
 
 
+    Wakeup *wakeup = S->get_wakeup(kAcceptorRole);
     while (true) {  // always listen to messages from the acceptors
+        FlushOutbox(primary_id);
+
         if (primary_id != S->get_primary_id()) {   // new primary has been elected
+            // servers which elect primaries themselves may have elected one
+            // while the old primary still lives, so its lease runs to expiry
+            if (S->get_options().leader_election == MASTER_ELECTION)
+                ReleaseLease();
             close(get_scout_fd(primary_id));
             set_scout_fd(primary_id, -1);
             return;
         }
+        ConnectToStandby(primary_id);
+        ConnectToLearners();
+        ProcessDeferredP1a(primary_id);
+        SendExpiredVotes(primary_id);
 
         int fd_max = INT_MIN, fd_temp;
         GetCommanderFdSet(recv_from, fd_max, fds);
 
         char buf;
-        fd_temp = get_scout_fd(primary_id);
-        int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
-        if (rv == 0) {
-            close(fd_temp);
-            set_scout_fd(primary_id, -1);
-        } else {
-            FD_SET(fd_temp, &recv_from);
-            fd_max = max(fd_max, fd_temp);
-            fds.push_back(fd_temp);
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            fd_temp = get_scout_fd(i);
+            if (fd_temp == -1)
+                continue;
+            int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
+            if (rv == 0) {
+                close(fd_temp);
+                outbox_.Discard(fd_temp);
+                inbox_.Reset(fd_temp);
+                set_scout_fd(i, -1);
+            } else {
+                FD_SET(fd_temp, &recv_from);
+                fd_max = max(fd_max, fd_temp);
+                fds.push_back(fd_temp);
+            }
         }
-
-        if (fd_max == INT_MIN) {
-            usleep(kBusyWaitSleep);
-            continue;
+        // votes of the group of this acceptor as a vote relay
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            fd_temp = get_peer_fd(i);
+            if (fd_temp == -1)
+                continue;
+            if (recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK) == 0) {
+                ClosePeer(i, primary_id);
+            } else {
+                FD_SET(fd_temp, &recv_from);
+                fd_max = max(fd_max, fd_temp);
+                fds.push_back(fd_temp);
+            }
         }
+        FD_SET(wakeup->get_fd(), &recv_from);
+        fd_max = max(fd_max, wakeup->get_fd());
+
+        fd_set send_to;
+        FD_ZERO(&send_to);
+        outbox_.FillWriteSet(send_to, fd_max);
 
         struct timeval timeout = kSelectTimeoutTimeval;
-        rv = select(fd_max + 1, &recv_from, NULL, NULL, &timeout);
+        if (!deferred_p1a_.empty()) {
+            // wake up when the lease expires, to answer deferred P1As
+            struct timeval now, remaining = {0, 0};
+            gettimeofday(&now, NULL);
+            if (timercmp(&lease_expiry_, &now, >))
+                timersub(&lease_expiry_, &now, &remaining);
+            if (timercmp(&remaining, &timeout, <))
+                timeout = remaining;
+        }
+        if (!tallies_.empty()) {
+            // and when the oldest tally is due
+            struct timeval now, remaining = {0, 0};
+            gettimeofday(&now, NULL);
+            const struct timeval &deadline = tallies_.begin()->second.deadline;
+            if (timercmp(&deadline, &now, >))
+                timersub(&deadline, &now, &remaining);
+            if (timercmp(&remaining, &timeout, <))
+                timeout = remaining;
+        }
+        int rv = select(fd_max + 1, &recv_from, &send_to, NULL, &timeout);
+        if (rv > 0 && FD_ISSET(wakeup->get_fd(), &recv_from))
+            wakeup->Clear();
 
         // if (rv == -1) { //error in select
         //     D(cout << "SA" << S->get_pid() << ": ERROR in select() for Acceptor errno=" << errno << "fd_max=" << fd_max << endl;)
@@ -232,56 +1059,51 @@ void Acceptor::AcceptorMode(const int primary_id)
             for (int i = 0; i < fds.size(); i++) {
                 if (FD_ISSET(fds[i], &recv_from)) { // we got one!!
                     char buf[kMaxDataSize];
+                    peer_id = GetPeerIdFromFd(fds[i]);
                     if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) == -1) {
                         D(cout << "SA" << S->get_pid() << ": ERROR in receiving from scout or commander" << endl;)
-                        if (fds[i] == get_scout_fd(primary_id)) {
+                        if (peer_id != -1) {
+                            ClosePeer(peer_id, primary_id);
+                            continue;
+                        }
+                        outbox_.Discard(fds[i]);
+                        inbox_.Reset(fds[i]);
+                        if (GetScoutIdFromFd(fds[i]) != -1) {
                             close(fds[i]);
-                            set_scout_fd(primary_id, -1);
+                            set_scout_fd(GetScoutIdFromFd(fds[i]), -1);
                         } else {
                             close(fds[i]);
                             RemoveFromCommanderFDSet(fds[i]);
                         }
                     } else if (num_bytes == 0) {     //connection closed
                         D(cout << "SA" << S->get_pid() << ": Connection closed by scout or commander." << endl;)
-                        if (i == get_scout_fd(primary_id)) {
+                        if (peer_id != -1) {
+                            ClosePeer(peer_id, primary_id);
+                            continue;
+                        }
+                        outbox_.Discard(fds[i]);
+                        inbox_.Reset(fds[i]);
+                        if (GetScoutIdFromFd(fds[i]) != -1) {
                             close(fds[i]);
-                            set_scout_fd(primary_id, -1);
+                            set_scout_fd(GetScoutIdFromFd(fds[i]), -1);
                         } else {
                             close(fds[i]);
                             RemoveFromCommanderFDSet(fds[i]);
                         }
                     } else {
-                        buf[num_bytes] = '\0';
-                        std::vector<string> message = split(string(buf), kMessageDelim[0]);
+                        // commanders connecting here are the primary's. A hot
+                        // standby may be taking over before this loop sees it.
+                        // with multi_leader they can be any server's
+                        int sender_id = GetScoutIdFromFd(fds[i]);
+                        if (sender_id == -1)
+                            sender_id = peer_id;
+                        if (sender_id == -1 && !S->get_options().multi_leader)
+                            sender_id = S->get_primary_id();
+                        S->get_failure_detector()->Heard(sender_id);
+                        inbox_.Extract(fds[i], buf, num_bytes, message);
                         for (const auto &msg : message) {
-                            std::vector<string> token = split(string(msg), kInternalDelim[0]);
-                            if (token[0] == kP1a)
-                            {
-                                D(cout << "SA" << S->get_pid() << ": Received P1A message" << msg <<  endl;)
-                                Ballot recvd_ballot = stringToBallot(token[2]);
-                                if (recvd_ballot > get_best_ballot_num())
-                                    set_best_ballot_num(recvd_ballot);
-                                SendP1b(get_best_ballot_num(), accepted_, primary_id);
-                            }
-                            else if (token[0] == kP2a)
-                            {
-                                D(cout << "SA" << S->get_pid() << ": Received P2A message: " << msg << endl;)
-
-                                int return_fd = stoi(token[1]);
-                                Triple recvd_triple = stringToTriple(token[2]);
-                                if (recvd_triple.b >= get_best_ballot_num())
-                                {
-                                    set_best_ballot_num(recvd_triple.b);
-                                    accepted_.insert(recvd_triple);
-                                }
-                                SendP2b(get_best_ballot_num(), return_fd, primary_id);
-                                //TODO: Check if following is correct
-                                // close(fds[i]);
-                                // RemoveFromCommanderFDSet(fds[i]);
-                            }
-                            else {    //other messages
+                            if (!dispatcher.Dispatch(msg, fds[i]))
                                 D(cout << "SA" << S->get_pid() << ": Unexpected message received: " << msg << endl;)
-                            }
                         }
                     }
                 }
@@ -304,11 +1126,15 @@ void* AcceptorEntry(void *_S) {
 
     while (true) {
         int primary_id = A.S->get_primary_id();
+        auto renamed = [&]() { return A.S->get_primary_id() != primary_id; };
 
-        // sleep for some time to make sure accept threads of scouts are running
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
-        if (A.ConnectToScout(primary_id)) {
+        // the scout of a new primary may not be accepting yet. retry with backoff,
+        // till another primary is named. a hot standby's scout is connected already
+        if (A.get_scout_fd(primary_id) != -1
+                || RetryWithBackoff([&]() { return renamed() || A.ConnectToScout(primary_id); },
+                                    kConnectTimeout)) {
+            if (renamed())
+                continue;
             D(cout << "SA" << A.S->get_pid() << ": Connected to scout of S"
               << primary_id << endl;)
         } else {
@@ -317,10 +1143,6 @@ void* AcceptorEntry(void *_S) {
             return NULL;
         }
 
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
-
         A.S->set_acceptor_ready(true);
         A.AcceptorMode(primary_id);
     }
@@ -3,35 +3,92 @@
 
 #include "server.h"
 #include "utilities.h"
+#include "channel.h"
 #include "vector"
 #include "string"
 #include "unordered_set"
 #include "map"
 #include "set"
+#include "deque"
 using namespace std;
 
+/**
+ * votes a relay collects from its group for one P1A or P2A of the leader,
+ * see Acceptor::ReceiveRelay
+ */
+struct RelayTally {
+    int return_fd;          // fd of the scout or commander to answer
+    bool phase1;            // for a P1A, otherwise for a P2A
+    Ballot b;               // ballot voted for
+    set<int> awaited;       // acceptors of the group yet to answer
+    set<int> voters;        // acceptors which promised or accepted b
+    unordered_set<Triple> pvalues;          // phase 1: accepted by the voters
+    unordered_map<Triple, int> fast_votes;  // phase 1: voters per fast slot triple
+    struct timeval deadline;                // when to answer with the votes so far
+};
+
 void* AcceptConnectionsAcceptor(void* _A);
 void *AcceptorEntry(void *_S);
 
 class Acceptor {
 public:
     bool ConnectToScout(const int server_id);
+    bool ConnectToReplica(const int server_id);
+    bool ConnectToPeerAcceptor(const int server_id);
+    int ConnectFromAcceptorPort(const int port);
+    void ConnectToLearners();
+    void SendLearn(const Triple &t, const int skip_to, const int stride);
+    bool AcceptP2a(const Triple &t, const int skip_to, const int stride,
+                   const int primary_id);
+    void ReceiveChain(const std::vector<string> &token, const int primary_id);
+    int GetPeerConnection(const int server_id);
+    void ClosePeer(const int server_id, const int primary_id);
+    int GetPeerIdFromFd(const int fd);
+    void ReceiveRelay(const std::vector<string> &token, const int primary_id);
+    void RelayP1a(const std::vector<string> &token, const int primary_id,
+                  const int return_fd);
+    int AddTally(const int return_fd, const bool phase1, const Ballot &b);
+    void ReceiveMemberP2b(const int member_id, const Ballot &b, const int primary_id);
+    void ReceiveMemberP1b(const int member_id, const std::vector<string> &token,
+                          const int primary_id);
+    void SettleTally(const int tally_id, const int member_id, const int primary_id);
+    void SendVotes(const int tally_id, const int primary_id);
+    void SendExpiredVotes(const int primary_id);
     void GetCommanderFdSet(fd_set&, int&, std::vector<int> &cfds_vec);
     void AddToCommanderFDSet(const int fd);
     void RemoveFromCommanderFDSet(const int fd);
     void SendBackOwnFD(const int fd);
     void AcceptorMode(const int primary_id);
     void SendP1b(const Ballot& b, const unordered_set<Triple> &st,
-                 const int primary_id);
+                 const int primary_id, int return_fd);
+    void SendPromised();
+    void ConnectToStandby(const int primary_id);
+    int GetScoutIdFromFd(const int fd);
     void SendP2b(const Ballot& b, int return_fd, const int primary_id);
+    void ReceiveP1a(const Ballot &b, const int primary_id, const int return_fd);
+    void ReceiveLease(const std::vector<string> &token, const int primary_id,
+                      const int return_fd);
+    bool LeaseActive();
+    void ReleaseLease();
+    void ProcessDeferredP1a(const int primary_id);
+    bool FastGranted();
+    void ReceiveAny(const std::vector<string> &token, const int primary_id);
+    void ReceiveFast(const Proposal &p, const int primary_id);
     void Unicast(const string &type, const string& msg,
                  const int primary_id, int r_fd = -1);
+    void FlushOutbox(const int primary_id);
 
     int get_scout_fd(const int server_id);
+    int get_replica_fd(const int server_id);
+    int get_peer_fd(const int server_id);
+    int get_peer_remote_fd(const int server_id);
     set<int> get_commander_fd_set();
     Ballot get_best_ballot_num();
 
     void set_scout_fd(const int server_id, const int fd);
+    void set_replica_fd(const int server_id, const int fd);
+    void set_peer_fd(const int server_id, const int fd);
+    void set_peer_remote_fd(const int server_id, const int fd);
     void set_best_ballot_num(const Ballot &b);
 
     Acceptor(Server *_S);
@@ -43,7 +100,38 @@ private:
     std::unordered_set<Triple> accepted_;
 
     std::vector<int> scout_fd_;
+    struct timeval last_standby_attempt_;
     std::set<int> commander_fd_set_;
+    Outbox outbox_;
+    Inbox inbox_;
+
+    // lease granted to a leader: no other leader is promised till it expires
+    Ballot lease_ballot_;
+    struct timeval lease_expiry_;
+    std::vector<pair<int, Ballot> > deferred_p1a_;  // (scout fd, ballot)
+
+    // fast path: chats from clients are accepted in fast slots, from
+    // next_fast_slot_ on in arrival order, with the ballot of the last ANY
+    Ballot fast_ballot_;
+    int next_fast_slot_;
+    std::unordered_set<Triple> fast_accepted_;
+    std::vector<Proposal> fast_waiting_;    // chats which came with no fast ballot granted
+
+    // distributed learning: every accepted pvalue goes to the replicas too
+    std::vector<int> replica_fd_;
+    struct timeval last_learner_attempt_;
+
+    // connections to other acceptors: the next ones of chains in the chain
+    // mode of phase 2, and the rest of the group of a vote relay. The fd
+    // numbers on their side are the return fds of relayed P2As
+    std::vector<int> peer_fd_;
+    std::vector<int> peer_remote_fd_;
+
+    // vote relays: votes collected for the leader, by tally id
+    std::map<int, RelayTally> tallies_;
+    int next_tally_;
+    std::vector<std::deque<int> > p2b_awaited_;  // per acceptor, tallies of the P2As it was sent, in order
+    int phase1_tally_;                          // tally of the last relayed P1A, -1 if none
 
 };
 
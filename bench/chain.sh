@@ -0,0 +1,34 @@
+#!/bin/sh
+# bytes sent by the leader's server per chat and commit latency on 7
+# servers, with P2A sent to every acceptor, along a chain (chain_p2a), and
+# along a chain with replicas learning from the acceptors
+# (distributed_learning), for chats of 64 B to 64 KB from a single client.
+# copies is bytes per commit over chat size. It includes the PROPOSE, the
+# RESPONSE to the client, the decision to the leader, and one copy per
+# server in the decisions exchanged on allClear at the end.
+# run from the project directory after make:
+#   bench/chain.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-6s %-9s %-8s %-17s %-7s %s\n" size mode commits bytes_per_commit copies commit_latency_us
+for size in 64 1024 8192 65536; do
+    chat=$(head -c "$size" /dev/zero | tr '\0' x)
+    for mode in off chain learning; do
+        case $mode in
+            off)      printf "chain_p2a off" > "$tmp/options" ;;
+            chain)    printf "chain_p2a on" > "$tmp/options" ;;
+            learning) printf "chain_p2a on\ndistributed_learning on" > "$tmp/options" ;;
+        esac
+        bench_test 7 1 config/ports-file7 "$chats" "$chat"
+        bench_run
+        summary=$(server_summary 0)
+        commits=$(summary_value "$summary" commits)
+        bytes=$(summary_value "$summary" bytes_sent)
+        per_commit=0
+        [ "${commits:-0}" -gt 0 ] && per_commit=$((bytes / commits))
+        printf "%-6s %-9s %-8s %-17s %-7s %s\n" "$size" "$mode" "$commits" "$per_commit" \
+            $((per_commit / size)) "$(summary_value "$summary" commit_latency_us)"
+    done
+done
@@ -0,0 +1,39 @@
+# shared by the bench scripts, which source it from the project directory:
+#   . bench/common.sh
+# makes $tmp, a directory removed when the script exits or is interrupted.
+# Each run goes through a test file naming its options and ports file on its
+# start line, so no bench touches config/
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+trap 'exit 130' INT TERM
+mkdir -p chatlog
+
+# bench_test <servers> <clients> <ports file> <chats> [chat]
+# writes $tmp/test, which starts the servers and clients with $tmp/options
+# and the ports file, sends chats round robin over the clients, and ends
+# with an allClear. Chats are chat<i>, or [chat] for every one
+bench_test() {
+    printf "start %s %s %s %s\n" "$1" "$2" "$tmp/options" "$3" > "$tmp/test"
+    i=0
+    while [ $i -lt "$4" ]; do
+        printf "sendMessage %s %s\n" $((i % $2)) "${5:-chat$i}" >> "$tmp/test"
+        i=$((i + 1))
+    done
+    printf "allClear" >> "$tmp/test"
+}
+
+# bench_run: runs $tmp/test, with the log in $tmp/log
+bench_run() {
+    ./master < "$tmp/test" > "$tmp/log" 2>&1
+}
+
+# server_summary <server>: the summary the server printed on its last allClear
+server_summary() {
+    grep "^S$1 : messages_sent" "$tmp/log" | tail -1
+}
+
+# summary_value <summary> <key>: the number after <key>= in the summary
+summary_value() {
+    echo "$1" | sed -n "s/.* $2=\([0-9]*\).*/\1/p"
+}
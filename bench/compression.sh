@@ -0,0 +1,37 @@
+#!/bin/sh
+# bytes sent by all servers, and compression of bulk messages, on 3
+# servers with frames sent as they are and with compress_min_bytes 256.
+# Three clients send chats, S0 crashes, and S1 takes over with P1Bs and an
+# ADOPTED carrying every pvalue accepted before. Two allClears exchange all
+# decisions. For each message type, frames is the frames S1 compressed,
+# ratio their bytes before over after, and compress_us and decompress_us
+# the CPU time per frame at S1
+# run from the project directory after make:
+#   bench/compression.sh [chats per client]
+
+chats=${1:-50}
+. bench/common.sh
+
+printf "%-10s %-11s %s\n" min_bytes bytes_sent compression_at_S1
+for min_bytes in 0 256; do
+    printf "compress_min_bytes %s" "$min_bytes" > "$tmp/options"
+    printf "start 3 3 %s\n" "$tmp/options" > "$tmp/test"
+    i=0
+    while [ $i -lt "$chats" ]; do
+        for c in 0 1 2; do
+            printf "sendMessage %s chat number %s from client %s\n" "$c" "$i" "$c" >> "$tmp/test"
+        done
+        i=$((i + 1))
+    done
+    printf "allClear\ncrashServer 0\nsendMessage 1 last chat\nallClear" >> "$tmp/test"
+
+    bench_run
+    # the last summary of each server, printed on allClear
+    bytes=0
+    for s in S0 S1 S2; do
+        b=$(grep "^$s : messages_sent" "$tmp/log" | tail -1 | sed -n 's/.* bytes_sent=\([0-9]*\).*/\1/p')
+        bytes=$((bytes + ${b:-0}))
+    done
+    compression=$(grep "^S1 : messages_sent" "$tmp/log" | tail -1 | sed 's/.* vote_messages=[0-9]*//')
+    printf "%-10s %-11s %s\n" "$min_bytes" "$bytes" "${compression:- -}"
+done
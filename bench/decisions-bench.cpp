@@ -0,0 +1,98 @@
+/**
+ * size and speed of the columnar encoding of decisions which ALLDECISIONS
+ * and handoffs carry (see allDecisionsToString()), against the row encoding
+ * it replaced, slot.client.chat.msg for each decision joined by ','.
+ * The decisions are those of a run with a few clients sending chats in
+ * turn, each chat id one past the client's last, with a no-op every 16
+ * slots. Every decode is checked against the decisions.
+ * build and run from the project directory:
+ *   make decisions-bench && bench/decisions-bench [runs]
+ */
+#include "utilities.h"
+#include "cstdio"
+#include "cstdlib"
+using namespace std;
+
+/**
+ * the row encoding, as allDecisionsToString() wrote it before
+ */
+static string RowsToString(const map<int, Proposal> &d)
+{
+    string rval;
+    for (auto it = d.begin(); it != d.end(); it++) {
+        if (it != d.begin())
+            rval += kInternalSetDelim;
+        rval += decisionToStringForAll(it->first, it->second);
+    }
+    return rval;
+}
+
+/**
+ * the row decoding, as stringToAllDecisions() read it before
+ */
+static void StringToRows(const string &s, map<int, Proposal> &decs)
+{
+    decs.clear();
+    vector<string> decisions = split(s, kInternalSetDelim[0]);
+    for (auto &d : decisions) {
+        int slot;
+        Proposal p;
+        stringToDecisionForAll(d, slot, p);
+        decs[slot] = p;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? atol(argv[1]) : 200;
+    int counts[] = { 100, 1000, 10000 };
+    int num_clients = 5;
+
+    printf("%-10s %-10s %-12s %-10s %-14s %-14s %-14s %s\n", "decisions", "row_bytes",
+           "column_bytes", "ratio", "row_encode_us", "col_encode_us",
+           "row_decode_us", "col_decode_us");
+    for (auto count : counts) {
+        map<int, Proposal> decisions;
+        vector<int> chat_id(num_clients, 0);
+        for (int s = 0; s < count; s++) {
+            if (s % 16 == 15) {
+                decisions[s] = Proposal("0", "0", kNoop);
+                continue;
+            }
+            int c = rand() % num_clients;
+            decisions[s] = Proposal(to_string(c), to_string(chat_id[c]++),
+                                    "chat " + to_string(s) + " of client " + to_string(c));
+        }
+
+        string rows, columns;
+        double time[4];
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            rows = RowsToString(decisions);
+        time[0] = (double)ElapsedSince(start) / runs;
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            columns = allDecisionsToString(decisions);
+        time[1] = (double)ElapsedSince(start) / runs;
+
+        map<int, Proposal> decoded[2];
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            StringToRows(rows, decoded[0]);
+        time[2] = (double)ElapsedSince(start) / runs;
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            stringToAllDecisions(columns, decoded[1]);
+        time[3] = (double)ElapsedSince(start) / runs;
+        if (decoded[0] != decisions || decoded[1] != decisions) {
+            printf("ERROR: decode failed for %d decisions\n", count);
+            return 1;
+        }
+
+        printf("%-10d %-10zu %-12zu %-10.2f %-14.1f %-14.1f %-14.1f %.1f\n", count,
+               rows.size(), columns.size(), (double)rows.size() / columns.size(),
+               time[0], time[1], time[2], time[3]);
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * per message cost of finding the handler of a message, the way the
+ * receive loops did it (a chain of string compares of the first token,
+ * here the replica's, whose last types compare with every name before
+ * them) against a Dispatcher, which hashes the type name once and calls
+ * the handler at its index. Each message is tokenized first, and its
+ * handler counts it. table is the lookup alone, and dispatch adds the
+ * Dispatcher's counters, which time one message in kDispatchTimeEvery.
+ * build and run from the project directory:
+ *   make dispatch-bench && bench/dispatch-bench [runs]
+ */
+#include "dispatch.h"
+#include "constants.h"
+#include "cstdio"
+#include "cstdlib"
+using namespace std;
+
+// the replica's message types, in the order its chain compared them
+static const string kChainTypes[] = {
+    kChat, kRead, kEpoch, kReadIndexResp, kDecision, kLearn, kCommit,
+    kAllDecisions, kPayload, kReqPayload, kReqAllDecs
+};
+static const MessageType kTableTypes[] = {
+    MSG_CHAT, MSG_READ, MSG_EPOCH, MSG_READINDEXRESP, MSG_DECISION, MSG_LEARN, MSG_COMMIT,
+    MSG_ALLDECISIONS, MSG_PAYLOAD, MSG_REQPAYLOAD, MSG_REQALLDECS
+};
+const int kNumTypes = sizeof(kChainTypes) / sizeof(kChainTypes[0]);
+
+static long long handled[kNumTypes];
+
+/**
+ * the handler of msg through the type table, as Dispatcher::Dispatch() finds
+ * it but without counting and timing it
+ */
+static bool TableDispatch(const StringView &msg, vector<StringView> &token,
+                          const Dispatcher::Handler *handlers) {
+    SplitView(msg, kInternalDelim[0], token);
+    const Dispatcher::Handler &handler = handlers[MessageTypeOf(token[0])];
+    return handler && handler(msg, token, -1);
+}
+
+/**
+ * the handler of msg through the chain
+ */
+static bool ChainDispatch(const StringView &msg, vector<StringView> &token) {
+    SplitView(msg, kInternalDelim[0], token);
+    for (int t = 0; t < kNumTypes; t++) {
+        if (token[0] == kChainTypes[t]) {
+            handled[t]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? atol(argv[1]) : 2000000;
+
+    Dispatcher dispatcher("bench");
+    Dispatcher::Handler handlers[MSG_NUM_TYPES];
+    for (int t = 0; t < kNumTypes; t++) {
+        handlers[kTableTypes[t]] = [t](const StringView &msg, const vector<StringView> &token,
+                                       const int fd) {
+            handled[t]++;
+            return true;
+        };
+        dispatcher.Register(kTableTypes[t], handlers[kTableTypes[t]]);
+    }
+
+    printf("%-15s %-10s %-10s %s\n", "message", "chain_ns", "table_ns", "dispatch_ns");
+    for (int t = 0; t < kNumTypes; t++) {
+        string msg = kChainTypes[t] + kInternalDelim + "1" + kInternalDelim + "2.1417.chat";
+        vector<StringView> token;
+        double time[3];
+        struct timeval start;
+        for (int way = 0; way < 3; way++) {
+            handled[t] = 0;
+            gettimeofday(&start, NULL);
+            for (long r = 0; r < runs; r++) {
+                if (way == 0)
+                    ChainDispatch(msg, token);
+                else if (way == 1)
+                    TableDispatch(msg, token, handlers);
+                else
+                    dispatcher.Dispatch(msg, -1);
+            }
+            time[way] = 1000.0 * ElapsedSince(start) / runs;
+            if (handled[t] != runs) {
+                printf("ERROR: %s not handled by its handler\n", kChainTypes[t].c_str());
+                return 1;
+            }
+        }
+        printf("%-15s %-10.1f %-10.1f %.1f\n", kChainTypes[t].c_str(), time[0], time[1],
+               time[2]);
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# time to a new leader after the primary crashes, with the master electing
+# it and with the servers electing it among themselves (leader_election).
+# The master measures both from the old primary's failure till the new
+# primary is ready.
+# run from the project directory after make:
+#   bench/election.sh [runs per mode]
+
+runs=${1:-3}
+. bench/common.sh
+
+printf "%-16s %-8s %-6s %s\n" leader_election servers runs new_leader_ms
+for mode in master cluster; do
+    for n in 3 5; do
+        printf "leader_election %s" "$mode" > "$tmp/options"
+        total=0
+        done_runs=0
+        r=0
+        while [ $r -lt "$runs" ]; do
+            bench_test "$n" 1 "config/ports-file$n" 1
+            printf "\ncrashServer 0\nsendMessage 0 after\nallClear" >> "$tmp/test"
+            bench_run
+            ms=$(sed -n "s/^M  : New primary S[0-9]* .*ready in \([0-9]*\) ms.*/\1/p" "$tmp/log" | tail -1)
+            if [ -n "$ms" ]; then
+                total=$((total + ms))
+                done_runs=$((done_runs + 1))
+            fi
+            r=$((r + 1))
+        done
+        [ "$done_runs" -gt 0 ] && total=$((total / done_runs))
+        printf "%-16s %-8s %-6s %s\n" "$mode" "$n" "$done_runs" "$total"
+    done
+done
@@ -0,0 +1,69 @@
+/**
+ * throughput of the Reed-Solomon codec which fragments chats for the
+ * acceptors (see erasure.h), for chats of 1 KB to 1 MB and a few (k, m).
+ * Each chat is encoded, then decoded from the data fragments alone (the
+ * fast path, a copy) and from the last k fragments, with as many data
+ * fragments lost as there are parity ones. Every decode is checked against
+ * the chat. MB/s are of chat bytes, and fragments/chat is the bytes of
+ * all k + m fragments over the bytes of the chat.
+ * build and run from the project directory:
+ *   make erasure-bench && bench/erasure-bench [MB per run]
+ */
+#include "erasure.h"
+#include "utilities.h"
+#include "iostream"
+#include "cstdio"
+#include "cstdlib"
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    long total = (argc > 1 ? atol(argv[1]) : 64) * 1024 * 1024;
+    int codes[][2] = { {2, 1}, {3, 2}, {4, 3}, {8, 4} };
+    size_t sizes[] = { 1024, 16 * 1024, 64 * 1024, 1024 * 1024 };
+
+    srand(1);
+    printf("%-4s %-4s %-8s %-12s %-17s %-16s %s\n", "k", "m", "size",
+           "encode_MB/s", "decode_data_MB/s", "decode_lost_MB/s", "fragments/chat");
+    for (auto &code : codes) {
+        int k = code[0], m = code[1];
+        ReedSolomon rs(k, m);
+        for (auto size : sizes) {
+            string chat(size, '\0');
+            for (auto &c : chat)
+                c = (char)(rand() & 0xff);
+            long runs = max(total / (long)size, 1L);
+
+            vector<string> fragments;
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            for (long r = 0; r < runs; r++)
+                rs.Encode(chat, fragments);
+            double encode = (double)size * runs / ElapsedSince(start);
+
+            map<int, string> data_fragments, last_fragments;
+            for (int i = 0; i < k; i++)
+                data_fragments[i] = fragments[i];
+            for (int i = m; i < k + m; i++)
+                last_fragments[i] = fragments[i];
+
+            double decode[2];
+            map<int, string> *given[2] = { &data_fragments, &last_fragments };
+            for (int g = 0; g < 2; g++) {
+                string data;
+                gettimeofday(&start, NULL);
+                for (long r = 0; r < runs; r++) {
+                    if (!rs.Decode(*given[g], size, data) || data != chat) {
+                        printf("ERROR: decode failed for k=%d m=%d size=%zu\n", k, m, size);
+                        return 1;
+                    }
+                }
+                decode[g] = (double)size * runs / ElapsedSince(start);
+            }
+
+            printf("%-4d %-4d %-8zu %-12.0f %-17.0f %-16.0f %.2f\n", k, m, size,
+                   encode, decode[0], decode[1], (double)fragments[0].size() * (k + m) / size);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# bytes sent by the leader's server per chat, the P2A bytes each acceptor
+# got per chat, and commit latency on 7 servers, with whole chats in P2A
+# and with erasure coding into 7 fragments, any 3 or 5 of which rebuild a
+# chat (erasure_k), for chats of 1 KB to 64 KB from a single client.
+# copies is bytes per commit over chat size. It includes the PROPOSE, the
+# RESPONSE to the client, the decisions to every replica, which carry the
+# whole chat in every mode, and the decisions exchanged on allClear at the
+# end. The codec alone is measured by bench/erasure-bench.
+# run from the project directory after make:
+#   bench/erasure.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-6s %-4s %-8s %-17s %-7s %-14s %s\n" size k commits bytes_per_commit copies p2a_per_chat commit_latency_us
+for size in 1024 8192 65536; do
+    chat=$(head -c "$size" /dev/zero | tr '\0' x)
+    for k in 0 3 5; do
+        printf "erasure_k %s" "$k" > "$tmp/options"
+        bench_test 7 1 config/ports-file7 "$chats" "$chat"
+        bench_run
+        summary=$(server_summary 0)
+        commits=$(summary_value "$summary" commits)
+        bytes=$(summary_value "$summary" bytes_sent)
+        # the P2A the commander of slot 0 sent to acceptor S1
+        p2a=$(grep -m 1 "^SC0: P2A message sent to acceptor S1: " "$tmp/log" \
+              | sed 's/^SC0: P2A message sent to acceptor S1: //' | tr -d '\n' | wc -c)
+        per_commit=0
+        [ "${commits:-0}" -gt 0 ] && per_commit=$((bytes / commits))
+        printf "%-6s %-4s %-8s %-17s %-7s %-14s %s\n" "$size" "$k" "$commits" "$per_commit" \
+            $((per_commit / size)) "$p2a" "$(summary_value "$summary" commit_latency_us)"
+    done
+done
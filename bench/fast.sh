@@ -0,0 +1,32 @@
+#!/bin/sh
+# commit latency seen by clients on 3 servers, with chats going through the
+# primary and straight to the acceptors (fast_paxos). Chats are sent one at
+# a time, so fast slots do not collide.
+# run from the project directory after make:
+#   bench/fast.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-11s %-8s %-13s %-11s %s\n" fast_paxos commits fast_commits collisions commit_latency_us
+for mode in off on; do
+    printf "fast_paxos %s" "$mode" > "$tmp/options"
+    bench_test 3 3 config/ports-file3 "$chats"
+    printf "\nprintChatLog 0\nprintChatLog 1\nprintChatLog 2" >> "$tmp/test"
+    bench_run
+    # clients print their summary with their chat log, the primary S0 on allClear
+    commits=0
+    total=0
+    for c in 0 1 2; do
+        summary=$(grep "^C$c : messages_sent" "$tmp/log" | tail -1)
+        n=$(summary_value "$summary" commits)
+        latency=$(summary_value "$summary" commit_latency_us)
+        commits=$((commits + ${n:-0}))
+        total=$((total + ${n:-0} * ${latency:-0}))
+    done
+    summary=$(server_summary 0)
+    fast=$(summary_value "$summary" fast_commits)
+    collisions=$(summary_value "$summary" collisions)
+    [ "$commits" -gt 0 ] && total=$((total / commits))
+    printf "%-11s %-8s %-13s %-11s %s\n" "$mode" "$commits" "$fast" "$collisions" "$total"
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# commit latency seen by clients on 3 servers, with replicas learning
+# decisions from commanders and straight from the acceptors
+# (distributed_learning). Chats are sent one at a time.
+# run from the project directory after make:
+#   bench/learning.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-21s %-8s %-14s %s\n" distributed_learning commits messages_sent commit_latency_us
+for mode in off on; do
+    printf "distributed_learning %s" "$mode" > "$tmp/options"
+    bench_test 3 3 config/ports-file3 "$chats"
+    printf "\nprintChatLog 0\nprintChatLog 1\nprintChatLog 2" >> "$tmp/test"
+    bench_run
+    # clients print their summary with their chat log, servers on allClear
+    commits=0
+    total=0
+    for c in 0 1 2; do
+        summary=$(grep "^C$c : messages_sent" "$tmp/log" | tail -1)
+        n=$(summary_value "$summary" commits)
+        latency=$(summary_value "$summary" commit_latency_us)
+        commits=$((commits + ${n:-0}))
+        total=$((total + ${n:-0} * ${latency:-0}))
+    done
+    sent=0
+    for s in 0 1 2; do
+        n=$(grep "^S$s : messages_sent" "$tmp/log" | tail -1 | sed -n 's/.*messages_sent=\([0-9]*\).*/\1/p')
+        sent=$((sent + ${n:-0}))
+    done
+    [ "$commits" -gt 0 ] && total=$((total / commits))
+    printf "%-21s %-8s %-14s %s\n" "$mode" "$commits" "$sent" "$total"
+done
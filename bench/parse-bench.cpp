@@ -0,0 +1,166 @@
+/**
+ * per message cost of parsing the hot messages, P2A at acceptors, P2B at
+ * commanders and DECISION at replicas, the way the receive loops did it
+ * (split() through a stringstream into strings, then stringToTriple() and
+ * the like, which split again) against SplitView() and the view parsers.
+ * A message is extracted, tokenized and parsed into the values its handler
+ * takes. Allocations are counted through operator new. Every parse is
+ * checked against the values the message was made from.
+ * build and run from the project directory:
+ *   make parse-bench && bench/parse-bench [runs]
+ */
+#include "utilities.h"
+#include "cstdio"
+#include "cstdlib"
+#include "new"
+using namespace std;
+
+static long long allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+/**
+ * split() as it was, through a stringstream
+ */
+static vector<string> StreamSplit(const string &s, char delim)
+{
+    vector<string> elems;
+    if (s == "")
+        return elems;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, delim))
+        elems.push_back(item);
+    return elems;
+}
+
+static Ballot StreamToBallot(const string &s)
+{
+    vector<string> parts = StreamSplit(s, kInternalStructDelim[0]);
+    Ballot b;
+    b.id = stoi(parts[0]);
+    b.seq_num = stoi(parts[1]);
+    return b;
+}
+
+static Proposal StreamToProposal(const string &s)
+{
+    vector<string> parts = StreamSplit(s, kInternalStructDelim[0]);
+    return Proposal(parts[0], parts[1], parts[2]);
+}
+
+static Triple StreamToTriple(const string &s)
+{
+    vector<string> parts = StreamSplit(s, kInternalStructDelim[0]);
+    return Triple(Ballot(stoi(parts[0]), stoi(parts[1])), stoi(parts[2]),
+                  Proposal(parts[3], parts[4], parts[5]));
+}
+
+// what the handlers of the three messages take
+struct Parsed {
+    int fd_or_slot;
+    Triple t;
+    Ballot b;
+    Proposal p;
+    int skip_to;
+    int stride;
+};
+
+static void StreamParse(const string &type, const string &msg, Parsed &out)
+{
+    vector<string> token = StreamSplit(msg, kInternalDelim[0]);
+    if (token[0] != type)
+        return;
+    if (type == kP2a) {
+        out.fd_or_slot = stoi(token[1]);
+        out.t = StreamToTriple(token[2]);
+        out.skip_to = (token.size() == 5) ? stoi(token[3]) : -1;
+    } else if (type == kP2b) {
+        out.fd_or_slot = stoi(token[1]);
+        out.b = StreamToBallot(token[2]);
+    } else {
+        out.fd_or_slot = stoi(token[1]);
+        out.p = StreamToProposal(token[2]);
+        out.skip_to = (token.size() == 5) ? stoi(token[3]) : -1;
+    }
+}
+
+static void ViewParse(const string &type, const string &msg, vector<StringView> &view, Parsed &out)
+{
+    SplitView(msg, kInternalDelim[0], view);
+    if (view[0] != type)
+        return;
+    if (type == kP2a) {
+        out.fd_or_slot = viewToInt(view[1]);
+        out.t = viewToTriple(view[2]);
+        out.skip_to = (view.size() == 5) ? viewToInt(view[3]) : -1;
+    } else if (type == kP2b) {
+        out.fd_or_slot = viewToInt(view[1]);
+        out.b = viewToBallot(view[2]);
+    } else {
+        out.fd_or_slot = viewToInt(view[1]);
+        out.p = viewToProposal(view[2]);
+        out.skip_to = (view.size() == 5) ? viewToInt(view[3]) : -1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? atol(argv[1]) : 500000;
+    Proposal chat("2", "1417", "a chat of a typical length, some forty bytes");
+    Triple t(Ballot(1, 35), 52817, chat);
+    string messages[][2] = {
+        { kP2a, kP2a + kInternalDelim + "7" + kInternalDelim + tripleToString(t) },
+        { kP2b, kP2b + kInternalDelim + "1" + kInternalDelim + ballotToString(t.b) },
+        { kDecision, kDecision + kInternalDelim + to_string(t.s) + kInternalDelim
+                     + proposalToString(chat) },
+    };
+
+    printf("%-10s %-12s %-12s %-9s %-14s %s\n", "message", "split_ns", "view_ns",
+           "speedup", "split_allocs", "view_allocs");
+    for (auto &m : messages) {
+        const string &type = m[0], &msg = m[1];
+        Parsed parsed[2];
+        vector<StringView> view;
+        ViewParse(type, msg, view, parsed[1]);      // the view vector's one allocation
+
+        double time[2];
+        long long allocs[2];
+        struct timeval start;
+        for (int way = 0; way < 2; way++) {
+            long long allocations_before = allocations;
+            gettimeofday(&start, NULL);
+            for (long r = 0; r < runs; r++) {
+                if (way == 0)
+                    StreamParse(type, msg, parsed[0]);
+                else
+                    ViewParse(type, msg, view, parsed[1]);
+            }
+            time[way] = 1000.0 * ElapsedSince(start) / runs;
+            allocs[way] = allocations - allocations_before;
+        }
+
+        bool ok = (type == kP2a) ? parsed[0].t == t && parsed[1].t == t
+                  : (type == kP2b) ? parsed[0].b == t.b && parsed[1].b == t.b
+                  : parsed[0].p == chat && parsed[1].p == chat;
+        if (!ok || parsed[0].fd_or_slot != parsed[1].fd_or_slot) {
+            printf("ERROR: parse failed for %s\n", msg.c_str());
+            return 1;
+        }
+        printf("%-10s %-12.0f %-12.0f %-9.1f %-14.1f %.1f\n", type.c_str(), time[0], time[1],
+               time[0] / time[1], (double)allocs[0] / runs, (double)allocs[1] / runs);
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# commit latency of a steady leader for different phase 1 / phase 2 quorum
+# splits, on 5 and 7 servers. Each split is safe: q1 + q2 > n.
+# run from the project directory after make:
+#   bench/quorums.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-3s %-3s %-3s %-8s %s\n" n q1 q2 commits commit_latency_us
+for run in "5 3 3" "5 4 2" "5 5 1" "7 4 4" "7 5 3" "7 6 2" "7 7 1"; do
+    set -- $run
+    n=$1; q1=$2; q2=$3
+
+    printf "phase1_quorum %s\nphase2_quorum %s" "$q1" "$q2" > "$tmp/options"
+    bench_test "$n" "$n" "config/ports-file$n" "$chats"
+    bench_run
+    summary=$(server_summary 0)
+    printf "%-3s %-3s %-3s %-8s %s\n" "$n" "$q1" "$q2" "$(summary_value "$summary" commits)" \
+        "$(summary_value "$summary" commit_latency_us)"
+done
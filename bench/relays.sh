@@ -0,0 +1,40 @@
+#!/bin/sh
+# work on the leader's server per commit with 15 and 25 acceptors, with
+# P2A sent to every acceptor and through vote relays of 5 acceptors each
+# (vote_relay_group), for chats from a single client. connects and votes
+# are the connections commanders opened to acceptors and the P2B or VOTES
+# messages they received, per commit
+# run from the project directory after make:
+#   bench/relays.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-8s %-7s %-8s %-9s %-6s %-17s %s\n" servers group commits connects votes bytes_per_commit commit_latency_us
+for n in 15 25; do
+    # a ports file for n servers and 1 client
+    printf "55555\n44000\n55000\n" > "$tmp/ports"
+    i=0
+    while [ $i -lt "$n" ]; do
+        for base in 11000 12000 13000 14000 15000 16000 17000 18000 19000; do
+            echo $((base + i)) >> "$tmp/ports"
+        done
+        i=$((i + 1))
+    done
+    for group in 0 5; do
+        printf "vote_relay_group %s" "$group" > "$tmp/options"
+        bench_test "$n" 1 "$tmp/ports" "$chats"
+        bench_run
+        summary=$(server_summary 0)
+        commits=$(summary_value "$summary" commits)
+        if [ "${commits:-0}" -gt 0 ]; then
+            printf "%-8s %-7s %-8s %-9s %-6s %-17s %s\n" "$n" "$group" "$commits" \
+                $(($(summary_value "$summary" acceptor_connects) / commits)) \
+                $(($(summary_value "$summary" vote_messages) / commits)) \
+                $(($(summary_value "$summary" bytes_sent) / commits)) \
+                "$(summary_value "$summary" commit_latency_us)"
+        else
+            printf "%-8s %-7s %-8s\n" "$n" "$group" 0
+        fi
+    done
+done
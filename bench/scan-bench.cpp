@@ -0,0 +1,121 @@
+/**
+ * throughput of finding the field delimiters of 1 MB bulk payloads: the
+ * pvalues of a P1B (slot.ballot.client.chat.msg triples joined by ',') and
+ * a CHATLOG (slot.client.msg joined by ','). '.' and ',' are found together
+ * in one pass by each kernel of ScanDelimiters() the CPU supports, and one
+ * at a time through std::getline and memchr(), the way split() went before
+ * and goes now. found is the fields for those two, and the delimiters for
+ * the kernels. Every kernel is checked against the scalar one.
+ * build and run from the project directory:
+ *   make scan-bench && bench/scan-bench [runs]
+ */
+#include "scan.h"
+#include "utilities.h"
+#include "cstdio"
+#include "cstdlib"
+#include "cstring"
+using namespace std;
+
+/**
+ * the tokens of s at ',' and then each at '.', through std::getline
+ * @return number of fields
+ */
+static size_t GetlineFields(const string &s)
+{
+    size_t fields = 0;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, kInternalSetDelim[0])) {
+        stringstream fs(item);
+        string field;
+        while (getline(fs, field, kInternalStructDelim[0]))
+            fields++;
+    }
+    return fields;
+}
+
+/**
+ * the same through memchr(), one delimiter after the other
+ */
+static size_t MemchrFields(const string &s)
+{
+    size_t fields = 0;
+    const char *p = s.data();
+    const char *end = p + s.size();
+    while (p < end) {
+        const char *item_end = (const char *)memchr(p, kInternalSetDelim[0], end - p);
+        if (item_end == NULL)
+            item_end = end;
+        while (p < item_end) {
+            const char *d = (const char *)memchr(p, kInternalStructDelim[0], item_end - p);
+            if (d == NULL)
+                d = item_end;
+            fields++;
+            p = d + 1;
+        }
+        p = item_end + 1;
+    }
+    return fields;
+}
+
+int main(int argc, char **argv)
+{
+    long runs = argc > 1 ? atol(argv[1]) : 50;
+    const size_t size = 1024 * 1024;
+    string delims = kInternalStructDelim + kInternalSetDelim;
+
+    string pvalues, chat_log;
+    for (int s = 0; pvalues.size() < size; s++) {
+        if (s > 0)
+            pvalues += kInternalSetDelim;
+        pvalues += tripleToString(Triple(Ballot(1, 4), s,
+                                         Proposal(to_string(s % 5), to_string(s / 5),
+                                                  "chat " + to_string(s))));
+    }
+    for (int s = 0; chat_log.size() < size; s++) {
+        if (s > 0)
+            chat_log += kInternalSetDelim;
+        chat_log += to_string(s) + kInternalStructDelim + to_string(s % 5)
+                    + kInternalStructDelim + "chat " + to_string(s);
+    }
+    pvalues.resize(size);
+    chat_log.resize(size);
+
+    ScanKernel best = BestScanKernel();
+    printf("best kernel: %s\n", ScanKernelName(best).c_str());
+    printf("%-10s %-10s %-10s %s\n", "payload", "way", "MB/s", "found");
+    string payloads[][2] = { { "P1B", pvalues }, { "CHATLOG", chat_log } };
+    for (auto &payload : payloads) {
+        const string &name = payload[0], &data = payload[1];
+        struct timeval start;
+        size_t fields = 0;
+
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            fields = GetlineFields(data);
+        printf("%-10s %-10s %-10.0f %zu\n", name.c_str(), "getline",
+               (double)size * runs / ElapsedSince(start), fields);
+        gettimeofday(&start, NULL);
+        for (long r = 0; r < runs; r++)
+            fields = MemchrFields(data);
+        printf("%-10s %-10s %-10.0f %zu\n", name.c_str(), "memchr",
+               (double)size * runs / ElapsedSince(start), fields);
+
+        vector<size_t> expected, offsets;
+        ScanDelimitersWith(SCAN_SCALAR, data.data(), size, delims, expected);
+        for (int kernel = SCAN_SCALAR; kernel <= best; kernel++) {
+            gettimeofday(&start, NULL);
+            for (long r = 0; r < runs; r++)
+                ScanDelimitersWith((ScanKernel)kernel, data.data(), size, delims, offsets);
+            double rate = (double)size * runs / ElapsedSince(start);
+            if (offsets != expected) {
+                printf("ERROR: %s kernel disagrees with scalar\n",
+                       ScanKernelName((ScanKernel)kernel).c_str());
+                return 1;
+            }
+            printf("%-10s %-10s %-10.0f %zu\n", name.c_str(),
+                   ScanKernelName((ScanKernel)kernel).c_str(), rate, offsets.size());
+        }
+    }
+    return 0;
+}
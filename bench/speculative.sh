@@ -0,0 +1,38 @@
+#!/bin/sh
+# time seen by clients on 3 servers from sending a chat till the first
+# answer for it: the decision, or with speculative on the TENTATIVE sent
+# once the primary's acceptor accepted it. Chats are sent one at a time.
+# run from the project directory after make:
+#   bench/speculative.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-12s %-8s %-10s %-10s %-18s %s\n" speculative commits tentative rollbacks commit_latency_us answer_latency_us
+for mode in off on; do
+    printf "speculative %s" "$mode" > "$tmp/options"
+    bench_test 3 3 config/ports-file3 "$chats"
+    printf "\nprintChatLog 0\nprintChatLog 1\nprintChatLog 2" >> "$tmp/test"
+    bench_run
+    # clients print their summary with their chat log, the primary S0 on allClear
+    commits=0
+    total=0
+    answers=0
+    for c in 0 1 2; do
+        summary=$(grep "^C$c : messages_sent" "$tmp/log" | tail -1)
+        n=$(summary_value "$summary" commits)
+        latency=$(summary_value "$summary" commit_latency_us)
+        answer=$(summary_value "$summary" answer_latency_us)
+        commits=$((commits + ${n:-0}))
+        total=$((total + ${n:-0} * ${latency:-0}))
+        answers=$((answers + ${n:-0} * ${answer:-0}))
+    done
+    summary=$(server_summary 0)
+    tentative=$(summary_value "$summary" tentative)
+    rollbacks=$(summary_value "$summary" rollbacks)
+    if [ "$commits" -gt 0 ]; then
+        total=$((total / commits))
+        answers=$((answers / commits))
+    fi
+    printf "%-12s %-8s %-10s %-10s %-18s %s\n" "$mode" "$commits" "$tentative" "$rollbacks" "$total" "$answers"
+done
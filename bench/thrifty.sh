@@ -0,0 +1,18 @@
+#!/bin/sh
+# P2A messages and commit latency of a steady leader on 5 servers, with
+# commanders sending P2A to every acceptor and to the fastest majority only.
+# run from the project directory after make:
+#   bench/thrifty.sh [chats per run]
+
+chats=${1:-10}
+. bench/common.sh
+
+printf "%-12s %-8s %-9s %s\n" thrifty_p2a commits p2a_sent commit_latency_us
+for mode in off on; do
+    printf "thrifty_p2a %s" "$mode" > "$tmp/options"
+    bench_test 5 5 config/ports-file5 "$chats"
+    bench_run
+    summary=$(server_summary 0)
+    printf "%-12s %-8s %-9s %s\n" "$mode" "$(summary_value "$summary" commits)" \
+        "$(summary_value "$summary" p2a_sent)" "$(summary_value "$summary" commit_latency_us)"
+done
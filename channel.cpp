@@ -0,0 +1,457 @@
+#include "channel.h"
+#include "constants.h"
+#include "metrics.h"
+#include "compression.h"
+#include "scan.h"
+#include "iostream"
+#include "unistd.h"
+#include "limits.h"
+#include "sys/uio.h"
+#include "sys/socket.h"
+#include "sys/time.h"
+#include "poll.h"
+#include "errno.h"
+#include "string.h"
+#include "algorithm"
+#include "fcntl.h"
+using namespace std;
+
+#define DEBUG
+
+#ifdef DEBUG
+#  define D(x) x
+#else
+#  define D(x)
+#endif // DEBUG
+
+// message types which go compressed, lists of decisions or pvalues
+static const string kBulkTypes[] = { kAllDecisions, kP1b, kAdopted };
+
+/**
+ * @return CPU time used by the calling thread so far, in nanosec
+ */
+static long long ThreadCpuTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (long long)t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
+}
+
+/**
+ * @return type of msg, the text before its first kInternalDelim
+ */
+static string MessageType(const string &msg) {
+    return msg.substr(0, msg.find_first_of(kInternalDelim + kMessageDelim));
+}
+
+/**
+ * @param  msg       message, ending with kMessageDelim
+ * @param  min_bytes shortest message to be compressed, 0 for none
+ * @return           msg as a compressed frame, if it is a bulk message of
+ *                   min_bytes or more which compression makes shorter, msg
+ *                   itself otherwise
+ */
+static string CompressFrame(const string &msg, const size_t min_bytes) {
+    if (min_bytes == 0 || msg.size() < min_bytes || msg[msg.size() - 1] != kMessageDelim[0])
+        return msg;
+    string type = MessageType(msg);
+    if (find(begin(kBulkTypes), end(kBulkTypes), type) == end(kBulkTypes))
+        return msg;
+
+    long long start = ThreadCpuTime();
+    string raw = msg.substr(0, msg.size() - 1);
+    string block = LzCompress(raw);
+    string frame = kCompressedFrame + to_string(raw.size()) + kInternalStructDelim
+                   + to_string(block.size()) + kInternalStructDelim + block;
+    if (frame.size() >= msg.size())
+        return msg;
+    Metrics::AddCompression(type, msg.size(), frame.size(), ThreadCpuTime() - start);
+    return frame;
+}
+
+Outbox::Outbox() {
+    Configure(kOutboxMaxBytes, BACKPRESSURE, 0);
+}
+
+/**
+ * sets the bound on bytes queued per fd, and what happens beyond it
+ * @param max_bytes          max bytes queued for one fd
+ * @param policy             policy applied when a queue would exceed max_bytes
+ * @param compress_min_bytes shortest bulk message sent compressed, 0 for none
+ */
+void Outbox::Configure(const size_t max_bytes, const OverflowPolicy policy,
+                       const size_t compress_min_bytes) {
+    max_bytes_ = max_bytes;
+    policy_ = policy;
+    compress_min_bytes_ = compress_min_bytes;
+}
+
+/**
+ * queues a message for an fd. It is sent on the next Flush()
+ * @param  fd  fd to which message is to be sent
+ * @param  msg message to be sent
+ * @return     false if the message was not queued because the fd's queue
+ *             overflowed (DROP_AND_RESYNC or DISCONNECT policy)
+ */
+bool Outbox::Enqueue(const int fd, const string &msg) {
+    if (fd == -1)
+        return false;
+
+    PeerQueue &q = queue_[fd];
+    if (q.failed)
+        return false;
+
+    const string &frame = Frame(msg);
+    // a single message larger than the bound is still let through
+    if (!q.msgs.empty() && q.bytes + frame.size() > max_bytes_) {
+        if (policy_ == DROP_AND_RESYNC) {
+            D(cout << "Outbox: dropping " << q.bytes << " queued bytes for fd "
+              << fd << ", peer needs resync" << endl;)
+            // a partially sent message must be completed to keep the stream intact
+            size_t keep = (q.offset > 0) ? 1 : 0;
+            while (q.msgs.size() > keep) {
+                q.bytes -= q.msgs.back().size();
+                q.msgs.pop_back();
+            }
+            resync_.insert(fd);
+            return false;
+        } else if (policy_ == DISCONNECT) {
+            D(cout << "Outbox: queue overflow for fd " << fd << ", disconnecting" << endl;)
+            q.failed = true;
+            return false;
+        }
+        // BACKPRESSURE: keep queueing. Congested() tells the owner to
+        // stop admitting new work until the queue drains
+    }
+
+    q.msgs.push_back(frame);
+    q.bytes += frame.size();
+    return true;
+}
+
+/**
+ * @param  msg message to be queued
+ * @return     msg as it goes out, compressed or not. The same bulk message
+ *             is often queued for several fds in a row, and is compressed
+ *             for the first one only
+ */
+const string& Outbox::Frame(const string &msg) {
+    if (compress_min_bytes_ == 0 || msg.size() < compress_min_bytes_)
+        return msg;
+    if (msg != last_bulk_) {
+        last_bulk_ = msg;
+        last_frame_ = CompressFrame(msg, compress_min_bytes_);
+    }
+    return last_frame_;
+}
+
+/**
+ * drops all messages queued for an fd, typically because it was closed
+ * @param fd fd whose messages are to be dropped
+ */
+void Outbox::Discard(const int fd) {
+    queue_.erase(fd);
+    resync_.erase(fd);
+}
+
+/**
+ * @return true if no message is queued
+ */
+bool Outbox::Empty() {
+    return queue_.empty();
+}
+
+/**
+ * @return true if, under BACKPRESSURE policy, some fd has more than
+ *         max bytes queued
+ */
+bool Outbox::Congested() {
+    if (policy_ != BACKPRESSURE)
+        return false;
+    for (auto &q : queue_) {
+        if (q.second.bytes > max_bytes_)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * hands out the fds which dropped messages since the last call,
+ * and whose queues have drained since
+ * @param fds [out] fds whose peers need to be resynced
+ */
+void Outbox::TakeResyncFds(vector<int> &fds) {
+    fds.clear();
+    for (auto it = resync_.begin(); it != resync_.end(); ) {
+        if (queue_.find(*it) == queue_.end()) {
+            fds.push_back(*it);
+            resync_.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+/**
+ * adds the fds which still have queued bytes to a select() write set,
+ * so that the owner wakes up as soon as they can take more
+ * @param write_set [in/out] write set for select()
+ * @param fd_max    [in/out] max fd in all sets for select()
+ */
+void Outbox::FillWriteSet(fd_set &write_set, int &fd_max) {
+    for (auto &q : queue_) {
+        FD_SET(q.first, &write_set);
+        fd_max = max(fd_max, q.first);
+    }
+}
+
+/**
+ * writes out as much of one fd's queue as the socket takes without blocking
+ * @param  fd fd to write to
+ * @param  q  queue of fd
+ * @return    false if the fd returned an error
+ */
+bool Outbox::FlushFd(const int fd, PeerQueue &q) {
+    while (!q.msgs.empty()) {
+        struct iovec iov[IOV_MAX];
+        int count = 0;
+        size_t total = 0;
+        for (auto it = q.msgs.begin(); it != q.msgs.end() && count < IOV_MAX; it++, count++) {
+            size_t skip = (count == 0) ? q.offset : 0;
+            iov[count].iov_base = (void*)(it->data() + skip);
+            iov[count].iov_len = it->size() - skip;
+            total += iov[count].iov_len;
+        }
+
+        struct msghdr mh;
+        memset(&mh, 0, sizeof mh);
+        mh.msg_iov = iov;
+        mh.msg_iovlen = count;
+        ssize_t written = sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return true;    // socket buffer full. retry on next flush
+            return false;
+        }
+
+        // pop the messages which went out completely
+        size_t left = written;
+        int completed = 0;
+        while (!q.msgs.empty() && left >= q.msgs.front().size() - q.offset) {
+            left -= q.msgs.front().size() - q.offset;
+            q.bytes -= q.msgs.front().size();
+            q.msgs.pop_front();
+            q.offset = 0;
+            completed++;
+        }
+        q.offset += left;
+        Metrics::AddSend(completed, written);
+
+        if ((size_t)written < total)
+            return true;    // socket buffer full. rest goes on next flush
+    }
+    return true;
+}
+
+/**
+ * sends queued messages without blocking, at most one sendmsg per fd
+ * unless more than IOV_MAX messages are queued for it.
+ * unsent bytes stay queued for the next flush
+ * @param failed_fds [out] fds for which sending failed or which overflowed
+ *                   under DISCONNECT policy. Their queues are dropped
+ */
+void Outbox::Flush(vector<int> &failed_fds) {
+    failed_fds.clear();
+    for (auto it = queue_.begin(); it != queue_.end(); ) {
+        PeerQueue &q = it->second;
+        if (q.failed || !FlushFd(it->first, q)) {
+            D(cout << "ERROR: Cannot flush " << q.msgs.size()
+              << " message(s) to fd " << it->first << endl;)
+            failed_fds.push_back(it->first);
+            resync_.erase(it->first);
+            queue_.erase(it++);
+        } else if (q.msgs.empty()) {
+            queue_.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+/**
+ * sends queued messages, ignoring send failures.
+ * used where a failed connection is detected later by recv() anyway
+ */
+void Outbox::Flush() {
+    vector<int> failed_fds;
+    Flush(failed_fds);
+}
+
+/**
+ * flushes repeatedly until every queue is empty or timeout expires.
+ * used by owners which are about to go away, like a commander
+ * @param timeout    max time to wait for slow peers, in microseconds
+ * @param failed_fds [out] fds for which sending failed
+ */
+void Outbox::Drain(const time_t timeout, vector<int> &failed_fds) {
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    vector<int> failed;
+    failed_fds.clear();
+    while (true) {
+        Flush(failed);
+        failed_fds.insert(failed_fds.end(), failed.begin(), failed.end());
+        if (Empty())
+            return;
+
+        gettimeofday(&now, NULL);
+        time_t elapsed = (now.tv_sec - start.tv_sec) * 1000 * 1000
+                         + (now.tv_usec - start.tv_usec);
+        if (elapsed >= timeout)
+            return;
+
+        vector<struct pollfd> pfds;
+        for (auto &q : queue_) {
+            struct pollfd p;
+            p.fd = q.first;
+            p.events = POLLOUT;
+            p.revents = 0;
+            pfds.push_back(p);
+        }
+        poll(&pfds[0], pfds.size(), (timeout - elapsed) / 1000 + 1);
+    }
+}
+
+/**
+ * appends received bytes to the buffer of fd and extracts complete messages.
+ * they are copied back to back into one buffer, reused by every call, and
+ * handed out as views of it, which stay valid till the next Extract()
+ * @param fd        fd on which bytes were received
+ * @param buf       received bytes
+ * @param num_bytes number of bytes in buf
+ * @param messages  [out] complete messages, without kMessageDelim
+ */
+void Inbox::Extract(const int fd, const char *buf, const int num_bytes,
+                    vector<StringView> &messages) {
+    messages.clear();
+    batch_.clear();
+    ends_.clear();
+    string &data = partial_[fd];
+    data.append(buf, num_bytes);
+
+    // every kMessageDelim of the new bytes in one pass. What was kept from
+    // earlier has none, but inside a compressed frame, which is skipped
+    // along with the frame
+    size_t scanned = data.size() - num_bytes;
+    ScanDelimiters(data.data() + scanned, num_bytes, kMessageDelim, delims_);
+    size_t next = 0;
+    size_t start = 0;
+    size_t end;
+    while (start < data.size()) {
+        if (data[start] == kCompressedFrame[0]) {
+            if (!ExtractCompressed(data, start))
+                break;
+            continue;
+        }
+        while (next < delims_.size() && scanned + delims_[next] < start)
+            next++;
+        if (next == delims_.size())
+            break;
+        end = scanned + delims_[next];
+        if (end > start) {
+            batch_.append(data, start, end - start);
+            ends_.push_back(batch_.size());
+        }
+        start = end + 1;
+    }
+    data.erase(0, start);
+
+    size_t from = 0;
+    for (auto e : ends_) {
+        messages.push_back(StringView(batch_.data() + from, e - from));
+        from = e;
+    }
+}
+
+/**
+ * Extract() into copies, for loops which keep messages past the next one
+ */
+void Inbox::Extract(const int fd, const char *buf, const int num_bytes,
+                    vector<string> &messages) {
+    vector<StringView> views;
+    Extract(fd, buf, num_bytes, views);
+    messages = ViewsToStrings(views);
+}
+
+/**
+ * takes the compressed frame at start of data, if all of it has arrived
+ * @param  data     received bytes
+ * @param  start    [in/out] start of the frame, moved past it
+ * @return          false if the frame is not complete yet
+ */
+bool Inbox::ExtractCompressed(const string &data, size_t &start) {
+    size_t size_end = data.find(kInternalStructDelim[0], start);
+    if (size_end == string::npos)
+        return false;
+    size_t block_end = data.find(kInternalStructDelim[0], size_end + 1);
+    if (block_end == string::npos)
+        return false;
+    size_t size = strtoul(data.c_str() + start + 1, NULL, 10);
+    size_t block_size = strtoul(data.c_str() + size_end + 1, NULL, 10);
+    if (data.size() - (block_end + 1) < block_size)
+        return false;
+
+    long long cpu_start = ThreadCpuTime();
+    string msg;
+    if (LzDecompress(data.substr(block_end + 1, block_size), size, msg)) {
+        Metrics::AddDecompression(MessageType(msg), ThreadCpuTime() - cpu_start);
+        batch_ += msg;
+        ends_.push_back(batch_.size());
+    } else {
+        D(cout << "Inbox: ERROR dropping a compressed frame which does not decompress" << endl;)
+    }
+    start = block_end + 1 + block_size;
+    return true;
+}
+
+/**
+ * forgets any partial message of an fd, typically because it was closed
+ * @param fd fd to be reset
+ */
+void Inbox::Reset(const int fd) {
+    partial_.erase(fd);
+}
+
+Wakeup::Wakeup() {
+    if (pipe(pipe_fd_) == -1) {
+        D(cout << "ERROR: Cannot create wakeup pipe" << endl;)
+        pipe_fd_[0] = pipe_fd_[1] = -1;
+        return;
+    }
+    fcntl(pipe_fd_[0], F_SETFL, O_NONBLOCK);
+    fcntl(pipe_fd_[1], F_SETFL, O_NONBLOCK);
+}
+
+/**
+ * wakes up the thread waiting on get_fd(). A full pipe already does
+ */
+void Wakeup::Notify() {
+    char c = 0;
+    if (write(pipe_fd_[1], &c, 1) == -1) {
+        // EAGAIN: the pipe is full, and the fd readable anyway
+    }
+}
+
+/**
+ * consumes all pending notifications
+ */
+void Wakeup::Clear() {
+    char buf[64];
+    while (read(pipe_fd_[0], buf, sizeof buf) > 0) { }
+}
+
+/**
+ * @return fd to be added to a select() read set
+ */
+int Wakeup::get_fd() {
+    return pipe_fd_[0];
+}
@@ -0,0 +1,102 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "string"
+#include "vector"
+#include "map"
+#include "set"
+#include "deque"
+#include "ctime"
+#include "sys/select.h"
+#include "options.h"
+#include "utilities.h"
+using namespace std;
+
+/**
+ * per-connection outbound queues.
+ * messages generated for the same fd during one turn of an event loop are
+ * queued, and written out together by Flush() with one sendmsg() per fd.
+ * sends never block: whatever the socket does not take stays queued for the
+ * next Flush(), and each queue is bounded by the configured overflow policy.
+ * Bulk messages (ALLDECISIONS, P1B, ADOPTED) of compress_min_bytes or more
+ * are queued as compressed frames, kCompressedFrame<size>.<block size>.<block>,
+ * when that is shorter. The length replaces kMessageDelim, which the block
+ * may contain
+ */
+class Outbox {
+public:
+    Outbox();
+    void Configure(const size_t max_bytes, const OverflowPolicy policy,
+                   const size_t compress_min_bytes);
+    bool Enqueue(const int fd, const string &msg);
+    void Flush(vector<int> &failed_fds);
+    void Flush();
+    void Drain(const time_t timeout, vector<int> &failed_fds);
+    void Discard(const int fd);
+    void TakeResyncFds(vector<int> &fds);
+    void FillWriteSet(fd_set &write_set, int &fd_max);
+    bool Empty();
+    bool Congested();
+
+private:
+    struct PeerQueue {
+        std::deque<string> msgs;
+        size_t offset;      // bytes of msgs.front() already sent
+        size_t bytes;       // bytes queued, excluding offset
+        bool failed;        // overflowed under DISCONNECT policy
+
+        PeerQueue() : offset(0), bytes(0), failed(false) { }
+    };
+
+    bool FlushFd(const int fd, PeerQueue &q);
+    const string& Frame(const string &msg);
+
+    std::map<int, PeerQueue> queue_;
+    std::set<int> resync_;
+    size_t max_bytes_;
+    OverflowPolicy policy_;
+    size_t compress_min_bytes_;
+    string last_bulk_;      // last message of compress_min_bytes or more queued
+    string last_frame_;     // and its frame
+};
+
+/**
+ * per-connection inbound buffers.
+ * bytes received on an fd are appended to that fd's buffer, and only complete
+ * (kMessageDelim terminated) messages are handed out. A trailing partial
+ * message is kept until the rest of it arrives in a later recv(). Compressed
+ * frames are handed out decompressed
+ */
+class Inbox {
+public:
+    void Extract(const int fd, const char *buf, const int num_bytes,
+                 vector<StringView> &messages);
+    void Extract(const int fd, const char *buf, const int num_bytes,
+                 vector<string> &messages);
+    void Reset(const int fd);
+
+private:
+    bool ExtractCompressed(const string &data, size_t &start);
+
+    std::map<int, string> partial_;
+    string batch_;              // messages of the last Extract(), back to back
+    vector<size_t> ends_;       // where each of them ends in batch_
+    vector<size_t> delims_;     // offsets of kMessageDelim in the bytes received last
+};
+
+/**
+ * self-pipe for waking up a thread blocked in select().
+ * the fd turns readable on Notify(), and stays so till Clear()
+ */
+class Wakeup {
+public:
+    Wakeup();
+    void Notify();
+    void Clear();
+    int get_fd();
+
+private:
+    int pipe_fd_[2];
+};
+
+#endif //CHANNEL_H_
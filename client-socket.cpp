@@ -232,6 +232,105 @@ bool Client::ConnectToPrimary() {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection. A server which
+    // is not the primary answers with the primary it knows of instead
+    string reply;
+    if (!ReceiveHandshake(sockfd, kReadyTimeout, reply) || reply != kReady) {
+        std::vector<string> token = split(reply, kInternalDelim[0]);
+        if (token.size() == 2 && token[0] == kRedirect)
+            set_redirect_id(stoi(token[1]));
+        close(sockfd);
+        return false;
+    }
     set_primary_fd(sockfd);
     return true;
-}
\ No newline at end of file
+}
+/**
+ * connects to the replica of a server for reading the chat log through it.
+ * the chat port is taken by the connection to the primary, so the read
+ * connection uses an ephemeral port, and READ messages name the client
+ * @param  server_id id of server to read through
+ * @return           true if connected, and the replica registered the connection
+ */
+bool Client::ConnectForReads(const int server_id) {
+    int sockfd = ConnectFromEphemeralPort(server_id);
+    if (sockfd == -1)
+        return false;
+    read_fd_ = sockfd;
+    read_server_id_ = server_id;
+    return true;
+}
+
+/**
+ * connects to the replica of the home server for sending chats to it,
+ * in the multi-leader mode. CHAT messages name the client, like READ
+ * @return true if connected, and the replica registered the connection
+ */
+bool Client::ConnectToHome() {
+    home_fd_ = ConnectFromEphemeralPort(get_home_id());
+    return home_fd_ != -1;
+}
+
+/**
+ * connects to the replica of a server from an ephemeral port
+ * @param  server_id id of server to connect to
+ * @return           fd of connection once the replica registered it, -1 if
+ *                   connection failed
+ */
+int Client::ConnectFromEphemeralPort(const int server_id) {
+    int sockfd = ConnectToPort(get_primary_listen_port(server_id));
+    if (sockfd == -1)
+        return -1;
+
+    string reply;
+    if (!ReceiveHandshake(sockfd, kReadyTimeout, reply) || reply != kReady) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * connects to a listen port of a server from an ephemeral port
+ * @param  port port to connect to
+ * @return      fd of connection, -1 if connection failed
+ */
+int Client::ConnectToPort(const int port) {
+    struct addrinfo hints, *servinfo, *l;
+    int sockfd = -1;
+    int rv;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE; // use my IP
+    if ((rv = getaddrinfo(NULL, std::to_string(port).c_str(),
+                          &hints, &servinfo)) != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+    // loop through all the results and connect to the first we can
+    for (l = servinfo; l != NULL; l = l->ai_next)
+    {
+        if ((sockfd = socket(l->ai_family, l->ai_socktype, l->ai_protocol)) == -1)
+            continue;
+        if (connect(sockfd, l->ai_addr, l->ai_addrlen) == -1) {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+        // the listen ports may lie in the ephemeral range, so connecting
+        // to a crashed server can end up connected to itself
+        struct sockaddr_storage local;
+        socklen_t len = sizeof local;
+        if (getsockname(sockfd, (struct sockaddr*)&local, &len) == 0
+                && ntohs(return_port_no((struct sockaddr *)&local)) == port) {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(servinfo); // all done with this structure
+    return sockfd;
+}
@@ -1,6 +1,7 @@
 #include "client.h"
 #include "utilities.h"
 #include "constants.h"
+#include "metrics.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -23,6 +24,8 @@ using namespace std;
 extern void* AcceptConnections(void* _C);
 
 pthread_mutex_t final_chat_log_lock;
+pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t chat_sent_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int Client::get_pid() {
     return pid_;
@@ -56,6 +59,14 @@ int Client::get_primary_id() {
     return primary_id_;
 }
 
+int Client::get_redirect_id() {
+    return redirect_id_;
+}
+
+const Options& Client::get_options() {
+    return options_;
+}
+
 void Client::set_pid(const int pid) {
     pid_ = pid;
 }
@@ -72,6 +83,10 @@ int Client::set_primary_id(const int primary_id) {
     primary_id_ = primary_id;
 }
 
+void Client::set_redirect_id(const int redirect_id) {
+    redirect_id_ = redirect_id;
+}
+
 /**
  * @return size of chat list
  */
@@ -80,13 +95,14 @@ int Client::set_primary_id(const int primary_id) {
 }
 /**
  * reads ports-file and populates port related vectors/maps
- * @return true is ports-file was read successfully
+ * @param  path path of ports-file passed on by master
+ * @return      true is ports-file was read successfully
  */
- bool Client::ReadPortsFile() {
+ bool Client::ReadPortsFile(const string &path) {
     ifstream fin;
     fin.exceptions ( ifstream::failbit | ifstream::badbit );
     try {
-        fin.open(kPortsFile.c_str());
+        fin.open(path.c_str());
         fin >> master_port_;
 
         int port;
@@ -105,7 +121,9 @@ int Client::set_primary_id(const int primary_id) {
             fin >> port >> port >> port;
             fin >> port;
             primary_listen_port_[i] = port;
-            fin >> port >> port >> port >> port >> port;
+            fin >> port;
+            acceptor_listen_port_[i] = port;
+            fin >> port >> port >> port >> port;
         }
 
         fin.close();
@@ -118,6 +136,21 @@ int Client::set_primary_id(const int primary_id) {
     }
 }
 
+/**
+ * reads the options file passed on by master, and configures the outbox
+ * @param  path path of options file
+ * @return      true if options were read successfully
+ */
+ bool Client::ReadOptions(const string &path) {
+    if (!ReadOptionsFile(path, options_)) {
+        D(cout << "C" << get_pid() << " : ERROR in reading options file " << path << endl;)
+        return false;
+    }
+    outbox_.Configure(options_.outbox_max_bytes, options_.overflow_policy,
+                      options_.compress_min_bytes);
+    return true;
+}
+
 /**
  * initialize data members and resize vectors
  * @param  pid process's self id
@@ -129,33 +162,170 @@ int Client::set_primary_id(const int primary_id) {
     const int num_clients) {
     set_pid(pid);
     set_primary_id(0);
+    set_redirect_id(-1);
     num_servers_ = num_servers;
     num_clients_ = num_clients;
     primary_listen_port_.resize(num_servers_);
+    acceptor_listen_port_.resize(num_servers_);
+    acceptor_fd_.resize(num_servers_, -1);
+    next_read_id_ = 0;
+    pending_read_id_ = -1;
+    read_fd_ = -1;
+    read_server_id_ = -1;
+    home_fd_ = -1;
 }
 
 /**
- * sends chat message to primary along with chat id
+ * sends chat message to primary along with chat id. In the fast mode
+ * it goes to the acceptors instead
  * @param chat_id      id of the chat message
  * @param chat_message body of chat message
  */
  void Client::SendChatToPrimary(const int chat_id, const string &chat_message) {
-    string msg = kChat + kInternalDelim +
-    to_string(get_pid()) + kInternalStructDelim +
-    to_string(chat_id) + kInternalStructDelim +
-    chat_message + kMessageDelim;
+    pthread_mutex_lock(&chat_sent_lock);
+    if (chat_sent_.find(chat_id) == chat_sent_.end())
+        gettimeofday(&chat_sent_[chat_id], NULL);
+    pthread_mutex_unlock(&chat_sent_lock);
+
+    string proposal = to_string(get_pid()) + kInternalStructDelim +
+    to_string(chat_id) + kInternalStructDelim + chat_message;
+    if (get_options().fast_paxos) {
+        SendChatToAcceptors(proposal);
+        return;
+    }
+    string msg = kChat + kInternalDelim + proposal + kMessageDelim;
     int primary_id = get_primary_id();
-    if (send(get_primary_fd(), msg.c_str(), msg.size(), 0) == -1) {
-        D(cout << "C" << get_pid() << " : ERROR: Cannot send chat message to primary S"
-          << primary_id << endl;)
-    } else {
-        D(cout << "C" << get_pid() << " : Chat message sent to primary S"
+    int fd = ChatFd();
+    outbox_.Enqueue(fd, msg);
+    if (fd == get_primary_fd()) {
+        D(cout << "C" << get_pid() << " : Chat message queued for primary S"
           << primary_id << ": " << msg << endl;)
+    } else {
+        D(cout << "C" << get_pid() << " : Chat message queued for home S"
+          << get_home_id() << ": " << msg << endl;)
+    }
+}
+
+/**
+ * @return id of the server whose slots this client's chats are proposed in,
+ *         in the multi-leader mode
+ */
+int Client::get_home_id() {
+    return get_pid() % num_servers_;
+}
+
+/**
+ * in the multi-leader mode chats go to the home server, which proposes
+ * them in its own slots, while responses still come from the primary.
+ * Chats go to the primary when the home server cannot be reached
+ * @return fd to send chats on
+ */
+int Client::ChatFd() {
+    if (!get_options().multi_leader || get_home_id() == get_primary_id())
+        return get_primary_fd();
+    if (home_fd_ == -1 && ConnectToHome()) {
+        D(cout << "C" << get_pid() << " : Connected to home S" << get_home_id() << endl;)
+    }
+    return (home_fd_ != -1) ? home_fd_ : get_primary_fd();
+}
+
+/**
+ * closes the connection to the home server if the server went away,
+ * and resends the chats which may have died with it
+ */
+void Client::CheckHome() {
+    char buf;
+    if (home_fd_ == -1 || recv(home_fd_, &buf, 1, MSG_DONTWAIT | MSG_PEEK) != 0)
+        return;
+
+    D(cout << "C" << get_pid() << " : Connection closed by home S" << get_home_id() << endl;)
+    close(home_fd_);
+    outbox_.Discard(home_fd_);
+    home_fd_ = -1;
+    ResendChats();
+    FlushOutbox();
+}
+
+/**
+ * in the fast mode, sends a chat to every acceptor with FAST-<proposal>$, to
+ * be accepted in the next fast slot. The primary's leader learns of the votes
+ * and decides. Acceptors which cannot be reached are tried with the next chat
+ * @param proposal chat as <client id>.<chat id>.<chat message>
+ */
+void Client::SendChatToAcceptors(const string &proposal) {
+    string msg = kFast + kInternalDelim + proposal + kMessageDelim;
+    for (int i = 0; i < num_servers_; ++i) {
+        if (acceptor_fd_[i] == -1) {
+            acceptor_fd_[i] = ConnectToPort(acceptor_listen_port_[i]);
+            if (acceptor_fd_[i] == -1)
+                continue;
+            D(cout << "C" << get_pid() << " : Connected to acceptor S" << i << endl;)
+        }
+        outbox_.Enqueue(acceptor_fd_[i], msg);
+        D(cout << "C" << get_pid() << " : Chat message queued for acceptor S" << i << ": " << msg << endl;)
+    }
+}
+
+/**
+ * closes the connections to acceptors which went away. An acceptor sends
+ * nothing on them but the fd it took for the connection, which is dropped
+ */
+void Client::CheckAcceptors() {
+    char buf[kMaxDataSize];
+    for (int i = 0; i < num_servers_; ++i) {
+        if (acceptor_fd_[i] == -1)
+            continue;
+        int rv;
+        while ((rv = recv(acceptor_fd_[i], buf, kMaxDataSize, MSG_DONTWAIT)) > 0) { }
+        if (rv == 0) {
+            D(cout << "C" << get_pid() << " : Connection closed by acceptor S" << i << endl;)
+            close(acceptor_fd_[i]);
+            outbox_.Discard(acceptor_fd_[i]);
+            acceptor_fd_[i] = -1;
+        }
     }
 }
 
 /**
- * sends all chats which have not yet been decided to the (new) primary
+ * sends all chats queued for the primary, waiting at most
+ * kOutboxDrainTimeout if it is slow. Undecided chats are resent once
+ * if some were dropped on queue overflow. Chats the resend drops again
+ * are resent on the next flush
+ */
+ void Client::FlushOutbox() {
+    bool resent = false;
+    while (true) {
+        vector<int> failed_fds;
+        outbox_.Drain(kOutboxDrainTimeout, failed_fds);
+        if (!failed_fds.empty()) {
+            D(cout << "C" << get_pid() << " : ERROR: Cannot send chat messages to primary S"
+              << get_primary_id() << endl;)
+        }
+        for (auto fd : failed_fds) {
+            for (int i = 0; i < num_servers_; ++i) {
+                if (acceptor_fd_[i] == fd) {
+                    close(fd);
+                    outbox_.Discard(fd);
+                    acceptor_fd_[i] = -1;
+                }
+            }
+        }
+        if (resent)
+            return;
+
+        vector<int> resync_fds;
+        outbox_.TakeResyncFds(resync_fds);
+        if (resync_fds.empty())
+            return;
+        D(cout << "C" << get_pid() << " : Chats to primary were dropped. Resending" << endl;)
+        ResendChats();
+        resent = true;
+    }
+}
+
+/**
+ * queues all chats which have not yet been decided for the (new) primary.
+ * The caller flushes them
  */
  void Client::ResendChats() {
     for (int i = 0; i < chat_list_.size(); ++i) {
@@ -174,11 +344,82 @@ int Client::set_primary_id(const int primary_id) {
 }
 
 /**
- * adds a decided chat id to the decided_chat_ids list
+ * adds a decided chat id to the decided_chat_ids list, and records
+ * the time from the chat's first send till it was decided
  * @param chat_id chat id to be added
  */
  void Client::AddToDecidedChatIDs(const int chat_id) {
     decided_chat_ids_.insert(chat_id);
+    NoteAnswered(chat_id);
+
+    pthread_mutex_lock(&chat_sent_lock);
+    auto it = chat_sent_.find(chat_id);
+    if (it != chat_sent_.end()) {
+        Metrics::AddCommit(ElapsedSince(it->second));
+        chat_sent_.erase(it);
+    }
+    answered_chat_ids_.erase(chat_id);
+    pthread_mutex_unlock(&chat_sent_lock);
+}
+
+/**
+ * records the time from a chat's first send till the first answer for it,
+ * a tentative one or the decision
+ * @param chat_id chat id answered
+ */
+ void Client::NoteAnswered(const int chat_id) {
+    pthread_mutex_lock(&chat_sent_lock);
+    auto it = chat_sent_.find(chat_id);
+    if (it != chat_sent_.end() && answered_chat_ids_.insert(chat_id).second)
+        Metrics::AddAnswer(ElapsedSince(it->second));
+    pthread_mutex_unlock(&chat_sent_lock);
+}
+
+/**
+ * keeps a chat the primary accepted in a slot, ahead of its decision.
+ * Only decided chats go to the final chat log
+ * @param token TENTATIVE, slot, proposal
+ */
+ void Client::ReceiveTentative(const std::vector<string> &token) {
+    if (token.size() != 3)
+        return;
+    tentative_log_[stoi(token[1])] = token[2];
+    Metrics::AddTentative();
+
+    std::vector<string> proposal_token = split(token[2], kInternalStructDelim[0]);
+    if (proposal_token.size() == 3 && stoi(proposal_token[0]) == get_pid()
+            && decided_chat_ids_.find(stoi(proposal_token[1])) == decided_chat_ids_.end())
+        NoteAnswered(stoi(proposal_token[1]));
+}
+
+/**
+ * drops the chat told of in a slot which was decided otherwise. A chat of
+ * this client is proposed again by the primary, so nothing is resent
+ * @param token ROLLBACK, slot
+ */
+ void Client::ReceiveRollback(const std::vector<string> &token) {
+    if (token.size() != 2)
+        return;
+    if (tentative_log_.erase(stoi(token[1])) > 0) {
+        D(cout << "C" << get_pid() << " : Tentative slot " << token[1] << " rolled back" << endl;)
+        Metrics::AddRollback();
+    }
+}
+
+/**
+ * settles the chat told of in a slot, once the slot's decision comes. A new
+ * primary sends no ROLLBACK for its predecessor's slots, so a decision of
+ * another chat counts as one
+ * @param sequence_num decided slot
+ * @param proposal     decided proposal
+ */
+ void Client::SettleTentative(const string &sequence_num, const string &proposal) {
+    auto it = tentative_log_.find(stoi(sequence_num));
+    if (it == tentative_log_.end())
+        return;
+    if (it->second != proposal)
+        Metrics::AddRollback();
+    tentative_log_.erase(it);
 }
 
 /**
@@ -233,6 +474,137 @@ int Client::set_primary_id(const int primary_id) {
 } else {
     D(cout << "C" << get_pid() << " : ChatLog sent to M" << endl;)
 }
+D(cout << "C" << get_pid() << " : " << Metrics::Summary() << endl;)
+}
+
+/**
+ * asks the primary for the chat log as of now, with READ-<pid>-<read id>$.
+ * The primary answers from its own log once it knows no other server
+ * can have decided more
+ */
+ void Client::SendReadToPrimary() {
+    pthread_mutex_lock(&read_lock);
+    pending_read_id_ = next_read_id_++;
+    pthread_mutex_unlock(&read_lock);
+    ResendRead();
+}
+
+/**
+ * sends the pending read, if any, to the (new) primary
+ */
+ void Client::ResendRead() {
+    pthread_mutex_lock(&read_lock);
+    int read_id = pending_read_id_;
+    pthread_mutex_unlock(&read_lock);
+    if (read_id == -1)
+        return;
+
+    string msg = kRead + kInternalDelim + to_string(get_pid())
+                 + kInternalDelim + to_string(read_id) + kMessageDelim;
+    outbox_.Enqueue(get_primary_fd(), msg);
+    D(cout << "C" << get_pid() << " : Read queued for primary S" << get_primary_id() << ": " << msg << endl;)
+    FlushOutbox();
+}
+
+/**
+ * passes the chat log read from the primary on to the master
+ * @param token tokens of READRESP message
+ */
+ void Client::ReceiveReadResponse(const std::vector<string> &token) {
+    pthread_mutex_lock(&read_lock);
+    bool pending = (pending_read_id_ == stoi(token[1]));
+    if (pending)
+        pending_read_id_ = -1;
+    pthread_mutex_unlock(&read_lock);
+    if (!pending)
+        return;     // answer to a read sent to an earlier primary
+
+    string msg = kChatLog + kInternalDelim + ((token.size() == 3) ? token[2] : "") + kMessageDelim;
+    if (send(get_master_fd(), msg.c_str(), msg.size(), 0) == -1) {
+        D(cout << "C" << get_pid() << " : ERROR: Cannot send read ChatLog to M" << endl;)
+    } else {
+        D(cout << "C" << get_pid() << " : Read ChatLog sent to M" << endl;)
+    }
+}
+
+/**
+ * reads the chat log through the replica of any server, which serves it
+ * once it has performed every chat decided before the read (see
+ * Replica::ServeReads). Falls back to reading through the primary if
+ * the server cannot be reached or does not answer in time
+ * @param server_id id of server to read through
+ */
+ void Client::ReadFromServer(const int server_id) {
+    if (read_fd_ != -1 && read_server_id_ != server_id) {
+        close(read_fd_);
+        read_inbox_.Reset(read_fd_);
+        read_fd_ = -1;
+    }
+    if (read_fd_ == -1 && !ConnectForReads(server_id)) {
+        D(cout << "C" << get_pid() << " : ERROR in connecting for reads to S" << server_id
+          << ". Reading through primary" << endl;)
+        SendReadToPrimary();
+        return;
+    }
+
+    pthread_mutex_lock(&read_lock);
+    string read_id = to_string(next_read_id_++);
+    pthread_mutex_unlock(&read_lock);
+    string msg = kRead + kInternalDelim + to_string(get_pid())
+                 + kInternalDelim + read_id + kMessageDelim;
+    if (send(read_fd_, msg.c_str(), msg.size(), 0) == -1) {
+        D(cout << "C" << get_pid() << " : ERROR in sending read to S" << server_id << endl;)
+    } else {
+        D(cout << "C" << get_pid() << " : Read sent to S" << server_id << ": " << msg << endl;)
+    }
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    while (ElapsedSince(start) < kConnectTimeout) {
+        fd_set recv_from;
+        FD_ZERO(&recv_from);
+        FD_SET(read_fd_, &recv_from);
+        struct timeval timeout = kSelectTimeoutTimeval;
+        if (select(read_fd_ + 1, &recv_from, NULL, NULL, &timeout) <= 0)
+            continue;
+
+        char buf[kMaxDataSize];
+        int num_bytes = recv(read_fd_, buf, kMaxDataSize - 1, 0);
+        if (num_bytes <= 0)
+            break;
+        std::vector<string> message;
+        read_inbox_.Extract(read_fd_, buf, num_bytes, message);
+        for (const auto &m : message) {
+            std::vector<string> token = split(string(m), kInternalDelim[0]);
+            if (token[0] != kReadResp || token[1] != read_id)
+                continue;
+            D(cout << "C" << get_pid() << " : Read response received from S" << server_id
+              << ": " << m << endl;)
+            string chat_log = kChatLog + kInternalDelim + ((token.size() == 3) ? token[2] : "")
+                              + kMessageDelim;
+            if (send(get_master_fd(), chat_log.c_str(), chat_log.size(), 0) == -1) {
+                D(cout << "C" << get_pid() << " : ERROR: Cannot send read ChatLog to M" << endl;)
+            }
+            return;
+        }
+    }
+
+    D(cout << "C" << get_pid() << " : ERROR: No read response from S" << server_id
+      << ". Reading through primary" << endl;)
+    close(read_fd_);
+    read_inbox_.Reset(read_fd_);
+    read_fd_ = -1;
+    SendReadToPrimary();
+}
+
+/**
+ * @return true if a NEWPRIMARY from the master is waiting to be read. The
+ *         primary being connected to is then gone, and retrying is pointless
+ */
+ bool Client::NewPrimaryPending() {
+    char buf[kMaxDataSize];
+    int num_bytes = recv(get_master_fd(), buf, kMaxDataSize, MSG_DONTWAIT | MSG_PEEK);
+    return num_bytes > 0 && string(buf, num_bytes).find(kNewPrimary) != string::npos;
 }
 
 /**
@@ -240,16 +612,67 @@ int Client::set_primary_id(const int primary_id) {
  * and resending undecided chats to new primary
  */
  void Client::HandleNewPrimary(const int new_primary) {
+    // after a leadership transfer the old primary is still up. the chat
+    // port cannot connect to it again while this connection is open
+    if (get_primary_fd() != -1) {
+        close(get_primary_fd());
+        set_primary_fd(-1);
+    }
     set_primary_id(new_primary);
 
-    if (ConnectToPrimary()) {
+    if (RetryWithBackoff([&]() { return NewPrimaryPending() || ConnectToPrimary(); },
+                         kConnectTimeout)) {
         D(cout << "C" << get_pid() << " : Connected to primary S" << get_primary_id() << endl;)
     } else {
         D(cout << "C" << get_pid() << " : ERROR in connecting to primary S" << get_primary_id() << endl;)
     }
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
     ResendChats();
+    FlushOutbox();
+    ResendRead();
+}
+
+/**
+ * finds the new primary after the connection to the old one closed, when
+ * servers elect primaries among themselves. Servers are tried round robin
+ * starting after the old primary, and a server which is not the primary
+ * redirects to the primary it knows of
+ * @return true if connected to the new primary
+ */
+ bool Client::FindPrimary() {
+    int old_primary = get_primary_id();
+    int candidate = (old_primary + 1) % num_servers_;
+    struct timeval start;
+    gettimeofday(&start, NULL);
+
+    close(get_primary_fd());
+    set_primary_fd(-1);
+    bool found = RetryWithBackoff([&]() {
+        set_primary_id(candidate);
+        set_redirect_id(-1);
+        if (ConnectToPrimary())
+            return true;
+
+        // a redirect to the old primary comes from a server which
+        // has not heard of the election yet
+        int redirect = get_redirect_id();
+        if (redirect != -1 && redirect != old_primary)
+            candidate = redirect;
+        else
+            candidate = (candidate + 1) % num_servers_;
+        return false;
+    }, kConnectTimeout);
+
+    if (!found) {
+        D(cout << "C" << get_pid() << " : ERROR: Cannot find new primary" << endl;)
+        set_primary_id(old_primary);
+        return false;
+    }
+    D(cout << "C" << get_pid() << " : Found new primary S" << get_primary_id()
+      << " in " << ElapsedSince(start) / 1000 << " ms" << endl;)
+    ResendChats();
+    FlushOutbox();
+    ResendRead();
+    return true;
 }
 
 /**
@@ -280,20 +703,29 @@ int Client::set_primary_id(const int primary_id) {
             D(cout << "C" << C->get_pid() << " : Connection closed by Master. Exiting." << endl;)
             return NULL;
         } else {
-            buf[num_bytes] = '\0';
-
-            // extract multiple messages from the received buf
-            std::vector<string> message = split(string(buf), kMessageDelim[0]);
+            // extract multiple messages from the received buf. a chat
+            // longer than the buffer comes over several recv calls
+            std::vector<string> message;
+            C->master_inbox_.Extract(C->get_master_fd(), buf, num_bytes, message);
             for (const auto &msg : message) {
                 std::vector<string> token = split(string(msg), kInternalDelim[0]);
                 if (token[0] == kChat) {   // new chat message received from master
                     D(cout << "C" << C->get_pid()
                       << " : Chat message received from M: " << token[1] <<  endl;)
                     C->AddChatToChatList(token[1]);
+                    C->CheckHome();
+                    C->CheckAcceptors();
                     C->SendChatToPrimary(C->ChatListSize() - 1, token[1]);
+                    C->FlushOutbox();
                 } else if (token[0] == kChatLog) {  // chat log request from master
                     D(cout << "C" << C->get_pid() << " : ChatLog request received from M" <<  endl;)
                     C->SendChatLogToMaster();
+                } else if (token[0] == kRead) {     // chat log to be read
+                    D(cout << "C" << C->get_pid() << " : Read request received from M" <<  endl;)
+                    if (token.size() == 2)
+                        C->ReadFromServer(stoi(token[1]));
+                    else
+                        C->SendReadToPrimary();
                 } else if (token[0] == kNewPrimary) {
                     int new_primary = stoi(token[1]);
                     D(cout << "C" << C->get_pid()
@@ -325,20 +757,33 @@ int Client::set_primary_id(const int primary_id) {
         int primary_id = C->get_primary_id();
         int primary_fd = C->get_primary_fd();
 
+        if (primary_fd == -1 && C->get_options().leader_election == CLUSTER_ELECTION) {
+            // last search for the primary failed. keep looking
+            C->FindPrimary();
+            continue;
+        }
+
         // recv call times out after kReceiveTimeoutTimeval
         num_bytes = recv(primary_fd, buf, kMaxDataSize - 1, 0);
         if (num_bytes == -1) {
             // D(cout << "C" << C->get_pid() <<
             // " : ERROR in receiving message from primary S" << primary_id << endl;)
-            usleep(kBusyWaitSleep);
+            // a timeout only gives a new primary's fd a chance. sleeping
+            // after it would hold up the next response
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                usleep(kBusyWaitSleep);
         } else if (num_bytes == 0) {    // connection closed by primary
             D(cout << "C" << C->get_pid() << " : Connection closed by primary S" << primary_id << endl;)
-            usleep(kBusyWaitSleep);
+            if (C->get_options().leader_election == CLUSTER_ELECTION) {
+                // no NEWPRIMARY will come from the master. look for it
+                C->FindPrimary();
+            } else {
+                usleep(kBusyWaitSleep);
+            }
         } else {
-            buf[num_bytes] = '\0';
-
             // extract multiple messages from the received buf
-            std::vector<string> message = split(string(buf), kMessageDelim[0]);
+            std::vector<string> message;
+            C->inbox_.Extract(primary_fd, buf, num_bytes, message);
             for (const auto &msg : message) {
                 std::vector<string> token = split(string(msg), kInternalDelim[0]);
                 // token[0] = kresponse
@@ -353,8 +798,19 @@ int Client::set_primary_id(const int primary_id) {
                     // proposal_token[1] = (chat id) wrt to original sender of chat message
                     // proposal_token[2] = (msg) chat message body
                     C->AddToFinalChatLog(token[1], proposal_token[0], proposal_token[2]);
+                    C->SettleTentative(token[1], token[2]);
                     if (stoi(proposal_token[0]) == C->get_pid())
                         C->AddToDecidedChatIDs(stoi(proposal_token[1]));
+                } else if (token[0] == kTentative) {
+                    D(cout << "C" << C->get_pid()
+                      << " : Tentative response received from primary S" << primary_id << ": " << msg << endl;)
+                    C->ReceiveTentative(token);
+                } else if (token[0] == kRollback) {
+                    C->ReceiveRollback(token);
+                } else if (token[0] == kReadResp) {
+                    D(cout << "C" << C->get_pid()
+                      << " : Read response received from primary S" << primary_id << ": " << msg << endl;)
+                    C->ReceiveReadResponse(token);
                 } else {
                     D(cout << "C" << C->get_pid() << " : Unexpected message received: " << msg << endl;)
 
@@ -371,7 +827,9 @@ int main(int argc, char *argv[]) {
     Client C;
     C.Initialize(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
     C.InitializeLocks();
-    if (!C.ReadPortsFile())
+    if (!C.ReadPortsFile((argc > 5) ? argv[5] : kPortsFile))
+        return 1;
+    if (!C.ReadOptions((argc > 4) ? argv[4] : kOptionsFile))
         return 1;
 
     pthread_t accept_connections_thread;
@@ -380,7 +838,8 @@ int main(int argc, char *argv[]) {
     void* status;
     pthread_join(accept_connections_thread, &status);
 
-    if (C.ConnectToPrimary()) {
+    if (RetryWithBackoff([&]() { return C.NewPrimaryPending() || C.ConnectToPrimary(); },
+                         kConnectTimeout)) {
         D(cout << "C" << C.get_pid() << " : Connected to primary S" << C.get_primary_id() << endl;)
     } else {
         D(cout << "C" << C.get_pid() << " : ERROR in connecting to primary S" << C.get_primary_id() << endl;)
@@ -5,6 +5,8 @@
 #include "string"
 #include "map"
 #include "unordered_set"
+#include "channel.h"
+#include "options.h"
 using namespace std;
 
 void* ReceiveMessagesFromMaster(void* _C);
@@ -30,20 +32,40 @@ public:
     void Initialize(const int pid,
                     const int num_servers,
                     const int num_clients);
-    bool ReadPortsFile();
+    bool ReadPortsFile(const string &path);
+    bool ReadOptions(const string &path);
     void CreateThread(void* (*f)(void* ), void* arg, pthread_t &thread);
     void SendChatToPrimary(const int chat_id, const string &chat_message);
     void AddChatToChatList(const string &chat);
     bool ConnectToPrimary();
+    bool NewPrimaryPending();
+    bool ConnectForReads(const int server_id);
+    bool ConnectToHome();
+    int ConnectFromEphemeralPort(const int server_id);
+    int ConnectToPort(const int port);
+    int ChatFd();
+    void CheckHome();
+    void SendChatToAcceptors(const string &proposal);
+    void CheckAcceptors();
     void AddToFinalChatLog(const string &sequence_number,
                            const string &sender_index,
                            const string &body);
     void InitializeLocks();
     void ConstructChatLogMessage(string &msg);
     void SendChatLogToMaster();
+    void SendReadToPrimary();
+    void ResendRead();
+    void ReceiveReadResponse(const std::vector<string> &token);
+    void ReadFromServer(const int server_id);
     void ResendChats();
     void AddToDecidedChatIDs(const int chat_id);
+    void NoteAnswered(const int chat_id);
+    void ReceiveTentative(const std::vector<string> &token);
+    void ReceiveRollback(const std::vector<string> &token);
+    void SettleTentative(const string &sequence_num, const string &proposal);
     void HandleNewPrimary(const int new_primary);
+    bool FindPrimary();
+    void FlushOutbox();
 
     int get_pid();
     int get_master_fd();
@@ -53,17 +75,25 @@ public:
     int get_my_chat_port();
     int get_my_listen_port();
     int get_primary_id();
+    int get_redirect_id();
+    int get_home_id();
+    const Options& get_options();
 
     void set_pid(const int pid);
     void set_master_fd(const int fd);
     int set_primary_fd(const int fd);
     int set_primary_id(const int primary_id);
+    void set_redirect_id(const int redirect_id);
+
+    Inbox inbox_;
+    Inbox master_inbox_;    // used by the thread receiving from the master only
 
 private:
     int pid_;   // client's ID
     int num_servers_;
     int num_clients_;
     int primary_id_;
+    int redirect_id_;   // primary named by the last server which redirected us
 
     int master_fd_;
     int primary_fd_;     // fd for communication with primary server
@@ -76,6 +106,19 @@ private:
     std::vector<string> chat_list_;
     std::map<int, FinalChatLog> final_chat_log_;
     std::unordered_set<int> decided_chat_ids_;
+    int next_read_id_;
+    int pending_read_id_;   // read not answered yet, -1 if none
+    int read_fd_;           // read connection to a server other than through the primary
+    int read_server_id_;
+    Inbox read_inbox_;
+    int home_fd_;           // chat connection to the home server, in the multi-leader mode
+    std::vector<int> acceptor_listen_port_;
+    std::vector<int> acceptor_fd_;          // chat connections to acceptors, in the fast mode
+    std::map<int, struct timeval> chat_sent_;   // chat id -> first send, till decided
+    std::unordered_set<int> answered_chat_ids_; // sent chats answered, tentatively or not
+    std::map<int, string> tentative_log_;       // slot -> proposal told of, till decided
+    Options options_;
+    Outbox outbox_;
 };
 
 #endif //CLIENT_H_
\ No newline at end of file
@@ -108,10 +108,12 @@ void* AcceptConnectionsCommander(void* _C) {
         int process_id = C->S->IsLeaderPort(incoming_port);
         if (process_id != -1) { //incoming connection from a leader
             C->set_leader_fd(process_id, new_fd);
+            SendReady(new_fd);
         } else {
             process_id = C->S->IsReplicaPort(incoming_port);
             if (process_id != -1) { //incoming connection from a replica
                 C->set_replica_fd(process_id, new_fd);
+                SendReady(new_fd);
             } else {
                 D(cout << "SC" << C->S->get_pid() << ": ERROR: Unexpected connect request from port "
                   << incoming_port << endl;)
@@ -2,6 +2,9 @@
 #include "server.h"
 #include "constants.h"
 #include "utilities.h"
+#include "metrics.h"
+#include "dispatch.h"
+#include "erasure.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -12,10 +15,13 @@
 #include "errno.h"
 #include "sys/socket.h"
 #include "limits.h"
+#include "algorithm"
 using namespace std;
 
 typedef pair<int, Proposal> SPtuple;
 
+pthread_mutex_t commander_lock = PTHREAD_MUTEX_INITIALIZER;
+
 #define DEBUG
 
 #ifdef DEBUG
@@ -27,6 +33,7 @@ typedef pair<int, Proposal> SPtuple;
 // static member definitions
 std::vector<int> Commander::leader_fd_;
 std::vector<int> Commander::replica_fd_;
+int Commander::num_started_ = 0;
 
 Commander::~Commander() {
 
@@ -36,11 +43,20 @@ Commander::Commander(Server* _S, const int num_servers) {
     S = _S;
     leader_fd_.resize(num_servers, -1);
     replica_fd_.resize(num_servers, -1);
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
 }
 
 Commander::Commander(Server* _S) {
     S = _S;
     acceptor_fd_.resize(S->get_num_servers(), -1);
+    p2a_sent_.resize(S->get_num_servers(), {0, 0});
+    skip_to_ = -1;
+    skip_stride_ = 0;
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
 }
 
 int Commander::get_leader_fd(const int server_id) {
@@ -55,6 +71,15 @@ int Commander::get_acceptor_fd(const int server_id) {
     return acceptor_fd_[server_id];
 }
 
+void Commander::set_skip(const int skip_to, const int stride) {
+    skip_to_ = skip_to;
+    skip_stride_ = stride;
+}
+
+struct timeval Commander::get_p2a_sent(const int server_id) {
+    return p2a_sent_[server_id];
+}
+
 void Commander::set_leader_fd(const int server_id, const int fd) {
     leader_fd_[server_id] = fd;
 }
@@ -69,12 +94,8 @@ void Commander::set_acceptor_fd(const int server_id, const int fd) {
 
 void Commander::Unicast(const string &type, const string& msg)
 {
-    if (send(get_leader_fd(S->get_pid()), msg.c_str(), msg.size(), 0) == -1) {
-        D(cout << "SC" << S->get_pid() << ": ERROR in sending " << type << endl;)
-    }
-    else {
-        D(cout << "SC" << S->get_pid() << ": " << type << " message sent: " << msg << endl;)
-    }
+    outbox_.Enqueue(get_leader_fd(S->get_pid()), msg);
+    D(cout << "SC" << S->get_pid() << ": " << type << " message queued: " << msg << endl;)
 }
 
 void Commander::SendToServers(const string& type, const string& msg)
@@ -84,78 +105,394 @@ void Commander::SendToServers(const string& type, const string& msg)
         if (get_replica_fd(i) == -1)
             continue;
 
-        if (send(get_replica_fd(i), msg.c_str(), msg.size(), 0) == -1) {
-            D(cout << "SC" << S->get_pid()
-              << ": ERROR in sending decision to replica S" << (i) << endl;)
-            close(get_replica_fd(i));
-            set_replica_fd(i, -1);
+        outbox_.Enqueue(get_replica_fd(i), msg);
+        D(cout << "SC" << S->get_pid()
+          << ": Decision queued for replica S" << (i) << ": " << msg << endl;)
+    }
+}
+
+/**
+ * sends all queued messages, waiting at most kOutboxDrainTimeout for slow
+ * peers since a commander does not outlive its proposal. Closes the replica
+ * connections on which sending failed or decisions were dropped
+ */
+void Commander::FlushOutbox()
+{
+    vector<int> failed_fds, resync_fds;
+    outbox_.Drain(kOutboxDrainTimeout, failed_fds);
+    outbox_.TakeResyncFds(resync_fds);
+    failed_fds.insert(failed_fds.end(), resync_fds.begin(), resync_fds.end());
+    for (auto fd : failed_fds) {
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            if (get_replica_fd(i) == fd) {
+                D(cout << "SC" << S->get_pid()
+                  << ": ERROR in sending decision to replica S" << (i) << endl;)
+                close(fd);
+                set_replica_fd(i, -1);
+            }
         }
-        else {
-            D(cout << "SC" << S->get_pid()
-              << ": Decision sent to replica S" << (i) << ": " << msg << endl;)
+        if (fd == get_leader_fd(S->get_pid())) {
+            D(cout << "SC" << S->get_pid() << ": ERROR in sending to leader" << endl;)
         }
     }
 }
 
-void Commander::SendP2a(const Triple &t, const vector<int> &acceptor_peer_fd)
+/**
+ * sends P2As, or CHAINs or RELAYs carrying one, to acceptors. All of them
+ * are queued before any is flushed, so a slow acceptor does not hold up the
+ * rest. No more are queued than the message quota allows, and the quota is
+ * charged per message sent
+ * @param msgs acceptor ids, each with the message to send to it
+ */
+void Commander::SendToAcceptors(const vector<pair<int, string> > &msgs)
 {
-    int serv_fd;
-    for (int i = 0; i < S->get_num_servers(); i++)
-    {
-        S->ContinueOrDie();
-
-        serv_fd = get_acceptor_fd(i);
-
-        if (serv_fd == -1) {
+    S->ContinueOrDie();
+
+    int quota = S->get_message_quota();
+    vector<pair<int, string> > queued;
+    for (const auto &m : msgs) {
+        if ((int)queued.size() >= quota)
+            break;
+        if (get_acceptor_fd(m.first) == -1)
             continue;
-        }
-
-        string msg = kP2a + kInternalDelim + to_string(acceptor_peer_fd[i]);
-        msg += kInternalDelim + tripleToString(t) + kMessageDelim;
+        outbox_.Enqueue(get_acceptor_fd(m.first), m.second);
+        queued.push_back(m);
+    }
 
-        if (send(serv_fd, msg.c_str(), msg.size(), 0) == -1) {
+    vector<int> failed_fds;
+    outbox_.Drain(kOutboxDrainTimeout, failed_fds);
+    int num_sent = 0;
+    for (const auto &m : queued) {
+        int server_id = m.first;
+        int serv_fd = get_acceptor_fd(server_id);
+        string type = m.second.substr(0, m.second.find(kInternalDelim));
+        if (find(failed_fds.begin(), failed_fds.end(), serv_fd) != failed_fds.end()) {
             D(cout << "SC" << S->get_pid()
-              << ": ERROR in sending P2A message to acceptor S" << i << endl;)
+              << ": ERROR in sending " << type << " message to acceptor S" << server_id << endl;)
+            outbox_.Discard(serv_fd);
             close(serv_fd);
-            set_acceptor_fd(i, -1);
+            set_acceptor_fd(server_id, -1);
+            continue;
         }
-        else {
-            D(cout << "SC" << S->get_pid()
-              << ": P2A message sent to acceptor S" << i << ": " << msg << endl;)
+        D(cout << "SC" << S->get_pid()
+          << ": " << type << " message sent to acceptor S" << server_id << ": " << m.second << endl;)
+        S->get_failure_detector()->Sent(server_id);
+        gettimeofday(&p2a_sent_[server_id], NULL);
+        Metrics::AddP2a();
+        num_sent++;
+    }
+
+    S->DecrementMessageQuota(num_sent);
+}
+
+/**
+ * @return P2A-<return fd>-<triple>[-<skip to>-<stride>]$ for an acceptor.
+ *         With erasure coding each acceptor gets its own fragment of the
+ *         chat instead of the whole of it
+ * @param t                triple to be accepted
+ * @param acceptor_peer_fd acceptor side fds of commander-acceptor connections
+ * @param server_id        id of the acceptor
+ */
+string Commander::P2aMessage(const Triple &t, const vector<int> &acceptor_peer_fd, const int server_id)
+{
+    int k = S->get_options().erasure_k;
+    if (k > 0 && fragments_.empty())
+        fragments_ = FragmentProposal(ReedSolomon(k, S->get_num_servers() - k), t.p);
+
+    Triple sent = t;
+    if (!fragments_.empty())
+        sent.p = fragments_[server_id];
+    string msg = kP2a + kInternalDelim + to_string(acceptor_peer_fd[server_id]);
+    msg += kInternalDelim + tripleToString(sent);
+    if (skip_to_ != -1)
+        msg += kInternalDelim + to_string(skip_to_) + kInternalDelim + to_string(skip_stride_);
+    return msg + kMessageDelim;
+}
+
+/**
+ * sends P2A to the given acceptors
+ * @param t                triple to be accepted
+ * @param acceptor_peer_fd acceptor side fds of commander-acceptor connections
+ * @param targets          ids of acceptors to send P2A to
+ */
+void Commander::SendP2a(const Triple &t, const vector<int> &acceptor_peer_fd, const vector<int> &targets)
+{
+    vector<pair<int, string> > msgs;
+    for (auto i : targets)
+    {
+        if (get_acceptor_fd(i) != -1)
+            msgs.push_back(make_pair(i, P2aMessage(t, acceptor_peer_fd, i)));
+    }
+    SendToAcceptors(msgs);
+}
+
+/**
+ * sends RELAY-<return fd>-<triple>-<group>[-<skip to>-<stride>]$ to each
+ * vote relay, which passes the P2A on to the rest of its group and answers
+ * for all of them (see Acceptor::ReceiveRelay). A relay with no one else
+ * left in its group gets a plain P2A
+ * @param t                triple to be accepted
+ * @param acceptor_peer_fd acceptor side fds of commander-acceptor connections
+ * @param groups           ids of the rest of the group, by relay
+ */
+void Commander::SendRelay(const Triple &t, const vector<int> &acceptor_peer_fd,
+                          const map<int, vector<int> > &groups)
+{
+    vector<pair<int, string> > msgs;
+    for (const auto &group : groups)
+    {
+        int relay = group.first;
+        if (get_acceptor_fd(relay) == -1)
+            continue;
+        if (group.second.empty()) {
+            msgs.push_back(make_pair(relay, P2aMessage(t, acceptor_peer_fd, relay)));
+            continue;
         }
 
-        S->DecrementMessageQuota();
+        string members;
+        for (auto i : group.second) {
+            if (!members.empty())
+                members += kInternalSetDelim;
+            members += to_string(i);
+        }
+        string msg = kRelay + kInternalDelim + to_string(acceptor_peer_fd[relay])
+                     + kInternalDelim + tripleToString(t) + kInternalDelim + members;
+        if (skip_to_ != -1)
+            msg += kInternalDelim + to_string(skip_to_) + kInternalDelim + to_string(skip_stride_);
+        msg += kMessageDelim;
+        msgs.push_back(make_pair(relay, msg));
     }
+    SendToAcceptors(msgs);
 }
 
 void Commander::SendDecision(const Triple &t)
 {
     string msg = kDecision + kInternalDelim + to_string(t.s) + kInternalDelim;
-    msg += proposalToString(t.p)  + kMessageDelim;
+    msg += proposalToString(t.p);
+    if (skip_to_ != -1)
+        msg += kInternalDelim + to_string(skip_to_) + kInternalDelim + to_string(skip_stride_);
+    msg += kMessageDelim;
     SendToServers(kDecision, msg);
     Unicast(kDecision, msg);
+    FlushOutbox();
+
+}
+
+/**
+ * tells of a pvalue accepted by a phase 2 quorum. In the distributed
+ * learning mode replicas learn the value from the acceptors, and get only
+ * COMMIT-<ballot>-<slot>$ from here, for slots whose quorum of LEARNs they
+ * missed. The leader still gets the whole decision
+ * @param t decided triple
+ */
+void Commander::SendCommit(const Triple &t)
+{
+    if (!S->get_options().distributed_learning) {
+        SendDecision(t);
+        return;
+    }
+
+    string msg = kCommit + kInternalDelim + ballotToString(t.b) + kInternalDelim
+                 + to_string(t.s) + kMessageDelim;
+    SendToServers(kCommit, msg);
 
+    msg = kDecision + kInternalDelim + to_string(t.s) + kInternalDelim
+          + proposalToString(t.p) + kMessageDelim;
+    Unicast(kDecision, msg);
+    FlushOutbox();
 }
 
 void Commander::SendPreEmpted(const Ballot& b)
 {
     string msg = kPreEmpted + kInternalDelim + ballotToString(b) + kMessageDelim;
     Unicast(kPreEmpted, msg);
+    FlushOutbox();
 }
 
 /**
- * connects to all acceptors, and gets their fds
+ * sends CHAIN-<triple>-<chain>[-<skip to>-<stride>]$ to the first acceptor
+ * of a chain, which passes it on along the chain (see
+ * Acceptor::ReceiveChain). A single message leaves this server, whatever
+ * the number of acceptors
+ * @param t                triple to be accepted
+ * @param acceptor_peer_fd acceptor side fds of commander-acceptor connections
+ * @param chain            ids of acceptors in the chain, in order
+ */
+void Commander::SendChain(const Triple &t, const vector<int> &acceptor_peer_fd, const vector<int> &chain)
+{
+    string links;
+    for (auto i : chain) {
+        if (!links.empty())
+            links += kInternalSetDelim;
+        links += to_string(i) + kInternalStructDelim + to_string(acceptor_peer_fd[i]);
+    }
+    string msg = kChain + kInternalDelim + tripleToString(t) + kInternalDelim + links;
+    if (skip_to_ != -1)
+        msg += kInternalDelim + to_string(skip_to_) + kInternalDelim + to_string(skip_stride_);
+    msg += kMessageDelim;
+    SendToAcceptors(vector<pair<int, string> >(1, make_pair(chain.front(), msg)));
+}
+
+/**
+ * splits the connected acceptors into the ones P2A goes to right away,
+ * and the spare ones it goes to only if the first ones are too slow.
+ * without thrifty_p2a, or on every kThriftyProbeInterval-th commander,
+ * every acceptor is a target. Otherwise the targets are the phase 2 quorum
+ * of acceptors with the lowest round trip estimates, and acceptors not
+ * measured yet go first so that they get measured
+ * @param targets [out] ids of acceptors to send P2A to now
+ * @param spare   [out] ids of acceptors to fall back on
+ */
+void Commander::ChooseP2aTargets(vector<int> &targets, vector<int> &spare)
+{
+    targets.clear();
+    spare.clear();
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_acceptor_fd(i) != -1)
+            targets.push_back(i);
+    }
+
+    pthread_mutex_lock(&commander_lock);
+    bool probe = (num_started_++ % kThriftyProbeInterval == 0);
+    pthread_mutex_unlock(&commander_lock);
+
+    int quorum = S->get_phase2_quorum();
+    if (S->get_options().chain_p2a && targets.size() >= quorum) {
+        // a chain of the next quorum of acceptors after this server, this
+        // server's own last. Every acceptor is spare, for the fallback
+        spare = targets;
+        targets.clear();
+        int n = S->get_num_servers();
+        for (int k = 1; k <= n && targets.size() < quorum; ++k) {
+            int i = (S->get_pid() + k) % n;
+            if (get_acceptor_fd(i) != -1)
+                targets.push_back(i);
+        }
+        return;
+    }
+    if (!S->get_options().thrifty_p2a || probe || targets.size() <= quorum)
+        return;
+
+    FailureDetector *FD = S->get_failure_detector();
+    vector<pair<time_t, int> > by_round_trip;
+    for (auto i : targets)
+        by_round_trip.push_back(make_pair(FD->get_round_trip(i), i));
+    sort(by_round_trip.begin(), by_round_trip.end());
+
+    targets.clear();
+    for (int k = 0; k < by_round_trip.size(); ++k) {
+        if (k < quorum)
+            targets.push_back(by_round_trip[k].second);
+        else
+            spare.push_back(by_round_trip[k].second);
+    }
+}
+
+/**
+ * @param  targets   ids of acceptors P2A was sent to
+ * @param  groups    ids of the rest of the group, by vote relay, whose
+ *                   votes are awaited from the relay
+ * @param  num_acked number of acceptors which accepted the commander's
+ *                   ballot so far
+ * @param  waited    microsec since P2A was sent to the targets
+ * @return           true if the spare acceptors should be sent P2A, because
+ *                   the thrifty timeout, or twice the relay timeout, passed
+ *                   or because the targets still awaited, leaving out failed
+ *                   and suspected ones, can no longer make a quorum
+ */
+bool Commander::NeedsFallback(const vector<int> &targets, const map<int, vector<int> > &groups,
+                              const int num_acked, const time_t waited)
+{
+    time_t timeout = groups.empty() ? S->get_options().thrifty_timeout
+                                    : 2 * S->get_options().relay_timeout;
+    if (waited >= timeout)
+        return true;
+
+    int awaited = 0;
+    for (auto i : targets) {
+        if (get_acceptor_fd(i) != -1 && !S->get_failure_detector()->IsSuspected(i)) {
+            awaited++;
+            if (groups.count(i))
+                awaited += groups.at(i).size();
+        }
+    }
+    return num_acked + awaited < S->get_phase2_quorum();
+}
+
+/**
+ * raises the round trip estimates of acceptors whose P2B had not come
+ * by the time the commander finished, since their round trips are at
+ * least as long as the wait so far
+ */
+void Commander::RaisePendingRoundTrips()
+{
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_acceptor_fd(i) != -1 && p2a_sent_[i].tv_sec != 0)
+            S->get_failure_detector()->RaiseRoundTrip(i, ElapsedSince(p2a_sent_[i]));
+    }
+}
+
+/**
+ * connects to all acceptors not suspected by the failure detector,
+ * and gets their fds
  * @param  acceptor_peer_fd [out] peer fds of commander-acceptor connection
  * @return                  num of alive acceptors with which this exchange was successfull
  */
 int Commander::ConnectToAllAcceptors(std::vector<int> &acceptor_peer_fd) {
-    int num_servers = S->get_num_servers();
+    vector<int> ids;
+    for (int i = 0; i < S->get_num_servers(); ++i)
+        ids.push_back(i);
+    return ConnectToAcceptors(ids, acceptor_peer_fd);
+}
+
+/**
+ * connects to one acceptor of each group of vote relays, the relay, which
+ * is the first one in the group not suspected by the failure detector
+ * that could be connected to
+ * @param  acceptor_peer_fd [out] peer fds of commander-acceptor connection
+ * @param  groups           [out] ids of the acceptors in the rest of the
+ *                          group not suspected, by relay
+ * @return                  num of alive acceptors in the groups of the relays
+ */
+int Commander::ConnectToRelays(std::vector<int> &acceptor_peer_fd, map<int, vector<int> > &groups) {
+    int num_alive_acceptors = 0;
+    groups.clear();
+    for (const auto &group : RelayGroups(S->get_options(), S->get_num_servers())) {
+        vector<int> alive;
+        for (auto i : group) {
+            if (!S->get_failure_detector()->IsSuspected(i))
+                alive.push_back(i);
+        }
+        for (int k = 0; k < alive.size(); ++k) {
+            if (ConnectToAcceptors(vector<int>(1, alive[k]), acceptor_peer_fd) == 0)
+                continue;
+            groups[alive[k]] = vector<int>(alive.begin() + k + 1, alive.end());
+            num_alive_acceptors += alive.size() - k;
+            break;
+        }
+    }
+    return num_alive_acceptors;
+}
+
+/**
+ * connects to the given acceptors not suspected by the failure detector,
+ * and gets their fds
+ * @param  ids              ids of acceptors to connect to
+ * @param  acceptor_peer_fd [out] peer fds of commander-acceptor connection
+ * @return                  num of alive acceptors with which this exchange was successfull
+ */
+int Commander::ConnectToAcceptors(const vector<int> &ids, std::vector<int> &acceptor_peer_fd) {
     int num_alive_acceptors = 0;
 
-    for (int i = 0; i < num_servers; ++i) {
+    for (auto i : ids) {
+        if (S->get_failure_detector()->IsSuspected(i)) {
+            D(cout << "SC" << S->get_pid() << ": Skipping suspected acceptor S" << i << endl;)
+            continue;
+        }
         if (!ConnectToAcceptor(i)) {
             D(cout << "SC" << S->get_pid() << ": ERROR in connecting to acceptor S" << i << endl;)
         } else {
+            Metrics::AddAcceptorConnect();
             int num_bytes;
             char buf[kMaxDataSize];
             num_bytes = recv(get_acceptor_fd(i), buf, kMaxDataSize - 1, 0);
@@ -182,6 +519,10 @@ int Commander::ConnectToAllAcceptors(std::vector<int> &acceptor_peer_fd) {
     return num_alive_acceptors;
 }
 
+/**
+ * builds the select() set of acceptors whose P2B is still awaited,
+ * leaving out the ones suspected by the failure detector
+ */
 void Commander::GetAcceptorFdSet(fd_set& acceptor_set, vector<int>& fds, int& fd_max)
 {
     fd_max = INT_MIN;
@@ -190,18 +531,11 @@ void Commander::GetAcceptorFdSet(fd_set& acceptor_set, vector<int>& fds, int& fd
     fds.clear();
     for (int i = 0; i < S->get_num_servers(); i++) {
         fd_temp = get_acceptor_fd(i);
-        if (fd_temp != -1)
+        if (fd_temp != -1 && !S->get_failure_detector()->IsSuspected(i))
         {
-            char buf;
-            int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
-            if (rv == 0) {
-                close(fd_temp);
-                set_acceptor_fd(i, -1);
-            } else {
-                FD_SET(fd_temp, &acceptor_set);
-                fd_max = max(fd_max, fd_temp);
-                fds.push_back(fd_temp);
-            }
+            FD_SET(fd_temp, &acceptor_set);
+            fd_max = max(fd_max, fd_temp);
+            fds.push_back(fd_temp);
         }
     }
 }
@@ -235,55 +569,167 @@ void* CommanderMode(void* _rcv_thread_arg) {
     CommanderThreadArgument *rcv_thread_arg = (CommanderThreadArgument *)_rcv_thread_arg;
     Commander *C = rcv_thread_arg->C;
     Triple toSend = rcv_thread_arg->toSend;
+    C->set_skip(rcv_thread_arg->skip_to, rcv_thread_arg->stride);
     int num_servers = C->S->get_num_servers();
+    struct timeval start;
+    gettimeofday(&start, NULL);
 
     std::vector<int> acceptor_peer_fd(num_servers, -1);
-    int num_alive_acceptors = C->ConnectToAllAcceptors(acceptor_peer_fd);
-
-    if ((float)num_alive_acceptors < (num_servers / 2.0)) {
-        // won't send P2a to anyone since only a minority is alive
+    // with vote relays, only the relay of each group is connected to first
+    bool relays = C->S->get_options().vote_relay_group > 0;
+    map<int, vector<int> > groups;      // ids of the rest of the group, by relay
+    int num_alive_acceptors = relays ? C->ConnectToRelays(acceptor_peer_fd, groups)
+                                     : C->ConnectToAllAcceptors(acceptor_peer_fd);
+
+    int quorum = C->S->get_phase2_quorum();
+    if (num_alive_acceptors < quorum) {
+        // won't send P2a to anyone since less than a quorum is alive
         D(cout << "SC" << C->S->get_pid()
-          << ": Exiting because only minority of acceptors are alive" << endl;)
-        usleep(kMinoritySleep);
+          << ": Exiting because less than a quorum of acceptors are alive" << endl;)
+        C->S->get_failure_detector()->WaitForQuorum(quorum, kMinoritySleep);
 
         Triple no_op(toSend.b, toSend.s, Proposal(to_string(0), to_string(0), kNoop));
         C->SendDecision(no_op);
         return NULL;
     }
 
-    C->SendP2a(toSend, acceptor_peer_fd);
+    vector<int> targets, spare;
+    if (relays) {
+        // the rest of each group is connected to only if its relay fails
+        for (const auto &group : groups) {
+            targets.push_back(group.first);
+            spare.insert(spare.end(), group.second.begin(), group.second.end());
+        }
+    } else {
+        C->ChooseP2aTargets(targets, spare);
+    }
+    struct timeval p2a_start;
+    gettimeofday(&p2a_start, NULL);
+    bool chain = !relays && C->S->get_options().chain_p2a && !spare.empty();
+    if (relays)
+        C->SendRelay(toSend, acceptor_peer_fd, groups);
+    else if (chain)
+        C->SendChain(toSend, acceptor_peer_fd, targets);
+    else
+        C->SendP2a(toSend, acceptor_peer_fd, targets);
+    time_t fallback_timeout = relays ? 2 * C->S->get_options().relay_timeout
+                                     : C->S->get_options().thrifty_timeout;
 
     int num_bytes;
 
     fd_set acceptor_set;
     int fd_max = INT_MIN;
     vector<int> fds;
-    int waitfor = num_servers;
+    set<int> acked;     // acceptors which accepted with the commander's ballot
+    std::vector<StringView> message, voters;   // reused, so parsing allocates nothing
+
+    // serv_id is the acceptor the message being handled came from. done is
+    // set once the slot is decided or the ballot preempted
+    int serv_id = -1;
+    bool done = false;
+    Dispatcher dispatcher("commander");
+    Dispatcher::Handler receive_votes = [&](const StringView &msg, const vector<StringView> &token,
+                                            const int fd) {
+        if (token[0] == kVotes && token.size() != 4)
+            return false;
+        D(cout << "SC" << C->S->get_pid()
+          << ": " << token[0] << " message received from acceptor S" << serv_id << ": " << msg <<  endl;)
+        Metrics::AddVoteMessage();
+
+        // the last acceptor of a chain answers for the whole chain,
+        // and a vote relay for those of its group which accepted
+        bool chain_ack = (token.size() == 4 && token[3] == kChain);
+        bool relayed = (token[0] == kVotes);
+        if (!chain_ack && !relayed)
+            C->S->get_failure_detector()->AddRoundTrip(
+                serv_id, ElapsedSince(C->get_p2a_sent(serv_id)));
+
+        // close connection with this acceptor
+        // because no future communication with it will happen
+        close(fd);
+        C->set_acceptor_fd(serv_id, -1);
+
+        Ballot recvd_ballot = viewToBallot(token[2]);
+        if (recvd_ballot == toSend.b)
+        {
+            if (chain_ack && chain)
+                acked.insert(targets.begin(), targets.end());
+            if (relayed) {
+                SplitView(token[3], kInternalSetDelim[0], voters);
+                for (const auto &voter : voters)
+                    acked.insert(viewToInt(voter));
+            }
+            acked.insert(serv_id);
+            if (acked.size() >= quorum)
+            {
+                if (toSend.p.msg != kNoop)
+                    Metrics::AddCommit(ElapsedSince(start));
+                C->SendCommit(toSend);
+                C->RaisePendingRoundTrips();
+                C->CloseAllConnections();
+                done = true;
+            }
+        } else {
+            C->SendPreEmpted(recvd_ballot);
+            C->CloseAllConnections();
+            done = true;
+        }
+        return true;
+    };
+    dispatcher.Register(MSG_P2B, receive_votes);
+    dispatcher.Register(MSG_VOTES, receive_votes);
     while (true) {  // always listen to messages from the acceptors
+        if (!spare.empty()
+                && C->NeedsFallback(targets, groups, acked.size(), ElapsedSince(p2a_start))) {
+            if (relays) {
+                vector<int> unheard;
+                for (auto i : spare) {
+                    if (acked.count(i) == 0)
+                        unheard.push_back(i);
+                }
+                spare.swap(unheard);
+                C->ConnectToAcceptors(spare, acceptor_peer_fd);
+            }
+            D(cout << "SC" << C->S->get_pid() << ": Sending P2A to " << spare.size()
+              << " more acceptor(s) after " << ElapsedSince(p2a_start) / 1000 << " ms" << endl;)
+            C->SendP2a(toSend, acceptor_peer_fd, spare);
+            spare.clear();
+        }
         C->GetAcceptorFdSet(acceptor_set, fds, fd_max);
 
         if (fd_max == INT_MIN) {
             D(cout << "SC" << C->S->get_pid()
               << ": Exiting because no more interesting acceptors left" << endl;)
 
-            usleep(kMinoritySleep);
+            C->S->get_failure_detector()->WaitForQuorum(quorum, kMinoritySleep);
 
             Triple no_op(toSend.b, toSend.s, Proposal(to_string(0), to_string(0), kNoop));
             C->SendDecision(no_op);
             return NULL;
         }
 
-        int rv = select(fd_max + 1, &acceptor_set, NULL, NULL, NULL);
+        // wake up every heartbeat interval to stop waiting for
+        // acceptors which the failure detector started suspecting
+        time_t interval = C->S->get_failure_detector()->get_heartbeat_interval();
+        if (!spare.empty()) {
+            // and when the spare acceptors are due
+            time_t left = fallback_timeout - ElapsedSince(p2a_start);
+            interval = min(interval, max(left, (time_t)0));
+        }
+        struct timeval timeout;
+        timeout.tv_sec = interval / (1000 * 1000);
+        timeout.tv_usec = interval % (1000 * 1000);
+        int rv = select(fd_max + 1, &acceptor_set, NULL, NULL, &timeout);
 
         if (rv == -1) { //error in select
             D(cout << "SC" << C->S->get_pid() << ": ERROR in select()" << endl;)
         } else if (rv == 0) {
-            D(cout << "SC" << C->S->get_pid() << ": ERROR: Unexpected timeout in select()" << endl;)
+            continue;
         } else {
             for (int i = 0; i < fds.size(); i++) {
                 if (FD_ISSET(fds[i], &acceptor_set)) { // we got one!!
                     char buf[kMaxDataSize];
-                    int serv_id = C->GetAcceptorIdFromFd(fds[i]);
+                    serv_id = C->GetAcceptorIdFromFd(fds[i]);
                     if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) == -1) {
                         D(cout << "SC" << C->S->get_pid() << ": ERROR in receiving p2b from acceptor S" << serv_id << endl;)
                         close(fds[i]);
@@ -293,38 +739,13 @@ void* CommanderMode(void* _rcv_thread_arg) {
                         close(fds[i]);
                         C->set_acceptor_fd(serv_id, -1);
                     } else {
-                        buf[num_bytes] = '\0';
-                        std::vector<string> message = split(string(buf), kMessageDelim[0]);
+                        C->S->get_failure_detector()->Heard(serv_id);
+                        C->inbox_.Extract(fds[i], buf, num_bytes, message);
                         for (const auto &msg : message) {
-                            std::vector<string> token = split(string(msg), kInternalDelim[0]);
-
-                            if (token[0] == kP2b) {
-                                D(cout << "SC" << C->S->get_pid()
-                                  << ": P2b message received from acceptor S" << serv_id << ": " << msg <<  endl;)
-
-                                // close connection with this acceptor
-                                // because no future communication with it will happen
-                                close(fds[i]);
-                                C->set_acceptor_fd(serv_id, -1);
-
-                                Ballot recvd_ballot = stringToBallot(token[2]);
-                                if (recvd_ballot == toSend.b)
-                                {
-                                    waitfor--;
-                                    if ((float)waitfor < (num_servers / 2.0))
-                                    {
-                                        C->SendDecision(toSend);
-                                        C->CloseAllConnections();
-                                        return NULL;
-                                    }
-                                } else {
-                                    C->SendPreEmpted(recvd_ballot);
-                                    C->CloseAllConnections();
-                                    return NULL;
-                                }
-                            } else {    //other messages
+                            if (!dispatcher.Dispatch(msg, fds[i]))
                                 D(cout << "SC" << C->S->get_pid() << ": Unexpected message received: " << msg << endl;)
-                            }
+                            if (done)
+                                return NULL;
                         }
                     }
                 }
@@ -3,6 +3,7 @@
 
 #include "server.h"
 #include "utilities.h"
+#include "channel.h"
 #include "vector"
 #include "string"
 #include "unordered_set"
@@ -18,34 +19,56 @@ class Server;
 class Commander {
 public:
     bool ConnectToAcceptor(const int server_id);
-    void SendP2a(const Triple &t, const vector<int> &acceptor_peer_fd);
+    string P2aMessage(const Triple &t, const vector<int> &acceptor_peer_fd, const int server_id);
+    void SendP2a(const Triple &t, const vector<int> &acceptor_peer_fd, const vector<int> &targets);
+    void SendChain(const Triple &t, const vector<int> &acceptor_peer_fd, const vector<int> &chain);
+    void SendRelay(const Triple &t, const vector<int> &acceptor_peer_fd,
+                   const map<int, vector<int> > &groups);
+    void SendToAcceptors(const vector<pair<int, string> > &msgs);
+    void ChooseP2aTargets(vector<int> &targets, vector<int> &spare);
+    bool NeedsFallback(const vector<int> &targets, const map<int, vector<int> > &groups,
+                       const int num_acked, const time_t waited);
+    void RaisePendingRoundTrips();
     void SendDecision(const Triple &t);
+    void SendCommit(const Triple &t);
     void SendPreEmpted(const Ballot& b);
     void SendToServers(const string& type, const string& msg);
     int ConnectToAllAcceptors(std::vector<int> &acceptor_peer_fd);
+    int ConnectToRelays(std::vector<int> &acceptor_peer_fd, map<int, vector<int> > &groups);
+    int ConnectToAcceptors(const vector<int> &ids, std::vector<int> &acceptor_peer_fd);
     void GetAcceptorFdSet(fd_set& acceptor_set, vector<int>& fds, int& fd_max);
     void Unicast(const string &type, const string& msg);
+    void FlushOutbox();
     void CloseAllConnections();
     int GetAcceptorIdFromFd(int fd);
 
     int get_leader_fd(const int server_id);
     int get_replica_fd(const int server_id);
     int get_acceptor_fd(const int server_id);
+    struct timeval get_p2a_sent(const int server_id);
 
     void set_leader_fd(const int server_id, const int fd);
     void set_replica_fd(const int server_id, const int fd);
     void set_acceptor_fd(const int server_id, const int fd);
+    void set_skip(const int skip_to, const int stride);
 
     Commander(Server *_S);
     Commander(Server *_S, const int num_servers);
 
     Server *S;
+    Inbox inbox_;
     ~Commander();
 
 private:
     static std::vector<int> leader_fd_;
     static std::vector<int> replica_fd_;
     std::vector<int> acceptor_fd_;
+    std::vector<struct timeval> p2a_sent_;  // when P2A went to each acceptor, 0 if it did not
+    static int num_started_;                // commanders started, for thrifty probes
+    int skip_to_;       // see CommanderThreadArgument
+    int skip_stride_;
+    vector<Proposal> fragments_;    // fragment of the chat for each acceptor, with erasure coding
+    Outbox outbox_;
 };
 
 #endif //COMMANDER_H_
@@ -0,0 +1,152 @@
+#include "compression.h"
+#include "cstring"
+#include "vector"
+using namespace std;
+
+const int kLzMinMatch = 4;
+const int kLzHashBits = 12;
+const size_t kLzMaxOffset = 65535;
+
+/**
+ * @return hash of the 4 bytes at p, kLzHashBits wide
+ */
+static inline unsigned int LzHash(const char *p)
+{
+    unsigned int v;
+    memcpy(&v, p, sizeof v);
+    return (v * 2654435761u) >> (32 - kLzHashBits);
+}
+
+/**
+ * appends a length which did not fit its nibble, as bytes of 255 and a
+ * last one below 255
+ */
+static void PutLength(size_t len, string &out)
+{
+    while (len >= 255) {
+        out += (char)255;
+        len -= 255;
+    }
+    out += (char)len;
+}
+
+/**
+ * appends one sequence: literals from in, then a match unless it is the last
+ * @param literals first literal
+ * @param num_literals
+ * @param offset   distance back to the match, 0 for the last sequence
+ * @param match    match length, kLzMinMatch or more
+ */
+static void PutSequence(const char *literals, const size_t num_literals,
+                        const size_t offset, const size_t match, string &out)
+{
+    size_t match_code = (offset == 0) ? 0 : match - kLzMinMatch;
+    out += (char)(((num_literals < 15 ? num_literals : 15) << 4)
+                  | (match_code < 15 ? match_code : 15));
+    if (num_literals >= 15)
+        PutLength(num_literals - 15, out);
+    out.append(literals, num_literals);
+    if (offset == 0)
+        return;
+    out += (char)(offset & 0xff);
+    out += (char)(offset >> 8);
+    if (match_code >= 15)
+        PutLength(match_code - 15, out);
+}
+
+/**
+ * compresses in greedily: at each position, the last earlier position with
+ * the same 4 bytes hash is tried as a match, and extended as far as it goes
+ * @param  in bytes to be compressed
+ * @return    the compressed block, which LzDecompress() turns back into in
+ */
+string LzCompress(const string &in)
+{
+    string out;
+    out.reserve(in.size() / 2 + 16);
+    const char *base = in.data();
+    size_t n = in.size();
+    vector<size_t> last(1 << kLzHashBits, (size_t)-1);
+
+    size_t anchor = 0;      // first byte not written out yet
+    size_t i = 0;
+    while (i + kLzMinMatch <= n) {
+        unsigned int h = LzHash(base + i);
+        size_t candidate = last[h];
+        last[h] = i;
+        if (candidate == (size_t)-1 || i - candidate > kLzMaxOffset
+                || memcmp(base + candidate, base + i, kLzMinMatch) != 0) {
+            i++;
+            continue;
+        }
+
+        size_t match = kLzMinMatch;
+        while (i + match < n && base[candidate + match] == base[i + match])
+            match++;
+        PutSequence(base + anchor, i - anchor, i - candidate, match, out);
+        // positions inside the match are not hashed, except the last one
+        i += match;
+        anchor = i;
+        if (i + kLzMinMatch <= n)
+            last[LzHash(base + i - 1)] = i - 1;
+    }
+    PutSequence(base + anchor, n - anchor, 0, 0, out);
+    return out;
+}
+
+/**
+ * reads a length continued past its nibble
+ * @return false if in ends first
+ */
+static bool GetLength(const string &in, size_t &pos, size_t &len)
+{
+    unsigned char c;
+    do {
+        if (pos >= in.size())
+            return false;
+        c = (unsigned char)in[pos++];
+        len += c;
+    } while (c == 255);
+    return true;
+}
+
+/**
+ * @param  in   block from LzCompress()
+ * @param  size bytes it was compressed from
+ * @param  out  [out] the bytes it was compressed from
+ * @return      false if in is not a block of size bytes
+ */
+bool LzDecompress(const string &in, const size_t size, string &out)
+{
+    out.clear();
+    out.reserve(size);
+    size_t pos = 0;
+    while (pos < in.size()) {
+        unsigned char token = (unsigned char)in[pos++];
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !GetLength(in, pos, num_literals))
+            return false;
+        if (pos + num_literals > in.size() || out.size() + num_literals > size)
+            return false;
+        out.append(in, pos, num_literals);
+        pos += num_literals;
+        if (pos == in.size())
+            break;      // the last sequence
+
+        if (pos + 2 > in.size())
+            return false;
+        size_t offset = (unsigned char)in[pos] | ((unsigned char)in[pos + 1] << 8);
+        pos += 2;
+        size_t match = (token & 0x0f);
+        if (match == 15 && !GetLength(in, pos, match))
+            return false;
+        match += kLzMinMatch;
+        if (offset == 0 || offset > out.size() || out.size() + match > size)
+            return false;
+        // a match may overlap the bytes it copies, so byte by byte
+        size_t from = out.size() - offset;
+        for (size_t j = 0; j < match; j++)
+            out += out[from + j];
+    }
+    return out.size() == size;
+}
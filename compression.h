@@ -0,0 +1,19 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include "string"
+using namespace std;
+
+/**
+ * LZ77 codec for bulk messages, in the block layout of LZ4.
+ * A compressed block is a run of sequences, each a token byte, literals
+ * and a match. The high nibble of the token is the number of literals,
+ * and the low nibble the match length less kLzMinMatch. 15 in either is
+ * continued by bytes of 255 up to one below 255. The literals follow, then
+ * the match's offset back into the output, 2 bytes little endian. The last
+ * sequence has literals only
+ */
+string LzCompress(const string &in);
+bool LzDecompress(const string &in, const size_t size, string &out);
+
+#endif //COMPRESSION_H_
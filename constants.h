@@ -6,9 +6,11 @@ using namespace std;
 // constants for socket connections
 const int kMaxDataSize = 2000 ;          // max number of bytes we can get at once
 const int kBacklog = 20;                // how many pending connections queue will hold
+const int kOutboxMaxBytes = 1 << 20;    // default max bytes queued for one peer
 
 // filenames
 const string kPortsFile = "./config/ports-file";
+const string kOptionsFile = "./config/options-file";
 
 // testfile keywords
 const string kStart = "start";
@@ -18,6 +20,8 @@ const string kRestartServer = "restartServer";
 const string kAllClear = "allClear";
 const string kAllClearRemove = "allClearRemove";
 const string kTimeBombLeader = "timeBombLeader";
+const string kTransferLeader = "transferLeader";
+const string kReadChatLog = "readChatLog";
 const string kPrintChatLog = "printChatLog";
 
 // file paths
@@ -35,7 +39,24 @@ const string kChatLog = "CHATLOG";
 const string kNewPrimary = "NEWPRIMARY";
 const string kTimeBomb = "TIMEBOMB";
 const string kGoAhead = "GOAHEAD";
+const string kReady = "READY";
+const string kHeartbeat = "HEARTBEAT";
+const string kRedirect = "REDIRECT";
+const string kPromised = "PROMISED";
+const string kTransfer = "TRANSFER";
+const string kHandoff = "HANDOFF";
+const string kLease = "LEASE";
+const string kLeaseAck = "LEASEACK";
+const string kRead = "READ";
+const string kReadResp = "READRESP";
+const string kReadIndex = "READINDEX";
+const string kReadIndexResp = "READINDEXRESP";
+const string kEpoch = "EPOCH";
+const string kSkip = "SKIP";
 const string kNoop = "NOOP";
+const string kFast = "FAST";
+const string kFastP2b = "FASTP2B";
+const string kAny = "ANY";
 
 const string kP1a = "P1A";
 const string kP2a = "P2A";
@@ -48,22 +69,56 @@ const string kPreEmpted = "PREEMPTED";
 const string kAdopted = "ADOPTED";
 const string kPropose = "PROPOSE";
 const string kResponse = "RESPONSE";
+const string kTentative = "TENTATIVE";
+const string kRollback = "ROLLBACK";
+const string kLearn = "LEARN";
+const string kCommit = "COMMIT";
+const string kChain = "CHAIN";
+const string kRelay = "RELAY";
+const string kVotes = "VOTES";
+const string kPayload = "PAYLOAD";
+const string kReqPayload = "REQPAYLOAD";
+const string kPayloadRef = "REF";         // msg of a chat whose body went to replicas apart
+const string kFragment = "FRAG";         // msg of a P2A carrying one erasure coded fragment of a chat
+const string kCompressedFrame = "~";     // starts a frame of a compressed message, see Outbox
+const string kLiteralChatId = "=";       // starts a chat id which is not a number, see allDecisionsToString
 
 const string kLeaderRole = "LEADER";
 const string kReplicaRole = "REPLICA";
+const string kAcceptorRole = "ACCEPTOR";
 
 const string kAllClearSet = "SET";
 const string kAllClearNotSet = "NOTSET";
 const string kAllClearDone = "DONE";
 
+// every this many commanders send P2A to all acceptors in thrifty mode,
+// so that round trip times of the acceptors left out stay up to date
+const int kThriftyProbeInterval = 16;
+
 // sleep values
 const time_t kGeneralSleep = 1000 * 1000;
 const time_t kBusyWaitSleep = 500 * 1000;
 const time_t kRecoveryWaitSleep = 100 * 1000;
 const time_t kAllClearSleep = 500 * 1000;
 const time_t kMinoritySleep = 2 * kGeneralSleep;
+const time_t kOutboxDrainTimeout = 200 * 1000;
+const time_t kConnectRetryInitial = 5 * 1000;   // first backoff between connect attempts
+const time_t kConnectRetryMax = 200 * 1000;     // backoff cap between connect attempts
+const time_t kReadyPollSleep = 5 * 1000;
+const time_t kHeartbeatInterval = 100 * 1000;   // default, see options-file
+const time_t kScoutBackoffInitial = 10 * 1000;  // first backoff before a scout retry
+const time_t kScoutBackoffMax = 640 * 1000;     // backoff cap before a scout retry
+const time_t kClockDrift = 10 * 1000;           // default, see options-file
+const time_t kThriftyTimeout = 50 * 1000;       // default, see options-file
+const time_t kFastTimeout = 100 * 1000;         // default, see options-file
+const time_t kRelayTimeout = 20 * 1000;         // default, see options-file
 
 // timeout values
+const time_t kConnectTimeout = 10 * 1000 * 1000;    // max time to keep retrying a connect
+const time_t kReadyTimeout = 1000 * 1000;           // max wait for READY after connecting
+const time_t kFailureTimeout = 500 * 1000;          // default, see options-file
+const time_t kDrainTimeout = 1000 * 1000;           // max wait for in-flight proposals before a handoff
+const time_t kPayloadRetry = 100 * 1000;            // wait before asking replicas for a missing chat body again
 const timeval kReceiveTimeoutTimeval = {
     0, // tv_sec
     500 * 1000 //tv_usec (microsec)
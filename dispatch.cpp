@@ -0,0 +1,151 @@
+#include "dispatch.h"
+#include "constants.h"
+#include "ctime"
+#include "cstring"
+using namespace std;
+
+// names of the message types, at the index of their MessageType
+static const string kMessageTypeNames[MSG_NUM_TYPES] = {
+    "",
+    kChat, kChatLog, kNewPrimary, kTimeBomb, kGoAhead, kReady,
+    kHeartbeat, kRedirect, kPromised, kTransfer, kHandoff,
+    kLease, kLeaseAck, kRead, kReadResp, kReadIndex,
+    kReadIndexResp, kEpoch, kSkip, kFast, kFastP2b, kAny,
+    kP1a, kP2a, kP1b, kP2b, kDecision, kAllDecisions,
+    kReqAllDecs, kPreEmpted, kAdopted, kPropose, kResponse,
+    kTentative, kRollback, kLearn, kCommit, kChain, kRelay,
+    kVotes, kPayload, kReqPayload,
+};
+
+// slots of the open addressed table of type names, a power of 2
+const size_t kTypeTableSize = 128;
+
+/**
+ * hash of a type name from its first and last letters and its length,
+ * which puts all but three of the names in slots of their own, and costs the
+ * same for any name. The factors were picked for fewest collisions
+ */
+static size_t HashTypeName(const char *data, const size_t size) {
+    if (size == 0)
+        return 0;
+    return (unsigned char)data[0] * 15 + (unsigned char)data[size - 1] * 3 + size * 17;
+}
+
+// a slot of the type table, with a copy of the name to compare in place
+struct TypeSlot {
+    MessageType type;
+    size_t size;
+    const char *name;
+};
+
+/**
+ * table from hashed type names to types. A name is at the slot of its hash,
+ * or the next free one after it
+ */
+static struct TypeTable {
+    TypeSlot slot[kTypeTableSize];
+
+    TypeTable() {
+        for (size_t h = 0; h < kTypeTableSize; h++)
+            slot[h].type = MSG_UNKNOWN;
+        for (int t = MSG_UNKNOWN + 1; t < MSG_NUM_TYPES; t++) {
+            const string &name = kMessageTypeNames[t];
+            size_t h = HashTypeName(name.data(), name.size()) & (kTypeTableSize - 1);
+            while (slot[h].type != MSG_UNKNOWN)
+                h = (h + 1) & (kTypeTableSize - 1);
+            slot[h].type = (MessageType)t;
+            slot[h].size = name.size();
+            slot[h].name = name.data();
+        }
+    }
+} type_table;
+
+/**
+ * @param  name type name, the first token of a message
+ * @return      its type, MSG_UNKNOWN for no known name
+ */
+MessageType MessageTypeOf(const StringView &name) {
+    size_t h = HashTypeName(name.data, name.size) & (kTypeTableSize - 1);
+    while (type_table.slot[h].type != MSG_UNKNOWN) {
+        const TypeSlot &slot = type_table.slot[h];
+        if (slot.size == name.size && memcmp(slot.name, name.data, name.size) == 0)
+            return slot.type;
+        h = (h + 1) & (kTypeTableSize - 1);
+    }
+    return MSG_UNKNOWN;
+}
+
+const string &MessageTypeName(const MessageType type) {
+    return kMessageTypeNames[type];
+}
+
+/**
+ * @return monotonic clock, in nanosec
+ */
+static long long MonotonicTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
+}
+
+/**
+ * @param role name of the role, which the counters of its message types
+ *             are named after
+ */
+Dispatcher::Dispatcher(const string &role) : role_(role) {
+}
+
+/**
+ * leaves the counts of the role's messages to Metrics
+ */
+Dispatcher::~Dispatcher() {
+    for (int t = 0; t < MSG_NUM_TYPES; t++) {
+        if (handlers_[t])
+            Metrics::RemoveDispatchStats(&stats_[t]);
+    }
+}
+
+/**
+ * makes handler the one for messages of type, in place of any before
+ */
+void Dispatcher::Register(const MessageType type, const Handler &handler) {
+    if (!handlers_[type])
+        Metrics::AddDispatchStats(role_ + "_" + MessageTypeName(type), &stats_[type]);
+    handlers_[type] = handler;
+}
+
+/**
+ * takes messages of type without doing anything, for those which are left
+ * over from an earlier mode of the role
+ */
+void Dispatcher::Ignore(const MessageType type) {
+    Register(type, [](const StringView &, const vector<StringView> &, const int) {
+        return true;
+    });
+}
+
+/**
+ * calls the handler of msg's type
+ * @param  msg message, without kMessageDelim
+ * @param  fd  fd msg was received on
+ * @return     false if no handler took msg, which the caller reports
+ */
+bool Dispatcher::Dispatch(const StringView &msg, const int fd) {
+    SplitView(msg, kInternalDelim[0], token_);
+    if (token_.empty())
+        return false;
+    MessageType type = MessageTypeOf(token_[0]);
+    if (!handlers_[type])
+        return false;
+
+    DispatchStats &stats = stats_[type];
+    long long count = stats.handled.load(memory_order_relaxed);
+    AddToCounter(stats.handled, 1);
+    if (count % kDispatchTimeEvery != 0)
+        return handlers_[type](msg, token_, fd);
+
+    long long start = MonotonicTime();
+    bool handled = handlers_[type](msg, token_, fd);
+    Metrics::AddDispatch(stats, MonotonicTime() - start);
+    return handled;
+}
@@ -0,0 +1,65 @@
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+#include "string"
+#include "vector"
+#include "functional"
+#include "utilities.h"
+#include "metrics.h"
+using namespace std;
+
+// a clock read costs more than finding a handler, so only some messages are timed
+const long long kDispatchTimeEvery = 64;
+
+// message types, as told by the text before a message's first kInternalDelim
+typedef enum {
+    MSG_UNKNOWN,
+    MSG_CHAT, MSG_CHATLOG, MSG_NEWPRIMARY, MSG_TIMEBOMB, MSG_GOAHEAD, MSG_READY,
+    MSG_HEARTBEAT, MSG_REDIRECT, MSG_PROMISED, MSG_TRANSFER, MSG_HANDOFF,
+    MSG_LEASE, MSG_LEASEACK, MSG_READ, MSG_READRESP, MSG_READINDEX,
+    MSG_READINDEXRESP, MSG_EPOCH, MSG_SKIP, MSG_FAST, MSG_FASTP2B, MSG_ANY,
+    MSG_P1A, MSG_P2A, MSG_P1B, MSG_P2B, MSG_DECISION, MSG_ALLDECISIONS,
+    MSG_REQALLDECS, MSG_PREEMPTED, MSG_ADOPTED, MSG_PROPOSE, MSG_RESPONSE,
+    MSG_TENTATIVE, MSG_ROLLBACK, MSG_LEARN, MSG_COMMIT, MSG_CHAIN, MSG_RELAY,
+    MSG_VOTES, MSG_PAYLOAD, MSG_REQPAYLOAD,
+    MSG_NUM_TYPES       // not a type, the number of them
+} MessageType;
+
+MessageType MessageTypeOf(const StringView &name);
+const string &MessageTypeName(const MessageType type);
+
+/**
+ * handler table of one role's receive loop. The role registers a handler
+ * per message type it takes when it starts, and Dispatch() tokenizes each
+ * message, looks its type up once and calls the handler at that index.
+ * Every handled message is counted under <role>_<type>, and the first and
+ * every kDispatchTimeEvery-th message of a type are timed. The counters are
+ * the Dispatcher's own and take no lock, as it is used by one thread only.
+ * They are atomic, since Metrics reads them from other threads when it
+ * prints them. A handler gets the message,
+ * its tokens and the fd it came on, and returns false for a message it does
+ * not take, such as one with a wrong number of tokens
+ */
+class Dispatcher {
+public:
+    typedef function<bool(const StringView &msg, const vector<StringView> &token,
+                          const int fd)> Handler;
+
+    Dispatcher(const string &role);
+    ~Dispatcher();
+    void Register(const MessageType type, const Handler &handler);
+    void Ignore(const MessageType type);
+    bool Dispatch(const StringView &msg, const int fd);
+
+private:
+    // Metrics holds the counters by their address
+    Dispatcher(const Dispatcher &);
+    Dispatcher &operator=(const Dispatcher &);
+
+    string role_;
+    Handler handlers_[MSG_NUM_TYPES];
+    DispatchStats stats_[MSG_NUM_TYPES];    // of the types with a handler
+    vector<StringView> token_;      // reused, so dispatching allocates nothing
+};
+
+#endif //DISPATCH_H_
@@ -0,0 +1,118 @@
+#include "election.h"
+#include "server.h"
+#include "failure-detector.h"
+#include "constants.h"
+#include "iostream"
+#include "unistd.h"
+#include "sys/time.h"
+using namespace std;
+
+#define DEBUG
+
+#ifdef DEBUG
+#  define D(x) x
+#else
+#  define D(x)
+#endif // DEBUG
+
+/**
+ * picks the server which should take over from a failed primary: the next
+ * server after it, round robin, which the failure detector does not suspect.
+ * servers with the same view of failures pick the same candidate
+ * @param  S          pointer to server class object
+ * @param  primary_id id of the failed primary
+ * @return            id of candidate
+ */
+static int NextCandidate(Server *S, const int primary_id) {
+    FailureDetector *FD = S->get_failure_detector();
+    int n = S->get_num_servers();
+    int i = (primary_id + 1) % n;
+    while (i != primary_id && FD->IsSuspected(i)) {
+        i = (i + 1) % n;
+    }
+    return i;
+}
+
+/**
+ * makes a server follow the primary elected with ballot b, if b is newer
+ * than the latest election known to it.
+ * ballots travel on heartbeats, so every server learns of an election
+ * within a heartbeat interval
+ * @param S pointer to server class object
+ * @param b ballot of an election. b.id is the elected primary
+ */
+void LearnElectionBallot(Server *S, const Ballot &b) {
+    if (!S->AdoptElectionBallot(b))
+        return;
+
+    // the next heartbeats carry b, and ack the election to the candidate
+    S->get_failure_detector()->ForceHeartbeats();
+
+    // a recovering server may already have been spawned with this primary
+    if (b.id == S->get_primary_id())
+        return;
+
+    D(cout << "S" << S->get_pid() << " : S" << b.id << " elected primary with ballot "
+      << ballotToString(b) << endl;)
+    S->HandleNewPrimary(b.id);
+}
+
+/**
+ * thread entry function for electing a new primary without the master.
+ * every heartbeat interval, a server which suspects the primary checks
+ * whether it is the next candidate. If so, it proposes itself with a ballot
+ * higher than any election it knows of and announces the ballot on the
+ * heartbeat links. Other servers follow the highest ballot they hear of,
+ * and ack it on their own heartbeats. The candidate takes over as primary
+ * once a majority of servers acked its ballot, so that two candidates
+ * with different views of failures cannot both take over
+ * @param  _S pointer to server class object
+ * @return    NULL
+ */
+void* ElectionEntry(void* _S) {
+    Server *S = (Server*)_S;
+    FailureDetector *FD = S->get_failure_detector();
+
+    while (true) {
+        usleep(FD->get_heartbeat_interval());
+
+        // a recovering server does not know the latest ballot yet
+        int primary_id = S->get_primary_id();
+        if (S->get_mode() == RECOVER || primary_id == S->get_pid()
+                || !FD->IsSuspected(primary_id))
+            continue;
+
+        if (NextCandidate(S, primary_id) != S->get_pid())
+            continue;
+
+        struct timeval election_time;
+        gettimeofday(&election_time, NULL);
+        Ballot b = S->get_election_ballot();
+        b = Ballot(S->get_pid(), b.seq_num + 1);
+        if (!S->AdoptElectionBallot(b))
+            continue;
+
+        D(cout << "S" << S->get_pid() << " : Proposed self as primary with ballot "
+          << ballotToString(b) << " after S" << primary_id << " was suspected" << endl;)
+        FD->ForceHeartbeats();
+
+        // gives up if a higher election comes along while waiting
+        int majority = S->get_num_servers() / 2 + 1;
+        RetryWithBackoff([&]() {
+            return S->CountElectionAcks(b) >= majority || !(S->get_election_ballot() == b);
+        }, FD->get_failure_timeout());
+        if (S->CountElectionAcks(b) < majority) {
+            D(cout << "S" << S->get_pid() << " : Election with ballot " << ballotToString(b)
+              << " not acked by a majority" << endl;)
+            continue;
+        }
+
+        D(cout << "S" << S->get_pid() << " : Elected self as primary with ballot "
+          << ballotToString(b) << endl;)
+        S->SendNewPrimaryToMaster();
+        S->HandleNewPrimary(S->get_pid());
+        D(cout << "S" << S->get_pid() << " : Took over as primary in "
+          << ElapsedSince(election_time) / 1000 << " ms" << endl;)
+    }
+    return NULL;
+}
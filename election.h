@@ -0,0 +1,12 @@
+#ifndef ELECTION_H_
+#define ELECTION_H_
+
+#include "utilities.h"
+using namespace std;
+
+class Server;
+
+void* ElectionEntry(void* _S);
+void LearnElectionBallot(Server *S, const Ballot &b);
+
+#endif //ELECTION_H_
@@ -0,0 +1,371 @@
+#include "erasure.h"
+#include "constants.h"
+#include "iostream"
+#include "algorithm"
+using namespace std;
+
+#define DEBUG
+
+#ifdef DEBUG
+#  define D(x) x
+#else
+#  define D(x)
+#endif // DEBUG
+
+/**
+ * log and antilog tables of GF(2^8) with the polynomial x^8+x^4+x^3+x^2+1
+ * and generator 2. exp_ is doubled so that a product needs no modulo
+ */
+struct GaloisField {
+    unsigned char exp_[512];
+    int log_[256];
+
+    GaloisField() {
+        int x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp_[i] = exp_[i + 255] = (unsigned char)x;
+            log_[x] = i;
+            x <<= 1;
+            if (x & 0x100)
+                x ^= 0x11d;
+        }
+        exp_[510] = exp_[511] = exp_[0];
+        log_[0] = 0;
+    }
+
+    unsigned char Mul(const unsigned char a, const unsigned char b) const {
+        if (a == 0 || b == 0)
+            return 0;
+        return exp_[log_[a] + log_[b]];
+    }
+
+    unsigned char Inverse(const unsigned char a) const {
+        return exp_[255 - log_[a]];
+    }
+};
+
+static const GaloisField& Field() {
+    static const GaloisField field;
+    return field;
+}
+
+/**
+ * dst ^= c * src, over len bytes. The products of c with every low nibble
+ * and every high nibble are looked up in two 16 entry tables, so the loop
+ * body is two lookups and two xors per byte, with no branches
+ * @param c   constant to multiply src with
+ * @param src row to be multiplied
+ * @param dst row the product is added to
+ * @param len bytes in both rows
+ */
+void MulAddRow(const unsigned char c, const unsigned char *src, unsigned char *dst, const size_t len)
+{
+    if (c == 0)
+        return;
+    const GaloisField &gf = Field();
+    unsigned char low[16], high[16];
+    for (int x = 0; x < 16; x++) {
+        low[x] = gf.Mul(c, (unsigned char)x);
+        high[x] = gf.Mul(c, (unsigned char)(x << 4));
+    }
+    for (size_t i = 0; i < len; i++)
+        dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+}
+
+/**
+ * @param k fragments the data is cut into, and any k of which give it back
+ * @param m parity fragments. k + m is at most 256
+ */
+ReedSolomon::ReedSolomon(const int k, const int m) : k_(k), m_(m) {
+    const GaloisField &gf = Field();
+    matrix_.assign(k + m, vector<unsigned char>(k, 0));
+    for (int i = 0; i < k; i++)
+        matrix_[i][i] = 1;
+    // Cauchy rows 1 / (x_r + y_j), x_r = k + r and y_j = j are all distinct
+    for (int r = 0; r < m; r++) {
+        for (int j = 0; j < k; j++)
+            matrix_[k + r][j] = gf.Inverse((unsigned char)((k + r) ^ j));
+    }
+}
+
+int ReedSolomon::get_k() const {
+    return k_;
+}
+
+int ReedSolomon::get_m() const {
+    return m_;
+}
+
+/**
+ * cuts data into k data fragments, padded with zeros to the same size, and
+ * adds m parity fragments
+ * @param data      bytes to be coded
+ * @param fragments [out] k + m fragments of (size of data + k - 1) / k bytes
+ */
+void ReedSolomon::Encode(const string &data, vector<string> &fragments) const
+{
+    size_t len = (data.size() + k_ - 1) / k_;
+    fragments.assign(k_ + m_, string(len, '\0'));
+    for (int j = 0; j < k_; j++) {
+        size_t from = j * len;
+        if (from < data.size())
+            fragments[j].replace(0, min(len, data.size() - from), data, from, len);
+    }
+    for (int r = k_; r < k_ + m_; r++) {
+        unsigned char *dst = (unsigned char*)&fragments[r][0];
+        for (int j = 0; j < k_ && len > 0; j++)
+            MulAddRow(matrix_[r][j], (const unsigned char*)fragments[j].data(), dst, len);
+    }
+}
+
+/**
+ * inverts a k x k matrix in place, by Gauss-Jordan elimination
+ * @return false if it is singular
+ */
+bool ReedSolomon::Invert(vector<vector<unsigned char> > &a) const
+{
+    const GaloisField &gf = Field();
+    int n = a.size();
+    vector<vector<unsigned char> > inv(n, vector<unsigned char>(n, 0));
+    for (int i = 0; i < n; i++)
+        inv[i][i] = 1;
+
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        while (pivot < n && a[pivot][col] == 0)
+            pivot++;
+        if (pivot == n)
+            return false;
+        swap(a[col], a[pivot]);
+        swap(inv[col], inv[pivot]);
+
+        unsigned char scale = gf.Inverse(a[col][col]);
+        for (int j = 0; j < n; j++) {
+            a[col][j] = gf.Mul(a[col][j], scale);
+            inv[col][j] = gf.Mul(inv[col][j], scale);
+        }
+        for (int row = 0; row < n; row++) {
+            if (row == col || a[row][col] == 0)
+                continue;
+            unsigned char c = a[row][col];
+            MulAddRow(c, &a[col][0], &a[row][0], n);
+            MulAddRow(c, &inv[col][0], &inv[row][0], n);
+        }
+    }
+    a.swap(inv);
+    return true;
+}
+
+/**
+ * gives the data back from any k of its fragments
+ * @param  fragments fragments by index, 0 to k + m - 1
+ * @param  size      bytes of the data before padding
+ * @param  data      [out] the data
+ * @return           false if fewer than k fragments of the same size are
+ *                   given, or they do not fit size
+ */
+bool ReedSolomon::Decode(const map<int, string> &fragments, const size_t size, string &data) const
+{
+    vector<int> rows;
+    for (auto &f : fragments) {
+        if (f.first < 0 || f.first >= k_ + m_)
+            continue;
+        if (!rows.empty() && f.second.size() != fragments.at(rows[0]).size())
+            return false;
+        rows.push_back(f.first);
+        if ((int)rows.size() == k_)
+            break;
+    }
+    if ((int)rows.size() < k_)
+        return false;
+    size_t len = fragments.at(rows[0]).size();
+    if (len * k_ < size || (len > 0 && (len - 1) * k_ >= size))
+        return false;
+
+    // with the data fragments at hand the data is just their concatenation
+    data.clear();
+    if (rows.back() == k_ - 1) {
+        for (int j = 0; j < k_; j++)
+            data += fragments.at(j);
+        data.resize(size);
+        return true;
+    }
+
+    vector<vector<unsigned char> > a;
+    for (auto r : rows)
+        a.push_back(matrix_[r]);
+    if (!Invert(a))
+        return false;
+
+    data.assign(len * k_, '\0');
+    for (int j = 0; j < k_; j++) {
+        unsigned char *dst = (unsigned char*)&data[j * len];
+        for (int i = 0; i < k_ && len > 0; i++)
+            MulAddRow(a[j][i], (const unsigned char*)fragments.at(rows[i]).data(), dst, len);
+    }
+    data.resize(size);
+    return true;
+}
+
+static const string kBase64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * fragments are binary, and messages are text split at delimiters. base64
+ * uses none of the delimiters
+ */
+static string BytesToBase64(const string &bytes)
+{
+    string s;
+    s.reserve((bytes.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < bytes.size(); i += 3) {
+        unsigned int v = ((unsigned char)bytes[i] << 16) | ((unsigned char)bytes[i + 1] << 8)
+                         | (unsigned char)bytes[i + 2];
+        s += kBase64[v >> 18];
+        s += kBase64[(v >> 12) & 0x3f];
+        s += kBase64[(v >> 6) & 0x3f];
+        s += kBase64[v & 0x3f];
+    }
+    if (i < bytes.size()) {
+        unsigned int v = (unsigned char)bytes[i] << 16;
+        if (i + 1 < bytes.size())
+            v |= (unsigned char)bytes[i + 1] << 8;
+        s += kBase64[v >> 18];
+        s += kBase64[(v >> 12) & 0x3f];
+        s += (i + 1 < bytes.size()) ? kBase64[(v >> 6) & 0x3f] : '=';
+        s += '=';
+    }
+    return s;
+}
+
+/**
+ * @return false if s is not base64
+ */
+static bool Base64ToBytes(const string &s, string &bytes)
+{
+    // value of each base64 digit, -1 for other characters
+    static const struct Digits {
+        int value[256];
+        Digits() {
+            fill(value, value + 256, -1);
+            for (int i = 0; i < 64; i++)
+                value[(unsigned char)kBase64[i]] = i;
+        }
+    } digits;
+    const int *value = digits.value;
+
+    if (s.size() % 4 != 0)
+        return false;
+    bytes.clear();
+    bytes.reserve(s.size() / 4 * 3);
+    for (size_t i = 0; i < s.size(); i += 4) {
+        int pad = (s[i + 3] == '=') + (s[i + 2] == '=');
+        unsigned int v = 0;
+        for (int j = 0; j < 4 - pad; j++) {
+            int c = value[(unsigned char)s[i + j]];
+            if (c == -1)
+                return false;
+            v |= c << (18 - 6 * j);
+        }
+        bytes += (char)(v >> 16);
+        if (pad < 2)
+            bytes += (char)((v >> 8) & 0xff);
+        if (pad < 1)
+            bytes += (char)(v & 0xff);
+    }
+    return true;
+}
+
+/**
+ * @return true if the body of p is one fragment of a chat,
+ *         FRAG<index>:<size>:<base64 of fragment>
+ */
+bool IsFragment(const Proposal &p)
+{
+    return p.msg.compare(0, kFragment.size(), kFragment) == 0;
+}
+
+/**
+ * splits the body of a chat into fragments, one per acceptor
+ * @param  rs code with one fragment per acceptor
+ * @return    k + m proposals of the chat, each with one fragment as body.
+ *            NOOPs are not split
+ */
+vector<Proposal> FragmentProposal(const ReedSolomon &rs, const Proposal &p)
+{
+    int n = rs.get_k() + rs.get_m();
+    if (p.msg == kNoop)
+        return vector<Proposal>(n, p);
+
+    vector<string> fragments;
+    rs.Encode(p.msg, fragments);
+    vector<Proposal> rval;
+    for (int i = 0; i < n; i++) {
+        string msg = kFragment + to_string(i) + ":" + to_string(p.msg.size()) + ":"
+                     + BytesToBase64(fragments[i]);
+        rval.push_back(Proposal(p.client_id, p.chat_id, msg));
+    }
+    return rval;
+}
+
+/**
+ * rebuilds a chat from fragments of it
+ * @param  fragments proposals with a fragment each, of the same chat
+ * @param  p         [out] the chat
+ * @return           false if they are fewer than k, or not of one chat
+ */
+bool JoinFragments(const ReedSolomon &rs, const vector<Proposal> &fragments, Proposal &p)
+{
+    map<int, string> parts;
+    long size = -1;
+    for (const auto &f : fragments) {
+        if (!IsFragment(f) || f.client_id != fragments[0].client_id
+                || f.chat_id != fragments[0].chat_id)
+            return false;
+        vector<string> field = split(f.msg.substr(kFragment.size()), ':');
+        if (field.size() < 2 || (size != -1 && stol(field[1]) != size))
+            return false;
+        size = stol(field[1]);
+        string bytes;
+        if (field.size() == 3 && !Base64ToBytes(field[2], bytes))
+            return false;
+        parts[stoi(field[0])] = bytes;
+    }
+
+    string data;
+    if (size == -1 || !rs.Decode(parts, size, data))
+        return false;
+    p = Proposal(fragments[0].client_id, fragments[0].chat_id, data);
+    return true;
+}
+
+/**
+ * replaces the fragments acceptors accepted with the chats they came from.
+ * The fragments of a slot accepted with the same ballot are joined, and
+ * dropped if fewer than k came. A chat can only have been chosen with a
+ * ballot if at least k of any phase 1 quorum accepted its fragments, so
+ * the pvalues left are the ones which may have been chosen
+ * @param  pvalues pvalues from P1Bs
+ * @return         pvalues with whole chats
+ */
+unordered_set<Triple> JoinFragmentedPvalues(const ReedSolomon &rs, const unordered_set<Triple> &pvalues)
+{
+    unordered_set<Triple> rval;
+    map<pair<int, Ballot>, vector<Proposal> > fragments;
+    for (const auto &t : pvalues) {
+        if (IsFragment(t.p))
+            fragments[make_pair(t.s, t.b)].push_back(t.p);
+        else
+            rval.insert(t);
+    }
+    for (const auto &f : fragments) {
+        Proposal p;
+        if (JoinFragments(rs, f.second, p)) {
+            rval.insert(Triple(f.first.second, f.first.first, p));
+        } else {
+            D(cout << "Dropping " << f.second.size() << " fragment(s) of slot "
+              << f.first.first << ", too few to rebuild" << endl;)
+        }
+    }
+    return rval;
+}
@@ -0,0 +1,42 @@
+#ifndef ERASURE_H_
+#define ERASURE_H_
+
+#include "string"
+#include "vector"
+#include "map"
+#include "unordered_set"
+#include "utilities.h"
+using namespace std;
+
+/**
+ * systematic Reed-Solomon code over GF(2^8).
+ * data is cut into k data fragments of equal size, and m parity fragments
+ * are computed from them with a Cauchy matrix. Any k of the k + m fragments
+ * give the data back. Fragments are combined a whole row at a time, and a
+ * row is multiplied by a constant with two 16 entry tables, for the low and
+ * the high nibble of each byte, the layout SIMD byte shuffles take
+ */
+class ReedSolomon {
+public:
+    ReedSolomon(const int k, const int m);
+    void Encode(const string &data, vector<string> &fragments) const;
+    bool Decode(const map<int, string> &fragments, const size_t size, string &data) const;
+    int get_k() const;
+    int get_m() const;
+
+private:
+    bool Invert(vector<vector<unsigned char> > &a) const;
+
+    int k_;
+    int m_;
+    vector<vector<unsigned char> > matrix_;     // (k + m) x k, identity on top
+};
+
+void MulAddRow(const unsigned char c, const unsigned char *src, unsigned char *dst, const size_t len);
+
+bool IsFragment(const Proposal &p);
+vector<Proposal> FragmentProposal(const ReedSolomon &rs, const Proposal &p);
+bool JoinFragments(const ReedSolomon &rs, const vector<Proposal> &fragments, Proposal &p);
+unordered_set<Triple> JoinFragmentedPvalues(const ReedSolomon &rs, const unordered_set<Triple> &pvalues);
+
+#endif //ERASURE_H_
@@ -0,0 +1,354 @@
+#include "failure-detector.h"
+#include "server.h"
+#include "channel.h"
+#include "constants.h"
+#include "utilities.h"
+#include "election.h"
+#include "iostream"
+#include "unistd.h"
+#include "algorithm"
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <signal.h>
+using namespace std;
+
+#define DEBUG
+
+#ifdef DEBUG
+#  define D(x) x
+#else
+#  define D(x)
+#endif // DEBUG
+
+extern int return_port_no(struct sockaddr *sa);
+
+pthread_mutex_t detector_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * initializes the detector. every peer starts out as alive,
+ * and is given failure timeout to show a sign of life
+ * @param pid                id of this server
+ * @param num_servers        number of servers
+ * @param heartbeat_interval microsec between heartbeats on an idle link
+ * @param failure_timeout    microsec of silence before a peer is suspected
+ */
+void FailureDetector::Initialize(const int pid,
+                                 const int num_servers,
+                                 const time_t heartbeat_interval,
+                                 const time_t failure_timeout) {
+    pid_ = pid;
+    num_servers_ = num_servers;
+    heartbeat_interval_ = heartbeat_interval;
+    failure_timeout_ = failure_timeout;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    last_heard_.assign(num_servers, now);
+    last_sent_.assign(num_servers, {0, 0});
+    suspected_.assign(num_servers, false);
+    round_trip_.assign(num_servers, 0);
+}
+
+/**
+ * records a sign of life from a peer
+ * @param server_id id of server from which a message was received
+ */
+void FailureDetector::Heard(const int server_id) {
+    if (server_id < 0 || server_id >= num_servers_)
+        return;
+
+    pthread_mutex_lock(&detector_lock);
+    gettimeofday(&last_heard_[server_id], NULL);
+    if (suspected_[server_id]) {
+        suspected_[server_id] = false;
+        D(cout << "S" << pid_ << " : FD: S" << server_id << " is alive again" << endl;)
+    }
+    pthread_mutex_unlock(&detector_lock);
+}
+
+/**
+ * records that data was sent to a peer, which saves the next heartbeat
+ * @param server_id id of server to which a message was sent
+ */
+void FailureDetector::Sent(const int server_id) {
+    if (server_id < 0 || server_id >= num_servers_)
+        return;
+
+    pthread_mutex_lock(&detector_lock);
+    gettimeofday(&last_sent_[server_id], NULL);
+    pthread_mutex_unlock(&detector_lock);
+}
+
+/**
+ * @param  server_id id of peer server
+ * @return           true if nothing was heard from the peer for failure timeout.
+ *                   a server never suspects itself
+ */
+bool FailureDetector::IsSuspected(const int server_id) {
+    if (server_id == pid_)
+        return false;
+
+    pthread_mutex_lock(&detector_lock);
+    time_t silence = ElapsedSince(last_heard_[server_id]);
+    bool suspected = (silence >= failure_timeout_);
+    if (suspected && !suspected_[server_id]) {
+        // detection latency is the silence at the time of first suspicion
+        suspected_[server_id] = true;
+        D(cout << "S" << pid_ << " : FD: S" << server_id << " suspected after "
+          << silence / 1000 << " ms of silence" << endl;)
+    }
+    pthread_mutex_unlock(&detector_lock);
+    return suspected;
+}
+
+/**
+ * @param  server_id id of peer server
+ * @return           true if nothing was sent to the peer for heartbeat interval
+ */
+bool FailureDetector::NeedsHeartbeat(const int server_id) {
+    pthread_mutex_lock(&detector_lock);
+    bool idle = (ElapsedSince(last_sent_[server_id]) >= heartbeat_interval_);
+    pthread_mutex_unlock(&detector_lock);
+    return idle;
+}
+
+/**
+ * makes every peer due for a heartbeat, so that news carried
+ * on heartbeats goes out on the next round
+ */
+void FailureDetector::ForceHeartbeats() {
+    pthread_mutex_lock(&detector_lock);
+    last_sent_.assign(num_servers_, {0, 0});
+    pthread_mutex_unlock(&detector_lock);
+}
+
+/**
+ * @return number of servers not suspected, including this server
+ */
+int FailureDetector::CountAlive() {
+    int count = 0;
+    for (int i = 0; i < num_servers_; ++i) {
+        if (!IsSuspected(i))
+            count++;
+    }
+    return count;
+}
+
+/**
+ * @param  since point in time
+ * @return       number of servers heard from after since, including this server
+ */
+int FailureDetector::CountHeardSince(const struct timeval &since) {
+    int count = 1;
+    pthread_mutex_lock(&detector_lock);
+    for (int i = 0; i < num_servers_; ++i) {
+        if (i != pid_ && timercmp(&last_heard_[i], &since, >))
+            count++;
+    }
+    pthread_mutex_unlock(&detector_lock);
+    return count;
+}
+
+/**
+ * waits till a quorum of servers shows a sign of life after the call.
+ * used after finding less than a quorum reachable: a peer which just
+ * crashed is not suspected yet, so the wait asks for fresh messages instead
+ * @param  quorum  number of servers to hear from, including this server
+ * @param  timeout max time to wait, in microsec
+ * @return         true if a quorum was heard from within timeout
+ */
+bool FailureDetector::WaitForQuorum(const int quorum, const time_t timeout) {
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    return RetryWithBackoff([&]() {
+        return CountHeardSince(start) >= quorum;
+    }, timeout);
+}
+
+/**
+ * folds a measured round trip to a peer's acceptor into its estimate,
+ * smoothed the way TCP smooths its round trip time (1/8 per sample)
+ * @param server_id id of peer server
+ * @param rtt       microsec from sending P2A till receiving its P2B
+ */
+void FailureDetector::AddRoundTrip(const int server_id, const time_t rtt) {
+    if (server_id < 0 || server_id >= num_servers_)
+        return;
+
+    pthread_mutex_lock(&detector_lock);
+    if (round_trip_[server_id] == 0)
+        round_trip_[server_id] = max(rtt, (time_t)1);
+    else
+        round_trip_[server_id] += (rtt - round_trip_[server_id]) / 8;
+    pthread_mutex_unlock(&detector_lock);
+}
+
+/**
+ * raises the estimate of a peer whose P2B had not come after rtt.
+ * the round trip is only known to be longer, so it never lowers the estimate
+ * @param server_id id of peer server
+ * @param rtt       microsec waited so far for the P2B
+ */
+void FailureDetector::RaiseRoundTrip(const int server_id, const time_t rtt) {
+    if (server_id < 0 || server_id >= num_servers_)
+        return;
+
+    pthread_mutex_lock(&detector_lock);
+    if (rtt > round_trip_[server_id])
+        round_trip_[server_id] = rtt;
+    pthread_mutex_unlock(&detector_lock);
+}
+
+/**
+ * @param  server_id id of peer server
+ * @return           estimated round trip to the peer's acceptor in microsec,
+ *                   0 if none was measured yet
+ */
+time_t FailureDetector::get_round_trip(const int server_id) {
+    pthread_mutex_lock(&detector_lock);
+    time_t rtt = round_trip_[server_id];
+    pthread_mutex_unlock(&detector_lock);
+    return rtt;
+}
+
+time_t FailureDetector::get_heartbeat_interval() {
+    return heartbeat_interval_;
+}
+
+time_t FailureDetector::get_failure_timeout() {
+    return failure_timeout_;
+}
+
+/**
+ * connects to the listen port of a peer server for sending heartbeats.
+ * the connection uses an ephemeral port, and the peer learns who is on
+ * the other end from the heartbeats themselves
+ * @param  S         pointer to server class object
+ * @param  server_id id of server to connect to
+ * @return           fd of connection, -1 if connection failed
+ */
+static int ConnectForHeartbeats(Server *S, const int server_id) {
+    struct addrinfo hints, *servinfo, *l;
+    int sockfd = -1;
+    int rv;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE; // use my IP
+    if ((rv = getaddrinfo(NULL, std::to_string(S->get_server_listen_port(server_id)).c_str(),
+                          &hints, &servinfo)) != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+    // loop through all the results and connect to the first we can
+    for (l = servinfo; l != NULL; l = l->ai_next)
+    {
+        if ((sockfd = socket(l->ai_family, l->ai_socktype, l->ai_protocol)) == -1)
+            continue;
+        if (connect(sockfd, l->ai_addr, l->ai_addrlen) == -1) {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+        // the listen ports lie in the ephemeral range, so connecting to a
+        // crashed peer can end up connected to itself
+        struct sockaddr_storage local;
+        socklen_t len = sizeof local;
+        if (getsockname(sockfd, (struct sockaddr*)&local, &len) == 0
+                && ntohs(return_port_no((struct sockaddr *)&local))
+                   == S->get_server_listen_port(server_id)) {
+            close(sockfd);
+            sockfd = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(servinfo); // all done with this structure
+    return sockfd;
+}
+
+/**
+ * thread entry function for sending heartbeats to peer servers.
+ * a heartbeat is HEARTBEAT-<pid>-<election ballot>$.
+ * every heartbeat interval, each peer whose link carried no data
+ * since the last interval gets a heartbeat, and each peer is checked
+ * for suspicion
+ * @param  _S pointer to server class object
+ * @return    NULL
+ */
+void* HeartbeatEntry(void* _S) {
+    signal(SIGPIPE, SIG_IGN);
+    Server *S = (Server*)_S;
+    FailureDetector *FD = S->get_failure_detector();
+
+    std::vector<int> heartbeat_fd(S->get_num_servers(), -1);
+    while (true) {
+        // heartbeats carry the latest election ballot known to this server
+        string msg = kHeartbeat + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                     + ballotToString(S->get_election_ballot()) + kMessageDelim;
+        for (int i = 0; i < S->get_num_servers(); ++i) {
+            // checked every interval so that suspicions are logged on time
+            FD->IsSuspected(i);
+            if (i == S->get_pid() || !FD->NeedsHeartbeat(i))
+                continue;
+
+            if (heartbeat_fd[i] == -1)
+                heartbeat_fd[i] = ConnectForHeartbeats(S, i);
+            if (heartbeat_fd[i] == -1)
+                continue;
+
+            if (send(heartbeat_fd[i], msg.c_str(), msg.size(), MSG_DONTWAIT) == -1
+                    && errno != EAGAIN && errno != EWOULDBLOCK) {
+                close(heartbeat_fd[i]);
+                heartbeat_fd[i] = -1;
+                continue;
+            }
+            FD->Sent(i);
+        }
+        usleep(FD->get_heartbeat_interval());
+    }
+    return NULL;
+}
+
+/**
+ * thread function for receiving heartbeats from a peer server
+ * on a connection accepted on the server listen port
+ * @param  _arg pointer to HeartbeatLinkArgument
+ * @return      NULL
+ */
+void* ReceiveHeartbeats(void* _arg) {
+    HeartbeatLinkArgument *arg = (HeartbeatLinkArgument*)_arg;
+    Server *S = arg->S;
+    int fd = arg->fd;
+    delete arg;
+
+    Inbox inbox;
+    char buf[kMaxDataSize];
+    int num_bytes;
+    while ((num_bytes = recv(fd, buf, kMaxDataSize - 1, 0)) > 0) {
+        std::vector<string> message;
+        inbox.Extract(fd, buf, num_bytes, message);
+        for (const auto &msg : message) {
+            std::vector<string> token = split(string(msg), kInternalDelim[0]);
+            if (token[0] == kHeartbeat && token.size() == 3) {
+                S->get_failure_detector()->Heard(stoi(token[1]));
+                if (S->get_options().leader_election == CLUSTER_ELECTION) {
+                    Ballot b = stringToBallot(token[2]);
+                    S->NoteElectionBallot(stoi(token[1]), b);
+                    LearnElectionBallot(S, b);
+                }
+            } else {
+                D(cout << "S" << S->get_pid() << " : ERROR Unexpected message on heartbeat link: "
+                  << msg << endl;)
+            }
+        }
+    }
+    close(fd);
+    return NULL;
+}
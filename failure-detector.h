@@ -0,0 +1,60 @@
+#ifndef FAILURE_DETECTOR_H_
+#define FAILURE_DETECTOR_H_
+
+#include "vector"
+#include "ctime"
+#include "sys/time.h"
+using namespace std;
+
+class Server;
+
+void* HeartbeatEntry(void* _S);
+void* ReceiveHeartbeats(void* _arg);
+
+/**
+ * timeout based failure detector for peer servers.
+ * any message received from a peer, heartbeat or data, counts as a sign
+ * of life. A peer is suspected once nothing has been heard from it for
+ * failure timeout. Heartbeats are sent only on links which carried no
+ * data for a heartbeat interval, so a busy link costs no extra messages
+ */
+class FailureDetector {
+public:
+    void Initialize(const int pid,
+                    const int num_servers,
+                    const time_t heartbeat_interval,
+                    const time_t failure_timeout);
+    void Heard(const int server_id);
+    void Sent(const int server_id);
+    bool IsSuspected(const int server_id);
+    bool NeedsHeartbeat(const int server_id);
+    void ForceHeartbeats();
+    int CountAlive();
+    int CountHeardSince(const struct timeval &since);
+    bool WaitForQuorum(const int quorum, const time_t timeout);
+    void AddRoundTrip(const int server_id, const time_t rtt);
+    void RaiseRoundTrip(const int server_id, const time_t rtt);
+
+    time_t get_round_trip(const int server_id);
+
+    time_t get_heartbeat_interval();
+    time_t get_failure_timeout();
+
+private:
+    int pid_;
+    int num_servers_;
+    time_t heartbeat_interval_;
+    time_t failure_timeout_;
+
+    std::vector<struct timeval> last_heard_;
+    std::vector<struct timeval> last_sent_;
+    std::vector<bool> suspected_;   // last reported status, for logging changes
+    std::vector<time_t> round_trip_;    // smoothed P2A-P2B round trip, 0 till measured
+};
+
+struct HeartbeatLinkArgument {
+    Server *S;
+    int fd;
+};
+
+#endif //FAILURE_DETECTOR_H_
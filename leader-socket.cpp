@@ -108,6 +108,9 @@ void* AcceptConnectionsLeader(void* _L) {
         int process_id = L->S->IsReplicaPort(incoming_port);
         if (process_id != -1) { //incoming connection from chat port of a client
             L->set_replica_fd(process_id, new_fd);
+            SendReady(new_fd);
+            // a standing by leader listens to the replica from its next turn
+            L->S->get_wakeup(kLeaderRole)->Notify();
         } else {
             D(cout << "SR" << L->S->get_pid() << ": ERROR: Unexpected connect request from port "
               << incoming_port << endl;)
@@ -210,6 +213,11 @@ bool Leader::ConnectToCommander(const int server_id) {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return false;
+    }
     set_commander_fd(server_id, sockfd);
     return true;
 }
@@ -308,6 +316,11 @@ bool Leader::ConnectToScout(const int server_id) {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return false;
+    }
     set_scout_fd(server_id, sockfd);
     return true;
 }
\ No newline at end of file
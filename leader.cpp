@@ -2,6 +2,8 @@
 #include "server.h"
 #include "constants.h"
 #include "utilities.h"
+#include "metrics.h"
+#include "erasure.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -12,6 +14,7 @@
 #include "errno.h"
 #include "sys/socket.h"
 #include "limits.h"
+#include "stdlib.h"
 using namespace std;
 
 typedef pair<int, Proposal> SPtuple;
@@ -30,11 +33,14 @@ Leader::~Leader() {
 
 }
 
-Leader::Leader(Server* _S) {
+Leader::Leader(Server* _S) : acceptor_dispatcher_("leader") {
     S = _S;
 
     set_ballot_num(Ballot(S->get_pid(), 0));
     set_leader_active(false);
+    scout_backoff_ = kScoutBackoffInitial;
+    preemptions_ = 0;
+    seed_ = time(NULL) ^ (S->get_pid() << 16);
 
     int num_servers = S->get_num_servers();
 
@@ -43,6 +49,44 @@ Leader::Leader(Server* _S) {
     replica_fd_.resize(num_servers, -1);
 
     num_commanders_ = 0;
+    lease_round_ = 0;
+    lease_round_start_ = {0, 0};
+    lease_round_pending_ = false;
+    lease_from_slot_ = 0;
+    epoch_replica_fd_.resize(num_servers, -1);
+    preempted_by_ = Ballot(-1, -1);
+    fast_collision_ = false;
+    any_pending_ = false;
+    any_fd_.resize(num_servers, -1);
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
+
+    // see ReceiveFromAcceptor()
+    acceptor_dispatcher_.Register(MSG_LEASEACK, [this](const StringView &msg,
+                                                       const vector<StringView> &token, const int fd) {
+        if (token.size() != 4)
+            return false;
+        if (!lease_round_pending_ || viewToInt(token[3]) != lease_round_
+                || !(viewToBallot(token[2]) == get_ballot_num()))
+            return true;
+        lease_acks_.insert(viewToInt(token[1]));
+        if (lease_acks_.size() >= S->get_lease_quorum()) {
+            lease_round_pending_ = false;
+            S->ConfirmLeadership(lease_round_start_, lease_from_slot_);
+        }
+        return true;
+    });
+    acceptor_dispatcher_.Register(MSG_FASTP2B, [this](const StringView &msg,
+                                                      const vector<StringView> &token, const int fd) {
+        if (token.size() != 3)
+            return false;
+        ReceiveFastP2b(viewToTriple(token[2]), viewToInt(token[1]));
+        return true;
+    });
+    // left over from an earlier scout
+    acceptor_dispatcher_.Ignore(MSG_P1B);
+    acceptor_dispatcher_.Ignore(MSG_PROMISED);
 }
 
 int Leader::get_commander_fd(const int server_id) {
@@ -95,6 +139,30 @@ void Leader::set_leader_active(const bool b) {
     set_ballot_num(b);
 }
 
+/**
+ * moves ballot_num_ past a ballot seen in a preemption, so that a leader
+ * far behind the acceptors catches up in one round instead of one round
+ * per sequence number
+ * @param seen highest ballot known to the acceptors
+ */
+void Leader::JumpBallotPast(const Ballot &seen) {
+    Ballot b = get_ballot_num();
+    b.seq_num = max(b.seq_num, seen.seq_num) + 1;
+    set_ballot_num(b);
+}
+
+/**
+ * randomized exponential backoff before retrying a preempted scout.
+ * the cap doubles with every consecutive preemption, and the random
+ * sleep below it keeps competing leaders from retrying in lockstep
+ * @return microsec to sleep before sending P1A
+ */
+time_t Leader::NextScoutBackoff() {
+    time_t backoff = rand_r(&seed_) % scout_backoff_;
+    scout_backoff_ = min(2 * scout_backoff_, kScoutBackoffMax);
+    return backoff;
+}
+
 void Leader::GetFdSet(fd_set& recv_from_set, int& fd_max, std::vector<int> &fds)
 {
     fd_max = INT_MIN;
@@ -123,42 +191,513 @@ void Leader::GetFdSet(fd_set& recv_from_set, int& fd_max, std::vector<int> &fds)
         if(get_replica_fd(i) == -1)
             continue;
 
-        char buf;
-        int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
-        if (rv == 0) {
-            close(fd_temp);
-            set_replica_fd(i, -1);
+        // a closed connection shows up as readable, and is
+        // cleaned up when recv() returns 0 on it
+        FD_SET(fd_temp, &recv_from_set);
+        fd_max = max(fd_max, fd_temp);
+        fds.push_back(fd_temp);
+    }
+}
+
+/**
+ * @param  fd fd of a connection from a replica
+ * @return    id of server whose replica is on the other end, -1 if none
+ */
+int Leader::GetReplicaIdFromFd(const int fd)
+{
+    for (int i = 0; i < S->get_num_servers(); i++)
+    {
+        if (get_replica_fd(i) == fd)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * a LEASE round renews the lease a third of the way into it, and also
+ * runs when a replica holds reads which came after the last round started.
+ * a round which gets no quorum is given up after the failure timeout
+ * @return true if a new round should be sent
+ */
+bool Leader::LeaseRoundDue()
+{
+    time_t since_round = ElapsedSince(lease_round_start_);
+    if (lease_round_pending_ && since_round < S->get_failure_detector()->get_failure_timeout())
+        return false;
+
+    time_t lease = S->get_options().lease_duration;
+    struct timeval requested = S->get_round_requested();
+    return (lease > 0 && since_round >= lease / 3)
+           || timercmp(&requested, &lease_round_start_, >);
+}
+
+/**
+ * sends LEASE-<ballot>-<round>$ to every acceptor which is not suspected,
+ * through the outbox of the scout
+ */
+void Leader::StartLeaseRound()
+{
+    Scout *SC = S->get_scout_object();
+    lease_round_++;
+    gettimeofday(&lease_round_start_, NULL);
+    lease_round_pending_ = true;
+    lease_acks_.clear();
+
+    string msg = kLease + kInternalDelim + ballotToString(get_ballot_num())
+                 + kInternalDelim + to_string(lease_round_) + kMessageDelim;
+    vector<pair<int, string> > msgs;
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        if (!S->get_failure_detector()->IsSuspected(i))
+            msgs.push_back(make_pair(i, msg));
+    }
+    // LEASEs are not counted by the time bomb, as before
+    SC->SendToAcceptors(msgs, false);
+}
+
+/**
+ * adds the scout's connections to acceptors to the select() set,
+ * for receiving LEASEACKs while the scout is idle
+ */
+void Leader::AddAcceptorFds(fd_set& recv_from_set, int& fd_max, std::vector<int> &fds)
+{
+    Scout *SC = S->get_scout_object();
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        int fd_temp = SC->get_acceptor_fd(i);
+        if (fd_temp == -1)
+            continue;
+        FD_SET(fd_temp, &recv_from_set);
+        fd_max = max(fd_max, fd_temp);
+        fds.push_back(fd_temp);
+    }
+}
+
+/**
+ * receives on a connection of the scout to an acceptor while the scout is
+ * idle. LEASEACK-<acceptor>-<ballot>-<round>$ from a lease quorum for the latest
+ * round confirms this leader. FASTP2B-<acceptor>-<triple>$ is a vote in a fast
+ * slot. P1Bs of earlier scouts and PROMISED are left over
+ * @param fd fd of connection to an acceptor
+ */
+void Leader::ReceiveFromAcceptor(const int fd)
+{
+    Scout *SC = S->get_scout_object();
+    int server_id = SC->GetServerIdFromFd(fd);
+    char buf[kMaxDataSize];
+    int num_bytes = recv(fd, buf, kMaxDataSize - 1, 0);
+    if (num_bytes <= 0) {
+        D(cout << "SL" << S->get_pid() << ": Lost connection to acceptor S" << server_id << endl;)
+        SC->CloseAndUnSetAcceptor(server_id);
+        return;
+    }
+
+    S->get_failure_detector()->Heard(server_id);
+    std::vector<StringView> message;
+    SC->inbox_.Extract(fd, buf, num_bytes, message);
+    for (const auto &msg : message) {
+        if (!acceptor_dispatcher_.Dispatch(msg, fd))
+            D(cout << "SL" << S->get_pid() << ": ERROR: Unexpected message from acceptor: " << msg << endl;)
+    }
+}
+
+/**
+ * stops serving reads on the strength of this leader's past rounds,
+ * once it is preempted or steps down
+ */
+void Leader::EndLeadership()
+{
+    set_leader_active(false);
+    lease_round_pending_ = false;
+    lease_round_start_ = {0, 0};
+    S->RevokeLeadership();
+}
+
+/**
+ * @return first slot past any this leader or an earlier one may have decided.
+ *         every chat a client was told about lies below it
+ */
+int Leader::ReadIndex()
+{
+    int index = lease_from_slot_;
+    if (!proposals_.empty())
+        index = max(index, proposals_.rbegin()->first + 1);
+    // the other owners' proposals do not come here
+    if (S->get_options().multi_leader)
+        index = max(index, S->get_performed_slot());
+    return index;
+}
+
+/**
+ * answers READINDEX requests of replicas with READINDEXRESP-<request id>-<index>$
+ * once this leader is confirmed since the request came, and asks for a LEASE
+ * round otherwise. Requests wait while the leader is not active
+ */
+void Leader::AnswerReadIndexRequests()
+{
+    if (!get_leader_active())
+        return;
+
+    for (auto it = read_index_requests_.begin(); it != read_index_requests_.end(); ) {
+        if (GetReplicaIdFromFd(it->fd) == -1) {
+            it = read_index_requests_.erase(it);    // replica went away
+        } else if (S->LeadershipConfirmedSince(it->arrival)) {
+            string msg = kReadIndexResp + kInternalDelim + it->request_id + kInternalDelim
+                         + to_string(ReadIndex()) + kMessageDelim;
+            outbox_.Enqueue(it->fd, msg);
+            D(cout << "SL" << S->get_pid() << ": Read index message queued: " << msg << endl;)
+            it = read_index_requests_.erase(it);
         } else {
-            FD_SET(fd_temp, &recv_from_set);
-            fd_max = max(fd_max, fd_temp);
-            fds.push_back(fd_temp);
+            if (!it->round_requested) {
+                S->RequestLeadershipRound();
+                it->round_requested = true;
+            }
+            ++it;
         }
     }
 }
 
-void Leader::SendReplicasAllDecisions()
+/**
+ * starts a commander for a triple
+ * @param t       triple to be decided
+ * @param skip_to with a NOOP in t, also every stride-th slot below this
+ *                is filled with NOOP. -1 for none
+ * @param stride  number of owners in the epoch of the skip
+ */
+void Leader::SpawnCommander(const Triple &t, const int skip_to, const int stride)
+{
+    pthread_t commander_thread;
+    CommanderThreadArgument* arg = new CommanderThreadArgument;
+    arg->C = new Commander(S);
+    arg->toSend = t;
+    arg->skip_to = skip_to;
+    arg->stride = stride;
+    CreateThread(CommanderMode, (void*)arg, commander_thread);
+    commanders_.push_back(commander_thread);
+}
+
+/**
+ * in the multi-leader mode, starts a commander for a PROPOSE-<slot>-<proposal>-<ballot>$
+ * or a SKIP-<from>-<to>-<stride>-<ballot>$ of the replica here, if this server
+ * owns the slot in the current epoch, and the replica chose it in this epoch
+ * too. A replica which proposed in an earlier epoch proposes again once it
+ * follows the new one
+ * @param  token message split into tokens
+ * @return       true if a commander was started
+ */
+bool Leader::ProposeOwnSlot(const std::vector<string> &token)
+{
+    Epoch e = S->get_epoch();
+    int s = stoi(token[1]);
+    Ballot b = stringToBallot(token.back());
+    if (!(e.b == b) || slotOwner(e, s) != S->get_pid() || preempted_by_ > b) {
+        D(cout << "SL" << S->get_pid() << ": Slot " << s << " is not own in epoch "
+          << epochToString(e) << ", ignoring " << token[0] << endl;)
+        return false;
+    }
+
+    if (token[0] == kSkip) {
+        Proposal noop(to_string(0), to_string(0), kNoop);
+        SpawnCommander(Triple(b, s, noop), stoi(token[2]), stoi(token[3]));
+    } else {
+        SpawnCommander(Triple(b, s, stringToProposal(token[2])), -1, 0);
+    }
+    return true;
+}
+
+/**
+ * in the multi-leader and fast modes, the adopted pvalues leave holes where no
+ * acceptor of the phase 1 quorum accepted anything. Nothing can have been decided
+ * there, so the holes below the highest adopted slot are filled with NOOP
+ */
+void Leader::FillHoles()
+{
+    if (proposals_.empty())
+        return;
+
+    Proposal noop(to_string(0), to_string(0), kNoop);
+    int last = proposals_.rbegin()->first;
+    for (int s = 0; s < last; ++s) {
+        if (proposals_.find(s) == proposals_.end())
+            proposals_[s] = noop;
+    }
+}
+
+/**
+ * starts an epoch with the ballot just adopted: the slots past all adopted
+ * ones go round robin to this server and to the servers whose replicas are
+ * connected here and not suspected. They learn of it by EPOCH-<epoch>$
+ */
+void Leader::StartEpoch()
+{
+    FailureDetector *FD = S->get_failure_detector();
+    Epoch e;
+    e.b = get_ballot_num();
+    e.first_slot = proposals_.empty() ? 0 : proposals_.rbegin()->first + 1;
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        bool owner = (i == S->get_pid())
+                     || (get_replica_fd(i) != -1 && !FD->IsSuspected(i));
+        epoch_replica_fd_[i] = owner ? get_replica_fd(i) : -1;
+        if (owner)
+            e.owners.push_back(i);
+    }
+    S->StartEpoch(e);
+
+    string msg = kEpoch + kInternalDelim + epochToString(e) + kMessageDelim;
+    for (auto i : e.owners) {
+        if (get_replica_fd(i) == -1)
+            continue;
+        outbox_.Enqueue(get_replica_fd(i), msg);
+        D(cout << "SL" << S->get_pid() << ": Epoch queued for replica S" << i << ": " << msg << endl;)
+    }
+}
+
+/**
+ * @return true if the current epoch has to give way to a new one, because an
+ *         owner is suspected, or a replica connected here after the epoch was
+ *         announced. A server which restarted thus owns slots only in an
+ *         epoch started after it came back
+ */
+bool Leader::EpochStale()
+{
+    FailureDetector *FD = S->get_failure_detector();
+    Epoch e = S->get_epoch();
+    for (auto i : e.owners) {
+        if (FD->IsSuspected(i))
+            return true;
+    }
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        if (i == S->get_pid() || FD->IsSuspected(i))
+            continue;
+        if (get_replica_fd(i) != -1 && get_replica_fd(i) != epoch_replica_fd_[i])
+            return true;
+    }
+    return false;
+}
+
+/**
+ * counts a vote of an acceptor in a fast slot of the current ballot. A value
+ * accepted by a fast quorum is decided, and the replicas learn of it from
+ * here. A slot in which no value can get a fast quorum any more is recovered
+ * @param t           triple the acceptor accepted
+ * @param acceptor_id id of the acceptor
+ */
+void Leader::ReceiveFastP2b(const Triple &t, const int acceptor_id)
+{
+    if (!get_leader_active() || !(t.b == get_ballot_num())
+            || decisions_.find(t.s) != decisions_.end())
+        return;
+
+    std::map<int, Proposal> &votes = fast_votes_[t.s];
+    if (votes.empty())
+        gettimeofday(&fast_started_[t.s], NULL);
+    votes[acceptor_id] = t.p;
+
+    unordered_map<Proposal, int> count;
+    int most = 0;
+    for (const auto &v : votes)
+        most = max(most, ++count[v.second]);
+
+    if (count[t.p] >= S->get_fast_quorum()) {
+        D(cout << "SL" << S->get_pid() << ": Fast quorum for slot " << t.s << ": "
+          << proposalToString(t.p) << endl;)
+        decisions_[t.s] = t.p;
+        proposals_[t.s] = t.p;
+        fast_votes_.erase(t.s);
+        fast_started_.erase(t.s);
+        Metrics::AddFastCommit();
+
+        string msg = kDecision + kInternalDelim + to_string(t.s) + kInternalDelim
+                     + proposalToString(t.p) + kMessageDelim;
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            if (get_replica_fd(i) == -1)
+                continue;
+            outbox_.Enqueue(get_replica_fd(i), msg);
+            D(cout << "SL" << S->get_pid() << ": Decision queued for replica " << i << ": " << msg << endl;)
+        }
+    } else if (most + S->get_num_servers() - (int)votes.size() < S->get_fast_quorum()) {
+        D(cout << "SL" << S->get_pid() << ": Collision in fast slot " << t.s << endl;)
+        fast_collision_ = true;
+    }
+}
+
+/**
+ * @return true if a fast slot collided, or waited for a fast quorum longer
+ *         than fast_timeout_ms, e.g. because an acceptor is down. Its votes
+ *         are recovered with a new ballot
+ */
+bool Leader::FastRecoveryDue()
+{
+    if (fast_collision_)
+        return true;
+    for (const auto &f : fast_started_) {
+        if (ElapsedSince(f.second) >= S->get_options().fast_timeout)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * in the fast mode, picks the value of every slot whose highest reported
+ * ballot is a fast one, where acceptors may have accepted different values.
+ * A value may have been chosen there only if at least q1 + qf - n acceptors
+ * of the phase 1 quorum report it, which at most one value can, and then it
+ * is reported most. So the value reported most is kept. The other values
+ * reported are proposed again past the adopted slots, so that no chat is lost
+ * @param pvalues triples adopted
+ * @param votes   number of acceptors of the phase 1 quorum which reported
+ *                each triple accepted in a fast slot
+ */
+void Leader::ResolveFastVotes(const unordered_set<Triple> &pvalues,
+                              const unordered_map<Triple, int> &votes)
+{
+    map<int, Ballot> highest;
+    for (const auto &t : pvalues) {
+        if (highest.find(t.s) == highest.end() || t.b > highest[t.s])
+            highest[t.s] = t.b;
+    }
+
+    map<int, pair<Proposal, int> > kept;    // slot -> (value, votes)
+    vector<Proposal> others;
+    for (const auto &v : votes) {
+        const Triple &t = v.first;
+        if (!(t.b == highest[t.s])) {
+            others.push_back(t.p);      // a later ballot decided the slot
+            continue;
+        }
+        auto it = kept.find(t.s);
+        if (it == kept.end() || v.second > it->second.second) {
+            if (it != kept.end())
+                others.push_back(it->second.first);
+            kept[t.s] = make_pair(t.p, v.second);
+        } else {
+            others.push_back(t.p);
+        }
+    }
+    for (const auto &k : kept)
+        proposals_[k.first] = k.second.first;
+
+    int next = proposals_.empty() ? 0 : proposals_.rbegin()->first + 1;
+    for (const auto &p : others) {
+        bool proposed = false;
+        for (const auto &q : proposals_) {
+            if (q.second == p) {
+                proposed = true;
+                break;
+            }
+        }
+        if (!proposed)
+            proposals_[next++] = p;
+    }
+}
+
+/**
+ * @return true if every slot adopted with the current ballot is decided. The
+ *         acceptors have then seen the P2As of the chats they waited with
+ *         during recovery, and leave them out of the fast slots
+ */
+bool Leader::FastSlotsRecovered()
+{
+    for (const auto &p : proposals_) {
+        if (decisions_.find(p.first) == decisions_.end())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * opens the fast slots past all known ones to clients with
+ * ANY-<ballot>-<first slot>$, over the connections of the scout. It goes to
+ * every acceptor once per ballot, and to acceptors which connect to the
+ * scout later as they come
+ */
+void Leader::SendAny()
+{
+    any_pending_ = false;
+
+    Scout *SC = S->get_scout_object();
+    int first = proposals_.empty() ? 0 : proposals_.rbegin()->first + 1;
+    if (!fast_votes_.empty())
+        first = max(first, fast_votes_.rbegin()->first + 1);
+    string msg = kAny + kInternalDelim + ballotToString(get_ballot_num())
+                 + kInternalDelim + to_string(first) + kMessageDelim;
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        int fd = SC->get_acceptor_fd(i);
+        if (fd == -1 || fd == any_fd_[i])
+            continue;
+        any_fd_[i] = fd;
+        if (send(fd, msg.c_str(), msg.size(), MSG_DONTWAIT) == -1) {
+            D(cout << "SL" << S->get_pid() << ": ERROR in sending ANY to acceptor S" << i << endl;)
+        } else {
+            D(cout << "SL" << S->get_pid() << ": Fast slots from " << first << " opened to acceptor S"
+              << i << " with ballot " << ballotToString(get_ballot_num()) << endl;)
+        }
+    }
+}
+
+/**
+ * @return number of acceptors connected to the scout of this server
+ */
+int Leader::CountAcceptorsAtScout()
+{
+    Scout* scout_obj = S->get_scout_object();
+    int count = 0;
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (scout_obj->get_acceptor_fd(i) != -1)
+            count++;
+    }
+    return count;
+}
+
+string Leader::AllDecisionsMessage()
 {
     string msg = kAllDecisions;
     msg += kInternalDelim;
     msg += allDecisionsToString(decisions_);
     msg += kMessageDelim;
+    return msg;
+}
+
+void Leader::SendReplicasAllDecisions()
+{
+    string msg = AllDecisionsMessage();
 
     for (int i = 0; i < S->get_num_servers(); i++)
     {
         if (get_replica_fd(i) == -1)
             continue;
 
-        if (send(get_replica_fd(i), msg.c_str(), msg.size(), 0) == -1) {
-            D(cout << "SL" << S->get_pid()
-              << ": ERROR in sending all decisions to replica S" << i << endl;)
-            close(get_replica_fd(i));
-            set_replica_fd(i, -1);
-        }
-        else {
-            D(cout << "SL" << S->get_pid()
-              << ": All Decisions sent to replica " << i << ": " << msg << endl;)
+        outbox_.Enqueue(get_replica_fd(i), msg);
+        D(cout << "SL" << S->get_pid()
+          << ": All Decisions queued for replica " << i << ": " << msg << endl;)
+    }
+}
+
+/**
+ * sends as much of the messages queued during this turn of the leader loop
+ * as the sockets take, closes the replica connections on which sending
+ * failed, and resends all decisions to replicas whose messages were dropped
+ */
+void Leader::FlushOutbox()
+{
+    vector<int> failed_fds;
+    outbox_.Flush(failed_fds);
+    for (auto fd : failed_fds) {
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            if (get_replica_fd(i) == fd) {
+                D(cout << "SL" << S->get_pid()
+                  << ": ERROR in sending to replica S" << i << endl;)
+                close(fd);
+                inbox_.Reset(fd);
+                set_replica_fd(i, -1);
+            }
         }
     }
+
+    vector<int> resync_fds;
+    outbox_.TakeResyncFds(resync_fds);
+    for (auto fd : resync_fds) {
+        D(cout << "SL" << S->get_pid() << ": Resyncing replica on fd " << fd << endl;)
+        outbox_.Enqueue(fd, AllDecisionsMessage());
+    }
 }
 
 /**
@@ -174,11 +713,11 @@ void Leader::SendReplicasAllDecisions()
     pthread_t accept_connections_thread;
     CreateThread(AcceptConnectionsLeader, (void*)&L, accept_connections_thread);
 
-    // sleep for some time to make sure accept threads of commanders,scouts,replica are running
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
-    int primary_id = L.S->get_primary_id();
-    if (L.ConnectToCommander(primary_id)) {
+    // a leader talks to the commander and scout of its own server. Their
+    // accept threads are started just before the leader, and may not be
+    // accepting yet. retry with backoff
+    int primary_id = L.S->get_pid();
+    if (RetryWithBackoff([&]() { return L.ConnectToCommander(primary_id); }, kConnectTimeout)) {
         D(cout << "SL" << L.S->get_pid() << ": Connected to commander of S"
           << primary_id << endl;)
     } else {
@@ -187,7 +726,7 @@ void Leader::SendReplicasAllDecisions()
         return NULL;
     }
 
-    if (L.ConnectToScout(primary_id)) {
+    if (RetryWithBackoff([&]() { return L.ConnectToScout(primary_id); }, kConnectTimeout)) {
         D(cout << "SL" << L.S->get_pid() << ": Connected to scout of S"
           << primary_id << endl;)
     } else {
@@ -208,38 +747,469 @@ void Leader::SendReplicasAllDecisions()
     //     }
     // }
 
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
+    while (true) {
+        // a hot standby, or a leader which handed over, waits here till it takes
+        // over. In the multi-leader mode it leads its own slots meanwhile
+        if (L.S->get_options().multi_leader)
+            L.OwnerMode();
+        else
+            L.StandbyMode();
+
+        // phase 1 needs a quorum of acceptors connected to the scout. with
+        // less than a quorum alive, the scout copes as before once this times out
+        if (RetryWithBackoff([&]() { return L.CountAcceptorsAtScout() >= L.S->get_phase1_quorum(); },
+                             kReadyTimeout)) {
+            D(cout << "SL" << L.S->get_pid() << ": Phase 1 quorum of acceptors connected to scout" << endl;)
+        } else {
+            D(cout << "SL" << L.S->get_pid() << ": ERROR: Phase 1 quorum of acceptors not connected to scout" << endl;)
+        }
+
+        L.S->set_leader_ready(true);
+        L.LeaderMode();
+    }
 
-    L.S->set_leader_ready(true);
-    L.LeaderMode();
-    
     void *status;
     pthread_join(accept_connections_thread, &status);
     return NULL;
 }
 
+/**
+ * runs the leader of a hot standby till this server becomes primary.
+ * replicas mirror their proposals here, and acceptors tell the scout
+ * every ballot they promise, so that the leader takes over with
+ * ballot_num_ already past every promise and all pending proposals
+ * at hand. returns right away on the primary
+ */
+void Leader::StandbyMode()
+{
+    if (S->get_pid() == S->get_primary_id())
+        return;
+
+    D(cout << "SL" << S->get_pid() << ": Standing by for S" << S->get_primary_id() << endl;)
+    Scout *SC = S->get_scout_object();
+    Wakeup *wakeup = S->get_wakeup(kLeaderRole);
+    vector<int> fds;
+    std::vector<StringView> message;
+
+    // server_id is the replica or acceptor the message being handled came from
+    int server_id = -1;
+    Dispatcher dispatcher("leader");
+    dispatcher.Register(MSG_PROPOSE, [&](const StringView &msg, const vector<StringView> &token,
+                                         const int fd) {
+        D(cout << "SL" << S->get_pid() << ": Mirrored propose received: " << msg << endl;)
+        proposals_[viewToInt(token[1])] = viewToProposal(token[2]);
+        return true;
+    });
+    dispatcher.Register(MSG_PROMISED, [&](const StringView &msg, const vector<StringView> &token,
+                                          const int fd) {
+        Ballot promised = viewToBallot(token[2]);
+        if (promised >= get_ballot_num()) {
+            JumpBallotPast(promised);
+            D(cout << "SL" << S->get_pid() << ": Reserved ballot " << ballotToString(get_ballot_num())
+              << " past promise " << ballotToString(promised) << " of acceptor S" << server_id << endl;)
+        }
+        return true;
+    });
+    // left over from before this leader handed over
+    dispatcher.Ignore(MSG_DECISION);
+    dispatcher.Ignore(MSG_ADOPTED);
+    dispatcher.Ignore(MSG_PREEMPTED);
+    dispatcher.Ignore(MSG_P1B);
+    while (S->get_pid() != S->get_primary_id()) {
+        fd_set recv_from_set;
+        int fd_max;
+        GetFdSet(recv_from_set, fd_max, fds);
+
+        // acceptors are connected to the scout, which is idle till takeover
+        int num_replica_fds = fds.size();
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            int fd_temp = SC->get_acceptor_fd(i);
+            if (fd_temp == -1)
+                continue;
+            FD_SET(fd_temp, &recv_from_set);
+            fd_max = max(fd_max, fd_temp);
+            fds.push_back(fd_temp);
+        }
+        FD_SET(wakeup->get_fd(), &recv_from_set);
+        fd_max = max(fd_max, wakeup->get_fd());
+
+        struct timeval timeout = kSelectTimeoutTimeval;
+        int rv = select(fd_max + 1, &recv_from_set, NULL, NULL, &timeout);
+        if (rv <= 0)
+            continue;
+        if (FD_ISSET(wakeup->get_fd(), &recv_from_set))
+            wakeup->Clear();
+
+        for (int i = 0; i < fds.size(); i++) {
+            if (!FD_ISSET(fds[i], &recv_from_set))
+                continue;
+
+            bool from_acceptor = (i >= num_replica_fds);
+            server_id = from_acceptor ? SC->GetServerIdFromFd(fds[i])
+                                          : GetReplicaIdFromFd(fds[i]);
+            Inbox &inbox = from_acceptor ? SC->inbox_ : inbox_;
+            char buf[kMaxDataSize];
+            int num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0);
+            if (num_bytes <= 0) {
+                D(cout << "SL" << S->get_pid() << ": Standby lost connection to S" << server_id << endl;)
+                if (from_acceptor) {
+                    SC->CloseAndUnSetAcceptor(server_id);
+                } else if (server_id != -1) {
+                    close(fds[i]);
+                    set_replica_fd(server_id, -1);
+                    inbox_.Reset(fds[i]);
+                }
+                continue;
+            }
+
+            S->get_failure_detector()->Heard(server_id);
+            inbox.Extract(fds[i], buf, num_bytes, message);
+            for (const auto &msg : message) {
+                if (!dispatcher.Dispatch(msg, fds[i]))
+                    D(cout << "SL" << S->get_pid() << ": ERROR: Unexpected message received in standby: " << msg << endl;)
+            }
+        }
+    }
+    D(cout << "SL" << S->get_pid() << ": Taking over with ballot " << ballotToString(get_ballot_num())
+      << " and " << proposals_.size() << " mirrored proposal(s)" << endl;)
+}
+
+/**
+ * runs the leader of a server other than the primary in the multi-leader
+ * mode, till this server becomes primary. The replica here proposes in
+ * the slots the primary's epoch gives this server, and the commanders
+ * started here propose with the epoch's ballot. Returns right away on
+ * the primary
+ */
+void Leader::OwnerMode()
+{
+    if (S->get_pid() == S->get_primary_id())
+        return;
+
+    D(cout << "SL" << S->get_pid() << ": Leading own slots, primary is S" << S->get_primary_id() << endl;)
+    Wakeup *wakeup = S->get_wakeup(kLeaderRole);
+    vector<int> fds;
+    std::vector<StringView> message;
+
+    Dispatcher dispatcher("leader");
+    dispatcher.Register(MSG_PROPOSE, [&](const StringView &msg, const vector<StringView> &view,
+                                         const int fd) {
+        if (view.size() != 4)
+            return false;
+        D(cout << "SL" << S->get_pid() << ": Propose message received: " << msg << endl;)
+        if (ProposeOwnSlot(ViewsToStrings(view)))
+            proposals_[viewToInt(view[1])] = viewToProposal(view[2]);
+        return true;
+    });
+    dispatcher.Register(MSG_SKIP, [&](const StringView &msg, const vector<StringView> &view,
+                                      const int fd) {
+        if (view.size() != 5)
+            return false;
+        D(cout << "SL" << S->get_pid() << ": Skip message received: " << msg << endl;)
+        ProposeOwnSlot(ViewsToStrings(view));
+        return true;
+    });
+    dispatcher.Register(MSG_PREEMPTED, [&](const StringView &msg, const vector<StringView> &view,
+                                           const int fd) {
+        D(cout << "SL" << S->get_pid() << ": PreEmpted message received: " << msg << endl;)
+        // the primary started a new epoch. till it is announced,
+        // commanders of the old one would be preempted too
+        Ballot recvd_b = viewToBallot(view[1]);
+        if (recvd_b > preempted_by_)
+            preempted_by_ = recvd_b;
+        return true;
+    });
+    dispatcher.Register(MSG_DECISION, [&](const StringView &msg, const vector<StringView> &view,
+                                          const int fd) {
+        D(cout << "SL" << S->get_pid() << ": Decision message received from commander: " << msg << endl;)
+        decisions_[viewToInt(view[1])] = viewToProposal(view[2]);
+        return true;
+    });
+    // left over from when this server was primary
+    dispatcher.Ignore(MSG_ADOPTED);
+    dispatcher.Ignore(MSG_P1B);
+    while (S->get_pid() != S->get_primary_id()) {
+        FlushOutbox();
+        if (S->get_all_clear(kLeaderRole) == kAllClearSet) {
+            for (auto cit = commanders_.begin(); cit != commanders_.end(); cit++) {
+                void *status;
+                pthread_join(*cit, &status);
+            }
+            commanders_.clear();
+            SendReplicasAllDecisions();
+            FlushOutbox();
+            S->set_all_clear(kLeaderRole, kAllClearDone);
+        }
+
+        fd_set recv_from_set;
+        int fd_max;
+        GetFdSet(recv_from_set, fd_max, fds);
+        FD_SET(wakeup->get_fd(), &recv_from_set);
+        fd_max = max(fd_max, wakeup->get_fd());
+        fd_set send_to_set;
+        FD_ZERO(&send_to_set);
+        outbox_.FillWriteSet(send_to_set, fd_max);
+
+        struct timeval timeout = kSelectTimeoutTimeval;
+        int rv = select(fd_max + 1, &recv_from_set, &send_to_set, NULL, &timeout);
+        if (rv <= 0)
+            continue;
+        if (FD_ISSET(wakeup->get_fd(), &recv_from_set))
+            wakeup->Clear();
+
+        for (int i = 0; i < fds.size(); i++) {
+            if (!FD_ISSET(fds[i], &recv_from_set))
+                continue;
+
+            int replica_id = GetReplicaIdFromFd(fds[i]);
+            char buf[kMaxDataSize];
+            int num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0);
+            if (num_bytes <= 0) {
+                D(cout << "SL" << S->get_pid() << ": Owner lost connection to S" << replica_id << endl;)
+                if (replica_id != -1) {
+                    close(fds[i]);
+                    set_replica_fd(replica_id, -1);
+                    inbox_.Reset(fds[i]);
+                    outbox_.Discard(fds[i]);
+                }
+                continue;
+            }
+
+            S->get_failure_detector()->Heard(replica_id);
+            inbox_.Extract(fds[i], buf, num_bytes, message);
+            for (const auto &msg : message) {
+                if (!dispatcher.Dispatch(msg, fds[i]))
+                    D(cout << "SL" << S->get_pid() << ": ERROR: Unexpected message received as owner: " << msg << endl;)
+            }
+        }
+    }
+    D(cout << "SL" << S->get_pid() << ": Taking over as primary with ballot "
+      << ballotToString(get_ballot_num()) << endl;)
+}
+
 /**
  * function for performing leader related job
  */
  void Leader::LeaderMode()
  {
+    // a planned handoff tells which ballot the previous primary led with
+    Ballot handed = S->get_leader_ballot();
+    if (handed >= get_ballot_num())
+        JumpBallotPast(handed);
+
     // scout
     pthread_t scout_thread;
     ScoutThreadArgument* arg = new ScoutThreadArgument;
     arg->SC = S->get_scout_object();
     arg->ball = get_ballot_num();
     arg->sleep_time = 0;
+    arg->backoff = 0;
     CreateThread(ScoutMode, (void*)arg, scout_thread);
     bool scout_active = true;
     int num_servers = S->get_num_servers();
+    Wakeup *wakeup = S->get_wakeup(kLeaderRole);
     vector<int> fds;
+    std::vector<StringView> message;
+
+    Dispatcher dispatcher("leader");
+    dispatcher.Register(MSG_PROPOSE, [&](const StringView &msg, const vector<StringView> &view,
+                                         const int fd) {
+        D(cout << "SL" << S->get_pid() << ": Propose message received: " << msg <<  endl;)
+        int s = viewToInt(view[1]);
+        if (S->get_options().multi_leader)
+        {
+            // slots past the epoch are proposed again in the next one
+            if (!get_leader_active() || ProposeOwnSlot(ViewsToStrings(view)))
+                proposals_[s] = viewToProposal(view[2]);
+            return true;
+        }
+        // if (proposals_.find(s) == proposals_.end())
+        // {
+        proposals_[s] = viewToProposal(view[2]);
+        if (get_leader_active())
+        {
+            // commander
+            pthread_t commander_thread;
+            Commander *C = new Commander(S);
+            CommanderThreadArgument* arg = new CommanderThreadArgument;
+            arg->C = C;
+            Triple tempt = Triple(get_ballot_num(), s, proposals_[s]);
+            arg->toSend = tempt;
+            CreateThread(CommanderMode, (void*)arg, commander_thread);
+            commanders_.push_back(commander_thread);
+        }
+        // }
+        return true;
+    });
+    dispatcher.Register(MSG_ADOPTED, [&](const StringView &msg, const vector<StringView> &view,
+                                         const int fd) {
+        D(cout << "SL" << S->get_pid() << ": Adopted message received: " << msg <<  endl;)
+        D(cout << "SL" << S->get_pid() << ": Ballot " << ballotToString(get_ballot_num())
+          << " adopted after " << preemptions_ << " preemption(s)" << endl;)
+        std::vector<string> token = ViewsToStrings(view);
+        scout_active = false;
+        S->AdoptLeaderBallot(get_ballot_num());
+        preemptions_ = 0;
+        scout_backoff_ = kScoutBackoffInitial;
+        unordered_set<Triple> pvalues;
+        if (token.size() >= 3)
+        {
+            pvalues = stringToTripleSet(token[2]);
+            int k = S->get_options().erasure_k;
+            if (k > 0)
+                pvalues = JoinFragmentedPvalues(ReedSolomon(k, S->get_num_servers() - k), pvalues);
+            proposals_ = pairxor(proposals_, pmax(pvalues));
+        }
+        if (token.size() == 4)
+            ResolveFastVotes(pvalues, stringToFastVotes(token[3]));
+        if (S->get_options().multi_leader || S->get_options().fast_paxos)
+            FillHoles();
+        // slots below this may have been decided by earlier
+        // leaders. reads wait till the replica performed them
+        lease_from_slot_ = proposals_.empty() ? 0 : proposals_.rbegin()->first + 1;
+        pthread_t commander_thread[proposals_.size()];
+        int i = 0;
+        for (auto it = proposals_.begin(); it != proposals_.end(); it++)
+        {
+            // commander
+            Commander *C = new Commander(S);
+            CommanderThreadArgument* arg = new CommanderThreadArgument;
+            arg->C = C;
+            Triple tempt = Triple(get_ballot_num(), it->first, it->second);
+            arg->toSend = tempt;
+            CreateThread(CommanderMode, (void*)arg, commander_thread[i]);
+            commanders_.push_back(commander_thread[i]);
+            i++;
+        }
+        set_leader_active(true);
+        if (S->get_options().multi_leader)
+            StartEpoch();
+        // votes of the previous ballot which did not decide
+        // are recovered by the adopted ones
+        fast_votes_.clear();
+        fast_started_.clear();
+        fast_collision_ = false;
+        any_pending_ = S->get_options().fast_paxos;
+        any_fd_.assign(num_servers, -1);
+        return true;
+    });
+    dispatcher.Register(MSG_PREEMPTED, [&](const StringView &msg, const vector<StringView> &view,
+                                           const int fd) {
+        D(cout << "SL" << S->get_pid() << ": PreEmpted message received: " << msg <<  endl;)
+        Ballot recvd_b = viewToBallot(view[1]);
+        if (recvd_b > get_ballot_num())
+        {
+            EndLeadership();
+            JumpBallotPast(recvd_b);
+            preemptions_++;
+            Metrics::AddPreemption();
+
+            // scout
+            ScoutThreadArgument* arg = new ScoutThreadArgument;
+            arg->SC = S->get_scout_object();
+            arg->ball = get_ballot_num();
+            arg->sleep_time = 0;
+            arg->backoff = NextScoutBackoff();
+            CreateThread(ScoutMode, (void*)arg, scout_thread);
+            scout_active = true;
+        }
+        else if (recvd_b == get_ballot_num())    // minority of acceptors alive
+        {
+            EndLeadership();
+            // scout
+            ScoutThreadArgument* arg = new ScoutThreadArgument;
+            arg->SC = S->get_scout_object();
+            arg->ball = get_ballot_num();
+            arg->sleep_time = kMinoritySleep;
+            arg->backoff = 0;
+            CreateThread(ScoutMode, (void*)arg, scout_thread);
+            scout_active = true;
+        }
+        return true;
+    });
+    dispatcher.Register(MSG_SKIP, [&](const StringView &msg, const vector<StringView> &view,
+                                      const int fd) {
+        if (view.size() != 5)
+            return false;
+        D(cout << "SL" << S->get_pid() << ": Skip message received: " << msg <<  endl;)
+        if (get_leader_active())
+            ProposeOwnSlot(ViewsToStrings(view));
+        return true;
+    });
+    dispatcher.Register(MSG_READINDEX, [&](const StringView &msg, const vector<StringView> &view,
+                                           const int fd) {
+        if (view.size() != 3)
+            return false;
+        D(cout << "SL" << S->get_pid() << ": Read index request received: " << msg <<  endl;)
+        ReadIndexRequest request;
+        request.fd = fd;
+        request.request_id = view[2].ToString();
+        gettimeofday(&request.arrival, NULL);
+        request.round_requested = false;
+        read_index_requests_.push_back(request);
+        return true;
+    });
+    dispatcher.Register(MSG_DECISION, [&](const StringView &msg, const vector<StringView> &view,
+                                          const int fd) {
+        D(cout << "SL" << S->get_pid() << ": Decision message received from commander: " << msg <<  endl;)
+        int s = viewToInt(view[1]);
+        Proposal p = viewToProposal(view[2]);
+        decisions_[s] = p;
+        return true;
+    });
     while (true) {
         fd_set recv_from_set;
         int fd_max;
 
+        FlushOutbox();
+        if (S->get_pid() != S->get_primary_id()) {
+            // leadership was handed over. replicas brought the
+            // pending proposals to the new primary
+            D(cout << "SL" << S->get_pid() << ": Stepping down for S" << S->get_primary_id() << endl;)
+            EndLeadership();
+            proposals_.clear();
+            // replicas ask the new primary's leader again
+            read_index_requests_.clear();
+            return;
+        }
+        AnswerReadIndexRequests();
+        if (get_leader_active() && !scout_active && LeaseRoundDue())
+            StartLeaseRound();
+        if (get_leader_active() && !scout_active
+                && ((S->get_options().multi_leader && EpochStale())
+                    || (S->get_options().fast_paxos && FastRecoveryDue())))
+        {
+            // a new epoch needs a new ballot, which also preempts the
+            // commanders of the old epoch's owners. So do fast slots
+            // to be recovered, whose votes come with the P1Bs
+            if (S->get_options().multi_leader) {
+                D(cout << "SL" << S->get_pid() << ": Owners changed, ending epoch "
+                  << epochToString(S->get_epoch()) << endl;)
+            } else {
+                D(cout << "SL" << S->get_pid() << ": Recovering fast slots of ballot "
+                  << ballotToString(get_ballot_num()) << endl;)
+                Metrics::AddCollision();
+            }
+            EndLeadership();
+            IncrementBallotNum();
+            ScoutThreadArgument* arg = new ScoutThreadArgument;
+            arg->SC = S->get_scout_object();
+            arg->ball = get_ballot_num();
+            arg->sleep_time = 0;
+            arg->backoff = 0;
+            CreateThread(ScoutMode, (void*)arg, scout_thread);
+            scout_active = true;
+        }
+        if (S->get_options().fast_paxos && get_leader_active() && !scout_active
+                && (!any_pending_ || FastSlotsRecovered()))
+            SendAny();
         GetFdSet(recv_from_set, fd_max, fds);
+        // the leader reads the scout's connections while the scout is idle
+        int num_leader_fds = fds.size();
+        if (!scout_active)
+            AddAcceptorFds(recv_from_set, fd_max, fds);
+        FD_SET(wakeup->get_fd(), &recv_from_set);
+        fd_max = max(fd_max, wakeup->get_fd());
         if (S->get_all_clear(kLeaderRole) == kAllClearSet)
         {
             if (!commanders_.empty())
@@ -254,8 +1224,20 @@ void Leader::SendReplicasAllDecisions()
             }
         }
 
+        fd_set send_to_set;
+        FD_ZERO(&send_to_set);
+        outbox_.FillWriteSet(send_to_set, fd_max);
+
         struct timeval timeout = kSelectTimeoutTimeval; // not really needed
-        int rv = select(fd_max + 1, &recv_from_set, NULL, NULL, &timeout);
+        time_t lease = S->get_options().lease_duration;
+        if (lease > 0 && lease / 3 < timeout.tv_sec * 1000000 + timeout.tv_usec)
+            timeout = {lease / 3 / 1000000, lease / 3 % 1000000};
+        time_t fast = S->get_options().fast_timeout;
+        if (!fast_started_.empty() && fast < timeout.tv_sec * 1000000 + timeout.tv_usec)
+            timeout = {fast / 1000000, fast % 1000000};
+        int rv = select(fd_max + 1, &recv_from_set, &send_to_set, NULL, &timeout);
+        if (rv > 0 && FD_ISSET(wakeup->get_fd(), &recv_from_set))
+            wakeup->Clear();
 
         if (rv == -1) { //error in select
             D(cout << "SL" << S->get_pid() << ": ERROR in select()" << endl;)
@@ -264,112 +1246,45 @@ void Leader::SendReplicasAllDecisions()
         } else {
             for (int i = 0; i < fds.size(); i++)
             {
+                if (i >= num_leader_fds) {
+                    if (FD_ISSET(fds[i], &recv_from_set))
+                        ReceiveFromAcceptor(fds[i]);
+                    continue;
+                }
                 if (FD_ISSET(fds[i], &recv_from_set)) { // we got one!!
                     char buf[kMaxDataSize];
                     int num_bytes;
-                    if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) == -1)
+                    int replica_id = GetReplicaIdFromFd(fds[i]);
+                    if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) <= 0)
                     {
-                        D(cout << "SL" << S->get_pid() << ": ERROR in receving" << endl;)
-                    } else if (num_bytes == 0) {     //connection closed
-                        D(cout << "SL" << S->get_pid() << ": ERROR Connection closed" << endl;)
+                        if (num_bytes == -1) {
+                            D(cout << "SL" << S->get_pid() << ": ERROR in receving" << endl;)
+                        } else {     //connection closed
+                            D(cout << "SL" << S->get_pid() << ": ERROR Connection closed" << endl;)
+                        }
+                        if (replica_id != -1) {
+                            close(fds[i]);
+                            set_replica_fd(replica_id, -1);
+                            inbox_.Reset(fds[i]);
+                            outbox_.Discard(fds[i]);
+                        }
                     } else {
-                        buf[num_bytes] = '\0';
-                        std::vector<string> message = split(string(buf), kMessageDelim[0]);
+                        S->get_failure_detector()->Heard(replica_id);
+                        inbox_.Extract(fds[i], buf, num_bytes, message);
                         for (const auto &msg : message)
                         {
-                            std::vector<string> token = split(string(msg), kInternalDelim[0]);
-                            if (token[0] == kPropose)
-                            {
-                                D(cout << "SL" << S->get_pid() << ": Propose message received: " << msg <<  endl;)
-                                // if (proposals_.find(stoi(token[1])) == proposals_.end())
-                                // {
-                                proposals_[stoi(token[1])] = stringToProposal(token[2]);
-                                if (get_leader_active())
-                                {
-                                    // commander
-                                    pthread_t commander_thread;
-                                    Commander *C = new Commander(S);
-                                    CommanderThreadArgument* arg = new CommanderThreadArgument;
-                                    arg->C = C;
-                                    Triple tempt = Triple(get_ballot_num(), stoi(token[1]), proposals_[stoi(token[1])]);
-                                    arg->toSend = tempt;
-                                    CreateThread(CommanderMode, (void*)arg, commander_thread);
-                                    commanders_.push_back(commander_thread);
-                                }
-                                // }
-                            }
-                            else if (token[0] == kAdopted)
-                            {
-                                D(cout << "SL" << S->get_pid() << ": Adopted message received: " << msg <<  endl;)
-                                scout_active = false;
-                                unordered_set<Triple> pvalues;
-                                if (token.size() == 3)
-                                {
-                                    pvalues = stringToTripleSet(token[2]);
-                                    proposals_ = pairxor(proposals_, pmax(pvalues));
-                                }
-                                pthread_t commander_thread[proposals_.size()];
-                                int i = 0;
-                                for (auto it = proposals_.begin(); it != proposals_.end(); it++)
-                                {
-                                    // commander
-                                    Commander *C = new Commander(S);
-                                    CommanderThreadArgument* arg = new CommanderThreadArgument;
-                                    arg->C = C;
-                                    Triple tempt = Triple(get_ballot_num(), it->first, it->second);
-                                    arg->toSend = tempt;
-                                    CreateThread(CommanderMode, (void*)arg, commander_thread[i]);
-                                    commanders_.push_back(commander_thread[i]);
-                                    i++;
-                                }
-                                set_leader_active(true);
-                            }
-                            else if (token[0] == kPreEmpted)
-                            {
-                                D(cout << "SL" << S->get_pid() << ": PreEmpted message received: " << msg <<  endl;)
-                                Ballot recvd_b = stringToBallot(token[1]);
-                                if (recvd_b > get_ballot_num())
-                                {
-                                    set_leader_active(false);
-                                    IncrementBallotNum();
-
-                                    // scout
-                                    ScoutThreadArgument* arg = new ScoutThreadArgument;
-                                    arg->SC = S->get_scout_object();
-                                    arg->ball = get_ballot_num();
-                                    arg->sleep_time = 0;
-                                    CreateThread(ScoutMode, (void*)arg, scout_thread);
-                                    scout_active = true;
-                                }
-                                else if (recvd_b == get_ballot_num())    // minority of acceptors alive
-                                {
-                                    set_leader_active(false);
-                                    // scout
-                                    ScoutThreadArgument* arg = new ScoutThreadArgument;
-                                    arg->SC = S->get_scout_object();
-                                    arg->ball = get_ballot_num();
-                                    arg->sleep_time = kMinoritySleep;
-                                    CreateThread(ScoutMode, (void*)arg, scout_thread);
-                                    scout_active = true;
-                                }
-                            }
-                            else if (token[0] == kDecision)
-                            {
-                                D(cout << "SL" << S->get_pid() << ": Decision message received from commander: " << msg <<  endl;)
-                                int s = stoi(token[1]);
-                                Proposal p = stringToProposal(token[2]);
-                                decisions_[s] = p;
-                            }
-                            else {    //other messages
+                            if (!dispatcher.Dispatch(msg, fds[i]))
                                 D(cout << "SL" << S->get_pid() << ": ERROR: Unexpected message received: " << msg << endl;)
-                            }
                         }
                     }
                 }
             }
         }
 
-        while ((commanders_.empty()) && (S->get_all_clear(kLeaderRole) == kAllClearDone))
+        // every owner proposes and skips during all clear in the multi-leader
+        // mode, and fast votes keep coming in the fast mode
+        while ((commanders_.empty()) && (S->get_all_clear(kLeaderRole) == kAllClearDone)
+                && !S->get_options().multi_leader && !S->get_options().fast_paxos)
         {
             //means all done. just waiting for all clear to be lifted
             usleep(kAllClearSleep);
@@ -378,6 +1293,7 @@ void Leader::SendReplicasAllDecisions()
         while ((commanders_.empty()) && (S->get_all_clear(kLeaderRole) == kAllClearSet))
         {
             SendReplicasAllDecisions();
+            FlushOutbox();
             S->set_all_clear(kLeaderRole, kAllClearDone);
         }
     }
@@ -6,21 +6,58 @@
 #include "unordered_set"
 #include "map"
 #include "utilities.h"
+#include "channel.h"
+#include "dispatch.h"
 #include "set"
 using namespace std;
 
 void *LeaderEntry(void *_S);
 void* AcceptConnectionsLeader(void* _L);
 
+// a replica's request for the slot up to which it must perform
+// before serving a read
+struct ReadIndexRequest {
+    int fd;
+    string request_id;
+    struct timeval arrival;
+    bool round_requested;
+};
+
 class Leader {
 public:
     bool ConnectToCommander(const int server_id);
     bool ConnectToScout(const int server_id);
     bool ConnectToReplica(const int server_id);
     void LeaderMode();
+    void StandbyMode();
+    void OwnerMode();
     void IncrementBallotNum();
+    void JumpBallotPast(const Ballot &seen);
+    time_t NextScoutBackoff();
+    string AllDecisionsMessage();
     void SendReplicasAllDecisions();
     void GetFdSet(fd_set& recv_from_set, int& fd_max, std::vector<int> &fds);
+    void FlushOutbox();
+    int CountAcceptorsAtScout();
+    int GetReplicaIdFromFd(const int fd);
+    bool LeaseRoundDue();
+    void StartLeaseRound();
+    void AddAcceptorFds(fd_set& recv_from_set, int& fd_max, std::vector<int> &fds);
+    void ReceiveFromAcceptor(const int fd);
+    void EndLeadership();
+    int ReadIndex();
+    void AnswerReadIndexRequests();
+    void SpawnCommander(const Triple &t, const int skip_to, const int stride);
+    bool ProposeOwnSlot(const std::vector<string> &token);
+    void FillHoles();
+    void StartEpoch();
+    bool EpochStale();
+    void ReceiveFastP2b(const Triple &t, const int acceptor_id);
+    bool FastRecoveryDue();
+    void ResolveFastVotes(const unordered_set<Triple> &pvalues,
+                          const unordered_map<Triple, int> &votes);
+    bool FastSlotsRecovered();
+    void SendAny();
 
     int get_commander_fd(const int server_id);
     int get_scout_fd(const int server_id);
@@ -46,12 +83,36 @@ public:
 private:
     Ballot ballot_num_;
     bool leader_active_;
+    time_t scout_backoff_;  // current cap of randomized backoff before a scout retry
+    int preemptions_;       // preemptions since the last adopted ballot
+    unsigned int seed_;     // for rand_r()
     int num_commanders_;
     vector<pthread_t> commanders_;
     std::vector<int> commander_fd_;
     std::vector<int> scout_fd_;
     std::vector<int> replica_fd_;
 
+    // rounds of LEASE messages, which confirm leadership for reads
+    int lease_round_;                   // number of the latest round
+    struct timeval lease_round_start_;  // when the latest round was sent
+    bool lease_round_pending_;          // latest round not acked by a majority yet
+    std::set<int> lease_acks_;          // acceptors which acked the latest round
+    int lease_from_slot_;               // first slot past those adopted
+    vector<ReadIndexRequest> read_index_requests_;
+
+    // multi-leader mode
+    std::vector<int> epoch_replica_fd_; // replica connections the epoch was announced on
+    Ballot preempted_by_;               // highest ballot this server's commanders lost to
+
+    // fast path, for the fast slots of the current ballot which are not decided yet
+    std::map<int, std::map<int, Proposal> > fast_votes_;   // slot -> acceptor -> value
+    std::map<int, struct timeval> fast_started_;           // slot -> first vote
+    bool fast_collision_;               // a slot can no longer get a fast quorum
+    bool any_pending_;                  // ANY to be sent once the adopted slots are decided
+    std::vector<int> any_fd_;           // acceptor connections ANY went out on with this ballot
+    Outbox outbox_;
+    Inbox inbox_;
+    Dispatcher acceptor_dispatcher_;    // of the scout's connections while it is idle
 
 };
 
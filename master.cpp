@@ -1,6 +1,7 @@
 #include "master.h"
 #include "constants.h"
 #include "utilities.h"
+#include "options.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -32,6 +33,7 @@ using namespace std;
 extern char **environ;
 pthread_mutex_t primary_id_lock;
 pthread_mutex_t proceed_lock;
+pthread_mutex_t script_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int Master::get_server_fd(const int server_id) {
     return server_fd_[server_id];
@@ -77,6 +79,18 @@ bool Master::get_proceed() {
     return p;
 }
 
+string Master::get_options_file() {
+    return options_file_;
+}
+
+string Master::get_ports_file() {
+    return ports_file_;
+}
+
+const Options& Master::get_options() {
+    return options_;
+}
+
 int Master::get_num_servers() {
     return num_servers_;
 }
@@ -115,6 +129,14 @@ void Master::set_proceed(const bool p) {
     pthread_mutex_unlock(&proceed_lock);
 }
 
+void Master::set_options_file(const string &options_file) {
+    options_file_ = options_file;
+}
+
+void Master::set_ports_file(const string &ports_file) {
+    ports_file_ = ports_file;
+}
+
 void Master::set_server_status(const int server_id, const Status s) {
     server_status_[server_id] = s;
 }
@@ -173,7 +195,7 @@ void Master::SetCloseExecFlag(const int fd) {
     ifstream fin;
     fin.exceptions ( ifstream::failbit | ifstream::badbit );
     try {
-        fin.open(kPortsFile.c_str());
+        fin.open(ports_file_.c_str());
         fin >> master_port_;
 
         int port;
@@ -205,24 +227,48 @@ void Master::SetCloseExecFlag(const int fd) {
  */
  void Master::ReadTest() {
     string line;
-    while (getline(std::cin, line)) {
+    while (getline(std::cin, line))
+        script_.push_back(line);
+    armed_.assign(script_.size(), false);
+    for (int i = 0; i < script_.size(); i++) {
+        line = script_[i];
         if(line[0]=='#')
             continue;
+        if (!StartCommand(i))
+            continue;
 
         std::istringstream iss(line);
         string keyword;
         iss >> keyword;
         if (keyword == kStart) {
             iss >> num_servers_ >> num_clients_;
+            string options_file;
+            string ports_file;
+            if (!(iss >> options_file))
+                options_file = kOptionsFile;
+            if (!(iss >> ports_file))
+                ports_file = kPortsFile;
+            set_options_file(options_file);
+            set_ports_file(ports_file);
             Initialize();
             if (!ReadPortsFile())
                 return ;
-            if (!SpawnServers(num_servers_))
+            if (!ReadOptionsFile(get_options_file(), options_)
+                    || !CheckQuorums(options_, num_servers_)
+                    || !CheckMultiLeader(options_)
+                    || !CheckFastPaxos(options_)
+                    || !CheckErasureCoding(options_, num_servers_))
+                return;
+            struct timeval start_time;
+            gettimeofday(&start_time, NULL);
+            // a time bomb right after start is armed before the primary's
+            // first P1A
+            if (!SpawnServers(num_servers_, TakeTimeBomb(true)))
                 return;
             if (!SpawnClients(num_clients_))
                 return;
-            usleep(kGeneralSleep);
-            // usleep(kGeneralSleep);
+            WaitForGoAhead(get_primary_id());
+            D(cout << "M  : Cluster ready in " << ElapsedSince(start_time) / 1000 << " ms" << endl;)
             pthread_t peek_server_activities_thread;
             CreateThread(PeekServerActivities, (void*)this, peek_server_activities_thread);
         }
@@ -282,15 +328,30 @@ void Master::SetCloseExecFlag(const int fd) {
         if (keyword == kTimeBombLeader) {
             int num_messages;
             iss >> num_messages;
+            while (get_proceed() == WAIT) {
+                usleep(kBusyWaitSleep);
+            }
             TimeBombLeader(num_messages);
             WaitForGoAhead(get_primary_id());
         }
+        if (keyword == kTransferLeader) {
+            int server_id;
+            iss >> server_id;
+            TransferLeader(server_id);
+        }
+        if (keyword == kReadChatLog) {
+            int client_id, server_id;
+            iss >> client_id;
+            if (!(iss >> server_id))
+                server_id = -1;     // through the primary
+            ReadChatLog(client_id, server_id);
+        }
         if (keyword == kPrintChatLog) {
             usleep(kGeneralSleep);
             usleep(kGeneralSleep);
             int client_id;
             iss >> client_id;
-            string message = kChatLog + kInternalDelim;
+            string message = kChatLog + kInternalDelim + kMessageDelim;
             SendMessageToClient(client_id, message);
             string chat_log;
             ReceiveChatLogFromClient(client_id, chat_log);
@@ -327,6 +388,25 @@ void Master::WaitForGoAhead(const int server_id) {
         }
     }
 }
+/**
+ * consumes a NEWPRIMARY message from a server, if that is the next message
+ * on its connection, and makes the server the primary
+ * @param  server_id id of server
+ * @return           true if the server announced itself as the new primary
+ */
+bool Master::ReceiveNewPrimary(const int server_id) {
+    string expected = kNewPrimary + kInternalDelim + to_string(server_id) + kMessageDelim;
+    char buf[kMaxDataSize];
+    int num_bytes = recv(get_server_fd(server_id), buf, expected.size(), MSG_DONTWAIT | MSG_PEEK);
+    if (num_bytes != (int)expected.size() || string(buf, num_bytes) != expected)
+        return false;
+
+    recv(get_server_fd(server_id), buf, expected.size(), 0);
+    set_primary_id(server_id);
+    D(cout << "M  : S" << server_id << " announced itself as new primary" << endl;)
+    return true;
+}
+
 int Master::GetServerIdFromFd(int fd)
 {
     for (int i = 0; i < get_num_servers(); i++)
@@ -456,12 +536,134 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
     SendMessageToServer(primary_id, msg);
 }
 
+/**
+ * marks a line of the test as the one running
+ * @param  line index of the line in the test
+ * @return      false if the line is a timeBombLeader which was armed ahead
+ *              of time, and is not to be run again
+ */
+ bool Master::StartCommand(const int line) {
+    pthread_mutex_lock(&script_lock);
+    next_command_ = line + 1;
+    bool armed = armed_[line];
+    pthread_mutex_unlock(&script_lock);
+    return !armed;
+}
+
+/**
+ * takes the quota of a timeBombLeader still to come in the test, to arm a
+ * primary with before it sends anything. A primary begins phase 1 as soon
+ * as it is started or named, so a time bomb sent when the test reaches it
+ * would be armed after phase 1 or during it, depending on timing
+ * @param  next_only true to take only a timeBombLeader which is the next
+ *                   command, false to take the next timeBombLeader unless a
+ *                   crashServer or transferLeader comes first
+ * @return           quota of messages, or -1 for no time bomb to take
+ */
+ int Master::TakeTimeBomb(const bool next_only) {
+    int quota = -1;
+    pthread_mutex_lock(&script_lock);
+    for (int i = next_command_; i < script_.size(); i++) {
+        std::istringstream iss(script_[i]);
+        string keyword;
+        iss >> keyword;
+        if (keyword.empty() || keyword[0] == '#' || armed_[i])
+            continue;
+        if (keyword == kTimeBombLeader) {
+            iss >> quota;
+            armed_[i] = true;
+            break;
+        }
+        if (next_only || keyword == kCrashServer || keyword == kTransferLeader)
+            break;
+    }
+    pthread_mutex_unlock(&script_lock);
+    return quota;
+}
+
+/**
+ * hands leadership over from the primary to another server without a
+ * crash. The primary drains its in-flight proposals and replies with
+ * a HANDOFF, which is passed on to the target before NEWPRIMARY
+ * @param server_id id of server to take over
+ */
+ void Master::TransferLeader(const int server_id) {
+    int old_primary = get_primary_id();
+    if (options_.multi_leader) {
+        // every server leads its own slots, and the primary only assigns them
+        D(cout << "M  : ERROR: transferLeader is not supported with multi_leader" << endl;)
+        return;
+    }
+    if (server_id == old_primary || get_server_status(server_id) == DEAD) {
+        D(cout << "M  : ERROR: Cannot transfer leadership from S" << old_primary
+          << " to S" << server_id << endl;)
+        return;
+    }
+
+    struct timeval start_time;
+    gettimeofday(&start_time, NULL);
+    SendMessageToServer(old_primary, kTransfer + kInternalDelim + to_string(server_id) + kMessageDelim);
+
+    string handoff;
+    char buf[kMaxDataSize];
+    int num_bytes;
+    while (handoff.find(kMessageDelim) == string::npos) {
+        if ((num_bytes = recv(get_server_fd(old_primary), buf, kMaxDataSize - 1, 0)) <= 0) {
+            D(cout << "M  : ERROR in receiving HANDOFF from primary S" << old_primary << endl;)
+            return;
+        }
+        handoff.append(buf, num_bytes);
+    }
+    handoff = handoff.substr(0, handoff.find(kMessageDelim) + 1);
+    D(cout << "M  : HANDOFF received from S" << old_primary << " after "
+      << ElapsedSince(start_time) / 1000 << " ms: " << handoff << endl;)
+
+    SendMessageToServer(server_id, handoff);
+    set_primary_id(server_id);
+    InformServersAboutNewPrimary();
+    WaitForGoAhead(server_id);
+    InformClientsAboutNewPrimary();
+    D(cout << "M  : Leadership transferred from S" << old_primary << " to S" << server_id
+      << " in " << ElapsedSince(start_time) / 1000 << " ms" << endl;)
+}
+
+/**
+ * has a client read the chat log from a server, and prints it the way
+ * printChatLog does. Unlike printChatLog, this needs no wait for the chats
+ * sent so far to reach the client: the server answers once the chat log
+ * it holds is known to be complete
+ * @param client_id id of client to read through
+ * @param server_id id of server to read from, -1 for the primary
+ */
+ void Master::ReadChatLog(const int client_id, const int server_id) {
+    struct timeval start_time;
+    gettimeofday(&start_time, NULL);
+    string message = kRead + kInternalDelim;
+    if (server_id != -1)
+        message += to_string(server_id);
+    SendMessageToClient(client_id, message + kMessageDelim);
+    string chat_log;
+    ReceiveChatLogFromClient(client_id, chat_log);
+    D(cout << "M  : Chat log read through C" << client_id << " from "
+      << ((server_id == -1) ? "primary" : "S" + to_string(server_id)) << " in "
+      << ElapsedSince(start_time) / 1000 << " ms" << endl;)
+    PrintChatLog(client_id, chat_log);
+}
+
 /**
  * performs all tasks related to new primary election
  * and informing servers and clients about the new primary
+ * @param bombed true if the old primary died of its time bomb. The next
+ *               time bomb of the test is then meant for the new primary, and
+ *               is armed before it is named
  */
- void Master::NewPrimaryElection() {
+ void Master::NewPrimaryElection(const bool bombed) {
     ElectNewPrimary();
+    int quota = bombed ? TakeTimeBomb(false) : -1;
+    if (quota != -1) {
+        TimeBombLeader(quota);
+        WaitForGoAhead(get_primary_id());
+    }
     InformServersAboutNewPrimary();
 }
 
@@ -577,10 +779,8 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
     if (!SpawnOneServer(server_id, RECOVER))
         return false;
 
-    // sleep for some time to make sure accept threads of the server are running
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
-    if (ConnectToServer(server_id)) {
+    // accept thread of the server may not be running yet. retry with backoff
+    if (RetryWithBackoff([&]() { return ConnectToServer(server_id); }, kConnectTimeout)) {
         D(cout << "M  : Connected to server S" << server_id << endl;)
     } else {
         D(cout << "M  : ERROR: Cannot connect to server S" << server_id << endl;)
@@ -593,20 +793,19 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
 
 /**
  * spawns n servers and connects to them
- * @param n number of servers to be spawned
+ * @param n             number of servers to be spawned
+ * @param primary_quota message quota of the primary, -1 for no time bomb
  * @return true if n servers were spawned and connected to successfully
  */
- bool Master::SpawnServers(const int n) {
+ bool Master::SpawnServers(const int n, const int primary_quota) {
     for (int i = 0; i < n; ++i) {
-        if (!SpawnOneServer(i, RUNNING))
+        if (!SpawnOneServer(i, RUNNING, (i == get_primary_id()) ? primary_quota : -1))
             return false;
     }
 
-    // sleep for some time to make sure accept threads of servers are running
-    usleep(kGeneralSleep);
-    usleep(kGeneralSleep);
+    // accept threads of servers may not be running yet. retry with backoff
     for (int i = 0; i < n; ++i) {
-        if (ConnectToServer(i)) {
+        if (RetryWithBackoff([&]() { return ConnectToServer(i); }, kConnectTimeout)) {
             D(cout << "M  : Connected to server S" << i << endl;)
         } else {
             D(cout << "M  : ERROR: Cannot connect to server S" << i << endl;)
@@ -618,10 +817,11 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
 
 /**
  * spawns 1 servers and connects to them
- * @param server_id id of server to be spawned
+ * @param server_id     id of server to be spawned
+ * @param message_quota message quota it starts with, -1 for no time bomb
  * @return true if server wes spawned successfully
  */
- bool Master::SpawnOneServer(const int server_id, Status mode) {
+ bool Master::SpawnOneServer(const int server_id, Status mode, const int message_quota) {
     pid_t pid;
     int status;
     char server_id_arg[10];
@@ -629,10 +829,12 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
     char num_clients_arg[10];
     char primary_id_arg[10];
     char mode_arg[10];
+    char message_quota_arg[12];
     sprintf(server_id_arg, "%d", server_id);
     sprintf(num_servers_arg, "%d", num_servers_);
     sprintf(num_clients_arg, "%d", num_clients_);
     sprintf(primary_id_arg, "%d", get_primary_id());
+    sprintf(message_quota_arg, "%d", message_quota);
 
     if (mode == RECOVER)
         sprintf(mode_arg, "%d", 2);
@@ -645,6 +847,9 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
         num_clients_arg,
         mode_arg,
         primary_id_arg,
+        (char*)options_file_.c_str(),
+        (char*)ports_file_.c_str(),
+        (message_quota == -1) ? NULL : message_quota_arg,
         NULL
     };
     status = posix_spawn(&pid,
@@ -683,6 +888,8 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
             server_id_arg,
             num_servers_arg,
             num_clients_arg,
+            (char*)options_file_.c_str(),
+            (char*)ports_file_.c_str(),
             NULL
         };
         status = posix_spawn(&pid,
@@ -700,10 +907,9 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
         }
     }
 
-    // sleep for some time to make sure accept threads of clients are running
-    usleep(kGeneralSleep);
+    // accept threads of clients may not be running yet. retry with backoff
     for (int i = 0; i < n; ++i) {
-        if (ConnectToClient(i)) {
+        if (RetryWithBackoff([&]() { return ConnectToClient(i); }, kConnectTimeout)) {
             D(cout << "M  : Connected to client C" << i << endl;)
         } else {
             D(cout << "M  : ERROR: Cannot connect to client C" << i << endl;)
@@ -823,6 +1029,8 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
     char buf;
 
     std::vector<int> fds;
+    bool cluster_election = (M->get_options().leader_election == CLUSTER_ELECTION);
+    struct timeval failure_time;    // when the last primary was found dead
     while (true) {
         M->GetServerFdSet(server_set, fds, fd_max);
 
@@ -851,15 +1059,25 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
                         M->set_proceed(WAIT);
                         if (serv_id == M->get_primary_id()) {
                             // if a primary dies, it might have been because of timeBombLeader
-                            // master might not have closed and reset its fd/pid/status yet
+                            // master might not have closed and reset its fd/pid/status yet.
+                            // a primary the master crashed has its pid reset already
+                            bool bombed = (M->get_server_pid(serv_id) != -1);
                             close(M->get_server_fd(serv_id));
                             M->set_server_pid(serv_id, -1);
                             M->set_server_fd(serv_id, -1);
                             M->set_server_status(serv_id, DEAD);
 
-                            M->NewPrimaryElection();
+                            gettimeofday(&failure_time, NULL);
+                            if (cluster_election) {
+                                // servers elect the new primary themselves, and it
+                                // announces itself with NEWPRIMARY. Till then, wait
+                                continue;
+                            }
+                            M->NewPrimaryElection(bombed);
                             M->WaitForGoAhead(M->get_primary_id());
                             M->InformClientsAboutNewPrimary();
+                            D(cout << "M  : New primary S" << M->get_primary_id() << " ready in "
+                              << ElapsedSince(failure_time) / 1000 << " ms" << endl;)
                         } else {
                             // if a non-primary dies, master must have called crashServer on it
                             // no need to close and set fd/status/pid again.
@@ -869,6 +1087,12 @@ void Master::GetServerFdSet(fd_set& server_fd_set, vector<int>& server_fd_vec, i
                         }
                         M->set_proceed(NORMAL);
                         // M->set_proceed(true);
+                    } else if (cluster_election && M->ReceiveNewPrimary(serv_id)) {
+                        // primary elected by the servers
+                        M->WaitForGoAhead(serv_id);
+                        D(cout << "M  : New primary S" << serv_id << " elected by servers, ready in "
+                          << ElapsedSince(failure_time) / 1000 << " ms" << endl;)
+                        M->set_proceed(NORMAL);
                     } else {
                         // some valid activity detected. Ignore
                     }
@@ -4,6 +4,7 @@
 #include "string"
 #include "fstream"
 #include "iostream"
+#include "options.h"
 using namespace std;
 
 void* PeekServerActivities(void *_M);
@@ -17,8 +18,8 @@ public:
     bool ReadPortsFile();
     void ReadTest();
     void Initialize();
-    bool SpawnServers(const int n);
-    bool SpawnOneServer(const int server_id, Status mode);
+    bool SpawnServers(const int n, const int primary_quota = -1);
+    bool SpawnOneServer(const int server_id, Status mode, const int message_quota = -1);
     bool SpawnClients(const int n);
     void CrashServer(const int server_id);
     void CrashClient(const int client_id);
@@ -32,19 +33,24 @@ public:
     void SendMessageToServer(const int server_id, const string &message);
     void ReceiveChatLogFromClient(const int client_id, string &chat_log);
     void PrintChatLog(const int client_id, const string &chat_log);
+    void ReadChatLog(const int client_id, const int server_id = -1);
     void ElectNewLeader();
     void TimeBombLeader(const int num_messages);
+    bool StartCommand(const int line);
+    int TakeTimeBomb(const bool next_only);
+    void TransferLeader(const int server_id);
     void SendAllClearToServers(const string&);
     void WaitForAllClearDone();
     void GetServerFdSet(fd_set& server_fd_set, vector<int>& fds, int& fd_max);
     void ConstructAllClearMessage(string &message, const string& type);
-    void NewPrimaryElection();
+    void NewPrimaryElection(const bool bombed = false);
     void ElectNewPrimary();
     void InformClientsAboutNewPrimary();
     void InformServersAboutNewPrimary();
     void WaitForGoAhead(const int server_id);
     void CloseAndUnSetServer(int id);
     int GetServerIdFromFd(int fd);
+    bool ReceiveNewPrimary(const int server_id);
     bool RestartServer(const int server_id);
     void SetCloseExecFlag(const int fd);
     bool InitializeLocks();
@@ -59,6 +65,9 @@ public:
     int get_primary_id();
     int get_num_servers();
     bool get_proceed();
+    string get_options_file();
+    string get_ports_file();
+    const Options& get_options();
     Status get_server_status(const int server_id);
 
     void set_server_pid(const int server_id, const int pid);
@@ -68,6 +77,8 @@ public:
     void set_primary_id(const int primary_id);
     void set_server_status(const int server_id, const Status s);
     void set_proceed(const bool p);
+    void set_options_file(const string &options_file);
+    void set_ports_file(const string &ports_file);
 private:
     int num_servers_;
     int num_clients_;
@@ -87,5 +98,12 @@ private:
     std::vector<int> server_listen_port_;
     std::vector<int> client_listen_port_;
 
+    string options_file_;   // options file passed on to servers and clients
+    string ports_file_;     // ports file passed on to servers and clients
+
+    std::vector<string> script_;    // lines of the test, read from stdin
+    std::vector<bool> armed_;       // timeBombLeader lines armed ahead of time
+    int next_command_;              // index in script_ of the next line to run
+    Options options_;
 };
 #endif //MASTER_H_
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include "metrics.h"
+#include "sstream"
+#include "iomanip"
+#include "pthread.h"
+#include "algorithm"
+using namespace std;
+
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// static member definitions
+long long Metrics::messages_sent_ = 0;
+long long Metrics::bytes_sent_ = 0;
+long long Metrics::send_syscalls_ = 0;
+long long Metrics::preemptions_ = 0;
+long long Metrics::commits_ = 0;
+long long Metrics::commit_time_ = 0;
+long long Metrics::p2a_sent_ = 0;
+long long Metrics::fast_commits_ = 0;
+long long Metrics::collisions_ = 0;
+long long Metrics::tentative_ = 0;
+long long Metrics::rollbacks_ = 0;
+long long Metrics::answers_ = 0;
+long long Metrics::answer_time_ = 0;
+long long Metrics::acceptor_connects_ = 0;
+long long Metrics::vote_messages_ = 0;
+map<string, CompressionStats> Metrics::compression_;
+map<string, DispatchCounts> Metrics::dispatch_;
+map<const DispatchStats *, string> Metrics::live_dispatch_;
+
+/**
+ * adds the counters in from to those in to
+ */
+static void MergeDispatchStats(const DispatchStats &from, DispatchCounts &to) {
+    to.handled += from.handled.load(memory_order_relaxed);
+    to.timed += from.timed.load(memory_order_relaxed);
+    to.handle_time += from.handle_time.load(memory_order_relaxed);
+    for (int b = 0; b < kDispatchBuckets; b++)
+        to.buckets[b] += from.buckets[b].load(memory_order_relaxed);
+}
+
+/**
+ * records one send syscall
+ * @param num_messages number of messages written by the syscall
+ * @param num_bytes    number of bytes written by the syscall
+ */
+void Metrics::AddSend(const int num_messages, const int num_bytes) {
+    pthread_mutex_lock(&metrics_lock);
+    messages_sent_ += num_messages;
+    bytes_sent_ += num_bytes;
+    send_syscalls_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one preemption of a leader's ballot
+ */
+void Metrics::AddPreemption() {
+    pthread_mutex_lock(&metrics_lock);
+    preemptions_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one slot decided by a commander of this server, or on a client
+ * one of its chats decided
+ * @param latency microsec from the commander's start, or the chat's first
+ *                send, till the decision
+ */
+void Metrics::AddCommit(const long long latency) {
+    pthread_mutex_lock(&metrics_lock);
+    commits_++;
+    commit_time_ += latency;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one P2A sent by a commander of this server
+ */
+void Metrics::AddP2a() {
+    pthread_mutex_lock(&metrics_lock);
+    p2a_sent_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one fast slot decided by a fast quorum, without recovery
+ */
+void Metrics::AddFastCommit() {
+    pthread_mutex_lock(&metrics_lock);
+    fast_commits_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one recovery of fast slots, after a collision or a timeout
+ */
+void Metrics::AddCollision() {
+    pthread_mutex_lock(&metrics_lock);
+    collisions_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one tentative response, sent by the primary's replica or
+ * received by a client
+ */
+void Metrics::AddTentative() {
+    pthread_mutex_lock(&metrics_lock);
+    tentative_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one tentative response taken back, as the slot was decided
+ * otherwise
+ */
+void Metrics::AddRollback() {
+    pthread_mutex_lock(&metrics_lock);
+    rollbacks_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records on a client the first answer for one of its chats, tentative
+ * or decided
+ * @param latency microsec from the chat's first send till the answer
+ */
+void Metrics::AddAnswer(const long long latency) {
+    pthread_mutex_lock(&metrics_lock);
+    answers_++;
+    answer_time_ += latency;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one connection opened by a commander of this server to an acceptor
+ */
+void Metrics::AddAcceptorConnect() {
+    pthread_mutex_lock(&metrics_lock);
+    acceptor_connects_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one P2B or VOTES message received by a commander of this server
+ */
+void Metrics::AddVoteMessage() {
+    pthread_mutex_lock(&metrics_lock);
+    vote_messages_++;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one message sent as a compressed frame
+ * @param type        message type
+ * @param raw_bytes   bytes of the message
+ * @param frame_bytes bytes of the compressed frame
+ * @param cpu_time    nanosec of CPU time compressing it took
+ */
+void Metrics::AddCompression(const string &type, const int raw_bytes,
+                             const int frame_bytes, const long long cpu_time) {
+    pthread_mutex_lock(&metrics_lock);
+    CompressionStats &c = compression_[type];
+    c.frames++;
+    c.raw_bytes += raw_bytes;
+    c.frame_bytes += frame_bytes;
+    c.compress_time += cpu_time;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one compressed frame received and decompressed
+ * @param type     type of the message in it
+ * @param cpu_time nanosec of CPU time decompressing it took
+ */
+void Metrics::AddDecompression(const string &type, const long long cpu_time) {
+    pthread_mutex_lock(&metrics_lock);
+    CompressionStats &c = compression_[type];
+    c.decompressed++;
+    c.decompress_time += cpu_time;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * has Summary() report the counters of a Dispatcher, which it keeps and
+ * updates without a lock
+ * @param key   <role>_<message type>
+ * @param stats counters of the messages of that type the Dispatcher handles
+ */
+void Metrics::AddDispatchStats(const string &key, const DispatchStats *stats) {
+    pthread_mutex_lock(&metrics_lock);
+    live_dispatch_[stats] = key;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * keeps the counts of a Dispatcher which is going away, under its key
+ * @param stats counters given to AddDispatchStats()
+ */
+void Metrics::RemoveDispatchStats(const DispatchStats *stats) {
+    pthread_mutex_lock(&metrics_lock);
+    auto it = live_dispatch_.find(stats);
+    if (it != live_dispatch_.end()) {
+        MergeDispatchStats(*stats, dispatch_[it->second]);
+        live_dispatch_.erase(it);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * records one timed message. Takes no lock, and is called only by the
+ * thread of the Dispatcher owning stats
+ * @param stats counters of its role and type
+ * @param time  nanosec its handler took
+ */
+void Metrics::AddDispatch(DispatchStats &stats, const long long time) {
+    int bucket = 0;
+    while (bucket < kDispatchBuckets - 1 && time >= (1000LL << bucket))
+        bucket++;
+    AddToCounter(stats.timed, 1);
+    AddToCounter(stats.handle_time, time);
+    AddToCounter(stats.buckets[bucket], 1);
+}
+
+/**
+ * @return one line summary of all counters. Each message type compressed
+ *         or decompressed here adds <type>_frames, the compression ratio
+ *         of its frames, and the microsec of CPU time per frame compressing
+ *         and decompressing took. Each message type handled here by a role
+ *         adds <role>_<type>_handled, the mean microsec its handler took over
+ *         the timed messages, and a histogram of those times, as <bound>:<count>
+ *         for each bucket of messages handled in under <bound> microsec which
+ *         is not empty. The counters of running Dispatchers are read as
+ *         they are updated, so they may be a message behind
+ */
+string Metrics::Summary() {
+    ostringstream out;
+    pthread_mutex_lock(&metrics_lock);
+    double per_syscall = (send_syscalls_ == 0) ? 0 :
+                         (double)messages_sent_ / send_syscalls_;
+    long long per_commit = (commits_ == 0) ? 0 : commit_time_ / commits_;
+    long long per_answer = (answers_ == 0) ? 0 : answer_time_ / answers_;
+    out << "messages_sent=" << messages_sent_
+        << " bytes_sent=" << bytes_sent_
+        << " send_syscalls=" << send_syscalls_
+        << " messages_per_syscall=" << fixed << setprecision(2) << per_syscall
+        << " preemptions=" << preemptions_
+        << " commits=" << commits_
+        << " commit_latency_us=" << per_commit
+        << " p2a_sent=" << p2a_sent_
+        << " fast_commits=" << fast_commits_
+        << " collisions=" << collisions_
+        << " tentative=" << tentative_
+        << " rollbacks=" << rollbacks_
+        << " answer_latency_us=" << per_answer
+        << " acceptor_connects=" << acceptor_connects_
+        << " vote_messages=" << vote_messages_;
+    for (const auto &c : compression_) {
+        string type = c.first;
+        transform(type.begin(), type.end(), type.begin(), ::tolower);
+        const CompressionStats &s = c.second;
+        out << " " << type << "_frames=" << s.frames
+            << " " << type << "_ratio=" << ((s.frame_bytes == 0) ? 0 : (double)s.raw_bytes / s.frame_bytes)
+            << " " << type << "_compress_us=" << ((s.frames == 0) ? 0 : s.compress_time / 1000.0 / s.frames)
+            << " " << type << "_decompress_us="
+            << ((s.decompressed == 0) ? 0 : s.decompress_time / 1000.0 / s.decompressed);
+    }
+    map<string, DispatchCounts> dispatch = dispatch_;
+    for (const auto &d : live_dispatch_)
+        MergeDispatchStats(*d.first, dispatch[d.second]);
+    for (const auto &d : dispatch) {
+        string key = d.first;
+        transform(key.begin(), key.end(), key.begin(), ::tolower);
+        const DispatchCounts &s = d.second;
+        if (s.handled == 0)
+            continue;
+        out << " " << key << "_handled=" << s.handled
+            << " " << key << "_handle_us=" << ((s.timed == 0) ? 0 : s.handle_time / 1000.0 / s.timed)
+            << " " << key << "_hist=";
+        string sep = "";
+        for (int b = 0; b < kDispatchBuckets; b++) {
+            if (s.buckets[b] == 0)
+                continue;
+            out << sep << ((b == kDispatchBuckets - 1) ? "inf" : to_string(1 << b))
+                << ":" << s.buckets[b];
+            sep = ",";
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return out.str();
+}
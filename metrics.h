@@ -0,0 +1,108 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "string"
+#include "map"
+#include "atomic"
+using namespace std;
+
+// compressed frames of one message type
+struct CompressionStats {
+    long long frames;           // compressed here
+    long long raw_bytes;
+    long long frame_bytes;
+    long long compress_time;    // nanosec of thread CPU time
+    long long decompressed;     // frames decompressed here
+    long long decompress_time;  // nanosec of thread CPU time
+
+    CompressionStats() : frames(0), raw_bytes(0), frame_bytes(0), compress_time(0),
+                         decompressed(0), decompress_time(0) { }
+};
+
+// log2 buckets of handling times, see DispatchStats
+const int kDispatchBuckets = 16;
+
+// messages of one type handled by one role, as Summary() adds them up
+struct DispatchCounts {
+    long long handled;
+    long long timed;                        // handled messages which were timed
+    long long handle_time;                  // nanosec, summed over timed messages
+    long long buckets[kDispatchBuckets];    // timed messages handled in under 2^i
+                                            // microsec, the last bucket takes all
+                                            // slower ones
+
+    DispatchCounts() : handled(0), timed(0), handle_time(0), buckets() { }
+};
+
+// the counters of DispatchCounts, as a Dispatcher keeps them. Only the thread
+// of the Dispatcher owning them writes them, without a lock, and Summary()
+// reads them from another thread. Each is atomic so that the reads are not
+// torn, and relaxed, as the counters are not read together with other data
+struct DispatchStats {
+    atomic<long long> handled;
+    atomic<long long> timed;
+    atomic<long long> handle_time;
+    atomic<long long> buckets[kDispatchBuckets];
+
+    DispatchStats() : handled(0), timed(0), handle_time(0) {
+        for (int b = 0; b < kDispatchBuckets; b++)
+            buckets[b].store(0, memory_order_relaxed);
+    }
+};
+
+/**
+ * adds by to a counter of DispatchStats. There is one writer, so a relaxed
+ * load and store do, without the locked add of fetch_add
+ */
+inline void AddToCounter(atomic<long long> &counter, const long long by) {
+    counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+/**
+ * process wide counters, shared by all threads of a server or client
+ */
+class Metrics {
+public:
+    static void AddSend(const int num_messages, const int num_bytes);
+    static void AddPreemption();
+    static void AddCommit(const long long latency);
+    static void AddP2a();
+    static void AddFastCommit();
+    static void AddCollision();
+    static void AddTentative();
+    static void AddRollback();
+    static void AddAnswer(const long long latency);
+    static void AddAcceptorConnect();
+    static void AddVoteMessage();
+    static void AddCompression(const string &type, const int raw_bytes,
+                               const int frame_bytes, const long long cpu_time);
+    static void AddDecompression(const string &type, const long long cpu_time);
+    static void AddDispatchStats(const string &key, const DispatchStats *stats);
+    static void RemoveDispatchStats(const DispatchStats *stats);
+    static void AddDispatch(DispatchStats &stats, const long long time);
+    static string Summary();
+
+private:
+    static long long messages_sent_;
+    static long long bytes_sent_;
+    static long long send_syscalls_;
+    static long long preemptions_;
+    static long long commits_;
+    static long long commit_time_;      // microsec, summed over commits
+    static long long p2a_sent_;
+    static long long fast_commits_;
+    static long long collisions_;
+    static long long tentative_;
+    static long long rollbacks_;
+    static long long answers_;
+    static long long answer_time_;      // microsec, summed over answers
+    static long long acceptor_connects_;
+    static long long vote_messages_;
+    static map<string, CompressionStats> compression_;     // by message type
+    static map<string, DispatchCounts> dispatch_;           // by role and message type, of
+                                                            // Dispatchers which are gone
+    static map<const DispatchStats *, string> live_dispatch_;   // of running Dispatchers,
+                                                                // to their keys
+};
+
+#endif //METRICS_H_
@@ -0,0 +1,353 @@
+#include "options.h"
+#include "constants.h"
+#include "iostream"
+#include "fstream"
+#include "sstream"
+#include "algorithm"
+#include "cstdlib"
+#include "cerrno"
+#include "climits"
+using namespace std;
+
+#define DEBUG
+
+#ifdef DEBUG
+#  define D(x) x
+#else
+#  define D(x)
+#endif // DEBUG
+
+Options::Options()
+    : outbox_max_bytes(kOutboxMaxBytes),
+      overflow_policy(BACKPRESSURE),
+      heartbeat_interval(kHeartbeatInterval),
+      failure_timeout(kFailureTimeout),
+      leader_election(MASTER_ELECTION),
+      hot_standby(false),
+      lease_duration(0),
+      clock_drift(kClockDrift),
+      phase1_quorum(0),
+      phase2_quorum(0),
+      thrifty_p2a(false),
+      thrifty_timeout(kThriftyTimeout),
+      multi_leader(false),
+      fast_paxos(false),
+      fast_timeout(kFastTimeout),
+      speculative(false),
+      distributed_learning(false),
+      chain_p2a(false),
+      vote_relay_group(0),
+      relay_timeout(kRelayTimeout),
+      payload_separation(false),
+      erasure_k(0),
+      compress_min_bytes(0) { }
+
+/**
+ * parses the value of a numeric key, a whole decimal number
+ * @param  min    smallest value the key takes
+ * @param  max    largest value the key takes
+ * @param  number [out] the value, untouched if it is invalid
+ * @return        false if value is not a number, has anything after it, or
+ *                is out of [min, max]
+ */
+template <typename T>
+static bool StringToNumber(const string &value, const long min, const long max, T &number) {
+    char *end;
+    errno = 0;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno == ERANGE || n < min || n > max)
+        return false;
+    number = (T)n;
+    return true;
+}
+
+/**
+ * parses the value of a key in millisec
+ * @param  min_ms smallest value the key takes, in millisec
+ * @param  micros [out] the value in microsec, untouched if it is invalid
+ * @return        false if value is not a number of millisec of min_ms or more
+ */
+static bool StringToMillis(const string &value, const long min_ms, time_t &micros) {
+    long ms;
+    if (!StringToNumber(value, min_ms, LONG_MAX / 1000, ms))
+        return false;
+    micros = ms * 1000;
+    return true;
+}
+
+/**
+ * parses the value of an overflow policy key
+ * @return false if value is not a known policy
+ */
+static bool StringToOverflowPolicy(const string &value, OverflowPolicy &policy) {
+    if (value == "drop") {
+        policy = DROP_AND_RESYNC;
+    } else if (value == "disconnect") {
+        policy = DISCONNECT;
+    } else if (value == "backpressure") {
+        policy = BACKPRESSURE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * parses the value of a leader election key
+ * @return false if value is not a known election mode
+ */
+static bool StringToLeaderElection(const string &value, LeaderElection &election) {
+    if (value == "master") {
+        election = MASTER_ELECTION;
+    } else if (value == "cluster") {
+        election = CLUSTER_ELECTION;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * parses the value of an on/off key
+ * @return false if value is neither on nor off
+ */
+static bool StringToSwitch(const string &value, bool &on) {
+    if (value == "on") {
+        on = true;
+    } else if (value == "off") {
+        on = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * reads an options file with one "key value" pair per line.
+ * empty lines and lines starting with # are ignored
+ * @param  path    path of options file
+ * @param  options [out] options read from file. untouched keys keep defaults
+ * @return         false if the file exists but has an invalid line
+ */
+bool ReadOptionsFile(const string &path, Options &options) {
+    ifstream fin(path.c_str());
+    if (!fin.is_open()) {
+        // no options file. run with defaults
+        return true;
+    }
+
+    string line;
+    int line_num = 0;
+    while (getline(fin, line)) {
+        line_num++;
+        std::istringstream iss(line);
+        string key, value;
+        if (!(iss >> key) || key[0] == '#')
+            continue;
+
+        bool ok = (bool)(iss >> value);
+        if (ok) {
+            if (key == "outbox_max_bytes") {
+                ok = StringToNumber(value, 1, LONG_MAX, options.outbox_max_bytes);
+            } else if (key == "overflow_policy") {
+                ok = StringToOverflowPolicy(value, options.overflow_policy);
+            } else if (key == "heartbeat_interval_ms") {
+                ok = StringToMillis(value, 1, options.heartbeat_interval);
+            } else if (key == "failure_timeout_ms") {
+                ok = StringToMillis(value, 1, options.failure_timeout);
+            } else if (key == "leader_election") {
+                ok = StringToLeaderElection(value, options.leader_election);
+            } else if (key == "hot_standby") {
+                ok = StringToSwitch(value, options.hot_standby);
+            } else if (key == "lease_ms") {
+                ok = StringToMillis(value, 0, options.lease_duration);
+            } else if (key == "clock_drift_ms") {
+                ok = StringToMillis(value, 0, options.clock_drift);
+            } else if (key == "phase1_quorum") {
+                ok = StringToNumber(value, 0, INT_MAX, options.phase1_quorum);
+            } else if (key == "phase2_quorum") {
+                ok = StringToNumber(value, 0, INT_MAX, options.phase2_quorum);
+            } else if (key == "thrifty_p2a") {
+                ok = StringToSwitch(value, options.thrifty_p2a);
+            } else if (key == "thrifty_timeout_ms") {
+                ok = StringToMillis(value, 0, options.thrifty_timeout);
+            } else if (key == "multi_leader") {
+                ok = StringToSwitch(value, options.multi_leader);
+            } else if (key == "fast_paxos") {
+                ok = StringToSwitch(value, options.fast_paxos);
+            } else if (key == "fast_timeout_ms") {
+                ok = StringToMillis(value, 1, options.fast_timeout);
+            } else if (key == "speculative") {
+                ok = StringToSwitch(value, options.speculative);
+            } else if (key == "distributed_learning") {
+                ok = StringToSwitch(value, options.distributed_learning);
+            } else if (key == "chain_p2a") {
+                ok = StringToSwitch(value, options.chain_p2a);
+            } else if (key == "vote_relay_group") {
+                ok = StringToNumber(value, 0, INT_MAX, options.vote_relay_group);
+            } else if (key == "relay_timeout_ms") {
+                ok = StringToMillis(value, 0, options.relay_timeout);
+            } else if (key == "payload_separation") {
+                ok = StringToSwitch(value, options.payload_separation);
+            } else if (key == "erasure_k") {
+                ok = StringToNumber(value, 0, INT_MAX, options.erasure_k);
+            } else if (key == "compress_min_bytes") {
+                ok = StringToNumber(value, 0, LONG_MAX, options.compress_min_bytes);
+            } else {
+                ok = false;
+            }
+        }
+
+        if (!ok) {
+            D(cout << "ERROR: Invalid line " << line_num << " in " << path
+              << ": " << line << endl;)
+            fin.close();
+            return false;
+        }
+    }
+    fin.close();
+    return true;
+}
+
+/**
+ * @return fragments a phase 1 and a phase 2 quorum must have in common:
+ *         erasure_k with erasure coding, 1 otherwise
+ */
+static int QuorumOverlap(const Options &options) {
+    return max(options.erasure_k, 1);
+}
+
+/**
+ * @param  num_servers number of servers
+ * @return             number of P1Bs a scout needs for adoption
+ */
+int Phase1Quorum(const Options &options, const int num_servers) {
+    return (options.phase1_quorum > 0) ? options.phase1_quorum
+                                       : (num_servers + QuorumOverlap(options) + 1) / 2;
+}
+
+/**
+ * @param  num_servers number of servers
+ * @return             number of P2Bs a commander needs for a decision
+ */
+int Phase2Quorum(const Options &options, const int num_servers) {
+    return (options.phase2_quorum > 0) ? options.phase2_quorum
+                                       : (num_servers + QuorumOverlap(options) + 1) / 2;
+}
+
+/**
+ * quorums of any size are safe as long as every phase 1 quorum intersects
+ * every phase 2 quorum (Flexible Paxos), i.e. their sizes add up to more
+ * than the number of servers. With erasure coding they must have erasure_k
+ * acceptors in common, enough to rebuild a chat which may have been chosen
+ * (RS-Paxos)
+ * @param  num_servers number of servers
+ * @return             true if the quorum sizes are safe for num_servers
+ */
+bool CheckQuorums(const Options &options, const int num_servers) {
+    int q1 = Phase1Quorum(options, num_servers);
+    int q2 = Phase2Quorum(options, num_servers);
+    if (q1 > num_servers || q2 > num_servers
+            || q1 + q2 < num_servers + QuorumOverlap(options)) {
+        D(cout << "ERROR: Quorums of " << q1 << " (phase 1) and " << q2
+          << " (phase 2) are not safe for " << num_servers << " servers" << endl;)
+        return false;
+    }
+    return true;
+}
+
+/**
+ * the multi-leader mode relies on the master to pick the primary which
+ * assigns slots, and leaves out the features built around a single leader
+ * @return true if multi_leader is off, or on with options it supports
+ */
+bool CheckMultiLeader(const Options &options) {
+    if (!options.multi_leader)
+        return true;
+    if (options.leader_election != MASTER_ELECTION || options.hot_standby
+            || options.lease_duration > 0) {
+        D(cout << "ERROR: multi_leader needs leader_election master, hot_standby off"
+          << " and lease_ms 0" << endl;)
+        return false;
+    }
+    return true;
+}
+
+/**
+ * a value is chosen in a fast slot once a fast quorum accepted it. Any two
+ * fast quorums and any phase 1 quorum must have an acceptor in common, so
+ * that a leader recovering a slot sees at most one value which may have
+ * been chosen there
+ * @param  num_servers number of servers
+ * @return             number of acceptors which must accept the same value
+ *                     in a fast slot
+ */
+int FastQuorum(const Options &options, const int num_servers) {
+    int q1 = Phase1Quorum(options, num_servers);
+    return min(num_servers, max(Phase2Quorum(options, num_servers),
+                                (2 * num_servers - q1) / 2 + 1));
+}
+
+/**
+ * the fast path relies on the master to pick the primary whose leader
+ * recovers fast slots, and leaves out the features which assume that
+ * the leader knows of every chat before it is chosen. Clients send whole
+ * chats to acceptors, so it does not go with payload separation either
+ * @return true if fast_paxos is off, or on with options it supports
+ */
+bool CheckFastPaxos(const Options &options) {
+    if (!options.fast_paxos)
+        return true;
+    if (options.leader_election != MASTER_ELECTION || options.hot_standby
+            || options.lease_duration > 0 || options.multi_leader
+            || options.payload_separation) {
+        D(cout << "ERROR: fast_paxos needs leader_election master, hot_standby off,"
+          << " lease_ms 0, multi_leader off and payload_separation off" << endl;)
+        return false;
+    }
+    return true;
+}
+
+/**
+ * erasure coding gives each acceptor its own fragment of a chat in P2A. It
+ * leaves out the features which pass one P2A on to other acceptors, or use
+ * what an acceptor accepted as the chat itself
+ * @param  num_servers number of servers, one fragment for each
+ * @return             true if erasure_k is 0, or fits num_servers and the
+ *                     other options
+ */
+bool CheckErasureCoding(const Options &options, const int num_servers) {
+    if (options.erasure_k == 0)
+        return true;
+    if (options.erasure_k < 0 || options.erasure_k > num_servers || num_servers > 256) {
+        D(cout << "ERROR: erasure_k " << options.erasure_k << " does not fit "
+          << num_servers << " servers" << endl;)
+        return false;
+    }
+    if (options.fast_paxos || options.chain_p2a || options.vote_relay_group > 0
+            || options.speculative || options.payload_separation) {
+        D(cout << "ERROR: erasure_k needs fast_paxos, chain_p2a, speculative and"
+          << " payload_separation off, and vote_relay_group 0" << endl;)
+        return false;
+    }
+    return true;
+}
+
+/**
+ * splits the acceptors into groups of vote_relay_group consecutive ids.
+ * the leader sends each group's P1A or P2A to one of its acceptors, the
+ * relay, which passes it on to the rest and answers for the whole group
+ * @param  num_servers number of servers
+ * @return             ids of the acceptors in each group, none without relays
+ */
+vector<vector<int> > RelayGroups(const Options &options, const int num_servers) {
+    vector<vector<int> > groups;
+    if (options.vote_relay_group <= 0)
+        return groups;
+    for (int i = 0; i < num_servers; ++i) {
+        if (i % options.vote_relay_group == 0)
+            groups.push_back(vector<int>());
+        groups.back().push_back(i);
+    }
+    return groups;
+}
@@ -0,0 +1,59 @@
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+#include "string"
+#include "ctime"
+#include "vector"
+using namespace std;
+
+typedef enum {
+    DROP_AND_RESYNC, DISCONNECT, BACKPRESSURE
+} OverflowPolicy;
+
+typedef enum {
+    MASTER_ELECTION, CLUSTER_ELECTION
+} LeaderElection;
+
+/**
+ * per-cluster tunables, read from an options file by master, servers
+ * and clients. Keys missing from the file keep their default values
+ */
+struct Options {
+    size_t outbox_max_bytes;    // max bytes queued for one peer
+    OverflowPolicy overflow_policy;
+    time_t heartbeat_interval;  // microsec between heartbeats on an idle link
+    time_t failure_timeout;     // microsec of silence before a peer is suspected
+    LeaderElection leader_election; // who picks a new primary when it fails
+    bool hot_standby;           // next server after the primary keeps a warm leader
+    time_t lease_duration;      // microsec a majority's lease lasts, 0 for no leases
+    time_t clock_drift;         // microsec by which leases are cut short at the leader
+    int phase1_quorum;          // acceptors a scout waits for, 0 for a majority
+    int phase2_quorum;          // acceptors a commander waits for, 0 for a majority
+    bool thrifty_p2a;           // commanders send P2A to the fastest phase 2 quorum only
+    time_t thrifty_timeout;     // microsec before a thrifty commander tries the other acceptors
+    bool multi_leader;          // slots rotate among servers, each leading its own (Mencius)
+    bool fast_paxos;            // clients send chats straight to acceptors (Fast Paxos)
+    time_t fast_timeout;        // microsec before an undecided fast slot is recovered
+    bool speculative;           // the primary's replica tells clients of accepted chats early
+    bool distributed_learning;  // acceptors tell replicas of accepted pvalues, replicas count quorums
+    bool chain_p2a;             // P2A goes along a chain of a phase 2 quorum of acceptors
+    int vote_relay_group;       // acceptors per group whose votes one relay collects, 0 for none
+    time_t relay_timeout;       // microsec a relay waits for its group before answering
+    bool payload_separation;    // chat bodies go to replicas once, Paxos orders their ids only
+    int erasure_k;              // fragments of a chat that rebuild it, one per acceptor, 0 for none
+    size_t compress_min_bytes;  // bulk messages this long or longer go compressed, 0 for never
+
+    Options();
+};
+
+bool ReadOptionsFile(const string &path, Options &options);
+int Phase1Quorum(const Options &options, const int num_servers);
+int Phase2Quorum(const Options &options, const int num_servers);
+bool CheckQuorums(const Options &options, const int num_servers);
+bool CheckMultiLeader(const Options &options);
+int FastQuorum(const Options &options, const int num_servers);
+bool CheckFastPaxos(const Options &options);
+bool CheckErasureCoding(const Options &options, const int num_servers);
+vector<vector<int> > RelayGroups(const Options &options, const int num_servers);
+
+#endif //OPTIONS_H_
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -107,15 +108,45 @@ void* AcceptConnectionsReplica(void* _R) {
 
         int process_id = R->S->IsClientChatPort(incoming_port);
         if (process_id != -1) { //incoming connection from chat port of a client
-            R->set_client_chat_fd(process_id, new_fd);
+            if (R->S->get_primary_ready()) {
+                // TENTATIVE and RESPONSE for a chat go out a round apart.
+                // without this, the RESPONSE waits for the TENTATIVE's ack
+                int yes = 1;
+                setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+                R->set_client_chat_fd(process_id, new_fd);
+                SendReady(new_fd);
+                // the replica loop listens to the client from its next turn
+                R->S->get_wakeup(kReplicaRole)->Notify();
+            } else {
+                // only a ready primary takes clients. point the client to the
+                // primary this server knows of, which may be itself
+                string msg = kRedirect + kInternalDelim + to_string(R->S->get_primary_id())
+                             + kMessageDelim;
+                send(new_fd, msg.c_str(), msg.size(), 0);
+                close(new_fd);
+            }
         } else {
             process_id = R->S->IsReplicaPort(incoming_port);
+            int acceptor_id = R->S->IsAcceptorPort(incoming_port);
             if (process_id != -1) { //incoming connection from chat port of a client
                 R->set_replica_fd(process_id, new_fd);
+                SendReady(new_fd);
+                R->S->get_wakeup(kReplicaRole)->Notify();
+            }
+            else if (acceptor_id != -1) {
+                // an acceptor telling of the pvalues it accepts
+                R->set_acceptor_fd(acceptor_id, new_fd);
+                SendReady(new_fd);
+                R->S->get_wakeup(kReplicaRole)->Notify();
             }
             else {
-                D(cout << "SR" << R->S->get_pid() << ": ERROR: Unexpected connect request from port "
+                // clients read through any server over a connection from an
+                // ephemeral port. READ messages name the client
+                D(cout << "SR" << R->S->get_pid() << ": Read connection accepted from port "
                   << incoming_port << endl;)
+                R->AddToReadFDSet(new_fd);
+                SendReady(new_fd);
+                R->S->get_wakeup(kReplicaRole)->Notify();
             }
         }
     }
@@ -217,6 +248,11 @@ bool Replica::ConnectToCommander(const int server_id) {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return false;
+    }
     set_commander_fd(server_id, sockfd);
     return true;
 }
@@ -413,6 +449,11 @@ bool Replica::ConnectToReplica(const int server_id) {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return false;
+    }
     set_replica_fd(server_id, sockfd);
     return true;
 }
@@ -511,6 +552,11 @@ bool Replica::ConnectToLeader(const int server_id) {
     }
     // int outgoing_port = ntohs(return_port_no((struct sockaddr *)l->ai_addr));
     freeaddrinfo(servinfo); // all done with this structure
+    // wait till the peer has registered this connection
+    if (!WaitForReady(sockfd, kReadyTimeout)) {
+        close(sockfd);
+        return false;
+    }
     set_leader_fd(server_id, sockfd);
     return true;
 }
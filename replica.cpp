@@ -2,6 +2,9 @@
 #include "replica.h"
 #include "constants.h"
 #include "utilities.h"
+#include "metrics.h"
+#include "dispatch.h"
+#include "erasure.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -12,10 +15,12 @@
 #include "errno.h"
 #include "sys/socket.h"
 #include "limits.h"
+#include "algorithm"
 using namespace std;
 
 typedef pair<int, Proposal> SPtuple;
 pthread_mutex_t decisions_lock;
+pthread_mutex_t read_fd_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define DEBUG
 
@@ -51,11 +56,24 @@ Replica::Replica(Server* _S) {
     leader_fd_.resize(num_servers, -1);
     client_chat_fd_.resize(num_clients, -1);
     replica_fd_.resize(num_servers, -1);
+    acceptor_fd_.resize(num_servers, -1);
+    synced_client_fd_.resize(num_clients, -1);
+    last_standby_attempt_ = {0, 0};
+    term_first_slot_ = 0;
+    transferring_ = false;
+    handed_off_ = false;
+    next_index_request_ = 0;
+    next_own_slot_ = 0;
+    highest_chat_slot_ = -1;
+    last_owner_attempt_ = {0, 0};
 
     if (pthread_mutex_init(&decisions_lock, NULL) != 0) {
         D(cout << "SR" << S->get_pid() << ": Mutex init failed" << endl;)
     }
 
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
 }
 
 int Replica::get_commander_fd(const int server_id) {
@@ -74,6 +92,10 @@ int Replica::get_replica_fd(const int server_id) {
     return replica_fd_[server_id];
 }
 
+int Replica::get_acceptor_fd(const int server_id) {
+    return acceptor_fd_[server_id];
+}
+
 int Replica::get_client_chat_fd(const int client_id) {
     return client_chat_fd_[client_id];
 }
@@ -96,6 +118,32 @@ void Replica::set_decisions(map<int, Proposal>& d) {
     pthread_mutex_unlock(&decisions_lock);
 }
 
+set<int> Replica::get_read_fd_set() {
+    pthread_mutex_lock(&read_fd_lock);
+    set<int> fds = read_fd_set_;
+    pthread_mutex_unlock(&read_fd_lock);
+    return fds;
+}
+
+/**
+ * adds a client's read connection, accepted on the replica listen port
+ * @param fd fd to be added
+ */
+void Replica::AddToReadFDSet(const int fd) {
+    pthread_mutex_lock(&read_fd_lock);
+    read_fd_set_.insert(fd);
+    pthread_mutex_unlock(&read_fd_lock);
+}
+
+/**
+ * @param fd fd of read connection to be removed
+ */
+void Replica::RemoveFromReadFDSet(const int fd) {
+    pthread_mutex_lock(&read_fd_lock);
+    read_fd_set_.erase(fd);
+    pthread_mutex_unlock(&read_fd_lock);
+}
+
 void Replica::set_commander_fd(const int server_id, const int fd) {
     commander_fd_[server_id] = fd;
 }
@@ -111,6 +159,10 @@ void Replica::set_replica_fd(const int server_id, const int fd) {
     replica_fd_[server_id] = fd;
 }
 
+void Replica::set_acceptor_fd(const int server_id, const int fd) {
+    acceptor_fd_[server_id] = fd;
+}
+
 void Replica::set_client_chat_fd(const int client_id, const int fd) {
     client_chat_fd_[client_id] = fd;
 }
@@ -122,17 +174,330 @@ void Replica::set_slot_num(const int slot_num) {
 /*** increments the value of slot_num_*/
 void Replica::IncrementSlotNum() {
     set_slot_num(get_slot_num() + 1);
+    S->NotePerformedSlot(get_slot_num());
 }
 
 void Replica::Unicast(const string &type, const string& msg, const int primary_id)
 {
-    if (send(get_leader_fd(primary_id), msg.c_str(), msg.size(), 0) == -1) {
+    // every server proposes through its own leader in the multi-leader mode
+    if (S->get_options().multi_leader) {
+        if (get_leader_fd(S->get_pid()) == -1) {
+            D(cout << "SR" << S->get_pid() << ": ERROR in sending" << type << " to own leader" << endl;)
+            return;
+        }
+        outbox_.Enqueue(get_leader_fd(S->get_pid()), msg);
+        D(cout << "SR" << S->get_pid() << ": " << type << " message queued for own leader: " << msg << endl;)
+        return;
+    }
+
+    // the leader of a hot standby gets a copy, to take over with it
+    int standby_id = S->get_standby_id();
+    if (standby_id != -1 && standby_id != primary_id && get_leader_fd(standby_id) != -1)
+        outbox_.Enqueue(get_leader_fd(standby_id), msg);
+
+    if (get_leader_fd(primary_id) == -1) {
         D(cout << "SR" << S->get_pid()
           << ": ERROR in sending" << type << " to leader S" << primary_id << endl;)
+        return;
     }
-    else {
-        D(cout << "SR" << S->get_pid() << ": " << type
-          << " message sent to primary's leader S" << primary_id << ": " << msg << endl;)
+    outbox_.Enqueue(get_leader_fd(primary_id), msg);
+    D(cout << "SR" << S->get_pid() << ": " << type
+      << " message queued for primary's leader S" << primary_id << ": " << msg << endl;)
+}
+
+/**
+ * keeps connections to the commander and leader of the hot standby, so
+ * that they are in place when it takes over. At most one attempt per
+ * heartbeat interval, and none while the standby is suspected
+ * @param primary_id id of primary server
+ */
+void Replica::ConnectToStandby(const int primary_id)
+{
+    int standby_id = S->get_standby_id();
+    if (standby_id == -1 || standby_id == primary_id)
+        return;
+    if (get_commander_fd(standby_id) != -1 && get_leader_fd(standby_id) != -1)
+        return;
+    if (S->get_failure_detector()->IsSuspected(standby_id))
+        return;
+    if (ElapsedSince(last_standby_attempt_) < S->get_failure_detector()->get_heartbeat_interval())
+        return;
+
+    gettimeofday(&last_standby_attempt_, NULL);
+    if (get_commander_fd(standby_id) == -1 && ConnectToCommander(standby_id)) {
+        D(cout << "SR" << S->get_pid() << ": Connected to commander of standby S" << standby_id << endl;)
+    }
+    if (get_leader_fd(standby_id) == -1 && ConnectToLeader(standby_id)) {
+        D(cout << "SR" << S->get_pid() << ": Connected to leader of standby S" << standby_id << endl;)
+    }
+}
+
+/**
+ * keeps connections to the commanders and leaders of all servers which are
+ * not suspected, in the multi-leader mode: each server proposes through its
+ * own leader, and decisions come from the commanders of all of them.
+ * At most one attempt per heartbeat interval
+ */
+void Replica::ConnectToOwners()
+{
+    if (ElapsedSince(last_owner_attempt_) < S->get_failure_detector()->get_heartbeat_interval())
+        return;
+
+    gettimeofday(&last_owner_attempt_, NULL);
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (S->get_failure_detector()->IsSuspected(i))
+            continue;
+        if (get_commander_fd(i) == -1 && ConnectToCommander(i)) {
+            D(cout << "SR" << S->get_pid() << ": Connected to commander of S" << i << endl;)
+        }
+        if (get_leader_fd(i) == -1 && ConnectToLeader(i)) {
+            D(cout << "SR" << S->get_pid() << ": Connected to leader of S" << i << endl;)
+        }
+    }
+}
+
+/**
+ * follows the latest epoch the primary announced. Undecided proposals in
+ * slots it assigns anew are proposed again in own slots, and so are the
+ * chats which waited for an epoch giving this server slots
+ */
+void Replica::FollowEpoch(const int primary_id)
+{
+    Epoch e = S->get_epoch();
+    if (e.b == epoch_.b)
+        return;
+
+    D(cout << "SR" << S->get_pid() << ": Following epoch " << epochToString(e) << endl;)
+    epoch_ = e;
+    next_own_slot_ = e.first_slot;
+    vector<Proposal> again;
+    for (auto it = proposals_.lower_bound(e.first_slot); it != proposals_.end(); ) {
+        if (decisions_.find(it->first) == decisions_.end()) {
+            again.push_back(it->second);
+            it = proposals_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    again.insert(again.end(), waiting_for_epoch_.begin(), waiting_for_epoch_.end());
+    waiting_for_epoch_.clear();
+    for (auto &p : again) {
+        if (Admitting())
+            Propose(p, primary_id);
+        else
+            buffered_proposals_.push_back(p);
+    }
+}
+
+/**
+ * skips the own slots below the highest slot another owner is known to have
+ * used, so that the slots in between need not wait for chats here.
+ * SKIP-<from>-<to>-<stride>-<ballot>$ gets NOOP decided in every own slot
+ * from from on below to
+ */
+void Replica::SkipOwnSlots(const int primary_id)
+{
+    int horizon = max(S->get_highest_accepted_slot(), highest_chat_slot_);
+    int from = nextOwnSlot(epoch_, S->get_pid(), next_own_slot_);
+    while (from != -1 && from < horizon && decisions_.find(from) != decisions_.end())
+        from = nextOwnSlot(epoch_, S->get_pid(), from + 1);
+    if (from == -1 || from >= horizon)
+        return;
+
+    next_own_slot_ = horizon + 1;
+    string msg = kSkip + kInternalDelim + to_string(from) + kInternalDelim + to_string(horizon + 1);
+    msg += kInternalDelim + to_string(epoch_.owners.size());
+    msg += kInternalDelim + ballotToString(epoch_.b) + kMessageDelim;
+    Unicast(kSkip, msg, primary_id);
+}
+
+/**
+ * all clear of the multi-leader mode: done once the leader of every owner
+ * sent its decisions, every proposal here is decided, and every decided
+ * slot is performed
+ */
+void Replica::CheckAllClearOfOwners()
+{
+    if (S->get_all_clear(kReplicaRole) != kAllClearSet)
+        return;
+    for (auto owner : epoch_.owners) {
+        if (all_decisions_from_.find(owner) == all_decisions_from_.end())
+            return;
+    }
+    if (!Drained() || !waiting_for_epoch_.empty())
+        return;
+    if (!decisions_.empty() && get_slot_num() <= decisions_.rbegin()->first)
+        return;
+
+    D(cout << "SR" << S->get_pid() << ": Has performed every decision of the owners("
+      << decisions_.size() << ")" << endl;)
+    all_decisions_from_.clear();
+    S->set_all_clear(kReplicaRole, kAllClearDone);
+}
+
+/**
+ * sends as much of the messages queued during this turn of the replica loop
+ * as the sockets take, resets the connections on which sending failed,
+ * and resyncs the peers whose messages were dropped on queue overflow
+ */
+void Replica::FlushOutbox(const int primary_id)
+{
+    vector<int> failed_fds;
+    outbox_.Flush(failed_fds);
+    for (auto fd : failed_fds) {
+        D(cout << "SR" << S->get_pid() << ": ERROR in sending to fd " << fd << endl;)
+        ResetFD(fd, primary_id);
+    }
+
+    vector<int> resync_fds;
+    outbox_.TakeResyncFds(resync_fds);
+    for (auto fd : resync_fds) {
+        ResyncFD(fd, primary_id);
+    }
+}
+
+/**
+ * resends the decided chat log to a client whose responses were dropped.
+ * Clients key responses by slot, so the resent ones are harmless duplicates.
+ * Other peers cannot be resynced this way, and their connections are reset
+ * @param fd fd whose queued messages were dropped
+ */
+void Replica::ResyncFD(const int fd, const int primary_id)
+{
+    for (int i = 0; i < S->get_num_clients(); ++i) {
+        if (fd == get_client_chat_fd(i)) {
+            D(cout << "SR" << S->get_pid() << ": Resyncing client C" << i << endl;)
+            ResendResponses(fd);
+            return;
+        }
+    }
+
+    D(cout << "SR" << S->get_pid() << ": Cannot resync fd " << fd << ", resetting it" << endl;)
+    ResetFD(fd, primary_id);
+}
+
+/**
+ * sends a client every response performed so far, the same way Perform()
+ * did: NOOPs and repeated decisions of a proposal are left out
+ * @param fd fd of client chat connection
+ */
+void Replica::ResendResponses(const int fd)
+{
+    unordered_set<Proposal> performed;
+    for (auto it = decisions_.begin(); it != decisions_.end(); ++it) {
+        if (it->first >= get_slot_num())
+            break;
+        Proposal chat;
+        if (it->second.msg == kNoop || !performed.insert(it->second).second
+                || !JoinPayload(it->second, chat))
+            continue;
+        string msg = kResponse + kInternalDelim;
+        msg += to_string(it->first) + kInternalDelim;
+        msg += proposalToString(chat) + kMessageDelim;
+        outbox_.Enqueue(fd, msg);
+    }
+}
+
+/**
+ * @return chat log performed so far, in the form clients send it to the
+ *         master: <index>.<sender>.<body>, for each chat, NOOPs and repeated
+ *         decisions left out as in Perform()
+ */
+string Replica::ChatLogToString()
+{
+    string chat_log;
+    unordered_set<Proposal> performed;
+    int i = 0;
+    for (auto it = decisions_.begin(); it != decisions_.end(); ++it) {
+        if (it->first >= get_slot_num())
+            break;
+        Proposal chat;
+        if (it->second.msg == kNoop || !performed.insert(it->second).second
+                || !JoinPayload(it->second, chat))
+            continue;
+        chat_log += to_string(i++) + kInternalStructDelim + chat.client_id
+                    + kInternalStructDelim + chat.msg + kInternalSetDelim;
+    }
+    return chat_log;
+}
+
+/**
+ * answers reads from the local chat log with READRESP-<read id>-<chat log>$.
+ * On the primary, a read is served once the leader of this server is
+ * confirmed for it (see Server::CanServeRead), and a LEASE round is asked for
+ * otherwise. On any other server, a read which came over a read connection
+ * is served once this replica performed up to the read index the primary's
+ * leader gives for it. Reads over the chat connection are dropped on a server
+ * which is not primary or has handed over: clients send them to the new primary
+ */
+void Replica::ServeReads(const int primary_id)
+{
+    bool serving_primary = (S->get_pid() == primary_id && !handed_off_);
+    set<int> read_fds = get_read_fd_set();
+    for (auto it = pending_reads_.begin(); it != pending_reads_.end(); ) {
+        bool connected = it->follower ? (read_fds.find(it->fd) != read_fds.end())
+                                      : (it->fd == get_client_chat_fd(it->client_id));
+        if (!connected || (!serving_primary && !it->follower)) {
+            it = pending_reads_.erase(it);
+            continue;
+        }
+
+        bool ready = false;
+        if (serving_primary) {
+            ready = S->CanServeRead(it->arrival, get_slot_num());
+            if (!ready && !it->round_requested) {
+                S->RequestLeadershipRound();
+                it->round_requested = true;
+            }
+        } else if (it->read_index == -1) {
+            if (it->index_request_id.empty())
+                RequestReadIndex(*it, primary_id);
+        } else {
+            ready = (get_slot_num() >= it->read_index);
+        }
+        if (!ready) {
+            ++it;
+            continue;
+        }
+
+        string msg = kReadResp + kInternalDelim + it->read_id + kInternalDelim
+                     + ChatLogToString() + kMessageDelim;
+        outbox_.Enqueue(it->fd, msg);
+        D(cout << "SR" << S->get_pid() << ": Served read " << it->read_id << " of client C"
+          << it->client_id << " locally at slot " << get_slot_num() << " after "
+          << ElapsedSince(it->arrival) / 1000 << " ms" << endl;)
+        it = pending_reads_.erase(it);
+    }
+}
+
+/**
+ * asks the primary's leader with READINDEX-<pid>-<request id>$ for
+ * the slot up to which this replica must perform before serving a read
+ * @param read read to ask for
+ */
+void Replica::RequestReadIndex(PendingRead &read, const int primary_id)
+{
+    int leader_fd = get_leader_fd(primary_id);
+    if (leader_fd == -1)
+        return;     // asked again once connected
+
+    read.index_request_id = to_string(next_index_request_++);
+    string msg = kReadIndex + kInternalDelim + to_string(S->get_pid())
+                 + kInternalDelim + read.index_request_id + kMessageDelim;
+    outbox_.Enqueue(leader_fd, msg);
+    D(cout << "SR" << S->get_pid() << ": READINDEX message queued for leader S"
+      << primary_id << ": " << msg << endl;)
+}
+
+/**
+ * READINDEXRESP-<request id>-<index>$ from the primary's leader
+ * @param token tokens of READINDEXRESP message
+ */
+void Replica::ReceiveReadIndex(const std::vector<string> &token)
+{
+    for (auto &read : pending_reads_) {
+        if (read.index_request_id == token[1])
+            read.read_index = stoi(token[2]);
     }
 }
 
@@ -145,6 +510,11 @@ void Replica::Propose(const Proposal &p, const int primary_id) {
         if (it->second == p)
             return;
     }
+    // a chat handed over by the previous primary is resent by its client too
+    for (auto it = proposals_.lower_bound(term_first_slot_); it != proposals_.end(); ++it) {
+        if (it->second == p && decisions_.find(it->first) == decisions_.end())
+            return;
+    }
 
     int min_slot;
     if (proposals_.rbegin() == proposals_.rend())
@@ -156,6 +526,19 @@ void Replica::Propose(const Proposal &p, const int primary_id) {
     while (decisions_.find(min_slot) != decisions_.end())
         min_slot++;
 
+    // in the multi-leader mode chats go in own slots of the epoch
+    if (S->get_options().multi_leader) {
+        min_slot = nextOwnSlot(epoch_, S->get_pid(), next_own_slot_);
+        while (min_slot != -1 && decisions_.find(min_slot) != decisions_.end())
+            min_slot = nextOwnSlot(epoch_, S->get_pid(), min_slot + 1);
+        if (min_slot == -1) {
+            D(cout << "SR" << S->get_pid() << ": No own slot, waiting for epoch - " << proposalToString(p) << endl;)
+            waiting_for_epoch_.push_back(p);
+            return;
+        }
+        next_own_slot_ = min_slot + 1;
+    }
+
     proposals_[min_slot] = p;
     SendProposal(min_slot, p, primary_id);
 }
@@ -169,10 +552,105 @@ void Replica::SendProposal(const int& s, const Proposal& p, const int primary_id
 {
     string msg = kPropose + kInternalDelim;
     msg += to_string(s) + kInternalDelim;
-    msg += proposalToString(p) + kMessageDelim;
+    msg += proposalToString(p);
+    // the slot is own in this epoch only
+    if (S->get_options().multi_leader)
+        msg += kInternalDelim + ballotToString(epoch_.b);
+    msg += kMessageDelim;
     Unicast(kPropose, msg, primary_id);
 }
 
+/**
+ * keeps the body of a chat from a client, and sends the chat to every other
+ * replica with PAYLOAD-<proposal>$ the first time it arrives, in the
+ * payload separation mode
+ * @param  p chat from a client
+ * @return   the chat as it is proposed, its body left out
+ */
+Proposal Replica::SeparatePayload(const Proposal &p)
+{
+    string key = p.client_id + kInternalStructDelim + p.chat_id;
+    if (payloads_.find(key) == payloads_.end()) {
+        payloads_[key] = p.msg;
+        string msg = kPayload + kInternalDelim + proposalToString(p) + kMessageDelim;
+        for (int i = 0; i < S->get_num_servers(); i++) {
+            if (get_replica_fd(i) != -1)
+                outbox_.Enqueue(get_replica_fd(i), msg);
+        }
+    }
+    return Proposal(p.client_id, p.chat_id, kPayloadRef);
+}
+
+/**
+ * joins a decided proposal with the body of its chat
+ * @param  p    decided proposal
+ * @param  chat [out] p with its body, p itself if it was proposed whole
+ * @return      false if the body of p is not known here yet
+ */
+bool Replica::JoinPayload(const Proposal &p, Proposal &chat)
+{
+    if (p.msg != kPayloadRef) {
+        chat = p;
+        return true;
+    }
+    auto it = payloads_.find(p.client_id + kInternalStructDelim + p.chat_id);
+    if (it == payloads_.end())
+        return false;
+    chat = Proposal(p.client_id, p.chat_id, it->second);
+    return true;
+}
+
+/**
+ * asks every other replica for the body of a decided chat with
+ * REQPAYLOAD-<proposal>$, at most once every kPayloadRetry
+ * @param p decided proposal whose body is missing
+ */
+void Replica::RequestPayload(const Proposal &p)
+{
+    string key = p.client_id + kInternalStructDelim + p.chat_id;
+    auto it = awaited_payloads_.find(key);
+    if (it != awaited_payloads_.end() && ElapsedSince(it->second) < kPayloadRetry)
+        return;
+    gettimeofday(&awaited_payloads_[key], NULL);
+
+    D(cout << "SR" << S->get_pid() << ": Asking replicas for payload of " << key << endl;)
+    string msg = kReqPayload + kInternalDelim + proposalToString(p) + kMessageDelim;
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (get_replica_fd(i) != -1)
+            outbox_.Enqueue(get_replica_fd(i), msg);
+    }
+}
+
+/**
+ * keeps the body of a chat another replica sent with PAYLOAD-<proposal>$
+ * @param token tokens of PAYLOAD
+ */
+void Replica::ReceivePayload(const std::vector<string> &token)
+{
+    if (token.size() != 2)
+        return;
+    Proposal p = stringToProposal(token[1]);
+    string key = p.client_id + kInternalStructDelim + p.chat_id;
+    if (payloads_.find(key) == payloads_.end())
+        payloads_[key] = p.msg;
+    awaited_payloads_.erase(key);
+}
+
+/**
+ * answers REQPAYLOAD-<proposal>$ with the chat's PAYLOAD, if its body is known
+ * @param fd    fd of the asking replica
+ * @param token tokens of REQPAYLOAD
+ */
+void Replica::SendPayload(const int fd, const std::vector<string> &token)
+{
+    if (token.size() != 2)
+        return;
+    Proposal chat;
+    if (!JoinPayload(stringToProposal(token[1]), chat))
+        return;
+    outbox_.Enqueue(fd, kPayload + kInternalDelim + proposalToString(chat) + kMessageDelim);
+}
+
 /**
  * performs the decision reached by Paxos by adding it to decisions,
  * incrementing slot num, followed by sending decision to client
@@ -182,6 +660,7 @@ void Replica::SendProposal(const int& s, const Proposal& p, const int primary_id
 void Replica::Perform(const int& slot, const Proposal& p, const int primary_id)
 {
     if (p.msg == kNoop) {
+        SettleTentative(slot, p, false);
         IncrementSlotNum();
         return;
     }
@@ -190,15 +669,191 @@ void Replica::Perform(const int& slot, const Proposal& p, const int primary_id)
     {
         if (it->second == p && it->first < get_slot_num())
         {
+            SettleTentative(slot, p, false);
             IncrementSlotNum();
             return;
         }
     }
 
+    SettleTentative(slot, p, true);
     IncrementSlotNum();
     SendResponseToAllClients(slot, p, primary_id);
 }
 
+/**
+ * records a decision
+ * @param s       decided slot
+ * @param p       decided proposal
+ * @param skip_to for a skip, NOOP in every stride-th slot from s below
+ *                skip_to, -1 otherwise
+ * @param stride  stride of the skip
+ */
+void Replica::AddDecision(const int s, const Proposal &p, const int skip_to, const int stride)
+{
+    decisions_[s] = p;
+    if (skip_to != -1) {
+        for (int k = s + stride; k < skip_to; k += stride) {
+            if (decisions_.find(k) == decisions_.end())
+                decisions_[k] = p;
+        }
+    } else if (p.msg != kNoop) {
+        highest_chat_slot_ = max(highest_chat_slot_, s);
+    }
+}
+
+/**
+ * counts LEARN-<acceptor>-<triple>[-<skip to>-<stride>]$ from an acceptor
+ * which accepted the pvalue. A pvalue accepted by a phase 2 quorum, or
+ * with a COMMIT notice for its slot and ballot, is decided. With erasure
+ * coding each acceptor tells of its own fragment of the chat, and the chat
+ * is decided once it can be rebuilt too
+ * @param  token tokens of LEARN
+ * @return       true if it decided a slot
+ */
+bool Replica::ReceiveLearn(const std::vector<string> &token)
+{
+    if (token.size() != 3 && token.size() != 5)
+        return false;
+    Triple t = stringToTriple(token[2]);
+    if (t.s < get_slot_num() || decisions_.find(t.s) != decisions_.end())
+        return false;
+
+    LearnedValue &v = learned_[t.s][t.b];
+    if (v.acceptors.empty()) {
+        v.p = t.p;
+        v.skip_to = (token.size() == 5) ? stoi(token[3]) : -1;
+        v.stride = (token.size() == 5) ? stoi(token[4]) : 0;
+    }
+    if (v.acceptors.insert(stoi(token[1])).second && S->get_options().erasure_k > 0)
+        v.fragments.push_back(t.p);
+
+    auto notice = commit_notices_.find(t.s);
+    if ((int)v.acceptors.size() < S->get_phase2_quorum()
+            && (notice == commit_notices_.end() || !(notice->second == t.b)))
+        return false;
+    return Learn(t.s, t.b);
+}
+
+/**
+ * takes COMMIT-<ballot>-<slot>$ from a commander. The pvalue accepted in
+ * the slot with the ballot is decided, once an acceptor tells of it
+ * @param  token tokens of COMMIT
+ * @return       true if it decided a slot
+ */
+bool Replica::ReceiveCommit(const std::vector<string> &token)
+{
+    if (token.size() != 3)
+        return false;
+    Ballot b = stringToBallot(token[1]);
+    int s = stoi(token[2]);
+    if (s < get_slot_num() || decisions_.find(s) != decisions_.end())
+        return false;
+
+    commit_notices_[s] = b;
+    auto slot = learned_.find(s);
+    if (slot == learned_.end() || slot->second.find(b) == slot->second.end())
+        return false;
+    return Learn(s, b);
+}
+
+/**
+ * decides the pvalue learned for a slot with a ballot
+ * @param  s slot
+ * @param  b ballot the pvalue was accepted with
+ * @return   false if it is a chat whose fragments are too few to rebuild it
+ */
+bool Replica::Learn(const int s, const Ballot &b)
+{
+    const LearnedValue &v = learned_[s][b];
+    Proposal p = v.p;
+    int k = S->get_options().erasure_k;
+    if (k > 0 && IsFragment(v.p)
+            && !JoinFragments(ReedSolomon(k, S->get_num_servers() - k), v.fragments, p))
+        return false;
+    D(cout << "SR" << S->get_pid() << ": Learned slot " << s << " from "
+      << v.acceptors.size() << " acceptor(s): " << proposalToString(p) << endl;)
+    AddDecision(s, p, v.skip_to, v.stride);
+    learned_.erase(s);
+    commit_notices_.erase(s);
+    return true;
+}
+
+/**
+ * drops learned pvalues and commit notices of slots decided already
+ */
+void Replica::PruneLearned()
+{
+    while (!learned_.empty() && (learned_.begin()->first < get_slot_num()
+            || decisions_.find(learned_.begin()->first) != decisions_.end()))
+        learned_.erase(learned_.begin());
+    while (!commit_notices_.empty() && (commit_notices_.begin()->first < get_slot_num()
+            || decisions_.find(commit_notices_.begin()->first) != decisions_.end()))
+        commit_notices_.erase(commit_notices_.begin());
+}
+
+/**
+ * tells clients with TENTATIVE-<slot>-<proposal>$ of the chats the acceptor
+ * here accepted, ahead of their decision. A slot told of with another chat
+ * before is taken back first. Chats decided already are left out
+ */
+void Replica::SendTentative(const int primary_id)
+{
+    vector<Triple> accepted;
+    S->TakeAcceptedValues(accepted);
+    if (S->get_pid() != primary_id || handed_off_)
+        return;
+
+    for (const auto &t : accepted) {
+        if (t.s < get_slot_num() || decisions_.find(t.s) != decisions_.end())
+            continue;
+        auto tentative = tentative_.find(t.s);
+        if (tentative != tentative_.end() && tentative->second == t.p)
+            continue;
+
+        bool performed = false;
+        for (auto it = decisions_.begin(); it != decisions_.end() && it->first < get_slot_num(); ++it) {
+            if (it->second == t.p) {
+                performed = true;
+                break;
+            }
+        }
+        Proposal chat;
+        if (performed || !JoinPayload(t.p, chat))
+            continue;
+
+        if (tentative != tentative_.end()) {
+            SendToAllClients(kRollback + kInternalDelim + to_string(t.s) + kMessageDelim);
+            Metrics::AddRollback();
+        }
+        tentative_[t.s] = t.p;
+        SendToAllClients(kTentative + kInternalDelim + to_string(t.s) + kInternalDelim
+                         + proposalToString(chat) + kMessageDelim);
+        Metrics::AddTentative();
+    }
+}
+
+/**
+ * settles the tentative response sent for a slot, once it is decided. If the
+ * decision is not the chat clients were told of, or is not answered at all,
+ * the slot is taken back with ROLLBACK-<slot>$. The RESPONSE confirms it
+ * otherwise
+ * @param slot     decided slot
+ * @param p        decided proposal
+ * @param answered true if clients get a RESPONSE for p in this slot
+ */
+void Replica::SettleTentative(const int slot, const Proposal &p, const bool answered)
+{
+    auto it = tentative_.find(slot);
+    if (it == tentative_.end())
+        return;
+    if (!answered || !(it->second == p)) {
+        D(cout << "SR" << S->get_pid() << ": Rolling back tentative slot " << slot << endl;)
+        SendToAllClients(kRollback + kInternalDelim + to_string(slot) + kMessageDelim);
+        Metrics::AddRollback();
+    }
+    tentative_.erase(it);
+}
+
 /**
  * sends the decided proposal to all clients
  * @param s decided slot num
@@ -208,29 +863,70 @@ void Replica::SendResponseToAllClients(const int& s,
                                        const Proposal& p,
                                        const int primary_id)
 {
-    if (S->get_pid() != primary_id)
+    Proposal chat;
+    if (S->get_pid() != primary_id || !JoinPayload(p, chat))
         return;
 
     string msg = kResponse + kInternalDelim;
     msg += to_string(s) + kInternalDelim;
-    msg += proposalToString(p) + kMessageDelim;
+    msg += proposalToString(chat) + kMessageDelim;
+    SendToAllClients(msg);
+}
 
+/**
+ * queues a message for every client's chat connection
+ * @param msg message to be sent
+ */
+void Replica::SendToAllClients(const string &msg)
+{
     for (int i = 0; i < S->get_num_clients(); ++i) {
         if (get_client_chat_fd(i) == -1) {
             D(cout << "SR" << S->get_pid()
               << ": ERROR: Unexpected fd=-1 for client C" << i << endl;)
             continue;
         }
-        if (send(get_client_chat_fd(i), msg.c_str(), msg.size(), 0) == -1) {
-            D(cout << "SR" << S->get_pid() << ": ERROR: sending response to client C"
-              << i << endl;)
-            close(get_client_chat_fd(i));
-            set_client_chat_fd(i, -1);
+        outbox_.Enqueue(get_client_chat_fd(i), msg);
+        D(cout << "SR" << S->get_pid() << ": Message queued for client C"
+          << i << ": " << msg << endl;)
+    }
+}
+
+/**
+ * performs decisions in slot order from slot num on, as far as they go.
+ * a proposal of this replica which lost its slot is proposed again. A
+ * decision whose chat body has not reached this replica waits for it
+ */
+void Replica::PerformDecisions(const int primary_id)
+{
+    Proposal currdecision;
+    Proposal chat;
+    int slot_num = get_slot_num();
+    while (decisions_.find(slot_num) != decisions_.end())
+    {
+        currdecision = decisions_[slot_num];
+        if (!JoinPayload(currdecision, chat))
+        {
+            RequestPayload(currdecision);
+            break;
         }
-        else {
-            D(cout << "SR" << S->get_pid() << ": Message sent to client C"
-              << i << ": " << msg << endl;)
+        if (proposals_.find(slot_num) != proposals_.end())
+        {
+            if (!(proposals_[slot_num] == currdecision))
+            {
+                if (!Admitting())
+                {
+                    D(cout << "SR" << S->get_pid() << ": Buffering propose - " << proposalToString(proposals_[slot_num]) << endl;)
+                    buffered_proposals_.push_back(proposals_[slot_num]);
+                }
+                else
+                {
+                    ProposeBuffered(primary_id);
+                    Propose(proposals_[slot_num], primary_id);
+                }
+            }
         }
+        Perform(slot_num, currdecision, primary_id);
+        slot_num = get_slot_num();
     }
 }
 
@@ -243,6 +939,81 @@ void Replica::ProposeBuffered(const int primary_id)
     buffered_proposals_.clear();
 }
 
+/**
+ * @return true if chats from clients are proposed right away. they are
+ *         buffered during all clear, and while leadership is handed over
+ */
+bool Replica::Admitting()
+{
+    return S->get_all_clear(kReplicaRole) == kAllClearNotSet && !transferring_;
+}
+
+/**
+ * @return true if every proposal made has been decided
+ */
+bool Replica::Drained()
+{
+    for (auto &p : proposals_) {
+        if (decisions_.find(p.first) == decisions_.end())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * hands the undecided and buffered proposals over to the transfer target,
+ * and forgets them here: the target proposes them once it is primary
+ */
+void Replica::HandOff()
+{
+    map<int, Proposal> pending;
+    for (auto it = proposals_.begin(); it != proposals_.end(); ) {
+        if (decisions_.find(it->first) == decisions_.end()) {
+            pending[it->first] = it->second;
+            it = proposals_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    int s = max(get_slot_num(), pending.empty() ? 0 : pending.rbegin()->first + 1);
+    for (auto &p : buffered_proposals_) {
+        pending[s++] = p;
+    }
+    buffered_proposals_.clear();
+
+    D(cout << "SR" << S->get_pid() << ": Handing over to S" << S->get_transfer_target()
+      << " at slot " << get_slot_num() << " with " << pending.size()
+      << " pending proposal(s), after draining for " << ElapsedSince(transfer_start_) / 1000
+      << " ms" << endl;)
+    // reads are not served here any more, so the lease can be given up
+    S->RevokeLeadership();
+    S->SendHandoffToMaster(get_slot_num(), pending);
+    handed_off_ = true;
+}
+
+/**
+ * proposes what the previous primary handed over, once this replica has
+ * performed the decisions the previous primary had, or has waited for
+ * them for the drain timeout
+ */
+void Replica::ProposeHandedOver(const int primary_id)
+{
+    if (handoff_proposals_.empty())
+        return;
+    if (get_slot_num() < handoff_slot_num_ && ElapsedSince(handoff_start_) < kDrainTimeout)
+        return;
+
+    D(cout << "SR" << S->get_pid() << ": Proposing " << handoff_proposals_.size()
+      << " handed over proposal(s) from slot " << get_slot_num() << endl;)
+    for (auto &p : handoff_proposals_) {
+        if (Admitting())
+            Propose(p.second, primary_id);
+        else
+            buffered_proposals_.push_back(p.second);
+    }
+    handoff_proposals_.clear();
+}
+
 void Replica::CheckReceivedAllDecisions(map<int, Proposal>& allDecisions)
 {
     if (map_compare (allDecisions, decisions_))
@@ -267,7 +1038,8 @@ void Replica::CreateFdSet(fd_set& fromset, vector<int> &fds,
     int fd_temp;
     FD_ZERO(&fromset);
     fds.clear();
-    for (int i = 0; i < S->get_num_clients(); i++)
+    // under backpressure, no new chats are admitted until slow clients catch up
+    for (int i = 0; i < S->get_num_clients() && !outbox_.Congested(); i++)
     {
         fd_temp = get_client_chat_fd(i);
         if (fd_temp == -1) {
@@ -301,12 +1073,16 @@ void Replica::CreateFdSet(fd_set& fromset, vector<int> &fds,
 
     }
 
-    fd_temp = get_leader_fd(primary_id);
-    if (fd_temp != -1) {
+    // leaders of the primary and of the hot standby
+    for (int i = 0; i < S->get_num_servers(); i++)
+    {
+        fd_temp = get_leader_fd(i);
+        if (fd_temp == -1)
+            continue;
         int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
         if (rv == 0) {
             close(fd_temp);
-            set_leader_fd(primary_id, -1);
+            set_leader_fd(i, -1);
         } else {
             fd_max = max(fd_max, fd_temp);
             fds.push_back(fd_temp);
@@ -330,13 +1106,53 @@ void Replica::CreateFdSet(fd_set& fromset, vector<int> &fds,
         }
 
     }
+
+    // acceptors, in the distributed learning mode
+    for (int i = 0; i < S->get_num_servers(); i++)
+    {
+        fd_temp = get_acceptor_fd(i);
+        if (fd_temp == -1)
+            continue;
+        int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (rv == 0) {
+            close(fd_temp);
+            inbox_.Reset(fd_temp);
+            set_acceptor_fd(i, -1);
+        } else {
+            fd_max = max(fd_max, fd_temp);
+            fds.push_back(fd_temp);
+            FD_SET(fd_temp, &fromset);
+        }
+    }
+
+    // reads do not add to the outbound queues of chats, and are
+    // taken under backpressure too
+    for (auto fd : get_read_fd_set())
+    {
+        int rv = recv(fd, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (rv == 0) {
+            close(fd);
+            inbox_.Reset(fd);
+            outbox_.Discard(fd);
+            RemoveFromReadFDSet(fd);
+        } else {
+            fd_max = max(fd_max, fd);
+            fds.push_back(fd);
+            FD_SET(fd, &fromset);
+        }
+    }
 }
 
 void Replica::ResetFD(const int fd, const int primary_id) {
-    if (fd == get_leader_fd(primary_id)) {
-        set_leader_fd(primary_id, -1);
-        close(fd);
-        return;
+    outbox_.Discard(fd);
+    inbox_.Reset(fd);
+
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        if (fd == get_leader_fd(i)) {
+            set_leader_fd(i, -1);
+            close(fd);
+            return;
+        }
     }
 
     for (int i = 0; i < S->get_num_servers(); ++i) {
@@ -355,6 +1171,21 @@ void Replica::ResetFD(const int fd, const int primary_id) {
         }
     }
 
+    set<int> read_fds = get_read_fd_set();
+    if (read_fds.find(fd) != read_fds.end()) {
+        RemoveFromReadFDSet(fd);
+        close(fd);
+        return;
+    }
+
+    for (int i = 0; i < S->get_num_servers(); ++i) {
+        if (fd == get_acceptor_fd(i)) {
+            set_acceptor_fd(i, -1);
+            close(fd);
+            return;
+        }
+    }
+
     for (int i = 0; i < S->get_num_servers(); ++i) {
         if (fd == get_replica_fd(i)) {
             set_replica_fd(i, -1);
@@ -412,6 +1243,7 @@ void Replica::ReplicaMode(const int primary_id)
     vector<int> fds;
     int fd_max;
     vector<int> waitfor;
+    std::vector<StringView> message;     // reused, so parsing allocates nothing
 
     if (S->get_mode() == RECOVER) {
         waitfor = SendDecisionsRequest();
@@ -419,29 +1251,257 @@ void Replica::ReplicaMode(const int primary_id)
     map<int, Proposal> allDecs;
     allDecs[-1] = Proposal("", "", "");
 
+    // DECISION is parsed in place, the others from strings
+    Dispatcher dispatcher("replica");
+    dispatcher.Register(MSG_CHAT, [&](const StringView &msg, const vector<StringView> &view,
+                                      const int fd) {
+        D(cout << "SR" << S->get_pid() << ": Received chat from client: " << msg <<  endl;)
+        Proposal p = viewToProposal(view[1]);
+        if (S->get_options().payload_separation)
+            p = SeparatePayload(p);
+        if (handed_off_)
+        {
+            // the client resends it to the new primary
+            D(cout << "SR" << S->get_pid() << ": Handed over, ignoring chat - " << view[1] << endl;)
+        }
+        else if (!Admitting())
+        {
+            D(cout << "SR" << S->get_pid() << ": Buffering propose - " << view[1] << endl;)
+            buffered_proposals_.push_back(p);
+        }
+        else
+        {
+            ProposeBuffered(primary_id);
+            Propose(p, primary_id);
+        }
+        return true;
+    });
+    dispatcher.Register(MSG_READ, [&](const StringView &msg, const vector<StringView> &view,
+                                      const int fd) {
+        if (view.size() != 3)
+            return false;
+        D(cout << "SR" << S->get_pid() << ": Received read from client: " << msg <<  endl;)
+        PendingRead read;
+        read.client_id = viewToInt(view[1]);
+        read.fd = fd;
+        read.read_id = view[2].ToString();
+        gettimeofday(&read.arrival, NULL);
+        read.round_requested = false;
+        read.follower = (fd != get_client_chat_fd(read.client_id));
+        read.read_index = -1;
+        pending_reads_.push_back(read);
+        return true;
+    });
+    dispatcher.Register(MSG_EPOCH, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        if (view.size() != 2)
+            return false;
+        D(cout << "SR" << S->get_pid() << ": Received epoch from leader: " << msg <<  endl;)
+        S->StartEpoch(stringToEpoch(view[1].ToString()));
+        return true;
+    });
+    dispatcher.Register(MSG_READINDEXRESP, [&](const StringView &msg, const vector<StringView> &view,
+                                               const int fd) {
+        if (view.size() != 3)
+            return false;
+        D(cout << "SR" << S->get_pid() << ": Received read index from leader: " << msg <<  endl;)
+        ReceiveReadIndex(ViewsToStrings(view));
+        return true;
+    });
+
+    // what every message which decided slots is followed by
+    auto decided = [&]() {
+        PerformDecisions(primary_id);
+        PruneLearned();
+
+        if (allDecs.find(-1) == allDecs.end()) //means allDecs has been received
+        {
+            CheckReceivedAllDecisions(allDecs);
+        }
+    };
+    dispatcher.Register(MSG_DECISION, [&](const StringView &msg, const vector<StringView> &view,
+                                          const int fd) {
+        D(cout << "SR" << S->get_pid() << ": Received decision from commander: " << msg <<  endl;)
+        if (view.size() == 5)
+            AddDecision(viewToInt(view[1]), viewToProposal(view[2]),
+                        viewToInt(view[3]), viewToInt(view[4]));
+        else
+            AddDecision(viewToInt(view[1]), viewToProposal(view[2]), -1, 0);
+        decided();
+        return true;
+    });
+    dispatcher.Register(MSG_LEARN, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        // nothing decided by it yet, if ReceiveLearn() says no
+        if (ReceiveLearn(ViewsToStrings(view)))
+            decided();
+        return true;
+    });
+    dispatcher.Register(MSG_COMMIT, [&](const StringView &msg, const vector<StringView> &view,
+                                        const int fd) {
+        if (ReceiveCommit(ViewsToStrings(view)))
+            decided();
+        return true;
+    });
+    dispatcher.Register(MSG_ALLDECISIONS, [&](const StringView &msg, const vector<StringView> &view,
+                                              const int fd) {
+        std::vector<string> token = ViewsToStrings(view);
+        if (S->get_mode() == RECOVER)
+        {
+            D(cout << "SR" << S->get_pid() << ": All decisions response message received: " << msg <<  endl;)
+            CheckAndDecrementWaitFor(waitfor, fd);
+            map<int, Proposal> receivedAllDecisions;
+            if (token.size() != 1)
+                stringToAllDecisions(token[1], receivedAllDecisions);
+
+            MergeDecisions(receivedAllDecisions);
+            if (waitfor.empty()) {
+                S->set_mode(RUNNING);
+                S->SendGoAheadToMaster();
+                D(cout << "SR" << S->get_pid() << ": Recovered. My decisions are now " << allDecisionsToString(decisions_) << endl;)
+            }
+        }
+        else if (S->get_options().multi_leader)
+        {
+            // every owner's leader sends the decisions of its commanders
+            D(cout << "SR" << S->get_pid() << ": Received allDecisions from leader: " << msg <<  endl;)
+            map<int, Proposal> received;
+            if (token.size() != 1)
+                stringToAllDecisions(token[1], received);
+            for (auto &d : received) {
+                if (decisions_.find(d.first) != decisions_.end())
+                    continue;
+                decisions_[d.first] = d.second;
+                if (d.second.msg != kNoop)
+                    highest_chat_slot_ = max(highest_chat_slot_, d.first);
+            }
+            for (int k = 0; k < S->get_num_servers(); k++) {
+                if (get_leader_fd(k) == fd)
+                    all_decisions_from_.insert(k);
+            }
+            PerformDecisions(primary_id);
+        }
+        else
+        {
+            D(cout << "SR" << S->get_pid() << ": Received allDecisions from leader: " << msg <<  endl;)
+            if (token.size() != 1)
+                stringToAllDecisions(token[1], allDecs);
+            else
+                allDecs.clear(); //alldecs should be empty as leader sent empty as all decs
+
+            // decisions made before this replica connected to
+            // their commanders never reached it
+            for (auto &d : allDecs) {
+                if (d.first >= 0 && decisions_.find(d.first) == decisions_.end())
+                    decisions_[d.first] = d.second;
+            }
+            PerformDecisions(primary_id);
+        }
+        return true;
+    });
+    dispatcher.Register(MSG_PAYLOAD, [&](const StringView &msg, const vector<StringView> &view,
+                                         const int fd) {
+        D(cout << "SR" << S->get_pid() << ": Received payload from replica: " << msg <<  endl;)
+        ReceivePayload(ViewsToStrings(view));
+        PerformDecisions(primary_id);
+        return true;
+    });
+    dispatcher.Register(MSG_REQPAYLOAD, [&](const StringView &msg, const vector<StringView> &view,
+                                            const int fd) {
+        D(cout << "SR" << S->get_pid() << ": Received payload request from replica: " << msg <<  endl;)
+        SendPayload(fd, ViewsToStrings(view));
+        return true;
+    });
+    dispatcher.Register(MSG_REQALLDECS, [&](const StringView &msg, const vector<StringView> &view,
+                                            const int fd) {
+        D(cout << "SR" << S->get_pid() << ": Request for all decisions message received: " << msg <<  endl;)
+        SendDecisionsResponse(fd, primary_id);
+        //ResendProposals(primary_id);
+        return true;
+    });
+
+    term_first_slot_ = proposals_.empty() ? 0 : proposals_.rbegin()->first + 1;
+    if (S->get_pid() == primary_id && S->TakeHandoff(handoff_slot_num_, handoff_proposals_))
+        gettimeofday(&handoff_start_, NULL);
+
+    Wakeup *wakeup = S->get_wakeup(kReplicaRole);
     while (true) {  // always listen to messages from the acceptors
+        FlushOutbox(primary_id);
 
         if (primary_id != S->get_primary_id()) {   // new primary elected
-            set_commander_fd(primary_id, -1);
-            // set_scout_fd(primary_id, -1);
-            set_leader_fd(primary_id, -1);
+            // connections to the old primary stay open: it is back to its
+            // own fixed ports when leadership is handed back. if it died,
+            // CreateFdSet() closes them
+            transferring_ = false;
+            handed_off_ = false;
+            tentative_.clear();
+            // reads over read connections ask the new primary's leader
+            for (auto it = pending_reads_.begin(); it != pending_reads_.end(); ) {
+                if (!it->follower) {
+                    it = pending_reads_.erase(it);
+                } else {
+                    it->index_request_id.clear();
+                    it->read_index = -1;
+                    ++it;
+                }
+            }
             return;
         }
-        CreateFdSet(fromset, fds, fd_max, primary_id);
+        ConnectToStandby(primary_id);
+        if (S->get_options().multi_leader) {
+            ConnectToOwners();
+            FollowEpoch(primary_id);
+            SkipOwnSlots(primary_id);
+            CheckAllClearOfOwners();
+        }
 
-        if (fd_max == INT_MIN) {
-            usleep(kBusyWaitSleep);
-            continue;
+        // a planned leadership transfer: admit no new chats, let the ones
+        // in flight be decided, then hand over whatever is left
+        if (S->get_pid() == primary_id && S->get_transfer_target() != -1 && !handed_off_) {
+            if (!transferring_) {
+                transferring_ = true;
+                gettimeofday(&transfer_start_, NULL);
+            }
+            if (Drained() || ElapsedSince(transfer_start_) >= kDrainTimeout)
+                HandOff();
         }
+        ProposeHandedOver(primary_id);
+        // asks again for chat bodies which did not come
+        if (!awaited_payloads_.empty())
+            PerformDecisions(primary_id);
+        ServeReads(primary_id);
+        SendTentative(primary_id);
+
+        // a hot standby can decide before the clients have moved over to it.
+        // clients key responses by slot, so resending is harmless
+        for (int i = 0; i < S->get_num_clients() && S->get_pid() == primary_id; i++) {
+            int fd_temp = get_client_chat_fd(i);
+            if (fd_temp != -1 && fd_temp != synced_client_fd_[i]) {
+                ResendResponses(fd_temp);
+                synced_client_fd_[i] = fd_temp;
+            }
+        }
+        CreateFdSet(fromset, fds, fd_max, primary_id);
+        FD_SET(wakeup->get_fd(), &fromset);
+        fd_max = max(fd_max, wakeup->get_fd());
 
         //if just become not set, then propose buffered
-        if ((S->get_all_clear(kReplicaRole) == kAllClearNotSet) && (!buffered_proposals_.empty()))
+        if (Admitting() && (!buffered_proposals_.empty()))
             ProposeBuffered(primary_id);
         if ((S->get_all_clear(kReplicaRole) == kAllClearSet) && (allDecs.find(-1) == allDecs.end()) )
             CheckReceivedAllDecisions(allDecs);
 
+        // everything generated so far in this turn goes out before blocking,
+        // and whatever the sockets did not take wakes select() once they can
+        FlushOutbox(primary_id);
+        fd_set toset;
+        FD_ZERO(&toset);
+        outbox_.FillWriteSet(toset, fd_max);
+
         struct timeval timeout = kSelectTimeoutTimeval;
-        int rv = select(fd_max + 1, &fromset, NULL, NULL, &timeout);
+        int rv = select(fd_max + 1, &fromset, &toset, NULL, &timeout);
+        if (rv > 0 && FD_ISSET(wakeup->get_fd(), &fromset))
+            wakeup->Clear();
         if (rv == -1) { //error in select
             D(cout << "SR" << S->get_pid() << ": ERROR in select() errno=" << errno << " fdmax=" << fd_max << endl;)
         } else if (rv == 0) {
@@ -449,7 +1509,6 @@ void Replica::ReplicaMode(const int primary_id)
         } else {
             for (int i = 0; i < fds.size(); i++) {
                 if (FD_ISSET(fds[i], &fromset)) { // we got one!!
-                    char buf[kMaxDataSize];
                     if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) == -1) {
                         D(cout << "SR" << S->get_pid()
                           << ": ERROR in receiving" << endl;)
@@ -460,99 +1519,10 @@ void Replica::ReplicaMode(const int primary_id)
                         ResetFD(fds[i], primary_id);
                         CheckAndDecrementWaitFor(waitfor, fds[i]);
                     } else {
-                        buf[num_bytes] = '\0';
-                        std::vector<string> message = split(string(buf), kMessageDelim[0]);
+                        inbox_.Extract(fds[i], buf, num_bytes, message);
                         for (const auto &msg : message) {
-                            std::vector<string> token = split(string(msg), kInternalDelim[0]);
-                            if (token[0] == kChat)
-                            {
-                                D(cout << "SR" << S->get_pid() << ": Received chat from client: " << msg <<  endl;)
-                                Proposal p = stringToProposal(token[1]);
-                                if (S->get_all_clear(kReplicaRole) != kAllClearNotSet)
-                                {
-                                    D(cout << "SR" << S->get_pid() << ": Buffering propose - " << token[1] << endl;)
-                                    buffered_proposals_.push_back(p);
-                                }
-                                else
-                                {
-                                    ProposeBuffered(primary_id);
-                                    Propose(p, primary_id);
-                                }
-                            }
-                            else if (token[0] == kDecision)
-                            {
-                                D(cout << "SR" << S->get_pid() << ": Received decision from commander: " << msg <<  endl;)
-                                int s = stoi(token[1]);
-                                Proposal p = stringToProposal(token[2]);
-                                decisions_[s] = p;
-
-                                Proposal currdecision;
-                                int slot_num = get_slot_num();
-                                while (decisions_.find(slot_num) != decisions_.end())
-                                {
-                                    currdecision = decisions_[slot_num];
-                                    if (proposals_.find(slot_num) != proposals_.end())
-                                    {
-                                        if (!(proposals_[slot_num] == currdecision))
-                                        {
-                                            if (S->get_all_clear(kReplicaRole) != kAllClearNotSet)
-                                            {
-                                                D(cout << "SR" << S->get_pid() << ": Buffering propose - " << token[1] << endl;)
-                                                buffered_proposals_.push_back(proposals_[slot_num]);
-                                            }
-                                            else
-                                            {
-                                                ProposeBuffered(primary_id);
-                                                Propose(proposals_[slot_num], primary_id);
-                                            }
-                                        }
-                                    }
-                                    Perform(slot_num, currdecision, primary_id);
-                                    slot_num = get_slot_num();
-                                    //s has to slot_num. check if it is slotnum in recovery too.
-                                    //if so can remove argument from perform, sendresponse functions
-                                }
-
-                                if (allDecs.find(-1) == allDecs.end()) //means allDecs has been received
-                                {
-                                    CheckReceivedAllDecisions(allDecs);
-                                }
-                            }
-                            else if (token[0] == kAllDecisions)
-                            {
-                                if (S->get_mode() == RECOVER)
-                                {
-                                    D(cout << "SR" << S->get_pid() << ": All decisions response message received: " << msg <<  endl;)
-                                    CheckAndDecrementWaitFor(waitfor, fds[i]);
-                                    map<int, Proposal> receivedAllDecisions;
-                                    if (token.size() != 1)
-                                        stringToAllDecisions(token[1], receivedAllDecisions);
-
-                                    MergeDecisions(receivedAllDecisions);
-                                    if (waitfor.empty()) {
-                                        S->set_mode(RUNNING);
-                                        S->SendGoAheadToMaster();
-                                        D(cout << "SR" << S->get_pid() << ": Recovered. My decisions are now " << allDecisionsToString(decisions_) << endl;)
-                                    }
-                                }
-                                else
-                                {
-                                    D(cout << "SR" << S->get_pid() << ": Received allDecisions from leader: " << msg <<  endl;)
-                                    if (token.size() != 1)
-                                        stringToAllDecisions(token[1], allDecs);
-                                    else
-                                        allDecs.clear(); //alldecs should be empty as leader sent empty as all decs
-                                }
-                            }
-                            else if (token[0] == kReqAllDecs)
-                            {
-                                D(cout << "SR" << S->get_pid() << ": Request for all decisions message received: " << msg <<  endl;)
-                                SendDecisionsResponse(fds[i], primary_id);
-                                //ResendProposals(primary_id);
-                            }
-                            else {    //other messages
+                            if (!dispatcher.Dispatch(msg, fds[i]))
                                 D(cout << "SR" << S->get_pid() << ": ERROR Unexpected message received: " << msg << endl;)
-                            }
                         }
                     }
                 }
@@ -585,17 +1555,24 @@ vector<int> Replica::SendDecisionsRequest()
         if (send_to == -1)
             continue;
 
-        // cout<<send_to<<" sending"<<endl;
-        if (send(send_to, msg.c_str(), msg.size(), 0) == -1) {
+        outbox_.Enqueue(send_to, msg);
+        sent_to.push_back(i);
+    }
+
+    vector<int> failed_fds;
+    outbox_.Flush(failed_fds);
+    for (int j = sent_to.size() - 1; j >= 0; j--) {
+        int id = sent_to[j];
+        int send_to = get_replica_fd(id);
+        if (find(failed_fds.begin(), failed_fds.end(), send_to) != failed_fds.end()) {
             D(cout << "SR" << S->get_pid() << ": ERROR: sending allDecs request to replica R"
-              << i << endl;)
+              << id << endl;)
             close(send_to);
-            set_replica_fd(i, -1);
-        }
-        else {
+            set_replica_fd(id, -1);
+            sent_to.erase(sent_to.begin() + j);
+        } else {
             D(cout << "SR" << S->get_pid() << ": Message sent to replica R"
-              << i << ": " << msg << endl;)
-            sent_to.push_back(i);
+              << id << ": " << msg << endl;)
         }
     }
     return sent_to;
@@ -606,13 +1583,8 @@ void Replica::SendDecisionsResponse(int fd, int primary_id)
     msg += allDecisionsToString(get_decisions());
     msg += kMessageDelim;
 
-    if (send(fd, msg.c_str(), msg.size(), 0) == -1) {
-        D(cout << "SR" << S->get_pid() << ": ERROR: sending allDecs response to replica" << endl;)
-        ResetFD(fd, primary_id);
-    }
-    else {
-        D(cout << "SR" << S->get_pid() << ": AllDecs response message sent to replica " << ": " << msg << endl;)
-    }
+    outbox_.Enqueue(fd, msg);
+    D(cout << "SR" << S->get_pid() << ": AllDecs response message queued for replica " << ": " << msg << endl;)
 
 }
 
@@ -642,14 +1614,19 @@ void* ReplicaEntry(void *_S) {
     pthread_t accept_connections_thread;
     CreateThread(AcceptConnectionsReplica, (void*)&R, accept_connections_thread);
 
+    bool first_round = true;
     while (1)
     {
-
-        // sleep for some time to make sure accept threads of commanders and scouts are running
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
+        // the commander of a new primary may not be accepting yet. retry with backoff.
+        // a hot standby's commander and leader are connected already. Stop
+        // retrying if another primary is named meanwhile, and go to that one
         int primary_id = R.S->get_primary_id();
-        if (R.ConnectToCommander(primary_id)) {
+        auto renamed = [&]() { return R.S->get_primary_id() != primary_id; };
+        if (R.get_commander_fd(primary_id) != -1
+                || RetryWithBackoff([&]() { return renamed() || R.ConnectToCommander(primary_id); },
+                                    kConnectTimeout)) {
+            if (renamed())
+                continue;
             D(cout << "SR" << R.S->get_pid() << ": Connected to commander of S"
               << primary_id << endl;)
         } else {
@@ -658,28 +1635,29 @@ void* ReplicaEntry(void *_S) {
             return NULL;
         }
 
-        // if (R.ConnectToScout(primary_id)) {
-        //     D(cout << "SR" << R.S->get_pid() << ": Connected to scout of S"
-        //       << primary_id << endl;)
-        // } else {
-        //     D(cout << "SR" << R.S->get_pid() << ": ERROR in connecting to scout of S"
-        //       << primary_id << endl;)
-        //     return NULL;
-        // }
-
         int upper_bound;
         if (R.S->get_mode() == RECOVER)
             upper_bound = R.S->get_num_servers();
         else
             upper_bound = R.S->get_pid();
 
+        // on cold start all replicas come up together, so retry till the peer
+        // is suspected. Otherwise a replica which refuses the connection is
+        // dead, and is not waited for
+        time_t replica_timeout = 0;
+        if (first_round && R.S->get_mode() != RECOVER)
+            replica_timeout = kConnectTimeout;
+
         for (int i = 0; i < upper_bound; i++)
         {
             if (R.S->get_pid() == i)
                 continue;
             if (R.get_replica_fd(i) != -1) //if not already connected
                 continue;
-            if (R.ConnectToReplica(i)) {
+            FailureDetector *FD = R.S->get_failure_detector();
+            if (RetryWithBackoff([&]() { return R.ConnectToReplica(i) || FD->IsSuspected(i); },
+                                 replica_timeout)
+                    && R.get_replica_fd(i) != -1) {
                 D(cout << "SR" << R.S->get_pid() << ": Connected to replica of S"
                   << i << endl;)
             } else {
@@ -689,7 +1667,11 @@ void* ReplicaEntry(void *_S) {
             }
         }
 
-        if (R.ConnectToLeader(primary_id)) {
+        if (R.get_leader_fd(primary_id) != -1
+                || RetryWithBackoff([&]() { return renamed() || R.ConnectToLeader(primary_id); },
+                                    kConnectTimeout)) {
+            if (renamed())
+                continue;
             D(cout << "SR" << R.S->get_pid() << ": Connected to leader of S"
               << primary_id << endl;)
         } else {
@@ -697,16 +1679,7 @@ void* ReplicaEntry(void *_S) {
               << primary_id << endl;)
             return NULL;
         }
-
-        // sleep for some time to make sure all connections are established
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
-        usleep(kGeneralSleep);
-
-        // pthread_t receive_from_replicas_thread;
-        // CreateThread(ReceiveMessagesFromReplicas, (void*)&R, receive_from_replicas_thread);
-        // while(R.S->get_mode() != RUNNING)
-        //     usleep(kRecoveryWaitSleep);
+        first_round = false;
 
         R.S->set_replica_ready(true);
         R.ReplicaMode(primary_id);
@@ -3,9 +3,11 @@
 
 #include "server.h"
 #include "utilities.h"
+#include "channel.h"
 #include "vector"
 #include "string"
 #include "unordered_set"
+#include "unordered_map"
 #include "map"
 #include "set"
 using namespace std;
@@ -14,21 +16,65 @@ void* AcceptConnectionsReplica(void* _R);
 void* ReplicaEntry(void *_S);
 void* ReceiveMessagesFromReplicas(void* _R );
 
+// a client's request for the chat log, waiting to be served locally
+struct PendingRead {
+    int client_id;
+    int fd;
+    string read_id;
+    struct timeval arrival;
+    bool round_requested;
+    bool follower;              // came over a read connection, not the chat connection
+    string index_request_id;    // READINDEX sent to the primary's leader, empty if none
+    int read_index;             // slot to perform before serving, -1 till known
+};
+
+// a pvalue acceptors told this replica of, in the distributed learning mode
+struct LearnedValue {
+    Proposal p;
+    int skip_to;                // a skip: NOOP in every stride-th slot below skip_to
+    int stride;
+    std::set<int> acceptors;    // acceptors which accepted it
+    vector<Proposal> fragments; // with erasure coding, the fragment each acceptor accepted
+};
+
 class Replica {
 public:
     bool ConnectToCommander(const int server_id);
     // bool ConnectToScout(const int server_id);
     bool ConnectToReplica(const int server_id);
     bool ConnectToLeader(const int server_id);
+    void ConnectToStandby(const int primary_id);
+    void ConnectToOwners();
+    void FollowEpoch(const int primary_id);
+    void SkipOwnSlots(const int primary_id);
+    void CheckAllClearOfOwners();
     void Propose(const Proposal &p, const int primary_id);
     void SendProposal(const int& s, const Proposal& p, const int primary_id);
+    Proposal SeparatePayload(const Proposal &p);
+    bool JoinPayload(const Proposal &p, Proposal &chat);
+    void RequestPayload(const Proposal &p);
+    void ReceivePayload(const std::vector<string> &token);
+    void SendPayload(const int fd, const std::vector<string> &token);
     void Perform(const int& slot, const Proposal& p, const int primary_id);
+    void PerformDecisions(const int primary_id);
     void SendResponseToAllClients(const int& s, const Proposal& p, const int primary_id);
+    void SendToAllClients(const string &msg);
+    void SendTentative(const int primary_id);
+    void SettleTentative(const int slot, const Proposal &p, const bool answered);
+    void AddDecision(const int s, const Proposal &p, const int skip_to, const int stride);
+    bool ReceiveLearn(const std::vector<string> &token);
+    bool ReceiveCommit(const std::vector<string> &token);
+    bool Learn(const int s, const Ballot &b);
+    void PruneLearned();
 
     void IncrementSlotNum();
     void ReplicaMode(const int primary_id);
     void Unicast(const string &type, const string& msg, const int primary_id);
     void ProposeBuffered(const int primary_id);
+    bool Admitting();
+    bool Drained();
+    void HandOff();
+    void ProposeHandedOver(const int primary_id);
     void CheckReceivedAllDecisions(map<int, Proposal>& allDecisions);
     void CheckAndDecrementWaitFor(vector<int>& waitfor, const int& s_fd);
 
@@ -39,7 +85,16 @@ public:
     void MergeDecisions(map<int, Proposal>);
     void DecisionsRecoveryMode();
     void ResetFD(const int fd, const int primary_id);
+    void ResyncFD(const int fd, const int primary_id);
     void ResendProposals(const int primary_id);
+    void ResendResponses(const int fd);
+    string ChatLogToString();
+    void ServeReads(const int primary_id);
+    void RequestReadIndex(PendingRead &read, const int primary_id);
+    void ReceiveReadIndex(const std::vector<string> &token);
+    void AddToReadFDSet(const int fd);
+    void RemoveFromReadFDSet(const int fd);
+    void FlushOutbox(const int primary_id);
 
     int get_slot_num();
     int get_commander_fd(const int server_id);
@@ -47,7 +102,9 @@ public:
     int get_leader_fd(const int server_id);
     int get_client_chat_fd(const int client_id);
     int get_replica_fd(const int server_id);
+    int get_acceptor_fd(const int server_id);
     map<int, Proposal> get_decisions();
+    set<int> get_read_fd_set();
 
     void set_slot_num(const int slot_num);
     void set_commander_fd(const int server_id, const int fd);
@@ -55,6 +112,7 @@ public:
     void set_leader_fd(const int server_id, const int fd);
     void set_client_chat_fd(const int client_id, const int fd);
     void set_replica_fd(const int client_id, const int fd);
+    void set_acceptor_fd(const int server_id, const int fd);
     void set_recovery(bool val);
     void set_decisions(map<int, Proposal>& d);
 
@@ -74,7 +132,46 @@ private:
     std::vector<int> leader_fd_;
     std::vector<int> client_chat_fd_;
     std::vector<int> replica_fd_;
+    std::vector<int> synced_client_fd_;    // client fds last sent all responses
+    struct timeval last_standby_attempt_;
     vector<Proposal> buffered_proposals_;
+    int term_first_slot_;       // first slot proposed since this server became primary
+
+    // planned leadership transfer, on the primary handing over
+    bool transferring_;         // new chats are not admitted
+    bool handed_off_;
+    struct timeval transfer_start_;
+
+    // and on the server taking over
+    int handoff_slot_num_;
+    std::map<int, Proposal> handoff_proposals_;
+    struct timeval handoff_start_;
+
+    vector<PendingRead> pending_reads_;
+    std::set<int> read_fd_set_;     // read connections of clients, on any server
+    int next_index_request_;
+
+    // multi-leader mode
+    Epoch epoch_;               // epoch proposed in, as last followed
+    int next_own_slot_;         // no own slot below this is free any more
+    int highest_chat_slot_;     // highest slot decided with a chat
+    vector<Proposal> waiting_for_epoch_;    // chats with no own slot to propose in
+    std::set<int> all_decisions_from_;      // leaders which sent decisions in this all clear
+    struct timeval last_owner_attempt_;
+
+    // speculative responses
+    std::map<int, Proposal> tentative_;     // slot -> chat clients were told of, till decided
+
+    // distributed learning
+    std::vector<int> acceptor_fd_;          // acceptors telling this replica of accepted pvalues
+    std::map<int, std::map<Ballot, LearnedValue> > learned_;   // slot -> ballot -> pvalue
+    std::map<int, Ballot> commit_notices_;  // slots committed with a ballot, value not known yet
+
+    // payload separation
+    std::unordered_map<string, string> payloads_;       // <client id>.<chat id> -> chat body
+    std::map<string, struct timeval> awaited_payloads_; // bodies asked of other replicas
+    Outbox outbox_;
+    Inbox inbox_;
 };
 
 struct ReceiveThreadArgument {
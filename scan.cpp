@@ -0,0 +1,154 @@
+#include "scan.h"
+#include "cstring"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define SCAN_X86
+#  include "immintrin.h"
+#endif
+
+// delimiters a SIMD kernel compares with, more go to the scalar kernel
+const size_t kScanMaxDelims = 4;
+
+/**
+ * one byte at a time, through a table of which bytes are delimiters
+ * @param base offset of data in the whole buffer
+ */
+static void ScanScalar(const char *data, const size_t size, const size_t base,
+                       const string &delims, vector<size_t> &offsets)
+{
+    bool is_delim[256] = { false };
+    for (auto c : delims)
+        is_delim[(unsigned char)c] = true;
+    for (size_t i = 0; i < size; i++) {
+        if (is_delim[(unsigned char)data[i]])
+            offsets.push_back(base + i);
+    }
+}
+
+#ifdef SCAN_X86
+// offsets a SIMD kernel gathers before it appends them to the vector
+const size_t kScanBatch = 256;
+
+/**
+ * adds base plus the offset of each set bit of mask, lowest first, to the
+ * batch, and moves a batch which may not hold another mask to offsets
+ */
+static inline void PushMask(unsigned int mask, const size_t base, size_t *batch,
+                            size_t &num_batched, vector<size_t> &offsets)
+{
+    while (mask != 0) {
+        batch[num_batched++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    if (num_batched > kScanBatch - 32) {
+        offsets.insert(offsets.end(), batch, batch + num_batched);
+        num_batched = 0;
+    }
+}
+
+__attribute__((target("sse2")))
+static void ScanSse2(const char *data, const size_t size, const string &delims,
+                     vector<size_t> &offsets)
+{
+    __m128i d[kScanMaxDelims];
+    for (size_t k = 0; k < delims.size(); k++)
+        d[k] = _mm_set1_epi8(delims[k]);
+    size_t batch[kScanBatch];
+    size_t num_batched = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i eq = _mm_cmpeq_epi8(v, d[0]);
+        for (size_t k = 1; k < delims.size(); k++)
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, d[k]));
+        PushMask((unsigned int)_mm_movemask_epi8(eq), i, batch, num_batched, offsets);
+    }
+    offsets.insert(offsets.end(), batch, batch + num_batched);
+    ScanScalar(data + i, size - i, i, delims, offsets);
+}
+
+__attribute__((target("avx2")))
+static void ScanAvx2(const char *data, const size_t size, const string &delims,
+                     vector<size_t> &offsets)
+{
+    __m256i d[kScanMaxDelims];
+    for (size_t k = 0; k < delims.size(); k++)
+        d[k] = _mm256_set1_epi8(delims[k]);
+    size_t batch[kScanBatch];
+    size_t num_batched = 0;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i eq = _mm256_cmpeq_epi8(v, d[0]);
+        for (size_t k = 1; k < delims.size(); k++)
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, d[k]));
+        PushMask((unsigned int)_mm256_movemask_epi8(eq), i, batch, num_batched, offsets);
+    }
+    offsets.insert(offsets.end(), batch, batch + num_batched);
+    ScanScalar(data + i, size - i, i, delims, offsets);
+}
+#endif
+
+/**
+ * @return the fastest kernel this CPU runs
+ */
+ScanKernel BestScanKernel()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SCAN_SSE2;
+#endif
+    return SCAN_SCALAR;
+}
+
+string ScanKernelName(const ScanKernel kernel)
+{
+    switch (kernel) {
+    case SCAN_AVX2:
+        return "avx2";
+    case SCAN_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+/**
+ * ScanDelimiters() with a given kernel, which the CPU must support
+ */
+void ScanDelimitersWith(const ScanKernel kernel, const char *data, const size_t size,
+                        const string &delims, vector<size_t> &offsets)
+{
+    offsets.clear();
+    if (delims.empty())
+        return;
+#ifdef SCAN_X86
+    if (delims.size() <= kScanMaxDelims) {
+        if (kernel == SCAN_AVX2) {
+            ScanAvx2(data, size, delims, offsets);
+            return;
+        }
+        if (kernel == SCAN_SSE2) {
+            ScanSse2(data, size, delims, offsets);
+            return;
+        }
+    }
+#endif
+    ScanScalar(data, size, 0, delims, offsets);
+}
+
+/**
+ * @param data    bytes to be scanned
+ * @param size    number of bytes in data
+ * @param delims  delimiters looked for
+ * @param offsets [out] offsets in data of every delimiter, in order
+ */
+void ScanDelimiters(const char *data, const size_t size, const string &delims,
+                    vector<size_t> &offsets)
+{
+    static const ScanKernel kernel = BestScanKernel();
+    ScanDelimitersWith(kernel, data, size, delims, offsets);
+}
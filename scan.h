@@ -0,0 +1,31 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include "string"
+#include "vector"
+using namespace std;
+
+// inputs shorter than this are split with memchr(), which wins on few bytes
+const size_t kScanMinBytes = 256;
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanKernel;
+
+/**
+ * finds every delimiter of a buffer in one pass, and gives their offsets.
+ * The SIMD kernels compare 16 (SSE2) or 32 (AVX2) bytes at a time with each
+ * delimiter, and turn the matches into a bit mask with movemask, whose set
+ * bits are the offsets. The kernel is picked once from what the CPU
+ * supports, and the scalar one, a table lookup per byte, serves any other
+ */
+void ScanDelimiters(const char *data, const size_t size, const string &delims,
+                    vector<size_t> &offsets);
+void ScanDelimitersWith(const ScanKernel kernel, const char *data, const size_t size,
+                        const string &delims, vector<size_t> &offsets);
+ScanKernel BestScanKernel();
+string ScanKernelName(const ScanKernel kernel);
+
+#endif //SCAN_H_
@@ -108,6 +108,7 @@ void* AcceptConnectionsScout(void* _SC) {
         int process_id = SC->S->IsLeaderPort(incoming_port);
         if (process_id != -1) { //incoming connection from a leader
             SC->set_leader_fd(process_id, new_fd);
+            SendReady(new_fd);
         } else {
             // process_id = SC->S->IsReplicaPort(incoming_port);
             // if (process_id != -1) { //incoming connection from a replica
@@ -116,6 +117,8 @@ void* AcceptConnectionsScout(void* _SC) {
             process_id = SC->S->IsAcceptorPort(incoming_port);
             if (process_id != -1) { //incoming connection from an acceptor
                 SC->set_acceptor_fd(process_id, new_fd);
+                SendReady(new_fd);
+                SC->S->get_wakeup(kLeaderRole)->Notify();
             } else {
                 D(cout << "SS" << SC->S->get_pid() << ": ERROR: Unexpected connect request from port "
                   << incoming_port << endl;)
@@ -2,6 +2,7 @@
 #include "server.h"
 #include "constants.h"
 #include "utilities.h"
+#include "dispatch.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -12,6 +13,7 @@
 #include "errno.h"
 #include "sys/socket.h"
 #include "limits.h"
+#include "algorithm"
 using namespace std;
 
 typedef pair<int, Proposal> SPtuple;
@@ -26,6 +28,11 @@ typedef pair<int, Proposal> SPtuple;
 
 extern void* AcceptConnectionsScout(void* _S);
 
+// the outbox is used by scout threads, and by the leader for lease rounds.
+// a scout thread may still be draining its last message when the leader
+// already sees the scout as done
+pthread_mutex_t scout_outbox_lock = PTHREAD_MUTEX_INITIALIZER;
+
 Scout::~Scout() {
 
 }
@@ -38,6 +45,9 @@ Scout::Scout(Server* _S) {
     leader_fd_.resize(num_servers, -1);
     // replica_fd_.resize(num_servers, -1);
     acceptor_fd_.resize(num_servers, -1);
+    outbox_.Configure(S->get_options().outbox_max_bytes,
+                      S->get_options().overflow_policy,
+                      S->get_options().compress_min_bytes);
 }
 
 int Scout::get_leader_fd(const int server_id) {
@@ -66,57 +76,91 @@ void Scout::set_acceptor_fd(const int server_id, const int fd) {
 
 int Scout::SendToServers(const string& type, const string& msg)
 {
-    int num_send = 0;
+    vector<pair<int, string> > msgs;
     for (int i = 0; i < S->get_num_servers(); i++)
-    {
+        msgs.push_back(make_pair(i, msg));
+    return SendToAcceptors(msgs);
+}
+
+/**
+ * sends messages to acceptors. All of them are queued before any is
+ * flushed, so a slow acceptor does not hold up the rest. No more are queued
+ * than the message quota allows, and the quota is charged per message sent
+ * @param  msgs         acceptor ids, each with the message to send to it
+ * @param  charge_quota false for messages the time bomb does not count,
+ *                      such as the leader's LEASEs
+ * @return              number of messages sent
+ */
+int Scout::SendToAcceptors(const vector<pair<int, string> > &msgs, const bool charge_quota)
+{
+    if (charge_quota)
         S->ContinueOrDie();
 
-        int serv_id = get_acceptor_fd(i);
-        if (serv_id != -1)
-        {
-            if (send(serv_id, msg.c_str(), msg.size(), 0) == -1) {
-                D(cout << "SS" << S->get_pid() << ": ERROR: sending to acceptor S" << (serv_id) << endl;)
-                close(get_acceptor_fd(i));
-                set_acceptor_fd(i, -1);
-            }
-            else {
-                D(cout << "SS" << S->get_pid() << ": Message sent to acceptor S" << i << ": " << msg << endl;)
-                num_send++;
-            }
-        }
+    int quota = charge_quota ? S->get_message_quota() : INT_MAX;
+    vector<pair<int, string> > queued;
+    pthread_mutex_lock(&scout_outbox_lock);
+    for (const auto &m : msgs) {
+        if ((int)queued.size() >= quota)
+            break;
+        if (get_acceptor_fd(m.first) == -1)
+            continue;
+        outbox_.Enqueue(get_acceptor_fd(m.first), m.second);
+        queued.push_back(m);
+    }
 
-        S->DecrementMessageQuota();
+    vector<int> failed_fds;
+    outbox_.Drain(kOutboxDrainTimeout, failed_fds);
+    int num_sent = 0;
+    for (const auto &m : queued) {
+        int serv_fd = get_acceptor_fd(m.first);
+        if (find(failed_fds.begin(), failed_fds.end(), serv_fd) != failed_fds.end()) {
+            D(cout << "SS" << S->get_pid() << ": ERROR: sending to acceptor S" << m.first << endl;)
+            outbox_.Discard(serv_fd);
+            CloseAndUnSetAcceptor(m.first);
+            continue;
+        }
+        D(cout << "SS" << S->get_pid() << ": Message sent to acceptor S" << m.first << ": " << m.second << endl;)
+        S->get_failure_detector()->Sent(m.first);
+        num_sent++;
     }
-    return num_send;
+    pthread_mutex_unlock(&scout_outbox_lock);
+
+    if (charge_quota)
+        S->DecrementMessageQuota(num_sent);
+    return num_sent;
 }
 
+/**
+ * builds the select() set of acceptors which are not suspected by the
+ * failure detector. A closed connection shows up as readable, and is
+ * cleaned up by the receive loop
+ */
 void Scout::GetAcceptorFdSet(fd_set& acceptor_set, vector<int>& fds, int& fd_max)
 {
-    char buf;
     fd_max = INT_MIN;
     int fd_temp;
     FD_ZERO(&acceptor_set);
     fds.clear();
     for (int i = 0; i < S->get_num_servers(); i++) {
         fd_temp = get_acceptor_fd(i);
-        if (fd_temp == -1) continue;
+        if (fd_temp == -1 || S->get_failure_detector()->IsSuspected(i))
+            continue;
 
-        int rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
-        if (rv == 0) {
-            close(fd_temp);
-            set_acceptor_fd(i, -1);
-        } else {
-            FD_SET(fd_temp, &acceptor_set);
-            fd_max = max(fd_max, fd_temp);
-            fds.push_back(fd_temp);
-        }
+        FD_SET(fd_temp, &acceptor_set);
+        fd_max = max(fd_max, fd_temp);
+        fds.push_back(fd_temp);
     }
 }
 
 void Scout::Unicast(const string &type, const string& msg)
 {
     int serv_fd = get_leader_fd(S->get_pid());
-    if (send(serv_fd, msg.c_str(), msg.size(), 0) == -1) {
+    vector<int> failed_fds;
+    pthread_mutex_lock(&scout_outbox_lock);
+    outbox_.Enqueue(serv_fd, msg);
+    outbox_.Drain(kOutboxDrainTimeout, failed_fds);
+    pthread_mutex_unlock(&scout_outbox_lock);
+    if (serv_fd == -1 || !failed_fds.empty()) {
         D(cout << "SS" << S->get_pid() << ": ERROR in sending " << type << endl;)
     }
     else {
@@ -131,9 +175,73 @@ int Scout::SendP1a(const Ballot &b)
     return SendToServers(kP1a, msg);
 }
 
-void Scout::SendAdopted(const Ballot& recvd_ballot, unordered_set<Triple> pvalues) {
+/**
+ * sends P1A-<pid>-<ballot>-<group>$ to one acceptor of each group of vote
+ * relays, the first one connected and not suspected, with the ids of the
+ * rest of its group which are. It passes the P1A on to them and answers
+ * for all of them (see Acceptor::RelayP1a). A relay with no one else left
+ * in its group gets a plain P1A
+ * @return number of relays to which P1A was sent
+ */
+int Scout::SendP1aToRelays(const Ballot &b)
+{
+    vector<pair<int, string> > msgs;
+    string p1a = kP1a + kInternalDelim + to_string(S->get_pid()) + kInternalDelim
+                 + ballotToString(b);
+    for (const auto &group : RelayGroups(S->get_options(), S->get_num_servers())) {
+        int relay = -1;
+        string members;
+        for (auto i : group) {
+            if (get_acceptor_fd(i) == -1 || S->get_failure_detector()->IsSuspected(i))
+                continue;
+            if (relay == -1) {
+                relay = i;
+                continue;
+            }
+            if (!members.empty())
+                members += kInternalSetDelim;
+            members += to_string(i);
+        }
+        if (relay == -1)
+            continue;
+        string msg = p1a;
+        if (!members.empty())
+            msg += kInternalDelim + members;
+        msg += kMessageDelim;
+        msgs.push_back(make_pair(relay, msg));
+    }
+    return SendToAcceptors(msgs);
+}
+
+/**
+ * sends plain P1A to the given acceptors, whose vote relay did not answer
+ * for them in time
+ * @param pending acceptors from which a P1B is still awaited
+ */
+void Scout::SendP1aFallback(const Ballot &b, const vector<bool> &pending)
+{
+    string msg = kP1a + kInternalDelim + to_string(S->get_pid());
+    msg += kInternalDelim + ballotToString(b) + kMessageDelim;
+    vector<pair<int, string> > msgs;
+    for (int i = 0; i < S->get_num_servers(); i++) {
+        if (pending[i])
+            msgs.push_back(make_pair(i, msg));
+    }
+    SendToAcceptors(msgs);
+}
+
+/**
+ * sends ADOPTED-<ballot>-<pvalues>$ to the leader. With fast votes reported,
+ * ADOPTED-<ballot>-<pvalues>-<fast votes>$, which tells how many acceptors
+ * of the phase 1 quorum accepted each triple in a fast slot
+ */
+void Scout::SendAdopted(const Ballot& recvd_ballot, unordered_set<Triple> pvalues,
+                        const unordered_map<Triple, int> &fast_votes) {
     string msg = kAdopted + kInternalDelim + ballotToString(recvd_ballot) + kInternalDelim;
-    msg += tripleSetToString(pvalues) + kMessageDelim;
+    msg += tripleSetToString(pvalues);
+    if (!fast_votes.empty())
+        msg += kInternalDelim + fastVotesToString(fast_votes);
+    msg += kMessageDelim;
     Unicast(kAdopted, msg);
 }
 
@@ -152,36 +260,28 @@ int Scout::GetServerIdFromFd(int fd)
             return i;
         }
     }
+    return -1;
 }
 
 void Scout::CloseAndUnSetAcceptor(int id)
 {
+    inbox_.Reset(get_acceptor_fd(id));
     close(get_acceptor_fd(id));
     set_acceptor_fd(id, -1);
 
 }
 
 /**
- * counts and returns the number of acceptors currently alive
+ * counts and returns the number of acceptors currently alive,
+ * i.e. connected and not suspected by the failure detector
  * @return number of alive acceptors
  */
 int Scout::CountAcceptorsAlive() {
-    char buf;
-    int rv;
     int count = 0;
     for (int i = 0; i < S->get_num_servers(); ++i)
     {
-        int fd_temp = get_acceptor_fd(i);
-        if (fd_temp == -1)
-            continue;
-
-        rv = recv(fd_temp, &buf, 1, MSG_DONTWAIT | MSG_PEEK);
-        if (rv == 0) {
-            close(fd_temp);
-            set_acceptor_fd(i, -1);
-        } else {
+        if (get_acceptor_fd(i) != -1 && !S->get_failure_detector()->IsSuspected(i))
             count++;
-        }
     }
     return count;
 }
@@ -193,24 +293,169 @@ void* ScoutMode(void* _rcv_thread_arg) {
     Scout *SC = rcv_thread_arg->SC;
     Ballot ball = rcv_thread_arg->ball;
     time_t sleep_time = rcv_thread_arg->sleep_time;
+    time_t backoff = rcv_thread_arg->backoff;
 
-    usleep(sleep_time);
     int num_servers = SC->S->get_num_servers();
     int num_send;
 
+    // after a preemption, give a competing leader time to finish
+    if (backoff > 0)
+        usleep(backoff);
+
+    // after too few acceptors were alive, wait till a phase 1 quorum shows
+    // a sign of life again, but no longer than sleep_time
+    int quorum = SC->S->get_phase1_quorum();
+    if (sleep_time > 0)
+        SC->S->get_failure_detector()->WaitForQuorum(quorum, sleep_time);
     int num_alive_acceptors = SC->CountAcceptorsAlive();
-    if ((float)num_alive_acceptors < (num_servers / 2.0)) {
-        num_send = 0;   // won't send to anyone since only a minority is alive
+    bool relays = SC->S->get_options().vote_relay_group > 0;
+    if (num_alive_acceptors < quorum) {
+        num_send = 0;   // won't send to anyone since less than a quorum is alive
+    } else if (relays) {
+        num_send = SC->SendP1aToRelays(ball);   // number of relays to which p1a successfully sent
     } else {
         num_send = SC->SendP1a(ball);   // number of servers to which p1a successfully sent
     }
+    struct timeval p1a_start;
+    gettimeofday(&p1a_start, NULL);
+    bool fell_back = false;     // P1A sent straight to acceptors relays did not answer for
 
     int num_bytes;
     unordered_set<Triple> pvalues;
+    unordered_map<Triple, int> fast_votes;
 
     int waitfor = num_servers;
     vector<int> fds;
+    // acceptors from which a P1B is still awaited
+    vector<bool> pending(num_servers, false);
+    for (int i = 0; i < num_servers && num_send; ++i) {
+        pending[i] = (SC->get_acceptor_fd(i) != -1);
+    }
+    // relays answer for the rest of their groups
+    if (relays && num_send)
+        num_send = count(pending.begin(), pending.end(), true);
+
+    // serv_id is the acceptor the message being handled came from. done is
+    // set once the ballot is adopted or preempted
+    int serv_id = -1;
+    bool done = false;
+    std::vector<StringView> message;
+    Dispatcher dispatcher("scout");
+    dispatcher.Register(MSG_P1B, [&](const StringView &msg, const vector<StringView> &view,
+                                     const int fd) {
+        D(cout << "SS" << SC->S->get_pid()
+          << ": received P1B from acceptor S" << serv_id << ": " << msg << endl;)
+
+        // an acceptor answers a P1A with a ballot at least as high. a lower
+        // one answers the P1A of an earlier scout, which was preempted
+        // before this acceptor replied
+        Ballot recvd_ballot = viewToBallot(view[2]);
+        if (recvd_ballot < ball || !pending[serv_id])
+            return true;
+
+        std::vector<string> token = ViewsToStrings(view);
+        pending[serv_id] = false;
+        num_send--;
+        unordered_set<Triple> r;
+        if (token.size() >= 4)
+        {
+            r = stringToTripleSet(token[3]);
+        }
+
+        if (recvd_ballot == ball)
+        {
+
+            union_set(pvalues, r);
+            if (token.size() == 5) {
+                for (auto &t : stringToTripleSet(token[4]))
+                    fast_votes[t]++;
+            }
+            waitfor--;
+            if (num_servers - waitfor >= quorum)
+            {
+
+                SC->SendAdopted(recvd_ballot, pvalues, fast_votes);
+                done = true;
+            }
+        } else {
+            SC->SendPreEmpted(recvd_ballot);
+            done = true;
+        }
+        return true;
+    });
+    dispatcher.Register(MSG_VOTES, [&](const StringView &msg, const vector<StringView> &view,
+                                       const int fd) {
+        if (view.size() < 4)
+            return false;
+        D(cout << "SS" << SC->S->get_pid()
+          << ": received VOTES from acceptor S" << serv_id << ": " << msg << endl;)
+
+        Ballot recvd_ballot = viewToBallot(view[2]);
+        if (recvd_ballot < ball)
+            return true;
+        if (recvd_ballot > ball) {
+            SC->SendPreEmpted(recvd_ballot);
+            done = true;
+            return true;
+        }
+
+        // the fast votes of a relay are summed over its voters,
+        // so they count only if none of them was counted before
+        std::vector<string> token = ViewsToStrings(view);
+        vector<int> voters;
+        for (const auto &voter : split(token[3], kInternalSetDelim[0]))
+            voters.push_back(stoi(voter));
+        bool fresh = true;
+        for (auto v : voters)
+            fresh = fresh && pending[v];
+        if (!fresh)
+            return true;
+
+        for (auto v : voters) {
+            pending[v] = false;
+            num_send--;
+            waitfor--;
+        }
+        if (token.size() >= 5) {
+            unordered_set<Triple> r = stringToTripleSet(token[4]);
+            union_set(pvalues, r);
+        }
+        if (token.size() == 6) {
+            for (auto &vote : stringToFastVotes(token[5]))
+                fast_votes[vote.first] += vote.second;
+        }
+        if (num_servers - waitfor >= quorum)
+        {
+            SC->SendAdopted(recvd_ballot, pvalues, fast_votes);
+            done = true;
+        }
+        return true;
+    });
+    // meant for this server as hot standby, or for a lease round of this
+    // leader before it was preempted. Fast votes come along in the P1Bs
+    dispatcher.Ignore(MSG_PROMISED);
+    dispatcher.Ignore(MSG_LEASEACK);
+    dispatcher.Ignore(MSG_FASTP2B);
     while (num_send) {  // always listen to messages from the acceptors
+        if (relays && !fell_back
+                && ElapsedSince(p1a_start) >= 2 * SC->S->get_options().relay_timeout) {
+            D(cout << "SS" << SC->S->get_pid() << ": Sending P1A to acceptors not heard from after "
+              << ElapsedSince(p1a_start) / 1000 << " ms" << endl;)
+            SC->SendP1aFallback(ball, pending);
+            fell_back = true;
+        }
+
+        // a suspected acceptor will not answer. stop waiting for it
+        for (int i = 0; i < num_servers; ++i) {
+            if (pending[i] && SC->S->get_failure_detector()->IsSuspected(i)) {
+                D(cout << "SS" << SC->S->get_pid() << ": Not waiting for suspected acceptor S" << i << endl;)
+                pending[i] = false;
+                num_send--;
+            }
+        }
+        if (!num_send)
+            break;
+
         fd_set acceptor_set;
         int fd_max;
         SC->GetAcceptorFdSet(acceptor_set, fds, fd_max);
@@ -219,6 +464,15 @@ void* ScoutMode(void* _rcv_thread_arg) {
             continue;
         }
         struct timeval timeout = kSelectTimeoutTimeval;
+        if (relays && !fell_back) {
+            // wake up when the fallback is due
+            time_t left = max(2 * SC->S->get_options().relay_timeout - ElapsedSince(p1a_start),
+                              (time_t)0);
+            if (left < timeout.tv_sec * 1000 * 1000 + timeout.tv_usec) {
+                timeout.tv_sec = left / (1000 * 1000);
+                timeout.tv_usec = left % (1000 * 1000);
+            }
+        }
         int rv = select(fd_max + 1, &acceptor_set, NULL, NULL, &timeout);
         if (rv == -1) { //error in select
             D(cout << "SS" << SC->S->get_pid() << ": ERROR in select()" << endl;)
@@ -228,52 +482,27 @@ void* ScoutMode(void* _rcv_thread_arg) {
             for (int i = 0; i < fds.size(); i++) {
                 if (FD_ISSET(fds[i], &acceptor_set)) { // we got one!!
                     char buf[kMaxDataSize];
-                    int serv_id = SC->GetServerIdFromFd(fds[i]);
+                    serv_id = SC->GetServerIdFromFd(fds[i]);
                     if ((num_bytes = recv(fds[i], buf, kMaxDataSize - 1, 0)) == -1) {
                         SC->CloseAndUnSetAcceptor(serv_id);
+                        pending[serv_id] = false;
                         num_send--;
                         D(cout << "SS" << SC->S->get_pid()
                           << ": ERROR in receiving p1b from acceptor S" << serv_id << endl;)
                     } else if (num_bytes == 0) {     //connection closed
                         SC->CloseAndUnSetAcceptor(serv_id);
+                        pending[serv_id] = false;
                         num_send--;
                         D(cout << "SS" << SC->S->get_pid()
                           << ": ERROR Connection closed connection closed by acceptor S" << serv_id << endl;)
                     } else {
-                        buf[num_bytes] = '\0';
-                        std::vector<string> message = split(string(buf), kMessageDelim[0]);
+                        SC->S->get_failure_detector()->Heard(serv_id);
+                        SC->inbox_.Extract(fds[i], buf, num_bytes, message);
                         for (const auto &msg : message) {
-                            std::vector<string> token = split(string(msg), kInternalDelim[0]);
-                            if (token[0] == kP1b) {
-                                D(cout << "SS" << SC->S->get_pid()
-                                  << ": received P1B from acceptor S" << serv_id << ": " << msg << endl;)
-
-                                num_send--;
-                                Ballot recvd_ballot = stringToBallot(token[2]);
-                                unordered_set<Triple> r;
-                                if (token.size() == 4)
-                                {
-                                    r = stringToTripleSet(token[3]);
-                                }
-
-                                if (recvd_ballot == ball)
-                                {
-
-                                    union_set(pvalues, r);
-                                    waitfor--;
-                                    if ((float)waitfor < (num_servers / 2.0))
-                                    {
-
-                                        SC->SendAdopted(recvd_ballot, pvalues);
-                                        return NULL;
-                                    }
-                                } else {
-                                    SC->SendPreEmpted(recvd_ballot);
-                                    return NULL;
-                                }
-                            } else {    //other messages
+                            if (!dispatcher.Dispatch(msg, fds[i]))
                                 D(cout << "SS" << SC->S->get_pid() << ": ERROR Unexpected message received: " << msg << endl;)
-                            }
+                            if (done)
+                                return NULL;
                         }
                     }
                 }
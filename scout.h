@@ -3,6 +3,7 @@
 
 #include "server.h"
 #include "utilities.h"
+#include "channel.h"
 #include "vector"
 #include "string"
 #include "unordered_set"
@@ -19,8 +20,12 @@ class Scout {
 public:
     int SendToServers(const string& type, const string& msg);
     void GetAcceptorFdSet(fd_set&, vector<int>&, int&);
+    int SendToAcceptors(const vector<pair<int, string> > &msgs, const bool charge_quota = true);
     int SendP1a(const Ballot &b);
-    void SendAdopted(const Ballot& recvd_ballot, unordered_set<Triple> pvalues);
+    int SendP1aToRelays(const Ballot &b);
+    void SendP1aFallback(const Ballot &b, const vector<bool> &pending);
+    void SendAdopted(const Ballot& recvd_ballot, unordered_set<Triple> pvalues,
+                     const unordered_map<Triple, int> &fast_votes);
     void SendPreEmpted(const Ballot& b);
     void Unicast(const string &type, const string& msg);
     void CloseAndUnSetAcceptor(int id);
@@ -38,11 +43,13 @@ public:
     Scout(Server *_S);
 
     Server *S;
+    Inbox inbox_;
     ~Scout();
 private:
     std::vector<int> leader_fd_;
     // std::vector<int> replica_fd_;
     std::vector<int> acceptor_fd_;
+    Outbox outbox_;
 };
 
 #endif //SCOUT_H_
\ No newline at end of file
@@ -129,9 +129,12 @@ break;
             pthread_t receive_from_master_thread;
             CreateThread(ReceiveMessagesFromMaster, (void*)S, receive_from_master_thread);
 
-        } else {
-            D(cout << "S" << S->get_pid() << ": ERROR: Unexpected connect request from port "
-              << incoming_port << endl;)
+        } else { // any other connection carries heartbeats of a peer server
+            HeartbeatLinkArgument *arg = new HeartbeatLinkArgument;
+            arg->S = S;
+            arg->fd = new_fd;
+            pthread_t receive_heartbeats_thread;
+            CreateThread(ReceiveHeartbeats, (void*)arg, receive_heartbeats_thread);
         }
     }
     pthread_exit(NULL);
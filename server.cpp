@@ -1,6 +1,8 @@
 #include "server.h"
 #include "constants.h"
 #include "utilities.h"
+#include "metrics.h"
+#include "election.h"
 #include "iostream"
 #include "vector"
 #include "string"
@@ -20,6 +22,12 @@ pthread_mutex_t leader_ready_lock;
 pthread_mutex_t acceptor_ready_lock;
 pthread_mutex_t all_clear_lock;
 pthread_mutex_t message_quota_lock;
+pthread_mutex_t primary_ready_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t election_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t lease_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t speculative_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define DEBUG
 
@@ -71,6 +79,26 @@ Status Server::get_mode() {
     pthread_mutex_unlock(&mode_lock);
     return m;
 }
+const Options& Server::get_options() {
+    return options_;
+}
+
+FailureDetector* Server::get_failure_detector() {
+    return &failure_detector_;
+}
+
+/**
+ * @param  role kLeaderRole, kReplicaRole or kAcceptorRole
+ * @return      wakeup notified when the primary changes
+ */
+Wakeup* Server::get_wakeup(const string &role) {
+    if (role == kLeaderRole)
+        return &leader_wakeup_;
+    if (role == kReplicaRole)
+        return &replica_wakeup_;
+    return &acceptor_wakeup_;
+}
+
 int Server::get_client_listen_port(const int client_id) {
     return client_listen_port_[client_id];
 }
@@ -99,6 +127,39 @@ int Server::get_primary_id() {
     return primary_id_;
 }
 
+/**
+ * the hot standby is the server after the primary, round robin, which is
+ * the first one tried by both master and cluster election.
+ * if it happens to be down at failover, the new primary starts cold
+ * @return id of standby server, -1 if there is none
+ */
+int Server::get_standby_id() {
+    if (!get_options().hot_standby || get_num_servers() < 2)
+        return -1;
+    return (get_primary_id() + 1) % get_num_servers();
+}
+
+int Server::get_phase1_quorum() {
+    return phase1_quorum_;
+}
+
+int Server::get_phase2_quorum() {
+    return phase2_quorum_;
+}
+
+int Server::get_fast_quorum() {
+    return fast_quorum_;
+}
+
+/**
+ * a lease or confirmation round rules out other leaders only if its acks
+ * intersect every phase 1 quorum
+ * @return number of acceptors which must ack a LEASE round
+ */
+int Server::get_lease_quorum() {
+    return get_num_servers() - get_phase1_quorum() + 1;
+}
+
 int Server::get_num_servers() {
     return num_servers_;
 }
@@ -149,6 +210,38 @@ bool Server::get_acceptor_ready() {
     return b;
 }
 
+bool Server::get_primary_ready() {
+    bool b;
+    pthread_mutex_lock(&primary_ready_lock);
+    b = primary_ready_;
+    pthread_mutex_unlock(&primary_ready_lock);
+    return b;
+}
+
+Ballot Server::get_election_ballot() {
+    Ballot b;
+    pthread_mutex_lock(&election_lock);
+    b = election_ballot_;
+    pthread_mutex_unlock(&election_lock);
+    return b;
+}
+
+Ballot Server::get_leader_ballot() {
+    Ballot b;
+    pthread_mutex_lock(&transfer_lock);
+    b = leader_ballot_;
+    pthread_mutex_unlock(&transfer_lock);
+    return b;
+}
+
+int Server::get_transfer_target() {
+    int server_id;
+    pthread_mutex_lock(&transfer_lock);
+    server_id = transfer_target_;
+    pthread_mutex_unlock(&transfer_lock);
+    return server_id;
+}
+
 int Server::get_num_clients() {
     return num_clients_;
 }
@@ -215,6 +308,18 @@ void Server::set_replica_ready(bool b) {
     pthread_mutex_unlock(&replica_ready_lock);
 }
 
+void Server::set_primary_ready(bool b) {
+    pthread_mutex_lock(&primary_ready_lock);
+    primary_ready_ = b;
+    pthread_mutex_unlock(&primary_ready_lock);
+}
+
+void Server::set_transfer_target(const int server_id) {
+    pthread_mutex_lock(&transfer_lock);
+    transfer_target_ = server_id;
+    pthread_mutex_unlock(&transfer_lock);
+}
+
 void Server::set_acceptor_ready(bool b) {
     pthread_mutex_lock(&acceptor_ready_lock);
     acceptor_ready_ = b;
@@ -285,13 +390,14 @@ void Server::set_message_quota(const int num_messages) {
 
 /**
  * reads ports-file and populates port related vectors/maps
- * @return true is ports-file was read successfully
+ * @param  path path of ports-file passed on by master
+ * @return      true is ports-file was read successfully
  */
- bool Server::ReadPortsFile() {
+ bool Server::ReadPortsFile(const string &path) {
     ifstream fin;
     fin.exceptions ( ifstream::failbit | ifstream::badbit );
     try {
-        fin.open(kPortsFile.c_str());
+        fin.open(path.c_str());
         fin >> master_port_;
         int port;
         for (int i = 0; i < num_clients_; i++) {
@@ -343,6 +449,25 @@ void Server::set_message_quota(const int num_messages) {
     }
 }
 
+/**
+ * reads the options file passed on by master
+ * @param  path path of options file
+ * @return      true if options were read successfully
+ */
+bool Server::ReadOptions(const string &path) {
+    if (!ReadOptionsFile(path, options_)) {
+        D(cout << "S" << get_pid() << ": ERROR in reading options file " << path << endl;)
+        return false;
+    }
+    if (!CheckQuorums(options_, get_num_servers()) || !CheckMultiLeader(options_)
+            || !CheckFastPaxos(options_) || !CheckErasureCoding(options_, get_num_servers()))
+        return false;
+    phase1_quorum_ = Phase1Quorum(options_, get_num_servers());
+    phase2_quorum_ = Phase2Quorum(options_, get_num_servers());
+    fast_quorum_ = FastQuorum(options_, get_num_servers());
+    return true;
+}
+
 /**
  * initialize data members and resize vectors
  * @param  pid process's self id
@@ -359,6 +484,7 @@ void Server::set_message_quota(const int num_messages) {
     num_servers_ = num_servers;
     num_clients_ = num_clients;
     mode_ = static_cast<Status>(mode);
+    set_master_fd(-1);
 
     server_listen_port_.resize(num_servers_);
     client_listen_port_.resize(num_clients_);
@@ -395,6 +521,20 @@ void Server::set_message_quota(const int num_messages) {
     set_leader_ready(false);
     set_replica_ready(false);
     set_acceptor_ready(false);
+    set_primary_ready(false);
+    leader_started_ = false;
+    leader_ballot_ = Ballot(0, 0);  // lowest ballot
+    transfer_target_ = -1;
+    handoff_pending_ = false;
+    confirmed_round_start_ = {0, 0};
+    lease_expiry_ = {0, 0};
+    lease_from_slot_ = INT_MAX;
+    round_requested_ = {0, 0};
+    highest_accepted_slot_ = -1;
+    performed_slot_ = 0;
+    // every server starts out agreeing on the primary given by the master
+    election_ballot_ = Ballot(primary_id, 0);
+    peer_election_ballot_.assign(num_servers_, election_ballot_);
 
     set_message_quota(INT_MAX);
 }
@@ -420,7 +560,8 @@ void Server::AllClearPhase()
     // sleep(2); //for testing allclear
     set_all_clear(kReplicaRole, kAllClearSet);
 
-    if (get_pid() == get_primary_id())
+    // in the multi-leader mode every leader has commanders of its own
+    if (get_pid() == get_primary_id() || get_options().multi_leader)
         set_all_clear(kLeaderRole, kAllClearSet);
     else
         set_all_clear(kLeaderRole, kAllClearDone);
@@ -441,6 +582,7 @@ void Server::AllClearPhase()
     } else {
         D(cout << "S" << get_pid() << " : All clear done message sent to master" << endl;)
     }
+    D(cout << "S" << get_pid() << " : " << Metrics::Summary() << endl;)
     //wait for messages from leader and replica. once received. send to master
 }
 
@@ -455,11 +597,44 @@ void Server::FinishAllClear()
  * @param new_primary_id id of the new primary elected
  */
  void Server::HandleNewPrimary(const int new_primary_id) {
+    // replica and acceptor report ready again once they have connected
+    // to the new primary's commander and scout
+    set_leader_ready(false);
+    set_acceptor_ready(false);
+    set_replica_ready(false);
+    set_primary_ready(false);
+    set_transfer_target(-1);
     set_primary_id(new_primary_id);
 
+    // role loops blocked in select() move to the new primary right away
+    leader_wakeup_.Notify();
+    replica_wakeup_.Notify();
+    acceptor_wakeup_.Notify();
+
+    if (get_pid() == get_standby_id()) {
+        StartLeader();
+        return;
+    }
     if (get_pid() != get_primary_id())
         return;
 
+    // a hot standby's leader is running already, and takes over by itself
+    StartLeader();
+    WaitTillReady();
+    set_primary_ready(true);
+    SendGoAheadToMaster();
+}
+
+/**
+ * starts commander and scout accept threads, and the leader thread, once
+ * per process: when the server becomes primary, or earlier as hot standby
+ * or as an owner of slots in the multi-leader mode
+ */
+void Server::StartLeader() {
+    if (leader_started_)
+        return;
+    leader_started_ = true;
+
     Commander *C = new Commander(this, get_num_servers());
     CommanderAcceptThread(C);
 
@@ -468,22 +643,331 @@ void Server::FinishAllClear()
 
     pthread_t leader_thread;
     CreateThread(LeaderEntry, (void*)this, leader_thread);
+}
+
+/**
+ * adopts the ballot of a primary election if it is newer than
+ * the one this server knows of
+ * @param  b ballot of an election. b.id is the elected primary
+ * @return   true if b was adopted
+ */
+bool Server::AdoptElectionBallot(const Ballot &b) {
+    bool adopted = false;
+    pthread_mutex_lock(&election_lock);
+    if (b > election_ballot_) {
+        election_ballot_ = b;
+        adopted = true;
+    }
+    pthread_mutex_unlock(&election_lock);
+    return adopted;
+}
+
+/**
+ * records the election ballot a peer server sent on its heartbeats.
+ * a peer sends the ballot of an election once it has adopted it, which
+ * makes the heartbeat an ack of that election
+ * @param server_id id of peer server
+ * @param b         latest election ballot known to the peer
+ */
+void Server::NoteElectionBallot(const int server_id, const Ballot &b) {
+    if (server_id < 0 || server_id >= get_num_servers())
+        return;
+
+    pthread_mutex_lock(&election_lock);
+    peer_election_ballot_[server_id] = b;
+    pthread_mutex_unlock(&election_lock);
+}
+
+/**
+ * @param  b ballot of an election
+ * @return   number of servers which adopted b as their latest election,
+ *           including this server
+ */
+int Server::CountElectionAcks(const Ballot &b) {
+    int count = 0;
+    pthread_mutex_lock(&election_lock);
+    if (election_ballot_ == b)
+        count++;
+    for (int i = 0; i < num_servers_; ++i) {
+        if (i != pid_ && peer_election_ballot_[i] == b)
+            count++;
+    }
+    pthread_mutex_unlock(&election_lock);
+    return count;
+}
+
+/**
+ * records a ballot adopted by this server's leader, or used by the
+ * previous primary, if it is higher than the one known
+ * @param b ballot which led
+ */
+void Server::AdoptLeaderBallot(const Ballot &b) {
+    pthread_mutex_lock(&transfer_lock);
+    if (b > leader_ballot_)
+        leader_ballot_ = b;
+    pthread_mutex_unlock(&transfer_lock);
+}
 
+/**
+ * hands leadership over to the transfer target, through the master.
+ * HANDOFF-<slot num>-<ballot>-<pending proposals>$ tells the target where
+ * the decided log ends, which ballot to get past, and what to propose first
+ * @param slot_num slot num of this server's replica, after draining
+ * @param pending  proposals not decided yet, by proposed slot
+ */
+void Server::SendHandoffToMaster(const int slot_num, const map<int, Proposal> &pending) {
+    string message = kHandoff + kInternalDelim + to_string(slot_num) + kInternalDelim
+                     + ballotToString(get_leader_ballot()) + kInternalDelim
+                     + allDecisionsToString(pending) + kMessageDelim;
+    if (send(get_master_fd(), message.c_str(), message.size(), 0) == -1) {
+        D(cout << "S" << get_pid() << " : ERROR: Cannot send HANDOFF to master" <<  endl;)
+    } else {
+        D(cout << "S" << get_pid() << " : HANDOFF sent to master for S"
+          << get_transfer_target() << ": " << message << endl;)
+    }
+}
+
+/**
+ * keeps a handoff from the previous primary till this server's replica
+ * takes it. the leader takes over past the handed ballot
+ * @param token tokens of HANDOFF message
+ */
+void Server::ReceiveHandoff(const std::vector<string> &token) {
+    AdoptLeaderBallot(stringToBallot(token[2]));
+    pthread_mutex_lock(&transfer_lock);
+    handoff_slot_num_ = stoi(token[1]);
+    handoff_proposals_.clear();
+    if (token.size() == 4)
+        stringToAllDecisions(token[3], handoff_proposals_);
+    handoff_pending_ = true;
+    pthread_mutex_unlock(&transfer_lock);
+}
+
+/**
+ * @param  slot_num [out] slot num of the previous primary's replica
+ * @param  pending  [out] proposals it had not decided
+ * @return          true if there was a handoff not taken yet
+ */
+bool Server::TakeHandoff(int &slot_num, map<int, Proposal> &pending) {
+    bool taken = false;
+    pthread_mutex_lock(&transfer_lock);
+    if (handoff_pending_) {
+        slot_num = handoff_slot_num_;
+        pending = handoff_proposals_;
+        handoff_pending_ = false;
+        taken = true;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    return taken;
+}
+
+/**
+ * records that a majority of acceptors acked a LEASE round of this
+ * server's leader, and wakes the replica up to serve waiting reads
+ * @param round_start when the round's LEASE messages were sent
+ * @param from_slot   first slot not decided by an earlier leader
+ */
+void Server::ConfirmLeadership(const struct timeval &round_start, const int from_slot) {
+    pthread_mutex_lock(&lease_lock);
+    confirmed_round_start_ = round_start;
+    lease_expiry_ = {0, 0};
+    // the leader counts its lease from before it sent LEASE, and gives
+    // up the clock drift it may have against the acceptors
+    time_t lease = get_options().lease_duration - get_options().clock_drift;
+    if (get_options().lease_duration > 0 && lease > 0) {
+        struct timeval length = {lease / 1000000, lease % 1000000};
+        timeradd(&round_start, &length, &lease_expiry_);
+    }
+    lease_from_slot_ = from_slot;
+    pthread_mutex_unlock(&lease_lock);
+    replica_wakeup_.Notify();
+}
+
+/**
+ * forgets any confirmation and lease, once the leader is preempted,
+ * steps down, or hands leadership over
+ */
+void Server::RevokeLeadership() {
+    pthread_mutex_lock(&lease_lock);
+    confirmed_round_start_ = {0, 0};
+    lease_expiry_ = {0, 0};
+    lease_from_slot_ = INT_MAX;
+    pthread_mutex_unlock(&lease_lock);
+}
+
+/**
+ * the leader of this server is still the leader as of a point in time if it
+ * holds a lease, or if a majority confirmed it in a round started after it.
+ * either way no other leader can have decided a slot since then
+ * @param  arrival when a read came
+ * @return         true if no other leader decided anything since arrival
+ */
+bool Server::LeadershipConfirmedSince(const struct timeval &arrival) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    pthread_mutex_lock(&lease_lock);
+    bool ok = timercmp(&now, &lease_expiry_, <)
+              || timercmp(&confirmed_round_start_, &arrival, >);
+    pthread_mutex_unlock(&lease_lock);
+    return ok;
+}
+
+/**
+ * a read can be served from the local log once the leader is confirmed
+ * since the read came, and the replica performed the slots earlier
+ * leaders may have decided
+ * @param  arrival  when the read came
+ * @param  slot_num slot num of the replica
+ * @return          true if the read can be served now
+ */
+bool Server::CanServeRead(const struct timeval &arrival, const int slot_num) {
+    pthread_mutex_lock(&lease_lock);
+    int from_slot = lease_from_slot_;
+    pthread_mutex_unlock(&lease_lock);
+    return slot_num >= from_slot && LeadershipConfirmedSince(arrival);
+}
+
+/**
+ * asks the leader for a LEASE round, for reads which cannot be served yet
+ */
+void Server::RequestLeadershipRound() {
+    pthread_mutex_lock(&lease_lock);
+    gettimeofday(&round_requested_, NULL);
+    pthread_mutex_unlock(&lease_lock);
+    leader_wakeup_.Notify();
+}
+
+struct timeval Server::get_round_requested() {
+    pthread_mutex_lock(&lease_lock);
+    struct timeval requested = round_requested_;
+    pthread_mutex_unlock(&lease_lock);
+    return requested;
+}
+
+/**
+ * takes up slot ownership announced by the primary, unless a later
+ * epoch is known already, and wakes up leader and replica to use it
+ * @param  e epoch announced by the primary
+ * @return   true if e is newer than the epoch known so far
+ */
+bool Server::StartEpoch(const Epoch &e) {
+    pthread_mutex_lock(&epoch_lock);
+    bool newer = (e.b > epoch_.b);
+    if (newer)
+        epoch_ = e;
+    pthread_mutex_unlock(&epoch_lock);
+    if (newer) {
+        D(cout << "S" << get_pid() << " : Epoch " << epochToString(e) << " started" << endl;)
+        leader_wakeup_.Notify();
+        replica_wakeup_.Notify();
+    }
+    return newer;
+}
+
+Epoch Server::get_epoch() {
+    pthread_mutex_lock(&epoch_lock);
+    Epoch e = epoch_;
+    pthread_mutex_unlock(&epoch_lock);
+    return e;
+}
+
+/**
+ * records a slot for which the acceptor here accepted a P2A. In the
+ * multi-leader mode the replica skips its own unused slots below it
+ * @param slot slot of the accepted P2A
+ */
+void Server::NoteAcceptedSlot(const int slot) {
+    if (!get_options().multi_leader)
+        return;
+    pthread_mutex_lock(&epoch_lock);
+    bool higher = (slot > highest_accepted_slot_);
+    if (higher)
+        highest_accepted_slot_ = slot;
+    pthread_mutex_unlock(&epoch_lock);
+    if (higher)
+        replica_wakeup_.Notify();
+}
+
+/**
+ * hands a chat the acceptor here accepted to the replica, which
+ * tells clients of it ahead of the decision
+ * @param t accepted pvalue
+ */
+void Server::AddAcceptedValue(const Triple &t) {
+    pthread_mutex_lock(&speculative_lock);
+    accepted_values_.push_back(t);
+    pthread_mutex_unlock(&speculative_lock);
+    replica_wakeup_.Notify();
+}
+
+/**
+ * @param accepted filled with the chats accepted since the last call
+ */
+void Server::TakeAcceptedValues(std::vector<Triple> &accepted) {
+    accepted.clear();
+    pthread_mutex_lock(&speculative_lock);
+    accepted.swap(accepted_values_);
+    pthread_mutex_unlock(&speculative_lock);
+}
+
+int Server::get_highest_accepted_slot() {
+    pthread_mutex_lock(&epoch_lock);
+    int slot = highest_accepted_slot_;
+    pthread_mutex_unlock(&epoch_lock);
+    return slot;
+}
+
+/**
+ * records how far the replica here performed. In the multi-leader mode the
+ * leader of the primary does not see the other owners' proposals, and gives
+ * this as read index instead: every chat a client was told of lies below it
+ * @param slot_num slot num of the replica
+ */
+void Server::NotePerformedSlot(const int slot_num) {
+    pthread_mutex_lock(&epoch_lock);
+    performed_slot_ = slot_num;
+    pthread_mutex_unlock(&epoch_lock);
+}
+
+int Server::get_performed_slot() {
+    pthread_mutex_lock(&epoch_lock);
+    int slot_num = performed_slot_;
+    pthread_mutex_unlock(&epoch_lock);
+    return slot_num;
+}
+
+/**
+ * waits till leader, replica and acceptor of this server are connected
+ * to their peers, and resets their ready flags for the next primary change
+ */
+ void Server::WaitTillReady() {
     while (!get_leader_ready() || !get_replica_ready() || !get_acceptor_ready()) {
-        usleep(kBusyWaitSleep);
+        usleep(kReadyPollSleep);
     }
 
     set_leader_ready(false);
     set_acceptor_ready(false);
     set_replica_ready(false);
-    SendGoAheadToMaster();
 }
 
 /**
- * sends GoAhead message to master
+ * tells master that this server elected itself as the new primary.
+ * used when servers elect primaries among themselves
+ */
+ void Server::SendNewPrimaryToMaster() {
+    string message = kNewPrimary + kInternalDelim + to_string(get_pid()) + kMessageDelim;
+    if (send(get_master_fd(), message.c_str(), message.size(), 0) == -1) {
+        D(cout << "S" << get_pid() << " : ERROR: Cannot send NEWPRIMARY to master" <<  endl;)
+    }
+}
+
+/**
+ * sends GoAhead message to master. A recovering server can be ready
+ * before the master has connected to it, so wait for the master first
  */
  void Server::SendGoAheadToMaster() {
     string message = kGoAhead + kInternalDelim + kMessageDelim;
+    RetryWithBackoff([&]() { return get_master_fd() != -1; }, kConnectTimeout);
     if (send(get_master_fd(), message.c_str(), message.size(), 0) == -1) {
         D(cout << "S" << get_pid() << " : ERROR: Cannot send GOAHEAD done to master" <<  endl;)
     } else {
@@ -509,11 +993,11 @@ void Server::Die() {
 }
 
 /**
- * decrements the message quota by 1
+ * decrements the message quota by num_messages
  * after decrementing, it checks whether or not has it exhausted its message quota
  */
- void Server::DecrementMessageQuota() {
-    set_message_quota(get_message_quota() - 1);
+ void Server::DecrementMessageQuota(const int num_messages) {
+    set_message_quota(get_message_quota() - num_messages);
     ContinueOrDie();
 }
 
@@ -542,6 +1026,13 @@ void* ReceiveMessagesFromMaster(void* _S ) {
                 } else if (token[0] == kNewPrimary) {
                     D(cout << "S" << S->get_pid() << " : Received new primary id S" << token[1] << endl;)
                     S->HandleNewPrimary(stoi(token[1]));
+                } else if (token[0] == kTransfer) {
+                    D(cout << "S" << S->get_pid() << " : Transferring leadership to S" << token[1] << endl;)
+                    S->set_transfer_target(stoi(token[1]));
+                    S->get_wakeup(kReplicaRole)->Notify();
+                } else if (token[0] == kHandoff) {
+                    D(cout << "S" << S->get_pid() << " : Received handoff: " << msg << endl;)
+                    S->ReceiveHandoff(token);
                 } else if (token[0] == kTimeBomb) {
                     D(cout << "S" << S->get_pid() << " : Received TimeBomb " << token[1] << endl;)
                     S->set_message_quota(stoi(token[1]));
@@ -560,36 +1051,56 @@ int main(int argc, char *argv[]) {
 
     Server S;
     S.Initialize(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atoi(argv[5]));
-    if (!S.ReadPortsFile()) {
+    if (!S.ReadPortsFile((argc > 7) ? argv[7] : kPortsFile)) {
+        return 1;
+    }
+    if (!S.ReadOptions((argc > 6) ? argv[6] : kOptionsFile)) {
         return 1;
     }
+    // a time bomb the master armed before the server's first message
+    if (argc > 8)
+        S.set_message_quota(atoi(argv[8]));
+    S.get_failure_detector()->Initialize(S.get_pid(), S.get_num_servers(),
+                                         S.get_options().heartbeat_interval,
+                                         S.get_options().failure_timeout);
 
     pthread_t accept_connections_thread;
     CreateThread(AcceptConnectionsServer, (void*)&S, accept_connections_thread);
 
-    if (S.get_pid() == S.get_primary_id()) {
-        Commander *C = new Commander(&S, S.get_num_servers());
-        S.CommanderAcceptThread(C);
+    pthread_t heartbeat_thread;
+    CreateThread(HeartbeatEntry, (void*)&S, heartbeat_thread);
 
-        S.set_scout_object();
-        S.ScoutAcceptThread(S.get_scout_object());
+    if (S.get_options().leader_election == CLUSTER_ELECTION) {
+        pthread_t election_thread;
+        CreateThread(ElectionEntry, (void*)&S, election_thread);
     }
 
+    // a time bomb can go off in the first phase 1. Wait for the master to
+    // connect first, so that it sees the server die rather than fail to start
+    if (argc > 8)
+        RetryWithBackoff([&]() { return S.get_master_fd() != -1; }, kConnectTimeout);
+
+    // in the multi-leader mode every server leads its own slots
+    if (S.get_pid() == S.get_primary_id() || S.get_pid() == S.get_standby_id()
+            || S.get_options().multi_leader)
+        S.StartLeader();
+
     pthread_t replica_thread;
     CreateThread(ReplicaEntry, (void*)&S, replica_thread);
 
     pthread_t acceptor_thread;
     CreateThread(AcceptorEntry, (void*)&S, acceptor_thread);
 
-    pthread_t leader_thread;
     if (S.get_pid() == S.get_primary_id()) {
-        CreateThread(LeaderEntry, (void*)&S, leader_thread);
+        // master waits for the primary to be ready before starting the test
+        S.WaitTillReady();
+        S.set_primary_ready(true);
+        S.SendGoAheadToMaster();
     }
 
     void *status;
     pthread_join(accept_connections_thread, &status);
     pthread_join(replica_thread, &status);
     pthread_join(acceptor_thread, &status);
-    pthread_join(leader_thread, &status);
     return 0;
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include "unordered_set"
 #include "map"
 #include "utilities.h"
+#include "options.h"
+#include "failure-detector.h"
+#include "channel.h"
 #include "set"
 using namespace std;
 
@@ -31,20 +34,46 @@ public:
     int IsAcceptorPort(const int port);
     int IsLeaderPort(const int port);
     int IsClientChatPort(const int port);
-    bool ReadPortsFile();
+    bool ReadPortsFile(const string &path);
+    bool ReadOptions(const string &path);
     void CommanderAcceptThread(Commander* C);
     void ScoutAcceptThread(Scout* SC);
     void AllClearPhase();
     void FinishAllClear();
     void HandleNewPrimary(const int new_primary_id);
+    void StartLeader();
+    void WaitTillReady();
     void SendGoAheadToMaster();
+    void SendNewPrimaryToMaster();
+    bool AdoptElectionBallot(const Ballot &b);
+    void NoteElectionBallot(const int server_id, const Ballot &b);
+    int CountElectionAcks(const Ballot &b);
+    void AdoptLeaderBallot(const Ballot &b);
+    void SendHandoffToMaster(const int slot_num, const map<int, Proposal> &pending);
+    void ReceiveHandoff(const std::vector<string> &token);
+    bool TakeHandoff(int &slot_num, map<int, Proposal> &pending);
+    void ConfirmLeadership(const struct timeval &round_start, const int from_slot);
+    void RevokeLeadership();
+    bool LeadershipConfirmedSince(const struct timeval &arrival);
+    bool CanServeRead(const struct timeval &arrival, const int slot_num);
+    void RequestLeadershipRound();
+    struct timeval get_round_requested();
+    bool StartEpoch(const Epoch &e);
+    void NoteAcceptedSlot(const int slot);
+    void AddAcceptedValue(const Triple &t);
+    void TakeAcceptedValues(std::vector<Triple> &accepted);
+    void NotePerformedSlot(const int slot_num);
     void Die();
     void ContinueOrDie();
-    void DecrementMessageQuota();
+    void DecrementMessageQuota(const int num_messages = 1);
 
     bool get_leader_ready();
     bool get_replica_ready();
     bool get_acceptor_ready();
+    bool get_primary_ready();
+    Ballot get_election_ballot();
+    Ballot get_leader_ballot();
+    int get_transfer_target();
     int get_pid();
     int get_num_servers();
     int get_num_clients();
@@ -62,14 +91,27 @@ public:
     int get_replica_port(const int server_id);
     int get_leader_port(const int server_id);
     int get_primary_id();
+    int get_standby_id();
+    int get_phase1_quorum();
+    int get_phase2_quorum();
+    int get_fast_quorum();
+    int get_lease_quorum();
+    Epoch get_epoch();
+    int get_highest_accepted_slot();
+    int get_performed_slot();
     int get_message_quota();
     Scout* get_scout_object();
     int get_master_fd();
     Status get_mode();
+    const Options& get_options();
+    FailureDetector* get_failure_detector();
+    Wakeup* get_wakeup(const string &role);
 
     void set_leader_ready(bool b);
     void set_replica_ready(bool b);
     void set_acceptor_ready(bool b);
+    void set_primary_ready(bool b);
+    void set_transfer_target(const int server_id);
     void set_mode(Status);
     void set_pid(const int pid);
     void set_master_fd(const int fd);
@@ -89,6 +131,31 @@ private:
     bool leader_ready_;
     bool acceptor_ready_;
     bool replica_ready_;
+    bool primary_ready_;    // this server is the primary, and takes clients
+    Ballot election_ballot_;    // ballot of the latest primary election
+    std::vector<Ballot> peer_election_ballot_;  // latest election ballot heard from each server
+    bool leader_started_;   // commander, scout and leader threads are running
+    Ballot leader_ballot_;  // highest ballot adopted here, or handed over to this server
+    int transfer_target_;   // server being handed leadership by this primary, -1 if none
+
+    // handed over by the previous primary, for this server's replica
+    bool handoff_pending_;
+    int handoff_slot_num_;
+    std::map<int, Proposal> handoff_proposals_;
+
+    // leadership of this server's leader, as confirmed by a majority of acceptors
+    struct timeval confirmed_round_start_;  // start of the last round a majority acked
+    struct timeval lease_expiry_;           // end of the lease, as counted by the leader
+    int lease_from_slot_;       // reads wait till the replica performs this slot
+    struct timeval round_requested_;        // when a replica last asked for a round
+
+    // multi-leader mode
+    Epoch epoch_;               // latest slot ownership announced by the primary
+    int highest_accepted_slot_; // highest slot the acceptor here accepted a P2A for
+    int performed_slot_;        // slot num of the replica here
+
+    // speculative responses: chats the acceptor here accepted, for the replica
+    std::vector<Triple> accepted_values_;
     Status mode_;
     int message_quota_;
 
@@ -116,17 +183,33 @@ private:
     std::map<int, int> leader_port_map_;
 
     Scout* scout_object_;
+
+    Options options_;
+    int phase1_quorum_;
+    int phase2_quorum_;
+    int fast_quorum_;
+    FailureDetector failure_detector_;
+
+    // wake up the role loops when the primary changes
+    Wakeup leader_wakeup_;
+    Wakeup replica_wakeup_;
+    Wakeup acceptor_wakeup_;
 };
 
 struct CommanderThreadArgument {
     Commander *C;
     Triple toSend;
+    int skip_to;    // with a NOOP toSend, also every stride-th slot below skip_to
+    int stride;     // (a skip of the multi-leader mode). -1 and 0 otherwise
+
+    CommanderThreadArgument() : C(NULL), skip_to(-1), stride(0) {}
 };
 
 struct ScoutThreadArgument {
     Scout *SC;
     Ballot ball;
     time_t sleep_time;
+    time_t backoff;     // sleep before sending P1A, after a preemption
 };
 
 #endif //SERVER_H_
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "utilities.h"
+#include "scan.h"
+#include "cstring"
+#include "unistd.h"
+#include "poll.h"
+#include "sys/socket.h"
 
 #define DEBUG
 
@@ -65,11 +70,35 @@ bool Ballot::operator<=(const Ballot &b2) const {
 // }
 
 
+/**
+ * offsets of delim in data, found in one vectorized pass, which beats a
+ * memchr() per token on strings of kScanMinBytes or more. They stay valid
+ * till the next call on the same thread
+ */
+static const vector<size_t> &ScanDelim(const char *data, const size_t size, const char delim) {
+    static thread_local vector<size_t> offsets;
+    ScanDelimiters(data, size, string(1, delim), offsets);
+    return offsets;
+}
+
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
-    std::stringstream ss(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        elems.push_back(item);
+    if (s.size() >= kScanMinBytes) {
+        size_t start = 0;
+        for (auto end : ScanDelim(s.data(), s.size(), delim)) {
+            elems.push_back(s.substr(start, end - start));
+            start = end + 1;
+        }
+        if (start < s.size())
+            elems.push_back(s.substr(start));
+        return elems;
+    }
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find(delim, start);
+        if (end == string::npos)
+            end = s.size();
+        elems.push_back(s.substr(start, end - start));
+        start = end + 1;
     }
     return elems;
 }
@@ -84,6 +113,50 @@ std::vector<std::string> split(const std::string &s, char delim) {
     return elems;
 }
 
+ostream &operator<<(ostream &os, const StringView &v) {
+    return os.write(v.data, v.size);
+}
+
+/**
+ * splits s at delim like split(), into views of s. Nothing is allocated
+ * once tokens has room for the tokens
+ * @param s      string to be split
+ * @param delim  delimiter
+ * @param tokens [out] views of the tokens, without a last empty one
+ */
+void SplitView(const StringView &s, char delim, std::vector<StringView> &tokens) {
+    tokens.clear();
+    const char *p = s.data;
+    const char *end = s.data + s.size;
+    if (s.size >= kScanMinBytes) {
+        for (auto offset : ScanDelim(s.data, s.size, delim)) {
+            tokens.push_back(StringView(p, s.data + offset - p));
+            p = s.data + offset + 1;
+        }
+        if (p < end)
+            tokens.push_back(StringView(p, end - p));
+        return;
+    }
+    while (p < end) {
+        const char *d = (const char *)memchr(p, delim, end - p);
+        if (d == NULL)
+            d = end;
+        tokens.push_back(StringView(p, d - p));
+        p = d + 1;
+    }
+}
+
+/**
+ * @return copies of the tokens, for handlers which keep or pass on strings
+ */
+std::vector<std::string> ViewsToStrings(const std::vector<StringView> &views) {
+    std::vector<std::string> strings;
+    strings.reserve(views.size());
+    for (auto &v : views)
+        strings.push_back(v.ToString());
+    return strings;
+}
+
 string tripleToString(const Triple& t)
 {
     string s = to_string(t.b.id);
@@ -148,14 +221,106 @@ string tripleSetToString(const unordered_set<Triple>& st)
 return rval;
 }
 
+// digits of the numbers in columns of decisions, 5 bits each, least
+// significant first. The first 32 go on, the last 32 end a number
+const char kColumnDigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVabcdefghijklmnopqrstuvwxyzWXYZ+/";
+
+/**
+ * appends v to a column, as 1 digit below 32, 2 below 1024, and so on
+ */
+static void PutColumnNumber(unsigned long v, string &column)
+{
+    while (v >= 32) {
+        column += kColumnDigits[v & 31];
+        v >>= 5;
+    }
+    column += kColumnDigits[32 + v];
+}
+
+/**
+ * @return v zigzag encoded, 0, -1, 1, -2 as 0, 1, 2, 3
+ */
+static inline unsigned long Zigzag(const long v)
+{
+    return v >= 0 ? 2 * (unsigned long)v : 2 * (unsigned long)(-v) - 1;
+}
+
+/**
+ * @return true if s is a chat id as clients number them, a decimal of a few
+ *         digits with no leading zeros
+ */
+static bool IsChatNumber(const string &s)
+{
+    if (s.empty() || s.size() > 9 || (s[0] == '0' && s.size() > 1))
+        return false;
+    for (auto c : s) {
+        if (c < '0' || c > '9')
+            return false;
+    }
+    return true;
+}
+
+/**
+ * encodes decisions column by column, for ALLDECISIONS and handoffs.
+ * <count>.<slots>.<clients>.<client indexes>.<chat ids>.<body lengths>.<bodies>
+ * clients is a dictionary of the distinct client ids, in order of first use,
+ * joined by ','. The other columns but bodies hold a number per decision,
+ * in kColumnDigits, which need no delimiter between them:
+ * slots, each as the gap after the slot before less 1, zigzag encoded.
+ * client indexes, the index of each decision's client in clients.
+ * chat ids, each less the chat id of the same client before and 1, zigzag
+ * encoded, since chats of a client may be decided out of order. A chat id
+ * which is not a number goes whole after kLiteralChatId and its length.
+ * body lengths, which cut bodies, one blob of all bodies.
+ * in a run of decisions each of these is a single digit
+ * @param  d decisions, by slot
+ * @return   encoded decisions, "" for none
+ */
 string allDecisionsToString(const map<int, Proposal>& d)
 {
-    string rval;
-    for (auto it=d.begin(); it!=d.end(); it++)
+    if (d.empty())
+        return "";
+    string slots, clients, client_indexes, chat_ids, lengths, bodies;
+    unordered_map<string, int> dictionary;
+    vector<long> last_chat_id;      // by client index
+    long last_slot = -1;
+    for (auto &decision : d)
     {
-        if(it!=d.begin())
-            rval += kInternalSetDelim;
-        rval += decisionToStringForAll(it->first, it->second);
+        const Proposal &p = decision.second;
+        PutColumnNumber(Zigzag(decision.first - last_slot - 1), slots);
+        last_slot = decision.first;
+
+        auto entry = dictionary.find(p.client_id);
+        if (entry == dictionary.end()) {
+            if (!dictionary.empty())
+                clients += kInternalSetDelim;
+            clients += p.client_id;
+            entry = dictionary.insert(make_pair(p.client_id, (int)dictionary.size())).first;
+            last_chat_id.push_back(-1);
+        }
+        PutColumnNumber(entry->second, client_indexes);
+
+        if (IsChatNumber(p.chat_id)) {
+            long chat_id = stol(p.chat_id);
+            PutColumnNumber(Zigzag(chat_id - last_chat_id[entry->second] - 1), chat_ids);
+            last_chat_id[entry->second] = chat_id;
+        } else {
+            chat_ids += kLiteralChatId;
+            PutColumnNumber(p.chat_id.size(), chat_ids);
+            chat_ids += p.chat_id;
+        }
+
+        PutColumnNumber(p.msg.size(), lengths);
+        bodies += p.msg;
+    }
+
+    string rval;
+    rval.reserve(slots.size() + clients.size() + client_indexes.size()
+                 + chat_ids.size() + lengths.size() + bodies.size() + 16);
+    rval += to_string(d.size());
+    for (auto column : { &slots, &clients, &client_indexes, &chat_ids, &lengths, &bodies }) {
+        rval += kInternalStructDelim;
+        rval += *column;
     }
     return rval;
 }
@@ -202,74 +367,330 @@ void stringToDecisionForAll(const string& dec, int& s, Proposal& p)
     p = stringToProposal(prop);
 }
 
-void stringToAllDecisions(string s, map<int, Proposal>& decs)
+/**
+ * reads the number at p of a column, and moves p past it
+ * @return false if the column ends or holds something else first
+ */
+static inline bool ReadColumnNumber(const char *&p, const char *end, unsigned long &v)
+{
+    static const struct DigitValues {
+        signed char value[256];
+        DigitValues() {
+            memset(value, -1, sizeof value);
+            for (int i = 0; i < 64; i++)
+                value[(unsigned char)kColumnDigits[i]] = i;
+        }
+    } digits;
+
+    v = 0;
+    for (int shift = 0; p < end && shift < 60; shift += 5) {
+        int digit = digits.value[(unsigned char)*p++];
+        if (digit < 0)
+            return false;
+        if (digit >= 32) {
+            v |= (unsigned long)(digit - 32) << shift;
+            return true;
+        }
+        v |= (unsigned long)digit << shift;
+    }
+    return false;
+}
+
+/**
+ * @return v zigzag decoded
+ */
+static inline long Unzigzag(const unsigned long v)
+{
+    return (v & 1) ? -(long)(v >> 1) - 1 : (long)(v >> 1);
+}
+
+/**
+ * decodes decisions encoded by allDecisionsToString(). The columns are read
+ * in place, a number of each per decision, and the only strings made are
+ * the fields of the decoded proposals
+ * @param s    encoded decisions
+ * @param decs [out] decisions, by slot
+ */
+void stringToAllDecisions(const string& s, map<int, Proposal>& decs)
 {
     decs.clear();
-    // cout<<"string is "<<s;
-    vector<string> decisions = split(s, kInternalSetDelim[0]);
-    // cout<<". dec size is "<<decisions.size()<<endl;
-    for(auto &d : decisions)
+    const char *end = s.data() + s.size();
+    const char *column[7];          // count, slots, ..., bodies
+    column[0] = s.data();
+    for (int c = 1; c < 7; c++) {
+        const char *delim = (const char *)memchr(column[c - 1], kInternalStructDelim[0],
+                                                 end - column[c - 1]);
+        if (delim == NULL) {
+            D(cout << "Cant convert to all decisions. Error." << endl;)
+            return;
+        }
+        column[c] = delim + 1;
+    }
+    const char *slots = column[1], *indexes = column[3], *chat_ids = column[4];
+    const char *lengths = column[5], *body = column[6];
+
+    vector<pair<const char *, size_t> > clients;
+    for (const char *c = column[2]; ; ) {
+        const char *c_end = c;
+        while (c_end < column[3] - 1 && *c_end != kInternalSetDelim[0])
+            c_end++;
+        clients.push_back(make_pair(c, (size_t)(c_end - c)));
+        if (c_end >= column[3] - 1)
+            break;
+        c = c_end + 1;
+    }
+    vector<long> last_chat_id(clients.size(), -1);
+
+    long count = strtol(column[0], NULL, 10);
+    long slot = -1;
+    for (long i = 0; i < count; i++)
     {
-        int s;
-        Proposal p;
-        // cout<<"one dec: "<<d<<endl;
-        stringToDecisionForAll(d, s, p);
-        decs[s]=p;
+        unsigned long gap, index, chat_id, length;
+        bool ok = ReadColumnNumber(slots, column[2] - 1, gap)
+                  && ReadColumnNumber(indexes, column[4] - 1, index) && index < clients.size();
+        bool literal = ok && chat_ids < column[5] - 1 && *chat_ids == kLiteralChatId[0];
+        if (literal)
+            chat_ids++;
+        ok = ok && ReadColumnNumber(chat_ids, column[5] - 1, chat_id)
+             && (!literal || chat_id <= (unsigned long)(column[5] - 1 - chat_ids))
+             && ReadColumnNumber(lengths, column[6] - 1, length)
+             && length <= (unsigned long)(end - body);
+        if (!ok) {
+            D(cout << "Cant convert to all decisions. Error." << endl;)
+            return;
+        }
+
+        slot += Unzigzag(gap) + 1;
+        Proposal &p = decs.emplace_hint(decs.end(), (int)slot, Proposal())->second;
+        p.client_id.assign(clients[index].first, clients[index].second);
+        if (literal) {
+            p.chat_id.assign(chat_ids, chat_id);
+            chat_ids += chat_id;
+        } else {
+            last_chat_id[index] += Unzigzag(chat_id) + 1;
+            p.chat_id = to_string(last_chat_id[index]);
+        }
+        p.msg.assign(body, length);
+        body += length;
     }
 }
 
 Triple stringToTriple(const string& s)
+{
+    return viewToTriple(s);
+}
+
+/**
+ * @return the triple of the 6 fields in f
+ */
+static Triple FieldsToTriple(const StringView *f)
 {
     Triple t;
-    Proposal p;
-    Ballot b;
-    vector<string> parts = split(s, kInternalStructDelim[0]);
-    if(parts.size()==6)
-    {
-        b.id = stoi(parts[0]);
-        b.seq_num = stoi(parts[1]);
-        t.b = b;
-        t.s = stoi(parts[2]);
-        p.client_id = parts[3];
-        p.chat_id = parts[4];
-        p.msg = parts[5];
-        t.p = p;
-    }
+    t.b = Ballot(viewToInt(f[0]), viewToInt(f[1]));
+    t.s = viewToInt(f[2]);
+    t.p.client_id.assign(f[3].data, f[3].size);
+    t.p.chat_id.assign(f[4].data, f[4].size);
+    t.p.msg.assign(f[5].data, f[5].size);
     return t;
 }
 
+/**
+ * parses the pvalues of a P1B or ADOPTED. The delimiters of all fields of
+ * all triples are found in one pass, and the triples built from the table
+ * of their offsets. A malformed triple parses as in stringToTriple()
+ */
 unordered_set<Triple> stringToTripleSet(const string& s)
 {
     unordered_set<Triple> st;
-    vector<string> parts = split(s, kInternalSetDelim[0]);
-    for (auto it=parts.begin(); it!=parts.end(); it++)
+    vector<size_t> offsets;
+    ScanDelimiters(s.data(), s.size(), kInternalStructDelim + kInternalSetDelim, offsets);
+    offsets.push_back(s.size());
+
+    StringView f[6];
+    int n = 0;              // fields of the triple so far
+    size_t start = 0;       // of the field
+    size_t item_start = 0;  // of the triple
+    for (auto end : offsets)
     {
-        Triple t = stringToTriple(*it);
-        st.insert(t);
+        size_t field_size = end - start;
+        if (n < 6)
+            f[n] = StringView(s.data() + start, field_size);
+        n++;
+        start = end + 1;
+        if (end < s.size() && s[end] != kInternalSetDelim[0])
+            continue;
+        if (end == s.size() && end == item_start)
+            break;          // as split(), no empty last triple
+        if (field_size == 0)
+            n--;            // nor empty last field
+        st.insert(n == 6 ? FieldsToTriple(f) : Triple());
+        n = 0;
+        item_start = start;
     }
+    return st;
 }
 
 
 Ballot stringToBallot(const string& s)
 {
-    Ballot b;
+    return viewToBallot(s);
+}
+
+/**
+ * @return <ballot id>.<ballot seq>.<first slot>.<owner>,<owner>,...
+ */
+string epochToString(const Epoch& e)
+{
+    string s = ballotToString(e.b);
+    s += kInternalStructDelim;
+    s += to_string(e.first_slot);
+    s += kInternalStructDelim;
+    for (auto owner : e.owners) {
+        s += to_string(owner);
+        s += kInternalSetDelim;
+    }
+    return s;
+}
+
+Epoch stringToEpoch(const string& s)
+{
+    Epoch e;
     vector<string> parts = split(s, kInternalStructDelim[0]);
-    // cout<<"string to ballot:"<<s<<parts.size()<<endl;
-    b.id = stoi(parts[0]);
-    b.seq_num = stoi(parts[1]);
-    return b;
+    e.b.id = stoi(parts[0]);
+    e.b.seq_num = stoi(parts[1]);
+    e.first_slot = stoi(parts[2]);
+    if (parts.size() == 4) {
+        for (auto &owner : split(parts[3], kInternalSetDelim[0]))
+            e.owners.push_back(stoi(owner));
+    }
+    return e;
+}
+
+/**
+ * @return <count>.<triple>,<count>.<triple>,... where count is the number
+ *         of acceptors which reported accepting triple in a fast slot
+ */
+string fastVotesToString(const unordered_map<Triple, int>& votes)
+{
+    string s;
+    for (auto it = votes.begin(); it != votes.end(); it++) {
+        if (it != votes.begin())
+            s += kInternalSetDelim;
+        s += to_string(it->second) + kInternalStructDelim + tripleToString(it->first);
+    }
+    return s;
+}
+
+unordered_map<Triple, int> stringToFastVotes(const string& s)
+{
+    unordered_map<Triple, int> votes;
+    for (auto &vote : split(s, kInternalSetDelim[0])) {
+        size_t pos = vote.find(kInternalStructDelim[0]);
+        votes[stringToTriple(vote.substr(pos + 1))] = stoi(vote.substr(0, pos));
+    }
+    return votes;
+}
+
+/**
+ * @return id of server owning slot in epoch e, -1 if the slot lies before it
+ */
+int slotOwner(const Epoch& e, const int slot)
+{
+    if (slot < e.first_slot || e.owners.empty())
+        return -1;
+    return e.owners[(slot - e.first_slot) % e.owners.size()];
+}
+
+/**
+ * @return first slot from from on which owner owns in epoch e,
+ *         -1 if owner has no slots in it
+ */
+int nextOwnSlot(const Epoch& e, const int owner, const int from)
+{
+    int k = e.owners.size();
+    for (int i = 0; i < k; ++i) {
+        if (e.owners[i] != owner)
+            continue;
+        int slot = max(from, e.first_slot);
+        int offset = ((i - (slot - e.first_slot)) % k + k) % k;
+        return slot + offset;
+    }
+    return -1;
 }
 
 Proposal stringToProposal(const string& s)
+{
+    return viewToProposal(s);
+}
+
+/**
+ * splits v at kInternalStructDelim like split(), into views of at most max
+ * of its fields
+ * @return number of fields, which may be more than max
+ */
+static int SplitFields(const StringView &v, StringView *fields, const int max)
+{
+    int n = 0;
+    const char *p = v.data;
+    const char *end = v.data + v.size;
+    while (p < end) {
+        const char *d = (const char *)memchr(p, kInternalStructDelim[0], end - p);
+        if (d == NULL)
+            d = end;
+        if (n < max)
+            fields[n] = StringView(p, d - p);
+        n++;
+        p = d + 1;
+    }
+    return n;
+}
+
+/**
+ * @return the decimal at the start of v, like stoi() but 0 where stoi()
+ *         throws
+ */
+int viewToInt(const StringView& v)
+{
+    const char *p = v.data;
+    const char *end = v.data + v.size;
+    bool negative = (p < end && *p == '-');
+    if (negative || (p < end && *p == '+'))
+        p++;
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    return negative ? -value : value;
+}
+
+Ballot viewToBallot(const StringView& v)
+{
+    StringView f[2];
+    SplitFields(v, f, 2);
+    return Ballot(viewToInt(f[0]), viewToInt(f[1]));
+}
+
+Proposal viewToProposal(const StringView& v)
 {
     Proposal p;
-    vector<string> parts = split(s, kInternalStructDelim[0]);
-    p.client_id = parts[0];
-    p.chat_id = parts[1];
-    p.msg = parts[2];
+    StringView f[3];
+    SplitFields(v, f, 3);
+    p.client_id.assign(f[0].data, f[0].size);
+    p.chat_id.assign(f[1].data, f[1].size);
+    p.msg.assign(f[2].data, f[2].size);
     return p;
 }
 
+/**
+ * @return the triple in v, or a default one if v does not have 6 fields
+ */
+Triple viewToTriple(const StringView& v)
+{
+    StringView f[6];
+    if (SplitFields(v, f, 6) == 6)
+        return FieldsToTriple(f);
+    return Triple();
+}
+
 map<int, Proposal> pmax(const unordered_set<Triple> &pvalues)
 {
     map<int, Proposal> rval;
@@ -322,4 +743,94 @@ map<int, Proposal> pairxor(const map<int, Proposal> &x,const map<int, Proposal>
         D(cout << "U " << ": ERROR: Unable to create thread" << endl;)
         pthread_exit(NULL);
     }
-}
\ No newline at end of file
+}
+/**
+ * @param  start time at which measurement started
+ * @return       microseconds elapsed since start
+ */
+time_t ElapsedSince(const struct timeval &start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1000 * 1000 + (now.tv_usec - start.tv_usec);
+}
+
+/**
+ * calls attempt until it succeeds, sleeping between attempts with exponential
+ * backoff from kConnectRetryInitial up to kConnectRetryMax.
+ * used for connecting to peers whose accept threads may not be running yet
+ * @param  attempt function to be retried. returns true on success
+ * @param  timeout max time to keep retrying, in microseconds.
+ *                 0 means a single attempt
+ * @return         true if some attempt succeeded
+ */
+bool RetryWithBackoff(const std::function<bool()> &attempt, const time_t timeout) {
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    time_t backoff = kConnectRetryInitial;
+    while (true) {
+        if (attempt())
+            return true;
+        time_t elapsed = ElapsedSince(start);
+        if (elapsed >= timeout)
+            return false;
+        usleep(min(backoff, timeout - elapsed));
+        backoff = min(2 * backoff, kConnectRetryMax);
+    }
+}
+
+/**
+ * sends the ready message on a newly accepted connection, telling the
+ * connecting side that the connection has been registered
+ * @param  fd fd of accepted connection
+ * @return    true if ready message was sent successfully
+ */
+bool SendReady(const int fd) {
+    string msg = kReady + kMessageDelim;
+    return send(fd, msg.c_str(), msg.size(), 0) == (ssize_t)msg.size();
+}
+
+/**
+ * receives the first message on a newly established connection.
+ * nothing beyond that message is consumed from the connection
+ * @param  fd      fd of established connection
+ * @param  timeout max time to wait, in microseconds
+ * @param  reply   [out] message received, without kMessageDelim
+ * @return         true if a complete message was received within timeout
+ */
+bool ReceiveHandshake(const int fd, const time_t timeout, string &reply) {
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    reply.clear();
+    while (true) {
+        time_t left = timeout - ElapsedSince(start);
+        if (left <= 0)
+            return false;
+
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, left / 1000 + 1) <= 0)
+            continue;
+
+        // one byte at a time, so that messages after the delimiter stay queued
+        char c;
+        if (recv(fd, &c, 1, 0) <= 0)
+            return false;
+        if (c == kMessageDelim[0])
+            return true;
+        reply += c;
+    }
+}
+
+/**
+ * waits for the ready message on a newly established connection.
+ * nothing beyond the ready message is consumed from the connection
+ * @param  fd      fd of established connection
+ * @param  timeout max time to wait, in microseconds
+ * @return         true if ready message was received within timeout
+ */
+bool WaitForReady(const int fd, const time_t timeout) {
+    string reply;
+    return ReceiveHandshake(fd, timeout, reply) && reply == kReady;
+}
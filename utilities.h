@@ -7,16 +7,45 @@
 #include "iostream"
 #include "constants.h"
 #include "unordered_set"
+#include "unordered_map"
 #include "map"
+#include "functional"
+#include "sys/time.h"
+#include "cstring"
 
 using namespace std;
 
 struct Proposal;
 struct Ballot;
 struct Triple;
+struct Epoch;
+
+/**
+ * characters of a string it does not own, by where they start and how many.
+ * a stand-in for std::string_view, which C++0x lacks. It points into the
+ * string it was made from, which must outlive it and stay unchanged
+ */
+struct StringView {
+  const char *data;
+  size_t size;
+
+  StringView(): data(NULL), size(0) {}
+  StringView(const char *d, size_t n): data(d), size(n) {}
+  StringView(const string &s): data(s.data()), size(s.size()) {}
+
+  string ToString() const { return string(data, size); }
+  bool operator==(const string &s) const {
+    return size == s.size() && (size == 0 || memcmp(data, s.data(), size) == 0);
+  }
+  bool operator!=(const string &s) const { return !(*this == s); }
+};
+
+ostream &operator<<(ostream &os, const StringView &v);
 
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems);
 std::vector<std::string> split(const std::string &s, char delim);
+void SplitView(const StringView &s, char delim, std::vector<StringView> &tokens);
+std::vector<std::string> ViewsToStrings(const std::vector<StringView> &views);
 
 string tripleToString(const Triple& t);
 string proposalToString(const Proposal& p);
@@ -26,17 +55,34 @@ unordered_set<Triple> stringToTripleSet(const string& s);
 string tripleSetToString(const unordered_set<Triple>& st);
 Ballot stringToBallot(const string& s);
 Proposal stringToProposal(const string& s);
+int viewToInt(const StringView& v);
+Ballot viewToBallot(const StringView& v);
+Proposal viewToProposal(const StringView& v);
+Triple viewToTriple(const StringView& v);
 string allDecisionsToString(const map<int, Proposal>& d);
 string decisionToString(const int& s, const Proposal& p);
-void stringToAllDecisions(string s, map<int, Proposal>& decs);
+void stringToAllDecisions(const string& s, map<int, Proposal>& decs);
 void stringToDecision(const string& dec, int& s, Proposal& p);
 void stringToDecisionForAll(const string& dec, int& s, Proposal& p);
 string decisionToStringForAll(const int& s, const Proposal& p);
 
+string epochToString(const Epoch& e);
+Epoch stringToEpoch(const string& s);
+int slotOwner(const Epoch& e, const int slot);
+int nextOwnSlot(const Epoch& e, const int owner, const int from);
+
+string fastVotesToString(const unordered_map<Triple, int>& votes);
+unordered_map<Triple, int> stringToFastVotes(const string& s);
+
 void union_set(unordered_set<Triple>& s1, unordered_set<Triple>&s2);
 map<int, Proposal> pmax(const unordered_set<Triple> &pvalues);
 map<int, Proposal> pairxor(const map<int, Proposal> &x,const map<int, Proposal> &y);
 void CreateThread(void* (*f)(void* ), void* arg, pthread_t &thread);
+time_t ElapsedSince(const struct timeval &start);
+bool RetryWithBackoff(const std::function<bool()> &attempt, const time_t timeout);
+bool SendReady(const int fd);
+bool ReceiveHandshake(const int fd, const time_t timeout, string &reply);
+bool WaitForReady(const int fd, const time_t timeout);
 
 
 struct Proposal {
@@ -80,6 +126,16 @@ struct Triple {
   bool operator==(const Triple &t2) const;
 };
 
+// slot ownership in the multi-leader mode. From first_slot on, slots go
+// round robin to the owners, which propose in them with ballot, the ballot
+// the primary got adopted
+struct Epoch {
+  Ballot b;
+  int first_slot;
+  vector<int> owners;
+  Epoch(): b(-1, -1), first_slot(0) {}
+};
+
 template <class T>
 inline void hash_combine(std::size_t & seed, const T & v)
 {